@@ -24,18 +24,19 @@ _sequencerLoopCallback(void)
 {
     printf("Resetting...\n");
     Sequencer_clear();
-    Melody_generateToSequencer(&melodyParams);
+    Melody_generateToSequencer(SEQ_MAIN_TRACK, &melodyParams);
 }
 
 int
 melodyGenExample(void)
 {
     srand(time(NULL));
-    FmPlayer_initialize(&FM_PIANO_PARAMS);
+    FmPlayer_initialize(&FM_PIANO_PARAMS, NULL);
 
     Sequencer_initialize(220, _sequencerLoopCallback);
 
-    Melody_generateToSequencer(&melodyParams);
+    Melody_generateToSequencer(SEQ_MAIN_TRACK, &melodyParams);
+    Sequencer_commit();
 
     Sequencer_start();
 
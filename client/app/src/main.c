@@ -6,10 +6,15 @@
 #include <stdio.h>
 
 #include "app.h"
+#include "com/threadutils.h"
 #include "hal/rfid.h"
 #include "hal/segDisplay.h"
 #include "singer.h"
 
+/** Nice value for the sensor and display threads, so they yield to the
+ * audio thread when it can't run in real time. */
+#define WORKER_NICE 5
+
 int
 main(int argc, char** argv)
 {
@@ -20,6 +25,9 @@ main(int argc, char** argv)
 
     srand(time(NULL));
 
+    // Must come before any worker thread starts.
+    Threadutils_setWorkerNice(WORKER_NICE);
+
     Rfid_init();
     Singer_initialize();
     SegDisplay_init();
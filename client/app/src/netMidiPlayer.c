@@ -59,52 +59,52 @@ _setInstrumentFromMidiCode(int instrumentCode)
 {
     if (instrumentCode <= 8) {
         // Piano
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 16) {
         // Chromatic Perc.
-        FmPlayer_setSynthVoice(&FM_BELL_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BELL_PARAMS);
     } else if (instrumentCode <= 24) {
         // Organ
-        FmPlayer_setSynthVoice(&FM_BIG_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BIG_PARAMS);
     } else if (instrumentCode <= 32) {
         // Guitar
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 40) {
         // Bass
-        FmPlayer_setSynthVoice(&FM_BASS_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BASS_PARAMS);
     } else if (instrumentCode <= 48) {
         // Strings
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 56) {
         // Ensemble
-        FmPlayer_setSynthVoice(&FM_AHH_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_AHH_PARAMS);
     } else if (instrumentCode <= 64) {
         // Brass
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 72) {
         // Reed
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 80) {
         // Pipe
-        FmPlayer_setSynthVoice(&FM_CHIRP_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_CHIRP_PARAMS);
     } else if (instrumentCode <= 88) {
         // Synth Lead
-        FmPlayer_setSynthVoice(&FM_DEFAULT_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_DEFAULT_PARAMS);
     } else if (instrumentCode <= 96) {
         // Synth Pad
-        FmPlayer_setSynthVoice(&FM_SHINYDRONE_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_SHINYDRONE_PARAMS);
     } else if (instrumentCode <= 104) {
         // Synth FX
-        FmPlayer_setSynthVoice(&FM_BEEPBOOP_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BEEPBOOP_PARAMS);
     } else if (instrumentCode <= 112) {
         // "Ethnic"
-        FmPlayer_setSynthVoice(&FM_YOI_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_YOI_PARAMS);
     } else if (instrumentCode <= 120) {
         // Percussive
-        FmPlayer_setSynthVoice(&FM_BASS_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BASS_PARAMS);
     } else if (instrumentCode <= 128) {
         // Sound FX
-        FmPlayer_setSynthVoice(&FM_BEEPBOOP_PARAMS);
+        FmPlayer_setSynthVoice(FMPLAYER_MAIN, &FM_BEEPBOOP_PARAMS);
     } else {
         fprintf(stderr,
                 "WARN: Could not turn %d into an instrument!\n",
@@ -134,10 +134,10 @@ _playNetMidi(void* _unused)
         MidiEvent event = _deserializeMidiEvent(requestBuf);
 
         if (event.type == MIDIEVENT_NOTE_ON) {
-            FmPlayer_setNote(event.eventData - 36);
-            FmPlayer_controlNote(NOTE_CTRL_NOTE_ON);
+            FmPlayer_setNote(FMPLAYER_MAIN, event.eventData - 36);
+            FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_ON);
         } else if (event.type == MIDIEVENT_NOTE_OFF) {
-            FmPlayer_controlNote(NOTE_CTRL_NOTE_OFF);
+            FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_OFF);
         } else if (event.type == MIDIEVENT_PGM_CHANGE) {
             _setInstrumentFromMidiCode(event.eventData);
         } else {
@@ -183,6 +183,6 @@ NetMidi_stop(void)
 {
     play = 0;
     pthread_join(_midiPlayerThread, NULL);
-    FmPlayer_controlNote(NOTE_CTRL_NOTE_OFF);
+    FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_OFF);
     Tcp_cleanupTcpClient();
 }
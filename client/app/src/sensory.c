@@ -5,6 +5,7 @@
  */
 #include "sensory.h"
 #include "com/pwl.h"
+#include "com/threadutils.h"
 #include "com/timeutils.h"
 #include "hal/accel.h"
 #include "hal/adc.h"
@@ -451,6 +452,7 @@ _senseWorker(void* _unused)
 {
     (void)_unused;
 
+    Threadutils_applyWorkerPriority();
     float a = 0.7;
     float sensoryIndexHistory[SENSORY_INDEX_UPDATE_RATE];
     int count = 0;
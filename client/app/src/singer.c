@@ -8,9 +8,12 @@
 #include "das/fm.h"
 #include "das/fmplayer.h"
 #include "das/melodygen.h"
+#include "das/notecache.h"
+#include "das/presetbank.h"
 #include "das/sequencer.h"
 #include "sensory.h"
 #include "singer.h"
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,6 +48,45 @@
 #define HYPERBOLA_II(x) ((-IDLE_HYPERBOLA_NUMERATOR) / (x))
 
 #define TAC_ENABLE_PRINT_ENV "TAC_ENABLE_PRINT"
+/** Names a preset bank to take voices from instead of SINGER_VOICE_BANK. */
+#define TAC_VOICE_BANK_ENV "TAC_VOICE_BANK"
+
+/** Override in config.h. Preset bank file to take voices from, or NULL to use
+ * the presets built into the synth. A preset in the bank named after an
+ * emotion ("happy", "sad", "angry", "overstimulated" or "neutral") is used
+ * for it instead of the voice chosen in config.h. */
+#ifndef SINGER_VOICE_BANK
+#define SINGER_VOICE_BANK NULL
+#endif
+
+/** Override in config.h. Real-time priority for the audio thread, or 0 to
+ * leave it under the normal scheduler. */
+#ifndef SINGER_AUDIO_PRIORITY
+#define SINGER_AUDIO_PRIORITY FMPLAYER_REALTIME_PRIORITY
+#endif
+
+/** Override in config.h. Bake the notes of the emotions' voices at startup,
+ * so they cost next to nothing to play. Voices that can't be baked, and
+ * voices being modulated, are played live. See notecache.h. */
+#ifndef SINGER_BAKE_NOTES
+#define SINGER_BAKE_NOTES 0
+#endif
+
+/** Override in config.h. Directory baked notes are saved to and loaded from,
+ * so each voice is only baked once, or NULL to bake them at every startup. */
+#ifndef SINGER_NOTE_CACHE_DIR
+#define SINGER_NOTE_CACHE_DIR NULL
+#endif
+
+/** Override in config.h. What times the melody. SEQ_CLOCK_RENDER plays each
+ * note on the exact sample it is due, from the audio thread, instead of
+ * from a sequencer thread of its own. */
+#ifndef SINGER_SEQUENCER_CLOCK
+#define SINGER_SEQUENCER_CLOCK SEQ_CLOCK_THREAD
+#endif
+
+/** How many emotions have a voice of their own. */
+#define SINGER_VOICES 5
 
 /** Buffer for the report printed to stdout. */
 static char report[MAX_REPORT_SIZE];
@@ -58,6 +100,11 @@ static Mood mood = {
 
 /** The current FmSynth voice that the singer is using. */
 static const FmSynthParams* currentVoice;
+/** The preset bank voices come from, if not the built in one. */
+static PresetBank* voiceBank;
+
+/** Baked notes of each emotion's voice, if they were baked. */
+static NoteCache* noteCaches[SINGER_VOICES];
 
 /** Pointer to the current melody generation parameters. */
 static _Atomic(const MelodyGenParams*) melodyParams;
@@ -86,6 +133,26 @@ _trySwitchToEmotion(const Emotion newEmotion);
 static void
 _updateEmotionParams(void);
 
+/** Get the voice for an emotion: the preset named after it in the bank in
+ * use, or the configured voice if there isn't one. */
+static const FmSynthParams*
+_emotionVoice(const char* name, const FmSynthParams* configured);
+
+/** Open the configured preset bank and use it. Stays with the built in
+ * presets if it can't be opened. */
+static void
+_openVoiceBank(void);
+
+/** Bake the notes of every emotion's voice, or load them, and give them to
+ * the player. */
+static void
+_bakeVoices(void);
+
+/** Get the baked notes of a voice from SINGER_NOTE_CACHE_DIR, baking them if
+ * they aren't there. Returns NULL if the voice can't be baked. */
+static NoteCache*
+_loadNoteCache(const char* name, const FmSynthParams* voice);
+
 /** Callback called by the sequencer when it loops around. */
 static void
 _onSequencerLoop(void);
@@ -241,32 +308,139 @@ _updateEmotionParams(void)
     // Melody params defined in melodygen.h
     switch (mood.emotion) {
         case EMOTION_HAPPY:
-            currentVoice = &VOICE_HAPPY;
+            currentVoice = _emotionVoice("happy", &VOICE_HAPPY);
             melodyParams = &happyParams;
             break;
         case EMOTION_SAD:
-            currentVoice = &VOICE_SAD;
+            currentVoice = _emotionVoice("sad", &VOICE_SAD);
             melodyParams = &sadParams;
             break;
         case EMOTION_ANGRY:
-            currentVoice = &VOICE_ANGRY;
+            currentVoice = _emotionVoice("angry", &VOICE_ANGRY);
             melodyParams = &angryParams;
             break;
         case EMOTION_OVERSTIMULATED:
-            currentVoice = &VOICE_OVERSTIMULATED;
+            currentVoice =
+              _emotionVoice("overstimulated", &VOICE_OVERSTIMULATED);
             melodyParams = &overstimulatedParams;
             break;
         case EMOTION_NEUTRAL:
-            currentVoice = &VOICE_NEUTRAL;
+            currentVoice = _emotionVoice("neutral", &VOICE_NEUTRAL);
             melodyParams = &neutralParams;
             break;
         default:
-            currentVoice = &VOICE_NEUTRAL;
+            currentVoice = _emotionVoice("neutral", &VOICE_NEUTRAL);
             melodyParams = &neutralParams;
             break;
     }
 }
 
+static const FmSynthParams*
+_emotionVoice(const char* name, const FmSynthParams* configured)
+{
+    const FmSynthParams* voice = PresetBank_find(PresetBank_getActive(), name);
+    return voice ? voice : configured;
+}
+
+static void
+_openVoiceBank(void)
+{
+    const char* path = getenv(TAC_VOICE_BANK_ENV);
+    if (!path) {
+        path = SINGER_VOICE_BANK;
+    }
+    if (!path) {
+        return;
+    }
+
+    int err = PresetBank_open(&voiceBank, path);
+    if (err < 0) {
+        fprintf(stderr,
+                "Can't open voice bank %s, using built in voices: %s\n",
+                path,
+                strerror(-err));
+        voiceBank = NULL;
+        return;
+    }
+    PresetBank_use(voiceBank);
+}
+
+static void
+_bakeVoices(void)
+{
+    const char* names[SINGER_VOICES] = {
+        "happy", "sad", "angry", "overstimulated", "neutral"
+    };
+    const FmSynthParams* voices[SINGER_VOICES] = {
+        _emotionVoice("happy", &VOICE_HAPPY),
+        _emotionVoice("sad", &VOICE_SAD),
+        _emotionVoice("angry", &VOICE_ANGRY),
+        _emotionVoice("overstimulated", &VOICE_OVERSTIMULATED),
+        _emotionVoice("neutral", &VOICE_NEUTRAL),
+    };
+
+    for (int i = 0; i < SINGER_VOICES; i++) {
+        // Emotions can share a voice.
+        bool baked = false;
+        for (int j = 0; j < i && !baked; j++) {
+            baked = memcmp(voices[i], voices[j], sizeof(FmSynthParams)) == 0;
+        }
+        if (baked) {
+            continue;
+        }
+
+        noteCaches[i] = _loadNoteCache(names[i], voices[i]);
+        if (noteCaches[i]) {
+            FmPlayer_addNoteCache(FMPLAYER_MAIN, noteCaches[i]);
+        }
+    }
+}
+
+static NoteCache*
+_loadNoteCache(const char* name, const FmSynthParams* voice)
+{
+    const char* dir = SINGER_NOTE_CACHE_DIR;
+    char path[PATH_MAX];
+    NoteCache* cache = NULL;
+    int err;
+
+    if (dir) {
+        snprintf(path, sizeof(path), "%s/%s.tacn", dir, name);
+        // Notes left over from a voice that has since changed are baked
+        // again.
+        if (NoteCache_open(&cache, path) == 0 &&
+            memcmp(NoteCache_getParams(cache), voice, sizeof(FmSynthParams)) !=
+              0) {
+            NoteCache_close(cache);
+            cache = NULL;
+        }
+    }
+
+    if (!cache) {
+        err = NoteCache_bake(
+          &cache, voice, NOTECACHE_LOWEST_NOTE, NOTECACHE_HIGHEST_NOTE);
+        if (err < 0) {
+            fprintf(stderr,
+                    "Can't bake the %s voice, playing it live: %s\n",
+                    name,
+                    strerror(-err));
+            return NULL;
+        }
+        if (dir && (err = NoteCache_save(cache, path)) < 0) {
+            fprintf(stderr,
+                    "Can't save baked notes to %s: %s\n",
+                    path,
+                    strerror(-err));
+        }
+    }
+
+    if (NoteCache_countNotes(cache) == 0) {
+        NoteCache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
 static void
 _onSequencerLoop(void)
 {
@@ -279,20 +453,36 @@ _onSequencerLoop(void)
     params.upDownTendency *= mood.magnitude;
     params.stoccatoLegatoTendency *= mood.magnitude;
 
-    // Pass the final params to the respective functions
-    FmPlayer_setSynthVoice(currentVoice);
-    Melody_generateToSequencer(&params);
+    // Pass the final params to the respective functions. The voice changes
+    // when the melody starts playing.
+    Melody_generateToSequencer(SEQ_MAIN_TRACK, &params);
+    Sequencer_setSlotVoice(SEQ_MAIN_TRACK, 0, currentVoice);
     timesEmotionPlayed++;
 }
 
 void
 Singer_shutdown(void)
 {
+    if (_shouldPrintReport) {
+        Sequencer_printStats(stdout);
+    }
     Sequencer_destroy();
 
     Sensory_close();
 
     FmPlayer_close();
+
+    for (int i = 0; i < SINGER_VOICES; i++) {
+        if (noteCaches[i]) {
+            NoteCache_close(noteCaches[i]);
+            noteCaches[i] = NULL;
+        }
+    }
+
+    if (voiceBank) {
+        PresetBank_close(voiceBank);
+        voiceBank = NULL;
+    }
 }
 
 void
@@ -310,20 +500,32 @@ Singer_rest(void)
 int
 Singer_initialize(void)
 {
+    _openVoiceBank();
     _updateEmotionParams();
 
-    if (FmPlayer_initialize(currentVoice) < 0) {
+    // The default output, but run in real time so the sensors and network
+    // can't starve it.
+    FmPlayer_Config playerConfig = FMPLAYER_DEFAULT_CONFIG;
+    playerConfig.realtimePriority = SINGER_AUDIO_PRIORITY;
+    if (FmPlayer_initialize(currentVoice, &playerConfig) < 0) {
         fprintf(stderr, "Failed to intiialize FMplayer\n");
         return -1;
     }
 
+    if (SINGER_BAKE_NOTES) {
+        _bakeVoices();
+    }
+
     if (Sensory_initialize(&sensoryPreferences) < 0) {
         fprintf(stderr, "Failed to initialize sensory system\n");
         FmPlayer_close();
         return -1;
     }
 
-    if (Sequencer_initialize(120, _onSequencerLoop) < 0) {
+    Sequencer_Config sequencerConfig = SEQ_DEFAULT_CONFIG;
+    sequencerConfig.clock = SINGER_SEQUENCER_CLOCK;
+    if (Sequencer_initializeWithConfig(&sequencerConfig, _onSequencerLoop) <
+        0) {
         fprintf(stderr, "Failed to init sequencer\n");
         FmPlayer_close();
         Sensory_close();
@@ -350,21 +552,21 @@ Singer_modulateVoice(void)
 
     if (fabs(light) > 0.1) {
         lightIsHigh = true;
-        FmPlayer_updateOperatorCm(FM_OPERATOR1, light * 10);
+        FmPlayer_updateOperatorCm(FMPLAYER_MAIN, FM_OPERATOR1, light * 10);
     } else {
         if (lightIsHigh) {
-            FmPlayer_setSynthVoice(NULL);
+            FmPlayer_setSynthVoice(FMPLAYER_MAIN, NULL);
             lightIsHigh = false;
         }
     }
 
     if (fabs(pot) > 0.05) {
         FmPlayer_updateOperatorAlgorithmConnection(
-          FM_OPERATOR0, FM_OPERATOR1, pot * 8800);
+          FMPLAYER_MAIN, FM_OPERATOR0, FM_OPERATOR1, pot * 8800);
         potIsHigh = true;
     } else {
         if (potIsHigh) {
-            FmPlayer_setSynthVoice(NULL);
+            FmPlayer_setSynthVoice(FMPLAYER_MAIN, NULL);
             potIsHigh = false;
         }
     }
@@ -0,0 +1,13 @@
+/**
+ * @file benchClock.h
+ * @brief Timing helpers shared by the benchmarks.
+ */
+#pragma once
+
+/**
+ * @brief Monotonic time.
+ *
+ * @return long long Nanoseconds since an arbitrary point.
+ */
+long long
+BenchClock_nowNs(void);
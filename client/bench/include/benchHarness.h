@@ -0,0 +1,73 @@
+/**
+ * @file benchHarness.h
+ * @brief Runs benchmarks and reports their results.
+ *
+ * Each benchmark is timed for a number of repetitions after a few untimed
+ * warmup runs. The median and 99th percentile of the time per operation are
+ * reported, either as a table or as JSON that can be saved and compared
+ * across commits and machines.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Timed repetitions when none are given. */
+#define BENCH_DEFAULT_REPS 50
+/** Untimed warmup repetitions when none are given. */
+#define BENCH_DEFAULT_WARMUP 5
+
+/** How to run the benchmarks. */
+typedef struct
+{
+    /** Untimed repetitions before timing starts. */
+    size_t warmup;
+    /** Timed repetitions. */
+    size_t reps;
+    /** Only run benchmarks whose name contains this, or NULL for all. */
+    const char* filter;
+    /** Print JSON instead of a table. */
+    bool json;
+    /** Free-form label for the run, such as a commit, or NULL. */
+    const char* label;
+} BenchHarness_Options;
+
+/**
+ * One repetition of a benchmark.
+ *
+ * @param ctx The context given to BenchHarness_run.
+ * @return How many operations the repetition did.
+ */
+typedef size_t (*BenchHarness_Fn)(void* ctx);
+
+/**
+ * Start a run, printing the header of the report.
+ */
+void
+BenchHarness_begin(const BenchHarness_Options* options);
+
+/**
+ * Time a benchmark and report it, unless the filter excludes it.
+ *
+ * @param name The benchmark, as group/name.
+ * @param unit What an operation is, such as "sample".
+ * @param fn The benchmark.
+ * @param ctx Passed to fn.
+ */
+void
+BenchHarness_run(const char* name,
+                 const char* unit,
+                 BenchHarness_Fn fn,
+                 void* ctx);
+
+/**
+ * Would a benchmark with the given name run? Use it to skip expensive setup.
+ */
+bool
+BenchHarness_wants(const char* name);
+
+/**
+ * Finish a run, printing the end of the report.
+ */
+void
+BenchHarness_end(void);
@@ -0,0 +1,13 @@
+/**
+ * @file envBench.h
+ * @brief Benchmarks of the envelope and piecewise linear function code.
+ */
+#pragma once
+
+/**
+ * Sweep a piecewise linear function with Pwl_sample (pwl/sample), and run an
+ * envelope with Env_getValueAndAdvance (env/advance). Both are reported in ns
+ * per call.
+ */
+void
+EnvBench_run(void);
@@ -0,0 +1,16 @@
+/**
+ * @file melodyBench.h
+ * @brief Benchmark of melody generation.
+ */
+#pragma once
+
+/**
+ * Generate melodies into the sequencer with Melody_generateToSequencer, for
+ * each of the mood presets in melodygen.h. Reported as melody/<mood> in ns
+ * per melody.
+ *
+ * The sequencer needs a player, so this plays into the null backend for the
+ * duration. The sequencer is never started.
+ */
+void
+MelodyBench_run(void);
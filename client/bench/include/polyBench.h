@@ -0,0 +1,19 @@
+/**
+ * @file polyBench.h
+ * @brief Throughput benchmark for the FM synthesizer.
+ */
+#pragma once
+
+/**
+ * Render a held note with every preset in fm.h, reported as
+ * fm/preset/<preset> in ns per sample.
+ */
+void
+PolyBench_runPresets(void);
+
+/**
+ * Render with 1 through FM_MAX_VOICES voices sounding for each kernel,
+ * reported as fm/poly/<kernel>/<voices> in ns per sample.
+ */
+void
+PolyBench_run(void);
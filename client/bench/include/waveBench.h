@@ -0,0 +1,14 @@
+/**
+ * @file waveBench.h
+ * @brief Benchmark of the wavetable engines.
+ */
+#pragma once
+
+/**
+ * Sweep every wave type across the keyboard with the original double tables
+ * (WaveTable_sample) and with the band-limited fixed point tables
+ * (WaveTable_lookup). Reported as wavetable/sample/<wave> and
+ * wavetable/lookup/<wave>, in ns per sample.
+ */
+void
+WaveBench_run(void);
@@ -0,0 +1,15 @@
+/**
+ * @file benchClock.c
+ * @brief Implementation of the benchmark timing helpers.
+ */
+#include "benchClock.h"
+
+#include <time.h>
+
+long long
+BenchClock_nowNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file benchHarness.c
+ * @brief Implementation of the benchmark harness.
+ */
+#include "benchHarness.h"
+#include "benchClock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+/** The options for this run. */
+static BenchHarness_Options _options;
+/** Has a result been printed yet? Used to place commas in the JSON. */
+static bool _anyResults;
+
+/** qsort comparison for doubles. */
+static int
+_compareDouble(const void* a, const void* b);
+/** The given percentile of sorted samples, by nearest rank. */
+static double
+_percentile(const double* sorted, size_t n, double percent);
+/** Print a string as a JSON string. */
+static void
+_printJsonString(const char* str);
+
+static int
+_compareDouble(const void* a, const void* b)
+{
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right;
+}
+
+static double
+_percentile(const double* sorted, size_t n, double percent)
+{
+    size_t rank = (percent * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+_printJsonString(const char* str)
+{
+    putchar('"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            putchar('\\');
+        }
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+void
+BenchHarness_begin(const BenchHarness_Options* options)
+{
+    _options = *options;
+    if (_options.reps == 0) {
+        _options.reps = 1;
+    }
+    _anyResults = false;
+
+    struct utsname host;
+    if (uname(&host) < 0) {
+        strcpy(host.machine, "unknown");
+        strcpy(host.nodename, "unknown");
+    }
+
+    if (_options.json) {
+        printf("{\n  \"label\": ");
+        _printJsonString(_options.label ? _options.label : "");
+        printf(",\n  \"machine\": ");
+        _printJsonString(host.machine);
+        printf(",\n  \"host\": ");
+        _printJsonString(host.nodename);
+        printf(",\n  \"warmup\": %zu,\n  \"reps\": %zu,\n  \"results\": [",
+               _options.warmup,
+               _options.reps);
+    } else {
+        printf("%s on %s, %zu reps after %zu warmup\n",
+               _options.label ? _options.label : "das_bench",
+               host.machine,
+               _options.reps,
+               _options.warmup);
+        printf("%-36s %12s %12s %12s  %s\n",
+               "benchmark",
+               "median ns",
+               "p99 ns",
+               "min ns",
+               "per");
+    }
+}
+
+bool
+BenchHarness_wants(const char* name)
+{
+    return !_options.filter || strstr(name, _options.filter);
+}
+
+void
+BenchHarness_run(const char* name,
+                 const char* unit,
+                 BenchHarness_Fn fn,
+                 void* ctx)
+{
+    if (!BenchHarness_wants(name)) {
+        return;
+    }
+
+    double* samples = malloc(_options.reps * sizeof(double));
+    if (!samples) {
+        return;
+    }
+
+    for (size_t i = 0; i < _options.warmup; i++) {
+        fn(ctx);
+    }
+    for (size_t i = 0; i < _options.reps; i++) {
+        long long start = BenchClock_nowNs();
+        size_t ops = fn(ctx);
+        long long elapsed = BenchClock_nowNs() - start;
+        samples[i] = (double)elapsed / (ops > 0 ? ops : 1);
+    }
+    qsort(samples, _options.reps, sizeof(double), _compareDouble);
+
+    double median = _percentile(samples, _options.reps, 50);
+    double p99 = _percentile(samples, _options.reps, 99);
+    double min = samples[0];
+    if (_options.json) {
+        printf("%s\n    { \"name\": ", _anyResults ? "," : "");
+        _printJsonString(name);
+        printf(", \"unit\": ");
+        _printJsonString(unit);
+        printf(", \"median_ns\": %.3f, \"p99_ns\": %.3f, \"min_ns\": %.3f }",
+               median,
+               p99,
+               min);
+    } else {
+        printf("%-36s %12.2f %12.2f %12.2f  %s\n",
+               name,
+               median,
+               p99,
+               min,
+               unit);
+    }
+    // Flush so progress shows while the slower benchmarks run.
+    fflush(stdout);
+    _anyResults = true;
+    free(samples);
+}
+
+void
+BenchHarness_end(void)
+{
+    if (_options.json) {
+        printf("\n  ]\n}\n");
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * @file envBench.c
+ * @brief Implementation of the envelope benchmarks.
+ */
+#include "envBench.h"
+#include "benchHarness.h"
+#include "com/pwl.h"
+#include "das/envelope.h"
+
+/** Calls per repetition. */
+#define ENVBENCH_CALLS 4096
+/** Sample rate the envelope is prepared for. */
+#define ENVBENCH_SAMPLE_RATE 44100
+
+/** Sum of every value, so the compiler can't throw the calls away. */
+static volatile float _sink;
+
+/** Sweep a function from 0 to 1. ctx is the Pwl_Function. */
+static size_t
+_samplePwl(void* ctx);
+/** Trigger an envelope and advance it. ctx is the Env_Envelope. */
+static size_t
+_advanceEnvelope(void* ctx);
+
+static size_t
+_samplePwl(void* ctx)
+{
+    Pwl_Function* fn = ctx;
+    float acc = 0;
+    for (int i = 0; i < ENVBENCH_CALLS; i++) {
+        acc += Pwl_sample(fn, (float)i / ENVBENCH_CALLS);
+    }
+    _sink += acc;
+    return ENVBENCH_CALLS;
+}
+
+static size_t
+_advanceEnvelope(void* ctx)
+{
+    Env_Envelope* env = ctx;
+    float acc = 0;
+    Env_trigger(env);
+    // Gate halfway so the release is measured along with the attack.
+    for (int i = 0; i < ENVBENCH_CALLS; i++) {
+        if (i == ENVBENCH_CALLS / 2) {
+            Env_gate(env);
+        }
+        acc += Env_getValueAndAdvance(env);
+    }
+    _sink += acc;
+    return ENVBENCH_CALLS;
+}
+
+void
+EnvBench_run(void)
+{
+    Pwl_Function fn = PWL_EXP_FALLOFF_FUNCTION;
+    BenchHarness_run("pwl/sample", "call", _samplePwl, &fn);
+
+    // Long enough that the envelope is still moving after all the calls.
+    Env_Envelope env = { .gatePoint = 0.65,
+                         .repeatPoint = 0,
+                         .lengthMs = 10000,
+                         .fn = PWL_ADSR_PLUCK_FUNCTION };
+    Env_prepareEnvelope(&env, ENVBENCH_SAMPLE_RATE);
+    BenchHarness_run("env/advance", "call", _advanceEnvelope, &env);
+}
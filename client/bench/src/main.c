@@ -0,0 +1,72 @@
+// Benchmarks for the DAS library.
+// Runs on the BBG or on a host machine. Prints a table by default, or JSON
+// with -j so runs can be saved and compared across commits and machines.
+
+#include "benchHarness.h"
+#include "envBench.h"
+#include "melodyBench.h"
+#include "polyBench.h"
+#include "waveBench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** Print usage to stderr. */
+static void
+_usage(const char* program);
+
+static void
+_usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [-j] [-r reps] [-w warmup] [-f filter] [-l label]\n"
+            "  -j  print JSON instead of a table\n"
+            "  -r  timed repetitions of each benchmark (default %d)\n"
+            "  -w  untimed warmup repetitions (default %d)\n"
+            "  -f  only run benchmarks whose name contains filter\n"
+            "  -l  label the run, e.g. with a commit\n",
+            program,
+            BENCH_DEFAULT_REPS,
+            BENCH_DEFAULT_WARMUP);
+}
+
+int
+main(int argc, char** argv)
+{
+    BenchHarness_Options options = { .warmup = BENCH_DEFAULT_WARMUP,
+                                     .reps = BENCH_DEFAULT_REPS };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "jr:w:f:l:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                options.json = true;
+                break;
+            case 'r':
+                options.reps = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                options.warmup = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                options.filter = optarg;
+                break;
+            case 'l':
+                options.label = optarg;
+                break;
+            default:
+                _usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    BenchHarness_begin(&options);
+    WaveBench_run();
+    EnvBench_run();
+    PolyBench_runPresets();
+    PolyBench_run();
+    MelodyBench_run();
+    BenchHarness_end();
+    return 0;
+}
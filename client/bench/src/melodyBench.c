@@ -0,0 +1,74 @@
+/**
+ * @file melodyBench.c
+ * @brief Implementation of the melody generation benchmark.
+ */
+#include "melodyBench.h"
+#include "benchHarness.h"
+#include "das/fmplayer.h"
+#include "das/melodygen.h"
+#include "das/sequencer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Melodies generated per repetition. */
+#define MELODYBENCH_MELODIES 16
+/** Seed, so every run generates the same melodies. */
+#define MELODYBENCH_SEED 433
+
+/** Generate melodies. ctx is the MelodyGenParams. */
+static size_t
+_generate(void* ctx);
+
+static size_t
+_generate(void* ctx)
+{
+    const MelodyGenParams* params = ctx;
+    for (int i = 0; i < MELODYBENCH_MELODIES; i++) {
+        Melody_generateToSequencer(SEQ_MAIN_TRACK, params);
+    }
+    return MELODYBENCH_MELODIES;
+}
+
+void
+MelodyBench_run(void)
+{
+    const MelodyGenParams* moods[] = {
+        &happyParams, &sadParams,     &angryParams,
+        &overstimulatedParams,        &neutralParams,
+    };
+    const char* names[] = {
+        "melody/happy", "melody/sad", "melody/angry",
+        "melody/overstimulated",      "melody/neutral",
+    };
+    const size_t nMoods = sizeof(moods) / sizeof(moods[0]);
+
+    bool any = false;
+    for (size_t m = 0; m < nMoods; m++) {
+        any = any || BenchHarness_wants(names[m]);
+    }
+    if (!any) {
+        return;
+    }
+
+    FmPlayer_Config config = FMPLAYER_DEFAULT_CONFIG;
+    config.backend = FMPLAYER_BACKEND_NULL_REALTIME;
+    if (FmPlayer_initialize(&FM_DEFAULT_PARAMS, &config) < 0) {
+        fprintf(stderr, "Can't start the player, skipping melody benches\n");
+        return;
+    }
+    if (Sequencer_initialize(120, NULL) != SEQ_OK) {
+        fprintf(stderr, "Can't start the sequencer, skipping melody benches\n");
+        FmPlayer_close();
+        return;
+    }
+
+    srand(MELODYBENCH_SEED);
+    for (size_t m = 0; m < nMoods; m++) {
+        BenchHarness_run(
+          names[m], "melody", _generate, (void*)moods[m]);
+    }
+
+    Sequencer_destroy();
+    FmPlayer_close();
+}
@@ -0,0 +1,114 @@
+/**
+ * @file polyBench.c
+ * @brief Implementation of the synthesizer benchmarks.
+ */
+#include "polyBench.h"
+#include "benchHarness.h"
+#include "das/fm.h"
+#include "das/presetbank.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Frames rendered per repetition, matching a 100 ms FmPlayer period. */
+#define POLYBENCH_PERIOD_FRAMES 4410
+/** Notes to hold. One per voice. */
+static const Note _chord[FM_MAX_VOICES] = { C3, E3, G3, B3, D4, F4, A4, C5 };
+
+/** What a repetition renders with. */
+typedef struct
+{
+    FmSynthesizer* synth;
+    int16_t* buffer;
+} _Render;
+
+/** Render a period. ctx is a _Render. */
+static size_t
+_renderPeriod(void* ctx);
+/** Benchmark a synthesizer, then destroy it. Does nothing if it is NULL. */
+static void
+_benchSynth(const char* name, FmSynthesizer* synth, int16_t* buffer);
+
+static size_t
+_renderPeriod(void* ctx)
+{
+    _Render* render = ctx;
+    Fm_generateSamples(render->synth, render->buffer, POLYBENCH_PERIOD_FRAMES);
+    return POLYBENCH_PERIOD_FRAMES;
+}
+
+static void
+_benchSynth(const char* name, FmSynthesizer* synth, int16_t* buffer)
+{
+    if (!synth) {
+        return;
+    }
+    _Render render = { .synth = synth, .buffer = buffer };
+    BenchHarness_run(name, "sample", _renderPeriod, &render);
+    Fm_destroySynthesizer(synth);
+}
+
+void
+PolyBench_runPresets(void)
+{
+    int16_t* buffer = malloc(POLYBENCH_PERIOD_FRAMES * sizeof(int16_t));
+    if (!buffer) {
+        return;
+    }
+
+    const PresetBank* bank = PresetBank_getActive();
+    char name[64];
+    for (size_t p = 0; p < PresetBank_count(bank); p++) {
+        snprintf(
+          name, sizeof(name), "fm/preset/%s", PresetBank_getName(bank, p));
+        if (!BenchHarness_wants(name)) {
+            continue;
+        }
+        FmSynthesizer* synth =
+          Fm_createFmSynthesizer(PresetBank_get(bank, p));
+        if (synth) {
+            Fm_setNote(synth, A4);
+            Fm_noteOn(synth);
+        }
+        _benchSynth(name, synth, buffer);
+    }
+
+    free(buffer);
+}
+
+void
+PolyBench_run(void)
+{
+    int16_t* buffer = malloc(POLYBENCH_PERIOD_FRAMES * sizeof(int16_t));
+    if (!buffer) {
+        return;
+    }
+
+    const FmKernel kernels[] = { FM_KERNEL_SCALAR,
+                                 FM_KERNEL_SIMD,
+                                 FM_KERNEL_AUTO };
+    const char* kernelNames[] = { "scalar", "simd", "auto" };
+
+    char name[64];
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        for (size_t voices = 1; voices <= FM_MAX_VOICES; voices++) {
+            snprintf(
+              name, sizeof(name), "fm/poly/%s/%zu", kernelNames[k], voices);
+            if (!BenchHarness_wants(name)) {
+                continue;
+            }
+            FmSynthesizer* synth =
+              Fm_createPolySynthesizer(&FM_PIANO_PARAMS, voices);
+            if (synth) {
+                Fm_setKernel(synth, kernels[k]);
+                for (size_t v = 0; v < voices; v++) {
+                    Fm_voiceOn(synth, _chord[v]);
+                }
+            }
+            _benchSynth(name, synth, buffer);
+        }
+    }
+
+    free(buffer);
+}
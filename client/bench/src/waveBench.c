@@ -0,0 +1,88 @@
+/**
+ * @file waveBench.c
+ * @brief Implementation of the wavetable benchmark.
+ */
+#include "waveBench.h"
+#include "benchHarness.h"
+#include "das/wavetable.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Samples rendered per frequency in each repetition. */
+#define WAVEBENCH_SAMPLES 4096
+/** Frequencies swept, one octave apart starting at WAVEBENCH_LOWEST_HZ. */
+#define WAVEBENCH_OCTAVES 8
+/** The lowest frequency swept. About C2. */
+#define WAVEBENCH_LOWEST_HZ 65.41f
+/** Sample rate used to turn frequencies into steps. */
+#define WAVEBENCH_SAMPLE_RATE 44100
+
+/** Sum of every sample, so the compiler can't throw the lookups away. */
+static volatile float _sink;
+
+/** Sweep the original tables. ctx points to the WaveType. */
+static size_t
+_sweepLegacy(void* ctx);
+/** Sweep the band-limited tables. ctx points to the WaveType. */
+static size_t
+_sweepBandLimited(void* ctx);
+
+static size_t
+_sweepLegacy(void* ctx)
+{
+    WaveType type = *(const WaveType*)ctx;
+    float acc = 0;
+    for (int octave = 0; octave < WAVEBENCH_OCTAVES; octave++) {
+        // Same accumulate and wrap the synth did before fixed point phases.
+        float step =
+          WAVEBENCH_LOWEST_HZ * (1 << octave) / WAVEBENCH_SAMPLE_RATE;
+        float angle = 0;
+        for (int s = 0; s < WAVEBENCH_SAMPLES; s++) {
+            acc += WaveTable_sample(type, angle);
+            angle += step;
+            angle -= floorf(angle);
+        }
+    }
+    _sink += acc;
+    return WAVEBENCH_OCTAVES * WAVEBENCH_SAMPLES;
+}
+
+static size_t
+_sweepBandLimited(void* ctx)
+{
+    WaveType type = *(const WaveType*)ctx;
+    float acc = 0;
+    for (int octave = 0; octave < WAVEBENCH_OCTAVES; octave++) {
+        WaveTable_Phase step = WaveTable_phaseStep(
+          WAVEBENCH_LOWEST_HZ * (1 << octave), WAVEBENCH_SAMPLE_RATE);
+        const float* table = WaveTable_getBandLimited(type, step);
+        WaveTable_Phase phase = 0;
+        for (int s = 0; s < WAVEBENCH_SAMPLES; s++) {
+            acc += WaveTable_lookup(table, phase);
+            phase += step;
+        }
+    }
+    _sink += acc;
+    return WAVEBENCH_OCTAVES * WAVEBENCH_SAMPLES;
+}
+
+void
+WaveBench_run(void)
+{
+    WaveType types[] = { WAVETYPE_SINE, WAVETYPE_SQUARE, WAVETYPE_SAW };
+    const char* typeNames[] = { "sine", "square", "saw" };
+    if (WaveTable_initialize() < 0) {
+        fprintf(stderr, "Can't build the wave tables\n");
+        return;
+    }
+
+    char name[64];
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        snprintf(name, sizeof(name), "wavetable/sample/%s", typeNames[t]);
+        BenchHarness_run(name, "sample", _sweepLegacy, &types[t]);
+        snprintf(name, sizeof(name), "wavetable/lookup/%s", typeNames[t]);
+        BenchHarness_run(name, "sample", _sweepBandLimited, &types[t]);
+    }
+}
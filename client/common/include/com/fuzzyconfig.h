@@ -101,6 +101,19 @@ Comment the following for Zen Cape GREEN *
 // #define EMOTION_IDLE EMOTION_NEUTRAL
 #define EMOTION_IDLE EMOTION_NEUTRAL
 
+/** Optionally take voices from a preset bank file. A preset in it named after
+ * an emotion replaces the voice chosen for it below. **/
+// #define SINGER_VOICE_BANK "/mnt/remote/myApps/fuzzy.bank"
+
+/** Optionally bake the voices' notes at startup so they are cheap to play,
+ * keeping them in a directory so they are only baked once. **/
+// #define SINGER_BAKE_NOTES 1
+// #define SINGER_NOTE_CACHE_DIR "/mnt/remote/myApps/fuzzy-notes"
+
+/** Optionally play the melody from the audio thread, so every note starts on
+ * the exact sample it is due. **/
+// #define SINGER_SEQUENCER_CLOCK SEQ_CLOCK_RENDER
+
 /** Choose a synth voice for each emotion. **/
 // (1) Happy
 // #define VOICE_HAPPY FM_BELL_PARAMS
@@ -7,17 +7,38 @@
  */
 #pragma once
 
+/** Most points a function can have. */
+#define PWL_MAX_POINTS 6
+
 /** A piecwise linear function. */
 typedef struct
 {
     /** X coordinates. */
-    float ptsX[6];
+    float ptsX[PWL_MAX_POINTS];
     /** Y coordinates. */
-    float ptsY[6];
+    float ptsY[PWL_MAX_POINTS];
     /** Number of points specified. */
     int pts;
 } Pwl_Function;
 
+/**
+ * A piecewise linear function compiled into segments for sampling in order.
+ *
+ * Segment i starts at startX[i] and covers x up to the start of segment i + 1.
+ * The last segment carries on forever.
+ */
+typedef struct
+{
+    /** Where each segment starts. */
+    float startX[PWL_MAX_POINTS - 1];
+    /** Value at the start of each segment. */
+    float startY[PWL_MAX_POINTS - 1];
+    /** Slope of each segment. */
+    float slope[PWL_MAX_POINTS - 1];
+    /** Number of segments. */
+    int segments;
+} Pwl_Segments;
+
 /** An ADSR envelope representing a string pluck. */
 #define PWL_ADSR_PLUCK_FUNCTION                                                \
     {                                                                          \
@@ -100,3 +121,42 @@ typedef struct
 /** Sample a piecwise linear function at the given sample point. */
 float
 Pwl_sample(Pwl_Function* pwl, float samplePoint);
+
+/**
+ * Compile a piecewise linear function into segments.
+ *
+ * @param pwl The function. Must have at least 2 points.
+ * @param segs The segments to fill in.
+ */
+void
+Pwl_compile(const Pwl_Function* pwl, Pwl_Segments* segs);
+
+/**
+ * Find the segment that covers the sample point.
+ *
+ * Searches forward from hint, so when the sample point only moves forward a
+ * little at a time this is O(1). If the sample point is before hint, the
+ * search starts over from the first segment.
+ *
+ * @param segs The segments.
+ * @param samplePoint The sample point.
+ * @param hint The segment the last sample point was in.
+ * @return int The segment covering samplePoint.
+ */
+int
+Pwl_findSegment(const Pwl_Segments* segs, float samplePoint, int hint);
+
+/**
+ * Sample the given segment.
+ *
+ * @param segs The segments.
+ * @param segment The segment, as returned by Pwl_findSegment.
+ * @param samplePoint The sample point.
+ * @return float The value at samplePoint.
+ */
+static inline float
+Pwl_sampleSegment(const Pwl_Segments* segs, int segment, float samplePoint)
+{
+    return segs->startY[segment] +
+           (samplePoint - segs->startX[segment]) * segs->slope[segment];
+}
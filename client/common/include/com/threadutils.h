@@ -0,0 +1,69 @@
+/**
+ * @file threadutils.h
+ * @brief Contains util functions for scheduling threads.
+ *
+ * Everything here is best effort. Real-time scheduling and locking memory
+ * need privileges the process may not have, so failures are reported but
+ * leave the thread running as it was.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+/** Pass as the CPU to leave a thread free to run on any CPU. */
+#define THREADUTILS_ANY_CPU (-1)
+
+/**
+ * Run a thread under SCHED_FIFO.
+ *
+ * @param thread The thread.
+ * @param priority The real-time priority, 1 (lowest) to 99.
+ * @return 0 on success, or a negative errno. -EPERM means the process is not
+ * allowed to use real-time scheduling.
+ */
+int
+Threadutils_setRealtimePriority(pthread_t thread, int priority);
+
+/**
+ * Keep a thread on one CPU.
+ *
+ * @param thread The thread.
+ * @param cpu The CPU, or THREADUTILS_ANY_CPU to do nothing.
+ * @return 0 on success, or a negative errno.
+ */
+int
+Threadutils_pinToCpu(pthread_t thread, int cpu);
+
+/**
+ * Lock every current and future page of the process into memory so that
+ * page faults can't stall a real-time thread.
+ *
+ * @return 0 on success, or a negative errno.
+ */
+int
+Threadutils_lockMemory(void);
+
+/**
+ * Touch the given number of bytes of the calling thread's stack, so they
+ * are mapped before any time-critical code runs. Only useful once memory is
+ * locked.
+ */
+void
+Threadutils_prefaultStack(size_t bytes);
+
+/**
+ * Set the nice value worker threads should run at. Workers pick it up with
+ * Threadutils_applyWorkerPriority, so set it before starting them. 0, the
+ * default, leaves them alone.
+ */
+void
+Threadutils_setWorkerNice(int nice);
+
+/**
+ * Lower the calling thread to the worker nice value. Call this at the top of
+ * any background thread that isn't time critical.
+ */
+void
+Threadutils_applyWorkerPriority(void);
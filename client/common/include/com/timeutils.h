@@ -14,6 +14,11 @@ Timeutils_getTimeInMs(void);
 long double
 Timeutils_getTimeInNs(void);
 
+/** Get the current monotonic time in nanoseconds. Unlike the system time this
+ * never jumps, so use it for scheduling. */
+long long
+Timeutils_getMonotonicTimeInNs(void);
+
 /** Sleep the current thread for the given number of milliseconds. */
 void
 Timeutils_sleepForMs(long long delayInMs);
@@ -21,3 +26,10 @@ Timeutils_sleepForMs(long long delayInMs);
 /** Sleep the current thread for the given number of nanoseconds. */
 void
 Timeutils_sleepForNs(long long delayInNs);
+
+/** Sleep the current thread until the monotonic clock reaches the given time
+ * in nanoseconds, as returned by Timeutils_getMonotonicTimeInNs. Returns
+ * straight away if it already has. Unlike sleeping for a delay, time spent
+ * before the call doesn't push the wakeup back. */
+void
+Timeutils_sleepUntilMonotonicNs(long long deadlineNs);
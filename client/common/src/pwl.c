@@ -26,3 +26,36 @@ Pwl_sample(Pwl_Function* pwl, float samplePoint)
     float sample = ((samplePoint - x0) / (x1 - x0)) * (y1 - y0) + y0;
     return sample;
 }
+
+void
+Pwl_compile(const Pwl_Function* pwl, Pwl_Segments* segs)
+{
+    int pts = pwl->pts;
+    if (pts > PWL_MAX_POINTS) {
+        pts = PWL_MAX_POINTS;
+    }
+
+    segs->segments = (pts > 1) ? pts - 1 : 0;
+    for (int i = 0; i < segs->segments; i++) {
+        float dx = pwl->ptsX[i + 1] - pwl->ptsX[i];
+        segs->startX[i] = pwl->ptsX[i];
+        segs->startY[i] = pwl->ptsY[i];
+        // A zero length segment is never sampled since the one after it
+        // starts at the same point, but give it a slope that isn't inf.
+        segs->slope[i] = (dx != 0) ? (pwl->ptsY[i + 1] - pwl->ptsY[i]) / dx : 0;
+    }
+}
+
+int
+Pwl_findSegment(const Pwl_Segments* segs, float samplePoint, int hint)
+{
+    if (hint < 0 || hint >= segs->segments ||
+        samplePoint < segs->startX[hint]) {
+        hint = 0;
+    }
+    while (hint + 1 < segs->segments &&
+           segs->startX[hint + 1] <= samplePoint) {
+        hint++;
+    }
+    return hint;
+}
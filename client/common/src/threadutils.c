@@ -0,0 +1,109 @@
+/**
+ * @file threadutils.c
+ * @brief Implementation of the thread utils.
+ */
+#define _GNU_SOURCE
+#include "com/threadutils.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Nice value for worker threads. */
+static atomic_int _workerNice;
+
+int
+Threadutils_setRealtimePriority(pthread_t thread, int priority)
+{
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    if (priority < min || priority > max) {
+        return -EINVAL;
+    }
+
+    struct sched_param param = { .sched_priority = priority };
+    int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (err != 0) {
+        fprintf(stderr,
+                "Can't use real-time priority %d: %s\n",
+                priority,
+                strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+int
+Threadutils_pinToCpu(pthread_t thread, int cpu)
+{
+    if (cpu == THREADUTILS_ANY_CPU) {
+        return 0;
+    }
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -EINVAL;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "Can't pin thread to CPU %d: %s\n", cpu, strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+int
+Threadutils_lockMemory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        int err = errno;
+        fprintf(stderr, "Can't lock memory: %s\n", strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+void
+Threadutils_prefaultStack(size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+    // A VLA puts the pages right below the current frame, which is where the
+    // stack will grow into. Writing through a volatile pointer keeps the
+    // compiler from dropping the stores.
+    unsigned char stack[bytes];
+    volatile unsigned char* touch = stack;
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes; i += page) {
+        touch[i] = 0;
+    }
+}
+
+void
+Threadutils_setWorkerNice(int nice)
+{
+    atomic_store(&_workerNice, nice);
+}
+
+void
+Threadutils_applyWorkerPriority(void)
+{
+    int nice = atomic_load(&_workerNice);
+    if (nice == 0) {
+        return;
+    }
+    // On Linux nice values are per thread, addressed by thread id. Raising
+    // our own nice value never needs privileges.
+    pid_t tid = syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, nice) < 0) {
+        perror("Can't lower worker priority");
+    }
+}
@@ -3,6 +3,7 @@
  * @brief Implementation of the time utils.
  */
 #include "com/timeutils.h"
+#include <errno.h>
 #include <time.h>
 
 #define NS_PER_SECOND 1000000000
@@ -34,6 +35,18 @@ Timeutils_getTimeInNs(void)
     return totalNanoSeconds;
 }
 
+long long
+Timeutils_getMonotonicTimeInNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+
+    long long seconds = spec.tv_sec;
+    long long nanoSeconds = spec.tv_nsec;
+
+    return seconds * NS_PER_SECOND + nanoSeconds;
+}
+
 void
 Timeutils_sleepForMs(long long delayInMs)
 {
@@ -50,3 +63,14 @@ Timeutils_sleepForNs(long long delayNs)
     struct timespec reqDelay = { seconds, nanoseconds };
     nanosleep(&reqDelay, (struct timespec*)NULL);
 }
+
+void
+Timeutils_sleepUntilMonotonicNs(long long deadlineNs)
+{
+    struct timespec deadline = { deadlineNs / NS_PER_SECOND,
+                                 deadlineNs % NS_PER_SECOND };
+    // Signals interrupt the sleep, but the deadline stays the same.
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR) {
+    }
+}
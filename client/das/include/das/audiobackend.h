@@ -0,0 +1,174 @@
+/**
+ * @file audiobackend.h
+ * @brief Where the FmPlayer sends its samples.
+ *
+ * A backend takes 16 bit samples a period at a time, interleaved if there is
+ * more than one channel. The player waits
+ * for room, asks the backend for somewhere to render with
+ * AudioBackend_begin, renders into it and hands it over with
+ * AudioBackend_commit. Backends that play in real time also report how much
+ * audio is queued, which the player uses to time events.
+ *
+ * There are three backends: ALSA, which plays on the sound card, a WAV file
+ * writer, and a null sink that throws the samples away. Only the ALSA one
+ * needs a sound card, so the others can run the player headless.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct AudioBackend AudioBackend;
+
+/** The operations a backend implements. See the AudioBackend_* functions
+ * that call them for what each one does. */
+typedef struct
+{
+    int (*start)(AudioBackend* backend);
+    int (*wait)(AudioBackend* backend, int timeoutMs);
+    long (*delay)(AudioBackend* backend);
+    long (*begin)(AudioBackend* backend, int16_t** buffer, size_t nFrames);
+    int (*commit)(AudioBackend* backend, size_t nFrames);
+    int (*recover)(AudioBackend* backend, int err);
+    void (*close)(AudioBackend* backend);
+} AudioBackend_Ops;
+
+/** A backend. Implementations put this at the start of their own struct. */
+struct AudioBackend
+{
+    /** The backend's operations. */
+    const AudioBackend_Ops* ops;
+    /** Sample rate in Hz. */
+    unsigned int sampleRate;
+    /** Samples in a frame, one per channel. */
+    unsigned int channels;
+    /** Frames the player should render at a time. */
+    size_t periodSize;
+    /** Frames the backend can queue. */
+    size_t bufferSize;
+    /** Does the backend consume samples at the sample rate? If not it takes
+     * them as fast as they come, and there are no deadlines to meet. */
+    bool realtime;
+};
+
+/**
+ * Open the sound card through ALSA.
+ *
+ * @param backend Receives the backend.
+ * @param useMmap Render straight into the driver's ring buffer rather than
+ * copying periods in.
+ * @param sampleRate The sample rate. The device must support it exactly.
+ * @param channels 1 for mono, 2 for stereo.
+ * @param bufferTimeUs Requested buffer length in microseconds.
+ * @param periodTimeUs Requested period length in microseconds. 0 means half
+ * the buffer.
+ * @return 0 on success, or a negative errno. -ENOSYS if the library was
+ * built without ALSA.
+ */
+int
+AudioBackend_openAlsa(AudioBackend** backend,
+                      bool useMmap,
+                      unsigned int sampleRate,
+                      unsigned int channels,
+                      unsigned int bufferTimeUs,
+                      unsigned int periodTimeUs);
+
+/**
+ * Open a WAV file to write to. Samples are written as fast as they come.
+ *
+ * @param backend Receives the backend.
+ * @param path The file. It is overwritten if it exists.
+ * @param sampleRate The sample rate.
+ * @param channels 1 for mono, 2 for stereo.
+ * @param periodSize Frames to render at a time.
+ * @return 0 on success, or a negative errno.
+ */
+int
+AudioBackend_openWav(AudioBackend** backend,
+                     const char* path,
+                     unsigned int sampleRate,
+                     unsigned int channels,
+                     size_t periodSize);
+
+/**
+ * Open a sink that discards its samples.
+ *
+ * @param backend Receives the backend.
+ * @param sampleRate The sample rate.
+ * @param channels 1 for mono, 2 for stereo.
+ * @param periodSize Frames to render at a time.
+ * @param realtime Take samples at the sample rate, with a buffer of two
+ * periods, like a sound card would. Otherwise take them as fast as they
+ * come.
+ * @return 0 on success, or a negative errno.
+ */
+int
+AudioBackend_openNull(AudioBackend** backend,
+                      unsigned int sampleRate,
+                      unsigned int channels,
+                      size_t periodSize,
+                      bool realtime);
+
+/**
+ * Start consuming samples. Whatever was committed before this plays first.
+ *
+ * @return 0 on success, or a negative errno.
+ */
+int
+AudioBackend_start(AudioBackend* backend);
+
+/**
+ * Wait until a period can be written.
+ *
+ * @param timeoutMs How long to wait at most.
+ * @return 1 when there is room, 0 on timeout, or a negative errno.
+ */
+int
+AudioBackend_wait(AudioBackend* backend, int timeoutMs);
+
+/**
+ * How many frames are queued ahead of the next one written.
+ *
+ * @return The frames queued, or a negative errno. Backends that aren't real
+ * time always return 0.
+ */
+long
+AudioBackend_delay(AudioBackend* backend);
+
+/**
+ * Get somewhere to render the next frames.
+ *
+ * @param buffer Receives the buffer.
+ * @param nFrames Frames wanted.
+ * @return How many frames can go in the buffer, which may be fewer than
+ * asked for. 0 means there's no room yet, so wait and try again. Negative
+ * on error.
+ */
+long
+AudioBackend_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames);
+
+/**
+ * Hand over frames rendered into the buffer from AudioBackend_begin.
+ *
+ * @param nFrames How many frames were rendered.
+ * @return 0 on success, or a negative errno.
+ */
+int
+AudioBackend_commit(AudioBackend* backend, size_t nFrames);
+
+/**
+ * Try to recover from an error returned by the other functions, such as an
+ * underrun.
+ *
+ * @return 0 if playback can carry on, or a negative errno if not.
+ */
+int
+AudioBackend_recover(AudioBackend* backend, int err);
+
+/**
+ * Play out whatever is queued and close the backend.
+ */
+void
+AudioBackend_close(AudioBackend* backend);
@@ -14,6 +14,9 @@
  * Once an envelope is gated, whether or not a repeat point is specified, it
  * will be allowed past the gate point and will run to completion.
  *
+ * Envelopes run at a control rate of one point every ENV_CONTROL_PERIOD
+ * samples. Whoever plays them is expected to ramp linearly between points.
+ *
  * @author Spencer Leslie 3015713429
  */
 #pragma once
@@ -24,12 +27,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/** Samples between envelope control points. */
+#define ENV_CONTROL_PERIOD 64
+
 /** The envelope. */
 typedef struct
 {
     // "Private" data. Do not touch these.
-    /** The step that the sample point is moved by each time the envelope
-     * advances. Should not be changed externally. */
+    /** The step that the sample point is moved by each control period.
+     * Should not be changed externally. */
     float step;
     /** The current sample point. */
     float current;
@@ -49,6 +55,10 @@ typedef struct
     Pwl_Function fn;
 
     // "private" data. Included at the end as to not mess with alignment.
+    /** fn compiled into segments. */
+    Pwl_Segments segments;
+    /** The segment that the current sample point is in. */
+    int segment;
     /** Current envelope state. */
     uint8_t state;
 } Env_Envelope;
@@ -59,14 +69,25 @@ typedef struct
  * @param env The envelope to set up. Before calling this function,
  *            env->gatePoint, env->repeatPoint, env->lengthMs, and env->fn
  *            should all have been set.
- * @param sampleRate The rate in samples/second that the envelope will be
- * sampled at.
+ * @param sampleRate The audio sample rate. The envelope is advanced once
+ * every ENV_CONTROL_PERIOD samples.
  */
 void
 Env_prepareEnvelope(Env_Envelope* env, size_t sampleRate);
 
 /**
- * Samples the current value of the envelope and advances it.
+ * Give an envelope the shape of another, keeping its position and state, so
+ * that a running envelope carries on from where it was in the new shape.
+ *
+ * @param env The envelope to change.
+ * @param shape A prepared envelope to take the shape from.
+ */
+void
+Env_setShape(Env_Envelope* env, const Env_Envelope* shape);
+
+/**
+ * Samples the current value of the envelope and advances it by one control
+ * period.
  *
  * @param env The envelope to sample and advance.
  * @return float The envelope value.
@@ -90,3 +111,13 @@ Env_trigger(Env_Envelope* env);
  */
 void
 Env_gate(Env_Envelope* env);
+
+/**
+ * Is the envelope running? An envelope is running from the time it is
+ * triggered until it runs to completion after being gated.
+ *
+ * @param env The envelope.
+ * @return true if the envelope is running.
+ */
+bool
+Env_isActive(const Env_Envelope* env);
@@ -0,0 +1,75 @@
+/**
+ * @file eventqueue.h
+ * @brief Bounded lock-free event queue.
+ *
+ * Carries fixed size events from any number of producer threads to a single
+ * consumer thread. Neither side ever takes a lock, so the consumer can be a
+ * realtime audio thread. Pushing to a full queue fails rather than blocking;
+ * it is up to the producer to decide whether to wait and try again.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A queue. */
+typedef struct EventQueue EventQueue;
+
+/** Queue usage statistics. */
+typedef struct
+{
+    /** How many events the queue can hold. */
+    size_t capacity;
+    /** The most events that have been waiting in the queue at once. */
+    size_t highWater;
+    /** How many pushes failed because the queue was full. */
+    unsigned long overflows;
+} EventQueue_Stats;
+
+/**
+ * @brief Create a queue.
+ *
+ * @param capacity How many events the queue must hold. Rounded up to a power
+ * of two.
+ * @param eventSize The size of each event in bytes.
+ * @return EventQueue* The queue, or NULL on failure.
+ */
+EventQueue*
+EventQueue_create(size_t capacity, size_t eventSize);
+
+/**
+ * @brief Destroy a queue. No other thread may be using it.
+ *
+ * @param queue The queue.
+ */
+void
+EventQueue_destroy(EventQueue* queue);
+
+/**
+ * @brief Push an event. Safe to call from any thread.
+ *
+ * @param queue The queue.
+ * @param event The event. eventSize bytes are copied out of it.
+ * @return true if the event was queued, false if the queue was full.
+ */
+bool
+EventQueue_push(EventQueue* queue, const void* event);
+
+/**
+ * @brief Pop the oldest event. Must only be called from the consumer thread.
+ *
+ * @param queue The queue.
+ * @param event Receives eventSize bytes of the event.
+ * @return true if an event was popped, false if the queue was empty.
+ */
+bool
+EventQueue_pop(EventQueue* queue, void* event);
+
+/**
+ * @brief Get usage statistics. Safe to call from any thread.
+ *
+ * @param queue The queue.
+ * @param stats Receives the statistics.
+ */
+void
+EventQueue_getStats(EventQueue* queue, EventQueue_Stats* stats);
@@ -181,8 +181,10 @@ static void
 _sequence(const SequencerNote* song)
 {
     for (int i = 0; i < SEQ_LEN; i++) {
-        Sequencer_fillSlot(i, song[i].ctrl, song[i].note, NULL);
+        Sequencer_fillSlot(
+          SEQ_MAIN_TRACK, i, song[i].ctrl, song[i].note, NULL);
     }
+    Sequencer_commit();
 }
 
 /** The example. */
@@ -230,7 +232,7 @@ example(void)
     double op0Cm = 1.0;
 
     // Start the FmPlayer. This will also initialized the FmSynthesizer.
-    FmPlayer_initialize(songs[song_idx].voice);
+    FmPlayer_initialize(songs[song_idx].voice, NULL);
 
     // Initialize the sequencer.
     Sequencer_initialize(120);
@@ -250,7 +252,7 @@ example(void)
             _sleepForMs(1000); // let the last note ring out a bit
 
             _sequence(songs[song_idx].notes);
-            FmPlayer_setSynthVoice(songs[song_idx].voice);
+            FmPlayer_setSynthVoice(FMPLAYER_MAIN, songs[song_idx].voice);
 
             printf("Playing %s\n", songs[song_idx].name);
             Sequencer_reset();
@@ -291,11 +293,11 @@ example(void)
         if (op0Cm > 0 && newAdcReading != voltReading) {
             // 'Tune' the CM either up or down
             if (newAdcReading < 5 && newAdcReading >= 0) {
-                FmPlayer_updateOperatorCm(FM_OPERATOR0,
-                                          op0Cm / (5 - newAdcReading));
+                FmPlayer_updateOperatorCm(
+                  FMPLAYER_MAIN, FM_OPERATOR0, op0Cm / (5 - newAdcReading));
             } else if (newAdcReading >= 5) {
-                FmPlayer_updateOperatorCm(FM_OPERATOR0,
-                                          op0Cm + (newAdcReading - 5));
+                FmPlayer_updateOperatorCm(
+                  FMPLAYER_MAIN, FM_OPERATOR0, op0Cm + (newAdcReading - 5));
             }
             voltReading = newAdcReading;
         }
@@ -316,7 +318,7 @@ example(void)
     // Play Drones
     //------------------
     printf("PLAYING 'DRONE' VOICES\n");
-    FmPlayer_setNote(C4);
+    FmPlayer_setNote(FMPLAYER_MAIN, C4);
 
     while (!quit) {
         if (!msSlept) {
@@ -324,12 +326,12 @@ example(void)
                 break;
             }
 
-            FmPlayer_controlNote(NOTE_CTRL_NOTE_OFF);
+            FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_OFF);
             _sleepForMs(1000); // let the note fade
 
-            FmPlayer_setSynthVoice(drones[song_idx].voice);
+            FmPlayer_setSynthVoice(FMPLAYER_MAIN, drones[song_idx].voice);
             printf("Playing %s\n", drones[song_idx].name);
-            FmPlayer_controlNote(NOTE_CTRL_NOTE_ON);
+            FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_ON);
 
             op0Cm = drones[song_idx].voice->opParams[FM_OPERATOR0].CmRatio;
             song_idx++;
@@ -363,11 +365,11 @@ example(void)
 
         if (op0Cm > 0 && newAdcReading != voltReading) {
             if (newAdcReading < 5) {
-                FmPlayer_updateOperatorCm(FM_OPERATOR0,
-                                          op0Cm / (5 - newAdcReading));
+                FmPlayer_updateOperatorCm(
+                  FMPLAYER_MAIN, FM_OPERATOR0, op0Cm / (5 - newAdcReading));
             } else if (newAdcReading >= 5) {
-                FmPlayer_updateOperatorCm(FM_OPERATOR0,
-                                          op0Cm + (newAdcReading - 5));
+                FmPlayer_updateOperatorCm(
+                  FMPLAYER_MAIN, FM_OPERATOR0, op0Cm + (newAdcReading - 5));
             }
             voltReading = newAdcReading;
         }
@@ -378,7 +380,7 @@ example(void)
         }
     }
 
-    FmPlayer_controlNote(NOTE_CTRL_NOTE_OFF);
+    FmPlayer_controlNote(FMPLAYER_MAIN, NOTE_CTRL_NOTE_OFF);
 
     _sleepForMs(1000); // fadeout!
 
@@ -111,6 +111,30 @@ typedef enum
     FM_OPERATORS
 } FmOperator;
 
+/** Maximum number of voices a single synthesizer can play at once. */
+#define FM_MAX_VOICES 8
+
+/** Most note caches a synth can be given. */
+#define FM_MAX_NOTE_CACHES 16
+
+/** Returned by @ref Fm_voiceOn when no voice could be allocated. */
+#define FM_VOICE_NONE -1
+
+/** Render kernels that @ref Fm_generateSamples can use. */
+typedef enum
+{
+    /**
+     * Vectorized kernel specialized to the operator connections in use. Skips
+     * operators that can't be heard and operators whose envelopes are at 0.
+     */
+    FM_KERNEL_AUTO = 0,
+    /** Plain scalar kernel. Slow, but the simplest reference. */
+    FM_KERNEL_SCALAR,
+    /** Vectorized kernel that computes every operator and connection. Uses
+     * NEON or SSE2 when available. */
+    FM_KERNEL_SIMD,
+} FmKernel;
+
 /** Parameters for each operator. */
 typedef struct
 {
@@ -171,628 +195,96 @@ typedef struct
     Env_Envelope opEnvelopes[FM_OPERATORS];
 } FmSynthParams;
 
+/**
+ * Every preset as X(NAME, "name"), where FM_<NAME>_PARAMS is the preset.
+ * Use it to build tables of presets, so new presets only need adding here.
+ */
+#define FM_PRESETS(X)                                                          \
+    X(DEFAULT, "default")                                                      \
+    X(PIANO, "piano")                                                          \
+    X(SAWBLADE, "sawblade")                                                    \
+    X(BELL, "bell")                                                            \
+    X(CRY, "cry")                                                              \
+    X(AHH, "ahh")                                                              \
+    X(BASS, "bass")                                                            \
+    X(BRASS, "brass")                                                          \
+    X(YOI, "yoi")                                                              \
+    X(BIG, "big")                                                              \
+    X(GLITCHBOOP, "glitchboop")                                                \
+    X(BEEPBOOP, "beepboop")                                                    \
+    X(SHINYDRONE, "shinydrone")                                                \
+    X(CHIRP, "chirp")
+
+#define FM_PRESET_ID(NAME, name) FM_PRESET_##NAME,
+/** The presets, in FM_PRESETS order. */
+typedef enum
+{
+    FM_PRESETS(FM_PRESET_ID) FM_PRESET_COUNT
+} FmPresetId;
+#undef FM_PRESET_ID
+
+/**
+ * @brief Get a preset from the preset bank in use.
+ *
+ * The presets are built into the library, but a bank loaded from a file can
+ * replace them. See presetbank.h. The FM_*_PARAMS macros below call this.
+ *
+ * @param id The preset.
+ * @return The preset's params. Valid until the bank is closed.
+ */
+const FmSynthParams*
+Fm_getPreset(FmPresetId id);
+
 /**
  * @brief "Default" parameters.
  *
  * Configures OPERATOR0 to output a simple sine wave at A440.
  */
-static const FmSynthParams FM_DEFAULT_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 1.0,
-                    .algorithmConnections = { 0.0, 440.0, 0.0, 0.0 } },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .algorithmConnections = { 0 },
-                  },
-                  { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 2.0,
-                    .algorithmConnections = { 0 } },
-                  { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 2.0,
-                    .algorithmConnections = { 0 } } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 1.0,
-                       .repeatPoint = 0,
-                       .lengthMs = 1000,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION }
-
-    }
-};
+#define FM_DEFAULT_PARAMS (*Fm_getPreset(FM_PRESET_DEFAULT))
 
 /** Approximates a piano. */
-static const FmSynthParams FM_PIANO_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0, 853, 220, 220 } },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.0,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 200.0 },
-                  },
-                  { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 2.5,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0.0, 880.0, 0.0, 0.0 } },
-                  { .waveType = WAVETYPE_SINE,
-                    .CmRatio = 4,
-                    .outputStrength = 0.0,
-                    .algorithmConnections = { 0, 0, 0, 0 } } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_ADSR_HAMMER_FUNCTION },
-                     { .gatePoint = 0.8,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_CONST_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_BELLSTRIKE_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_ADSR_AHH_FUNCTION }
-
-    }
-};
+#define FM_PIANO_PARAMS (*Fm_getPreset(FM_PRESET_PIANO))
 
 /** A buzzy, angry sounding voice based on saw waves. */
-static const FmSynthParams FM_SAWBLADE_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 2.50,
-                    .outputStrength = 0.2,
-                    .algorithmConnections = { 0.0, 69, 0.0, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 0.25,
-                    .outputStrength = 0.1,
-                    .algorithmConnections = { 0, 0, 420, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 0.5,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0, 0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 3.5,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0, 0, 1760, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_ADSR_HAMMER_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_ADSR_AHH_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 1300,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 1200,
-                       .fn = PWL_ADSR_HAMMER_FUNCTION } }
-};
+#define FM_SAWBLADE_PARAMS (*Fm_getPreset(FM_PRESET_SAWBLADE))
 
 /** A ringing bell sound. */
-static const FmSynthParams FM_BELL_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0.0, 800, 0.0, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3.5,
-                    .algorithmConnections = { 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0, 0, 0, 300 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3.5,
-                    .algorithmConnections = { 0, 0, 0, 100 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_LINEARFALL_FUNCTION },
-                     { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1200,
-                       .fn = PWL_BELLSTRIKE_FUNCTION },
-                     { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_BELLSTRIKE_FUNCTION },
-                     { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1300,
-                       .fn = PWL_BELLSTRIKE_FUNCTION } }
-};
+#define FM_BELL_PARAMS (*Fm_getPreset(FM_PRESET_BELL))
 
 /** A sad sort of voice. */
-static const FmSynthParams FM_CRY_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1,
-                    .fixToNote = E2,
-                    .outputStrength = 1.0,
-                    .algorithmConnections = { 0.0, 300, 0.0, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .algorithmConnections = { 0, 0.0, 200, 100 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 9.0,
-                    .algorithmConnections = { 0, 0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3.0 / 2.0,
-                    .algorithmConnections = { 0, 0, 0, 160 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.85,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_LINEARFALL_FUNCTION },
-                     { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1200,
-                       .fn = PWL_BELLSTRIKE_FUNCTION },
-                     { .gatePoint = 0.75,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_BELLSTRIKE_FUNCTION },
-                     { .gatePoint = 1.0,
-                       .repeatPoint = 0,
-                       .lengthMs = 200,
-                       .fn = PWL_SWELL_FUNCTION } }
-};
+#define FM_CRY_PARAMS (*Fm_getPreset(FM_PRESET_CRY))
 
 /** Approximates an "ahh" vowell. Tries to emulate the first two vocal formants,
  * however the formants move with the carrier so it sounds most convincing at
  * low pitches (around C3). */
-static const FmSynthParams FM_AHH_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 120 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 11.0,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 760 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 18.0,
-                    .outputStrength = 0.2,
-                    .algorithmConnections = { 0, 0, 0, 1130 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .algorithmConnections = { 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_AHH_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_AHH_FUNCTION },
-                     { .gatePoint = 1,
-                       .repeatPoint = 0,
-                       .lengthMs = 1600,
-                       .fn = PWL_CONST_FUNCTION } }
-};
+#define FM_AHH_PARAMS (*Fm_getPreset(FM_PRESET_AHH))
 
 /** Approximates a bass guitar. */
-static const FmSynthParams FM_BASS_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 2,
-                    .outputStrength = 0.6,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 440 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 2.0,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0.0, 0.0, 230, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 2,
-                    .algorithmConnections = { 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 2.0,
-                    .algorithmConnections = { 0, 0, 140, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_EXP_FALLOFF_FUNCTION } }
-};
+#define FM_BASS_PARAMS (*Fm_getPreset(FM_PRESET_BASS))
 
 /** Approximates a brass instrument. Sounds trumpet-like. */
-static const FmSynthParams FM_BRASS_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.6,
-                    .fixToNote = NOTE_NONE,
-                    .algorithmConnections = { 0.0,
-                                              (8 * 233.1),
-                                              (8 * 233.1),
-                                              0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.0,
-                    .fixToNote = NOTE_NONE,
-                    .algorithmConnections = { 0.0, 0.0, (6 * 233.1), 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3.0,
-                    .outputStrength = 0,
-                    .fixToNote = NOTE_NONE,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 4.0,
-                    .outputStrength = 0.2,
-                    .fixToNote = NOTE_NONE,
-                    .algorithmConnections = { 0, (8 * 233.1), 0, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_AHH_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_AHH_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_AHH_FUNCTION } }
-};
+#define FM_BRASS_PARAMS (*Fm_getPreset(FM_PRESET_BRASS))
 
 /** Meant to have a "yoi" sound, but in practice has a buzzy and quiet
  * electronic sort of sound. */
-static const FmSynthParams FM_YOI_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.51,
-                    .algorithmConnections = { 0.0, 4097.0, 0.0, 490.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.68,
-                    .algorithmConnections = { 0.0, 0.0, 1287, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1,
-                    .algorithmConnections = { 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 8.0 / 5,
-                    .algorithmConnections = { 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.1,
-                       .repeatPoint = 0.0,
-                       .lengthMs = 2000,
-                       .fn = PWL_PEAKFALL_FUNCTION },
-                     { .gatePoint = 0.5,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_PEAKFALL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_EXP_FALLOFF_FUNCTION } }
-};
+#define FM_YOI_PARAMS (*Fm_getPreset(FM_PRESET_YOI))
 
 /** A mostly inharmonic but big-sounding voice. Good as a drone! */
-static const FmSynthParams FM_BIG_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.8,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 380 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1.0 / 20.0,
-                    .outputStrength = 0.3,
-                    .algorithmConnections = { 0.0, 0.0, 450, 30 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1,
-                    .algorithmConnections = { 0, 0, 140, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 2.0,
-                    .algorithmConnections = { 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1500,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 0.8,
-                       .repeatPoint = 0.2,
-                       .lengthMs = 3000,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 1.0,
-                       .repeatPoint = 0,
-                       .lengthMs = 7000,
-                       .fn = PWL_SWELL_FUNCTION }
-
-    }
-};
+#define FM_BIG_PARAMS (*Fm_getPreset(FM_PRESET_BIG))
 
 /** An inharmonic, glitchy, electronic sound. */
-static const FmSynthParams FM_GLITCHBOOP_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.7,
-                    .algorithmConnections = { 0.0, 1250, 0, 304 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 100.0,
-                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 1.0 / 9,
-                    .outputStrength = 0.15,
-                    .algorithmConnections = { 0, 0, 0, 24 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SAW,
-                    .CmRatio = 1.0 / 27,
-                    .algorithmConnections = { 0, 0, 0, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1500,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 1.0,
-                       .repeatPoint = 0,
-                       .lengthMs = 2345,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.8,
-                       .repeatPoint = 0.2,
-                       .lengthMs = 1000,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = 0.1,
-                       .lengthMs = 3200,
-                       .fn = PWL_SWELL_FUNCTION } }
-
-};
+#define FM_GLITCHBOOP_PARAMS (*Fm_getPreset(FM_PRESET_GLITCHBOOP))
 
 /** An inharmonic "boop boop" sound reminiscent of what people though computers
  * sounded like in the late 70's. */
-static const FmSynthParams FM_BEEPBOOP_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.7,
-                    .algorithmConnections = { 0.0, 250, 0, 304 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 100.0,
-                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0 / 9,
-                    .outputStrength = 0.15,
-                    .algorithmConnections = { 0, 0, 0, 24 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SQUARE,
-                    .CmRatio = 1.0 / 53,
-                    .algorithmConnections = { 0, 0, 0, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.65,
-                       .repeatPoint = -1,
-                       .lengthMs = 1500,
-                       .fn = PWL_ADSR_PLUCK_FUNCTION },
-                     { .gatePoint = 1.0,
-                       .repeatPoint = 0,
-                       .lengthMs = 2345,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.8,
-                       .repeatPoint = 0.2,
-                       .lengthMs = 1000,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = 0.1,
-                       .lengthMs = 3200,
-                       .fn = PWL_SWELL_FUNCTION } }
-
-};
+#define FM_BEEPBOOP_PARAMS (*Fm_getPreset(FM_PRESET_BEEPBOOP))
 
 /** A big, inharmonic, "shiny" sound with several interweaving
  * layers. Very interesting as a drone. */
-static const FmSynthParams FM_SHINYDRONE_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0.0, 2000, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 4.0,
-                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 6.0,
-                    .outputStrength = 0.5,
-                    .algorithmConnections = { 0, 0, 0, 2000 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 2.5,
-                    .algorithmConnections = { 0, 0, 0, 2000 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.8,
-                       .repeatPoint = 0.2,
-                       .lengthMs = 1000,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.8,
-                       .repeatPoint = 0.2,
-                       .lengthMs = 800,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = 0.1,
-                       .lengthMs = 2500,
-                       .fn = PWL_SWELL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = 0.1,
-                       .lengthMs = 3700,
-                       .fn = PWL_SWELL_FUNCTION } }
-
-};
+#define FM_SHINYDRONE_PARAMS (*Fm_getPreset(FM_PRESET_SHINYDRONE))
 
 /** A happy, short, chirpy sound. */
-static const FmSynthParams FM_CHIRP_PARAMS = {
-    .sampleRate = 44100,
-    .opParams = { {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.2,
-                    .algorithmConnections = { 0.0, 1760, 0, 0.0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 1.0,
-                    .outputStrength = 0.4,
-                    .algorithmConnections = { 0.0, 0.0, 0.0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 3,
-                    .outputStrength = 0.15,
-                    .algorithmConnections = { 380, 0, 0, 0 },
-                  },
-                  {
-                    .waveType = WAVETYPE_SINE,
-                    .CmRatio = 6.0,
-                    .algorithmConnections = { 0, 0, 0, 0 },
-                  } },
-    .opEnvelopes = { { .gatePoint = 0.2,
-                       .repeatPoint = -1,
-                       .lengthMs = 1000,
-                       .fn = PWL_PEAKFALL_FUNCTION },
-                     { .gatePoint = 0.3,
-                       .repeatPoint = -1,
-                       .lengthMs = 830,
-                       .fn = PWL_EXP_FALLOFF_FUNCTION },
-                     { .gatePoint = 0.2,
-                       .repeatPoint = -1,
-                       .lengthMs = 800,
-                       .fn = PWL_PEAKFALL_FUNCTION },
-                     { .gatePoint = 0.9,
-                       .repeatPoint = -1,
-                       .lengthMs = 600,
-                       .fn = PWL_CONST_FUNCTION } }
-
-};
+#define FM_CHIRP_PARAMS (*Fm_getPreset(FM_PRESET_CHIRP))
 
 /**
  * @brief External FmSythesizer handle.
@@ -802,6 +294,35 @@ typedef struct
     void* __FmSynth;
 } FmSynthesizer;
 
+/**
+ * @brief A voice compiled from FmSynthParams.
+ *
+ * Compiling does the work of setting up a voice ahead of time, so that a
+ * synth can switch to it in the middle of playing with very little work.
+ * Compiled voices never change and can be shared between synths and threads.
+ */
+typedef struct _FmVoice FmVoice;
+
+/** Notes of a voice rendered ahead of time. See notecache.h. */
+typedef struct NoteCache NoteCache;
+
+/**
+ * @brief What the output stage of a synth has done.
+ *
+ * Voices are mixed in floating point and run through a limiter before being
+ * converted to 16 bits, so a loud mix is turned down rather than clipped.
+ * These count how often that happens. They are updated by whoever renders
+ * and can be read from any thread.
+ */
+typedef struct
+{
+    /** Samples in the mix past full scale, that would have clipped without
+     * the limiter. */
+    unsigned long clipped;
+    /** Times the limiter turned the mix down. */
+    unsigned long limited;
+} FmMixStats;
+
 /**
  * @brief Create a new FM synth with default parameters.
  *
@@ -818,6 +339,20 @@ Fm_defaultSynthesizer(void);
 FmSynthesizer*
 Fm_createFmSynthesizer(const FmSynthParams* params);
 
+/**
+ * @brief Create a new polyphonic FM synth with the given parameters.
+ *
+ * All voices share the same parameters. Voices are started and stopped with
+ * @ref Fm_voiceOn and @ref Fm_voiceOff. The monophonic functions
+ * (@ref Fm_setNote, @ref Fm_noteOn, @ref Fm_noteOff) drive voice 0.
+ *
+ * @param params The synth params.
+ * @param nVoices How many voices to allocate. Clamped to [1, FM_MAX_VOICES].
+ * @return The FmSynthesizer or NULL on error.
+ */
+FmSynthesizer*
+Fm_createPolySynthesizer(const FmSynthParams* params, size_t nVoices);
+
 /**
  * @brief Destroy the synthesizer.
  *
@@ -855,9 +390,52 @@ Fm_noteOn(FmSynthesizer* synth);
 void
 Fm_noteOff(FmSynthesizer* synth);
 
+/**
+ * @brief Start playing a note on a free voice.
+ *
+ * If every voice is busy one is stolen. Voices that have been released are
+ * stolen before held voices, quietest first. If every voice is held, the oldest
+ * is stolen.
+ *
+ * @param s Handle to a synth.
+ * @param note The note to play.
+ * @return The index of the voice playing the note, or FM_VOICE_NONE.
+ */
+int
+Fm_voiceOn(FmSynthesizer* s, Note note);
+
+/**
+ * @brief Gate every held voice that is playing the given note.
+ *
+ * @param s Handle to a synth.
+ * @param note The note to release.
+ */
+void
+Fm_voiceOff(FmSynthesizer* s, Note note);
+
+/**
+ * @brief Gate every held voice.
+ *
+ * @param s Handle to a synth.
+ */
+void
+Fm_allVoicesOff(FmSynthesizer* s);
+
+/**
+ * @brief Get the number of voices the synth was created with.
+ *
+ * @param s Handle to a synth.
+ * @return size_t The number of voices.
+ */
+size_t
+Fm_getVoiceCount(FmSynthesizer* s);
+
 /**
  * @brief Apply the given parameters to the synthesizer.
  *
+ * Every voice is silenced and starts over. To switch voices while playing,
+ * use @ref Fm_setVoice.
+ *
  * This function is NOT thread-safe. Do not call it if @ref
  * Fm_generateSamples is running in another thread.
  *
@@ -879,9 +457,121 @@ Fm_updateOpParams(FmSynthesizer* s,
                   FmOperator op,
                   const OperatorParams* params);
 
+/**
+ * @brief Compile a voice.
+ *
+ * @param params The voice's params. They are copied.
+ * @return The voice, or NULL on error.
+ */
+FmVoice*
+Fm_compileVoice(const FmSynthParams* params);
+
+/**
+ * @brief Free a compiled voice. No synth may still be using it.
+ *
+ * @param voice The voice.
+ */
+void
+Fm_destroyVoice(FmVoice* voice);
+
+/**
+ * @brief The params a voice was compiled from.
+ *
+ * @param voice The voice.
+ * @return The params.
+ */
+const FmSynthParams*
+Fm_getVoiceParams(const FmVoice* voice);
+
+/**
+ * @brief Switch a synth to a compiled voice without interrupting it.
+ *
+ * Unlike @ref Fm_updateParams nothing is reset. Sounding notes carry on with
+ * the new voice from the same phase and envelope position. The switch is
+ * made by the thread rendering the synth, at the next note on, when nothing
+ * is sounding, or at a zero crossing, whichever comes first, and after no
+ * more than about 45 ms. Switching again before then replaces the pending
+ * voice.
+ *
+ * Safe to call from any thread. The voice must outlive its use by the synth.
+ *
+ * @param s Handle to a synth.
+ * @param voice The voice to switch to.
+ */
+void
+Fm_setVoice(FmSynthesizer* s, const FmVoice* voice);
+
+/**
+ * @brief Give a synth notes baked ahead of time.
+ *
+ * While the synth plays the voice the cache was baked from, notes in the
+ * cache are mixed in from it instead of being synthesized. Once an operator
+ * is changed the voice no longer sounds like the cache, so the synth goes
+ * back to synthesizing, picking up sounding notes where they are.
+ *
+ * This function is NOT thread-safe, like @ref Fm_updateParams. The cache
+ * must outlive the synth.
+ *
+ * @param s Handle to a synth.
+ * @param cache The cache.
+ * @return false if the synth already has FM_MAX_NOTE_CACHES caches.
+ */
+bool
+Fm_addNoteCache(FmSynthesizer* s, const NoteCache* cache);
+
+/**
+ * @brief Select the kernel used by @ref Fm_generateSamples.
+ *
+ * All kernels produce the same output to within floating point rounding. This
+ * is mostly useful for benchmarking and comparing kernels.
+ *
+ * @param s Handle to a synth.
+ * @param kernel The kernel to use.
+ */
+void
+Fm_setKernel(FmSynthesizer* s, FmKernel kernel);
+
+/**
+ * @brief Add TPDF dither when converting the mix to 16 bits.
+ *
+ * Off by default, so renders are exactly repeatable.
+ *
+ * @param s Handle to a synth.
+ * @param dither Should the output be dithered?
+ */
+void
+Fm_setDither(FmSynthesizer* s, bool dither);
+
+/**
+ * @brief Is the synth silent until the next note on?
+ *
+ * True once every envelope and baked note has finished its release.
+ * Rendering an idle synth costs next to nothing, and gives exact silence,
+ * dithered or not.
+ *
+ * @param s Handle to a synth.
+ * @return Is the synth idle?
+ */
+bool
+Fm_isIdle(FmSynthesizer* s);
+
+/**
+ * @brief Get the output stage statistics of a synth.
+ *
+ * Safe to call from any thread while another renders.
+ *
+ * @param s Handle to a synth.
+ * @param stats Receives the statistics.
+ */
+void
+Fm_getMixStats(FmSynthesizer* s, FmMixStats* stats);
+
 /**
  * @brief Generate a given number of frames into a given buffer.
  *
+ * The mix is limited to just under full scale, so nothing clips unless the
+ * limiter is overwhelmed. See @ref FmMixStats.
+ *
  * @param synth The synth to use for generating.
  * @param sampleBuf The buffer to write samples to.
  * @param nSamples How many samples to write.
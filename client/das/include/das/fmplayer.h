@@ -3,15 +3,36 @@
  * @brief Drives a synthesizer and sends its output to the audio driver for
  * playback.
  *
- * This module manages an FmSynthesizer internally and is meant to be used as
- * the primary interface to it.
+ * This module manages FmSynthesizers internally and is meant to be used as
+ * the primary interface to them.
+ *
+ * There is one audio output per process, with one thread rendering it. Each
+ * FmPlayer on it drives a synthesizer of its own, and the output mixes them
+ * together at each player's gain and pan. FmPlayer_initialize opens the
+ * output along with the first player, which FMPLAYER_MAIN refers to.
  *
  * @author Spencer Leslie 301571329
  */
 
 #pragma once
 
+#include "com/threadutils.h"
+#include "das/eventqueue.h"
 #include "das/fm.h"
+#include <stdio.h>
+
+/** Event time meaning "as soon as possible". */
+#define FMPLAYER_NOW 0
+
+/** The player made by FmPlayer_initialize. */
+#define FMPLAYER_MAIN NULL
+/** Most players that can share the output, including the main one. */
+#define FMPLAYER_MAX_PLAYERS 8
+/** Most channels the output can have. */
+#define FMPLAYER_MAX_CHANNELS 2
+
+/** A synthesizer on the output. */
+typedef struct FmPlayer FmPlayer;
 
 /** Note control. Specifies turing a note on, off, or playing a stoccato note
  * which results from turning a note on and immediately gating it.*/
@@ -23,24 +44,272 @@ typedef enum
     NOTE_CTRL_NOTE_STOCCATO,
 } FmPlayer_NoteCtrl;
 
+/** Where the player sends its samples. */
+typedef enum
+{
+    /** The sound card, through ALSA. */
+    FMPLAYER_BACKEND_ALSA = 0,
+    /** A WAV file, written as fast as the synth can render. */
+    FMPLAYER_BACKEND_WAV,
+    /** Nowhere, as fast as the synth can render. */
+    FMPLAYER_BACKEND_NULL,
+    /** Nowhere, at the sample rate, as if it were a sound card. */
+    FMPLAYER_BACKEND_NULL_REALTIME,
+} FmPlayer_Backend;
+
+/** How the player hands samples to ALSA. */
+typedef enum
+{
+    /** Render a period into a buffer of our own, then copy it to the driver
+     * with snd_pcm_writei. Works with every device. */
+    FMPLAYER_ACCESS_RW = 0,
+    /** Render straight into the driver's ring buffer. Saves a copy per
+     * period, but the device has to support mmap access. */
+    FMPLAYER_ACCESS_MMAP,
+} FmPlayer_Access;
+
+/** Audio output configuration. */
+typedef struct
+{
+    /** Where samples go. */
+    FmPlayer_Backend backend;
+    /** The file to write with FMPLAYER_BACKEND_WAV. */
+    const char* wavPath;
+    /** How samples get to ALSA. */
+    FmPlayer_Access access;
+    /** Requested length of the hardware buffer in microseconds. This is the
+     * main parameter for tuning latency. The actual length is whatever the
+     * hardware can do that is closest. Other backends only use it to pick
+     * the period length when periodTimeUs is 0. */
+    unsigned int bufferTimeUs;
+    /** Requested length of a period in microseconds. The player wakes up and
+     * renders once per period. 0 means half the buffer. */
+    unsigned int periodTimeUs;
+    /** If non-zero, run the player thread under SCHED_FIFO at this priority,
+     * 1 to 99, and lock the process's memory so the thread never waits on a
+     * page fault. Without the privileges for it the player warns and keeps
+     * running under the normal scheduler. */
+    int realtimePriority;
+    /** CPU to pin the player thread to, or THREADUTILS_ANY_CPU. */
+    int cpu;
+    /** Dither the output. See Fm_setDither. */
+    bool dither;
+    /** 1 for mono, or 2 for stereo, so players can be panned. */
+    unsigned int channels;
+} FmPlayer_Config;
+
+/** The configuration used when none is given. Safe on any device, but with
+ * a 100 ms period. */
+#define FMPLAYER_DEFAULT_CONFIG                                                \
+    {                                                                          \
+        .backend = FMPLAYER_BACKEND_ALSA, .wavPath = NULL,                     \
+        .access = FMPLAYER_ACCESS_RW, .bufferTimeUs = 200000,                  \
+        .periodTimeUs = 0, .realtimePriority = 0,                              \
+        .cpu = THREADUTILS_ANY_CPU, .dither = false, .channels = 1             \
+    }
+
+/** A priority for the player thread that sits above interrupt threads, so
+ * nothing but the kernel gets between it and the deadline. */
+#define FMPLAYER_REALTIME_PRIORITY 80
+
+/** A configuration for low latency playback, with 5 ms periods. Short
+ * periods leave little slack, so this runs the player in real time. */
+#define FMPLAYER_LOW_LATENCY_CONFIG                                            \
+    {                                                                          \
+        .backend = FMPLAYER_BACKEND_ALSA, .wavPath = NULL,                     \
+        .access = FMPLAYER_ACCESS_MMAP, .bufferTimeUs = 10000,                 \
+        .periodTimeUs = 5000,                                                  \
+        .realtimePriority = FMPLAYER_REALTIME_PRIORITY,                        \
+        .cpu = THREADUTILS_ANY_CPU, .dither = false, .channels = 1             \
+    }
+
+/** Number of bins in an FmPlayer_Histogram. */
+#define FMPLAYER_HISTOGRAM_BINS 24
+
+/**
+ * A histogram with power-of-two bins. Bin 0 counts values of 0 or less, and
+ * bin b counts values in [2^(b - 1), 2^b). The last bin also counts
+ * everything larger.
+ */
+typedef struct
+{
+    unsigned long counts[FMPLAYER_HISTOGRAM_BINS];
+} FmPlayer_Histogram;
+
+/** Playback statistics, collected since the player was initialized. */
+typedef struct
+{
+    /** Periods rendered. */
+    unsigned long periods;
+    /** Times the driver reported an underrun. */
+    unsigned long xruns;
+    /** Times the player called snd_pcm_recover, for underruns or anything
+     * else. */
+    unsigned long recoveries;
+    /** Times waiting for the driver timed out. */
+    unsigned long timeouts;
+    /** Periods that were not written before the driver ran out of frames. */
+    unsigned long overruns;
+    /** Periods where every player was idle, so the player wrote silence
+     * without rendering. See Fm_isIdle. */
+    unsigned long idlePeriods;
+    /** Events a render clock sent to a full queue, which were dropped since
+     * waiting for room would stop the player thread. See FmPlayer_ClockFn. */
+    unsigned long droppedEvents;
+    /** Longest time taken to render and write a period, in microseconds. */
+    long long maxRenderUs;
+    /** Smallest margin seen, in microseconds. See renderMarginUs. */
+    long long minMarginUs;
+    /** Time taken to render and write each period, in microseconds. */
+    FmPlayer_Histogram renderUs;
+    /** How long each period had to spare once it was written: the audio
+     * that was queued when rendering began, less the time it took. Margins of
+     * 0 or less are overruns. In microseconds. */
+    FmPlayer_Histogram renderMarginUs;
+    /** snd_pcm_delay at the start of each period, in frames. */
+    FmPlayer_Histogram delayFrames;
+    /** What the synths' limiters have done, counting samples that clipped
+     * when the players were mixed together. Players that have since been
+     * destroyed still count. Up to date as of the last period. */
+    FmMixStats mix;
+} FmPlayer_Stats;
+
 /**
  * @brief Initialize the player.
  *
- * Creates a synthesizer with the given params, spins up a synthesizer thread
- * and a playback thread.
+ * Opens the audio output, creates the main player with the given params and
+ * spins up the playback thread. Unless the process already handles SIGUSR1,
+ * sending it SIGUSR1 prints the playback statistics to stderr.
  *
  * @param params The synth params.
+ * @param config The audio output configuration, or NULL for
+ * FMPLAYER_DEFAULT_CONFIG.
  * @return 1 on success, negative on failure.
  */
 int
-FmPlayer_initialize(const FmSynthParams* params);
+FmPlayer_initialize(const FmSynthParams* params, const FmPlayer_Config* config);
+
+/**
+ * Add a player to the output. It starts out silent, at unity gain, in the
+ * middle.
+ *
+ * @param params The synth params. Their sample rate must be the output's.
+ * @return The player, or NULL if there is no output, the sample rate is
+ * wrong, FMPLAYER_MAX_PLAYERS are already playing, or there's no memory.
+ */
+FmPlayer*
+FmPlayer_create(const FmSynthParams* params);
+
+/**
+ * Take a player off the output and free it. Does nothing for the main
+ * player, which lasts until FmPlayer_close.
+ *
+ * Waits for the period being rendered, so don't call it where that matters.
+ *
+ * @param player The player.
+ */
+void
+FmPlayer_destroy(FmPlayer* player);
+
+/**
+ * Set how loud a player is in the mix, and where it sits.
+ *
+ * Players are summed, so turn them down to leave headroom when several play
+ * at once. Samples that still go over full scale are clipped, and counted
+ * in FmPlayer_Stats.
+ *
+ * @param player The player, or FMPLAYER_MAIN.
+ * @param gain What to scale the player's samples by. 1 leaves them as
+ * they are.
+ * @param pan From -1, left, to 1, right. Panning keeps the player equally
+ * loud. Ignored by mono outputs.
+ */
+void
+FmPlayer_setMix(FmPlayer* player, float gain, float pan);
+
+/**
+ * Type of a render clock: a function the player thread calls as it renders,
+ * so it can change what plays on an exact frame rather than at the start of
+ * a period. See FmPlayer_setClock.
+ *
+ * Events it sends, with FmPlayer_setNote and the like, apply on the frame it
+ * was called for. It runs while the period is being rendered, so it must be
+ * quick, and send no more than a handful of events at a time. Nothing it
+ * sends waits for room in a full queue: the event is dropped and counted in
+ * FmPlayer_Stats instead. It must switch voices with FmPlayer_setVoice, since
+ * FmPlayer_setSynthVoice may compile one.
+ *
+ * @param data The data given to FmPlayer_setClock.
+ * @param elapsedFrames Frames rendered since it was last called. 0 the first
+ * time.
+ * @param sampleRate The output's sample rate.
+ * @return How many frames to render before calling it again. It is also
+ * called at the start of every period, whether it is due or not.
+ */
+typedef size_t (*FmPlayer_ClockFn)(void* data,
+                                   size_t elapsedFrames,
+                                   unsigned int sampleRate);
+
+/**
+ * Set the output's render clock, replacing any it had.
+ *
+ * Waits for the period being rendered, so once it returns the old clock is
+ * no longer running. Don't call it from the clock itself.
+ *
+ * @param clock The clock, or NULL for none.
+ * @param data Passed to the clock.
+ * @return false if there is no output to set it on.
+ */
+bool
+FmPlayer_setClock(FmPlayer_ClockFn clock, void* data);
+
+/**
+ * Give a player notes baked ahead of time, which it plays instead of
+ * synthesizing them while its voice is the one they were baked from. See
+ * Fm_addNoteCache and notecache.h.
+ *
+ * @param player The player, or FMPLAYER_MAIN.
+ * @param cache The cache. It must stay open until FmPlayer_close, or until
+ * the player is destroyed.
+ * @return false if the player already has FM_MAX_NOTE_CACHES caches.
+ */
+bool
+FmPlayer_addNoteCache(FmPlayer* player, const NoteCache* cache);
 
 /**
  * Performs the note control operation to turn a note on, off, or play a
  * stoccato note.
+ *
+ * This and every other FmPlayer function that changes what is playing queues
+ * an event for the player thread. Events apply in the order they were sent,
+ * at the start of the next period. The *At variants instead apply their event
+ * at the exact sample where the given time falls, so their timing is not
+ * limited by the period size. All of them are safe to call from any thread
+ * and never block, unless the queue is full, in which case they wait for room
+ * rather than drop the event. A render clock is the exception; see
+ * FmPlayer_ClockFn.
+ *
+ * Each takes the player to send the event to, or FMPLAYER_MAIN.
+ *
+ * @param player The player.
+ * @param ctrl The note control.
  */
 void
-FmPlayer_controlNote(FmPlayer_NoteCtrl ctrl);
+FmPlayer_controlNote(FmPlayer* player, FmPlayer_NoteCtrl ctrl);
+
+/**
+ * Same as FmPlayer_controlNote, but the note is triggered or gated at the
+ * given time, to the sample.
+ *
+ * @param player The player.
+ * @param ctrl The note control.
+ * @param timeNs When to do it, from Timeutils_getMonotonicTimeInNs. Times
+ * that have already passed take effect as soon as possible.
+ */
+void
+FmPlayer_controlNoteAt(FmPlayer* player,
+                       FmPlayer_NoteCtrl ctrl,
+                       long long timeNs);
 
 /**
  * Update the active synth parameters.
@@ -49,69 +318,168 @@ FmPlayer_controlNote(FmPlayer_NoteCtrl ctrl);
  * useful if modulation params have been tweaked and you want to reset to the
  * last applied voice.
  *
+ * The params are compiled into a voice by the calling thread the first time
+ * the player sees them, and kept until the player is destroyed, so switching
+ * back to them later is cheap. The player switches voices without cutting off
+ * the note that's playing. See Fm_setVoice.
+ *
+ * @param player The player.
+ * @param params The parameters to update.
+ */
+void
+FmPlayer_setSynthVoice(FmPlayer* player, const FmSynthParams* params);
+
+/**
+ * Get a player's compiled voice for the params, compiling them the first
+ * time the player sees them as FmPlayer_setSynthVoice does. This can
+ * allocate and lock, so don't call it from a render clock.
+ *
+ * @param player The player.
+ * @param params The parameters.
+ * @return The voice, which lasts until the player is destroyed, or NULL if it
+ * couldn't be compiled.
+ */
+const FmVoice*
+FmPlayer_getVoice(FmPlayer* player, const FmSynthParams* params);
+
+/**
+ * Same as FmPlayer_setSynthVoice, with a voice from FmPlayer_getVoice for the
+ * same player. It compiles and locks nothing, so a render clock can call it.
+ *
+ * @param player The player.
+ * @param voice The voice, or NULL to apply the last voice again.
+ */
+void
+FmPlayer_setVoice(FmPlayer* player, const FmVoice* voice);
+
+/**
+ * Same as FmPlayer_setSynthVoice, but takes effect at the given time.
+ *
+ * @param player The player.
  * @param params The parameters to update.
+ * @param timeNs When to update, as in FmPlayer_controlNoteAt.
  */
 void
-FmPlayer_setSynthVoice(const FmSynthParams* params);
+FmPlayer_setSynthVoiceAt(FmPlayer* player,
+                         const FmSynthParams* params,
+                         long long timeNs);
 
 /**
  * Update the wave type played by the given operator.
  *
+ * @param player The player.
  * @param op The operator to update.
  * @param wave The new wave type.
  */
 void
-FmPlayer_updateOperatorWaveType(FmOperator op, WaveType wave);
+FmPlayer_updateOperatorWaveType(FmPlayer* player, FmOperator op, WaveType wave);
 
 /**
  * Updates the CM ratio of the current operator.
  *
+ * @param player The player.
  * @param op The operator to update.
  * @param cm The new cm ratio.
  */
 void
-FmPlayer_updateOperatorCm(FmOperator op, float cm);
+FmPlayer_updateOperatorCm(FmPlayer* player, FmOperator op, float cm);
 
 /**
  * Updates an operator's output strength in the mix.
  *
+ * @param player The player.
  * @param op The operator to update.
  * @param outStrength The new output strength of the operator.
  */
 void
-FmPlayer_updateOperatorOutputStrength(FmOperator op, float outStrength);
+FmPlayer_updateOperatorOutputStrength(FmPlayer* player,
+                                      FmOperator op,
+                                      float outStrength);
 
 /**
  * Fixes an operator to a note.
  *
+ * @param player The player.
  * @param op The operator to fix.
  * @param note The note to fix the operator to.
  */
 void
-FmPlayer_fixOperatorToNote(FmOperator op, Note note);
+FmPlayer_fixOperatorToNote(FmPlayer* player, FmOperator op, Note note);
 
 /**
  * Updates the current algorithmic connections for an operator.
  *
+ * @param player The player.
  * @param op The operator to update.
  * @param moddingOp The modulating operator in the connection.
  * @modIndex The new modulation index for the connection.
  */
 void
-FmPlayer_updateOperatorAlgorithmConnection(FmOperator op,
+FmPlayer_updateOperatorAlgorithmConnection(FmPlayer* player,
+                                           FmOperator op,
                                            FmOperator moddingOp,
                                            float modIndex);
 
 /**
  * Sets the currently playing note.
  *
+ * @param player The player.
  * @param note The note to play.
  */
 void
-FmPlayer_setNote(Note note);
+FmPlayer_setNote(FmPlayer* player, Note note);
+
+/**
+ * Same as FmPlayer_setNote, but takes effect at the given time.
+ *
+ * @param player The player.
+ * @param note The note to play.
+ * @param timeNs When to change notes, as in FmPlayer_controlNoteAt.
+ */
+void
+FmPlayer_setNoteAt(FmPlayer* player, Note note, long long timeNs);
+
+/**
+ * Get statistics on a player's event queue.
+ *
+ * @param player The player.
+ * @param stats Receives the statistics.
+ */
+void
+FmPlayer_getQueueStats(FmPlayer* player, EventQueue_Stats* stats);
+
+/**
+ * Get the playback statistics. They are updated without locks, so this is
+ * cheap and safe from any thread, but the numbers may be a period apart from
+ * each other.
+ *
+ * @param stats Receives the statistics.
+ */
+void
+FmPlayer_getStats(FmPlayer_Stats* stats);
+
+/**
+ * Print the playback statistics.
+ *
+ * @param out Where to print them.
+ */
+void
+FmPlayer_printStats(FILE* out);
+
+/**
+ * Print a histogram the way FmPlayer_printStats does, skipping empty bins.
+ *
+ * @param out Where to print it.
+ * @param name What it counts.
+ * @param histogram The histogram.
+ */
+void
+FmPlayer_printHistogram(FILE* out,
+                        const char* name,
+                        const FmPlayer_Histogram* histogram);
 
 /**
- * @brief Close and tear down the player.
+ * @brief Close and tear down the output, and every player on it.
  */
 void
 FmPlayer_close(void);
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "das/fm.h"
+#include "das/sequencer.h"
 
 /** A fast bpm. */
 #define TEMPO_FAST 180
@@ -172,7 +173,12 @@ static const MelodyGenParams neutralParams = { .tempo = TEMPO_SLOW,
                                                .stoccatoLegatoTendency = 0.9 };
 
 /**
- * Generates a melody according the given params.
+ * Generates a melody according the given params into a track of the
+ * sequencer's back pattern. Sets the pattern's tempo, which every track
+ * shares, from the start of its loop.
+ *
+ * @param track The track, e.g. SEQ_MAIN_TRACK.
+ * @param params The params.
  */
 void
-Melody_generateToSequencer(const MelodyGenParams* params);
+Melody_generateToSequencer(SequencerTrack track, const MelodyGenParams* params);
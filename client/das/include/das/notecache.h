@@ -0,0 +1,226 @@
+/**
+ * @file notecache.h
+ * @brief Notes rendered ahead of time.
+ *
+ * A note cache holds the notes of one voice, rendered by the synth in
+ * advance. Each note is an attack, a loop that plays for as long as the note
+ * is held, and a release. A synth given a cache for the voice it is playing
+ * mixes those samples in instead of synthesizing the note, which costs next
+ * to nothing. See Fm_addNoteCache.
+ *
+ * Only voices whose envelopes settle while a note is held can be baked,
+ * since the sustain is played by looping a short stretch of it. Envelopes
+ * with a repeat point never settle. Notes whose sustain doesn't repeat
+ * closely enough within NOTECACHE_MAX_LOOP samples, as with inharmonic CM
+ * ratios, are left out, and the synth plays those live.
+ *
+ * Cache files hold samples and FmSynthParams exactly as they are laid out in
+ * memory, so like preset banks they only load on the kind of machine that
+ * wrote them.
+ */
+#pragma once
+
+#include "das/fm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Lowest note baked by default, the bottom of the melody generator's range.
+ */
+#define NOTECACHE_LOWEST_NOTE C2
+/** Highest note baked by default, the top of the melody generator's range. */
+#define NOTECACHE_HIGHEST_NOTE B6
+/** Longest sustain loop, in samples. Low notes of voices with low CM ratios
+ * need long loops to repeat. */
+#define NOTECACHE_MAX_LOOP 8192
+
+typedef struct NoteCache NoteCache;
+
+/** Position in one baked note. Private to the note cache. */
+typedef struct
+{
+    /** The note's samples, or NULL if it isn't playing. */
+    const int16_t* samples;
+    /** The next sample to play. */
+    size_t pos;
+    /** Where the loop starts, which is where the attack ends. */
+    size_t loopStart;
+    /** Where the loop ends, which is where the release starts. */
+    size_t loopEnd;
+    /** Where the release ends. */
+    size_t end;
+    /** Has the note been gated? */
+    bool gated;
+} NoteCache_Cursor;
+
+/**
+ * Where a synth voice is in the baked notes it plays. Zeroed, nothing is
+ * playing. Its fields are private to the note cache.
+ */
+typedef struct
+{
+    /** The note playing. */
+    NoteCache_Cursor current;
+    /** The note it replaced, fading out. */
+    NoteCache_Cursor fading;
+    /** Samples left of the fade. */
+    size_t fadeLeft;
+    /** Length of the fade. */
+    size_t fadeLength;
+    /** Does the current note fade in while the other fades out? */
+    bool crossfade;
+} NoteCache_Playhead;
+
+/**
+ * Render the notes of a voice.
+ *
+ * Takes a while: every note is rendered from its attack to the end of its
+ * release. Do it at startup, or once and save it.
+ *
+ * @param cache Receives the cache.
+ * @param params The voice.
+ * @param lowest The lowest note to bake.
+ * @param highest The highest note to bake.
+ * @return 0 on success, or a negative errno. -EINVAL if the voice can't be
+ * baked.
+ */
+int
+NoteCache_bake(NoteCache** cache,
+               const FmSynthParams* params,
+               Note lowest,
+               Note highest);
+
+/**
+ * Map a cache file into memory.
+ *
+ * @param cache Receives the cache.
+ * @param path The file.
+ * @return 0 on success, or a negative errno. -EINVAL if the file isn't a
+ * cache, or was written by a different kind of machine.
+ */
+int
+NoteCache_open(NoteCache** cache, const char* path);
+
+/**
+ * Write a cache to a file.
+ *
+ * @param cache The cache.
+ * @param path The file. It is overwritten if it exists.
+ * @return 0 on success, or a negative errno.
+ */
+int
+NoteCache_save(const NoteCache* cache, const char* path);
+
+/**
+ * Free a cache. Nothing may still be playing from it, so close the FmPlayer
+ * or destroy the synth first.
+ */
+void
+NoteCache_close(NoteCache* cache);
+
+/**
+ * Get the voice a cache was baked from.
+ */
+const FmSynthParams*
+NoteCache_getParams(const NoteCache* cache);
+
+/**
+ * How many notes were baked. Notes in the range that couldn't be baked
+ * don't count.
+ */
+size_t
+NoteCache_countNotes(const NoteCache* cache);
+
+/**
+ * How much memory the cache takes, in bytes.
+ */
+size_t
+NoteCache_getSize(const NoteCache* cache);
+
+/**
+ * Start playing a note from the beginning of its attack.
+ *
+ * If something was playing, it is faded out over fadeLength samples.
+ *
+ * @param head The playhead.
+ * @param note The note.
+ * @param fadeLength How long to fade out what was playing, in samples.
+ * @return false, leaving the playhead alone, if the note wasn't baked.
+ */
+bool
+NoteCache_start(const NoteCache* cache,
+                NoteCache_Playhead* head,
+                Note note,
+                size_t fadeLength);
+
+/**
+ * Switch the playing note to another one, at the same point in its
+ * envelopes, crossfading between them over fadeLength samples.
+ *
+ * @param head The playhead.
+ * @param note The note.
+ * @param fadeLength How long to crossfade, in samples.
+ * @return false, leaving the playhead alone, if the note wasn't baked.
+ */
+bool
+NoteCache_retune(const NoteCache* cache,
+                 NoteCache_Playhead* head,
+                 Note note,
+                 size_t fadeLength);
+
+/**
+ * Gate the playing note. Gated during its attack, it plays the rest of the
+ * attack and goes on into its release, as the envelopes would. Gated while
+ * held, it crossfades into its release.
+ */
+void
+NoteCache_gate(NoteCache_Playhead* head);
+
+/**
+ * Fade the playing note out over fadeLength samples, leaving nothing
+ * playing.
+ */
+void
+NoteCache_fadeOut(NoteCache_Playhead* head, size_t fadeLength);
+
+/**
+ * Is a note playing, or fading out?
+ */
+bool
+NoteCache_isPlaying(const NoteCache_Playhead* head);
+
+/**
+ * How loud the playing note is, from 1 while it is held down to 0 at the end
+ * of its release.
+ */
+float
+NoteCache_getLevel(const NoteCache_Playhead* head);
+
+/**
+ * How far the playing note's envelopes have got, so a live voice can pick up
+ * where it is.
+ *
+ * @param head The playhead.
+ * @param held Receives the samples played before the note was released.
+ * @param released Receives the samples played since the note was released.
+ * @return Has the note been gated?
+ */
+bool
+NoteCache_getEnvelopeTime(const NoteCache_Playhead* head,
+                          size_t* held,
+                          size_t* released);
+
+/**
+ * Mix the next samples of the playing note into a bus.
+ *
+ * @param head The playhead. Left with nothing playing once the note ends.
+ * @param bus The bus, where full scale is 1.
+ * @param nSamples How many samples to mix.
+ * @param gain What to scale the note by.
+ */
+void
+NoteCache_mix(NoteCache_Playhead* head,
+              float* bus,
+              size_t nSamples,
+              float gain);
@@ -0,0 +1,126 @@
+/**
+ * @file presetbank.h
+ * @brief Banks of synth presets.
+ *
+ * A bank is a list of named FmSynthParams. The presets in fm.h make up the
+ * bank built into the library. Other banks are binary files that are mapped
+ * into memory as they are, so opening one costs a page fault per preset
+ * played rather than a copy of the whole file, and only the bank in use
+ * takes up memory.
+ *
+ * Using a bank makes the FM_*_PARAMS presets come from it. That way a
+ * personality's voices can be changed by writing a new bank, without
+ * recompiling anything.
+ *
+ * Bank files hold FmSynthParams exactly as they are laid out in memory, so
+ * they only load on the kind of machine that wrote them. Write them with
+ * tac_render built for the machine that will read them.
+ */
+#pragma once
+
+#include "das/fm.h"
+
+#include <stddef.h>
+
+/** Longest preset name, including the terminator. */
+#define PRESETBANK_NAME_MAX 32
+
+typedef struct PresetBank PresetBank;
+
+/**
+ * Get the bank built into the library. It holds the FM_*_PARAMS presets.
+ *
+ * @return The bank.
+ */
+const PresetBank*
+PresetBank_getBuiltin(void);
+
+/**
+ * Map a bank file into memory.
+ *
+ * @param bank Receives the bank.
+ * @param path The file.
+ * @return 0 on success, or a negative errno. -EINVAL if the file isn't a
+ * bank, was written by a different kind of machine, or has a preset that
+ * can't be played, such as one with an unknown wave type or an envelope
+ * with no points.
+ */
+int
+PresetBank_open(PresetBank** bank, const char* path);
+
+/**
+ * Unmap a bank. If it is in use, the built in bank is used again.
+ *
+ * Nothing may still be using its presets, so close the FmPlayer first.
+ */
+void
+PresetBank_close(PresetBank* bank);
+
+/**
+ * Write a bank file.
+ *
+ * @param path The file. It is overwritten if it exists.
+ * @param names The presets' names, shorter than PRESETBANK_NAME_MAX.
+ * @param params The presets.
+ * @param count How many presets there are.
+ * @return 0 on success, or a negative errno.
+ */
+int
+PresetBank_write(const char* path,
+                 const char* const* names,
+                 const FmSynthParams* const* params,
+                 size_t count);
+
+/**
+ * How many presets are in a bank.
+ */
+size_t
+PresetBank_count(const PresetBank* bank);
+
+/**
+ * Get the name of a preset.
+ *
+ * @param index The preset, less than PresetBank_count.
+ * @return The name.
+ */
+const char*
+PresetBank_getName(const PresetBank* bank, size_t index);
+
+/**
+ * Get a preset.
+ *
+ * @param index The preset, less than PresetBank_count.
+ * @return The preset. Valid until the bank is closed.
+ */
+const FmSynthParams*
+PresetBank_get(const PresetBank* bank, size_t index);
+
+/**
+ * Find a preset by name.
+ *
+ * @param name The name.
+ * @return The preset, or NULL if the bank doesn't have one by that name.
+ */
+const FmSynthParams*
+PresetBank_find(const PresetBank* bank, const char* name);
+
+/**
+ * Make the FM_*_PARAMS presets, and Fm_getPreset, come from a bank.
+ *
+ * Each one is looked up by its name in FM_PRESETS. Presets the bank doesn't
+ * have come from the built in bank.
+ *
+ * Not thread-safe. Call it at startup, before anything plays.
+ *
+ * @param bank The bank.
+ */
+void
+PresetBank_use(const PresetBank* bank);
+
+/**
+ * Get the bank in use.
+ *
+ * @return The bank.
+ */
+const PresetBank*
+PresetBank_getActive(void);
@@ -2,9 +2,27 @@
  * @file sequencer.h
  * @brief A software sequencer.
  *
- * A sequencer is a sequence of slots containing notes that are played in order
- * and then repeated. Slots can be filled to create a melody that will be played
- * at a configurable tempo and looped.
+ * A sequencer plays a pattern of events in order and then repeats it. Each
+ * event is timed in ticks from the start of the pattern, at a configurable
+ * number of ticks per quarter note, so events can fall between sixteenths for
+ * triplets, swing and grace notes. Patterns can be any number of ticks long.
+ * Only the ticks with events on them are played, and the sequencer sleeps
+ * through the rest.
+ *
+ * Patterns can also be filled a slot at a time, where slots are the
+ * sixteenths of the default SEQ_BEAT_SLOTS beat pattern.
+ *
+ * A pattern has a track for each player the sequencer plays, up to
+ * SEQ_MAX_TRACKS. Tracks share the tempo and start together, but each can
+ * loop over a length of its own within the pattern, and be muted. Since every
+ * player renders on the output's one thread, a track costs no more than the
+ * synth it plays on, and nothing while it's silent. The first track,
+ * SEQ_MAIN_TRACK, plays on FMPLAYER_MAIN.
+ *
+ * The sequencer holds two patterns. The front pattern plays while the
+ * back one is filled, and the back one takes over at the start of the next
+ * loop once it is committed. Filling never waits on playback, playback never
+ * waits on filling, and a loop never plays a half-filled pattern.
  *
  * @author Spencer Leslie 301571329
  */
@@ -19,48 +37,144 @@
 // TODO: thirtysecond note might be overkill
 #define SEQ_THIRTYSECOND_NOTE 8
 
-/** How many full beats the sequencer has. 8 beats is 2 bars. */
+/** How many full beats a pattern has by default. 8 beats is 2 bars. */
 #define SEQ_BEAT_SLOTS 8
 
+/** Ticks per quarter note by default. */
+#define SEQ_DEFAULT_PPQ 96
+/** Most ticks per quarter note. Even at SEQ_MAX_BPM, a tick is a frame or
+ * more at any sample rate from 4800 Hz up. */
+#define SEQ_MAX_PPQ 960
+
+/** Slowest tempo, in bpm. */
+#define SEQ_MIN_BPM 20
+/** Fastest tempo, in bpm. */
+#define SEQ_MAX_BPM 300
+
+/** Most events a track can hold. */
+#define SEQ_MAX_EVENTS 512
+
+/** Most tracks the sequencer can play. */
+#define SEQ_MAX_TRACKS FMPLAYER_MAX_PLAYERS
+/** The track that plays on FMPLAYER_MAIN. */
+#define SEQ_MAIN_TRACK 0
+
 /** Sequencer status codes. */
 #define SEQ_OK 0
 #define SEQ_EALLOC -1
 #define SEQ_EINVAL -2
+#define SEQ_EFULL -3
 
-/** Sequencer operations. Each slot contains one operation. */
+/** Sequencer operations. Each event plays one operation. */
 typedef struct
 {
     FmPlayer_NoteCtrl op;
     Note note;
-    FmSynthParams* synthParams;
+    /** The voice to change to, or NULL. Compiled for the track's player when
+     * the event is added, so playing it compiles and locks nothing. */
+    const FmVoice* voice;
 } SequencerOp;
 
 /** Type of the index of the currently playing slot. */
 typedef size_t SequencerIdx;
+/** Type of a time in ticks. */
+typedef size_t SequencerTick;
+/** Type of a track number. */
+typedef size_t SequencerTrack;
 /** Type of a BPM. */
 typedef size_t SequencerBpm;
 /** Type of a BPM when given as a delta. */
 typedef int SequencerBpmDelta;
 
+/** What times the sequencer's events. */
+typedef enum
+{
+    /** A thread of its own, which sleeps until each event is due and then
+     * sends its notes to the player. They start at the player's next
+     * period. */
+    SEQ_CLOCK_THREAD = 0,
+    /** The player, which counts the frames it renders and plays each event
+     * on the exact frame it is due. There is no sequencer thread. Needs
+     * FmPlayer_initialize first. See FmPlayer_setClock. */
+    SEQ_CLOCK_RENDER,
+} SequencerClock;
+
+/**
+ * Timing statistics, collected since the sequencer was initialized.
+ *
+ * Every event is due at a fixed time after the start of its loop. Lateness
+ * is how long after that the sequencer woke to play it. On SEQ_CLOCK_RENDER,
+ * events play on the frame they are due, so they are never late.
+ */
+typedef struct
+{
+    /** Events played, on every track. */
+    unsigned long events;
+    /** Times the sequencer woke to play events or start a loop. Events due
+     * at the same time on different tracks share a wakeup. */
+    unsigned long wakeups;
+    /** Times the sequencer fell more than a sixteenth behind and started
+     * timing again from where it was, rather than rushing to catch up. */
+    unsigned long resyncs;
+    /** The latest the sequencer has woken, in microseconds. */
+    long long maxLateUs;
+    /** How late each wakeup was, in microseconds. */
+    FmPlayer_Histogram lateUs;
+} Sequencer_Stats;
+
+/** Sequencer configuration. */
+typedef struct
+{
+    /** The tempo, from SEQ_MIN_BPM to SEQ_MAX_BPM. */
+    SequencerBpm bpm;
+    /** What times the events. */
+    SequencerClock clock;
+    /** Ticks per quarter note, e.g. 96 or 480. A multiple of
+     * SEQ_SIXTEENTH_NOTE_IN_QUARTER_NOTE, so slots fall on ticks, and no more
+     * than SEQ_MAX_PPQ. */
+    SequencerTick ppq;
+} Sequencer_Config;
+
+/** The default configuration. */
+#define SEQ_DEFAULT_CONFIG                                                     \
+    { .bpm = 120, .clock = SEQ_CLOCK_THREAD, .ppq = SEQ_DEFAULT_PPQ }
+
 /**
- * Type of an optional callback function that will be called immediately before
- * each time the sequencer plays its first slot.
+ * Type of an optional callback function that fills the pattern for the next
+ * loop.
  *
- * This function will be called from the sequencer thread. It's to be used to
- * set the melody before the sequencer starts playing.
+ * It is called from a thread of the sequencer's own once each loop starts, and
+ * once after every reset, and should fill the back pattern with
+ * Sequencer_clear and Sequencer_fillSlot or Sequencer_addEvent. The pattern is
+ * committed when it returns. It has until the loop ends, so it doesn't hold up
+ * playback. After a reset, playback waits for it.
  */
 typedef void (*loopCallbackFn)(void);
 
 /**
  * Initialize the sequencer at the given tempo.
  *
- * @param bpm The sequencer tempo.
+ * @param bpm The sequencer tempo, from SEQ_MIN_BPM to SEQ_MAX_BPM.
  * @param callback An optional loop callback.
- * @return A status code. SEQ_OK on success, or < 0 on error.
+ * @return A status code. SEQ_OK on success, or < 0 on error. SEQ_EINVAL if
+ * the tempo is out of range.
  */
 int
 Sequencer_initialize(SequencerBpm bpm, loopCallbackFn callback);
 
+/**
+ * Initialize the sequencer with the given configuration.
+ *
+ * @param config The configuration. Start from SEQ_DEFAULT_CONFIG.
+ * @param callback An optional loop callback.
+ * @return A status code. SEQ_OK on success, or < 0 on error. SEQ_EINVAL if
+ * the configuration is invalid, or the clock is SEQ_CLOCK_RENDER and there is
+ * no player.
+ */
+int
+Sequencer_initializeWithConfig(const Sequencer_Config* config,
+                               loopCallbackFn callback);
+
 /**
  * Get the index of a slot corresponding to a quarter, eighth, and sixteenth
  * note index.
@@ -92,54 +206,202 @@ SequencerIdx
 Sequencer_getSlotIndex(int quarter, int eighth, int sixteenth);
 
 /**
- * Fill a sequencer slot with a not operation.
+ * Get the number of ticks per quarter note.
+ */
+SequencerTick
+Sequencer_getPpq(void);
+
+/**
+ * Add a track that plays on a player.
+ *
+ * Tracks can't be removed, so destroy the sequencer before the player.
+ *
+ * @param player The player, from FmPlayer_create.
+ * @return The track, or SEQ_EFULL if there are SEQ_MAX_TRACKS already.
+ */
+int
+Sequencer_addTrack(FmPlayer* player);
+
+/**
+ * Mute or unmute a track. Takes effect right away, rather than at the next
+ * loop. A muted track keeps time and changes voices, but starts no notes.
+ *
+ * @param track The track.
+ * @param mute Mute it?
+ * @return SEQ_OK on success, or SEQ_EINVAL if there is no such track.
+ */
+int
+Sequencer_setTrackMute(SequencerTrack track, bool mute);
+
+/**
+ * Fill a slot of a track in the back pattern with a note operation, replacing
+ * the events at the slot's tick.
  *
+ * The back pattern starts out as a copy of the one playing. Only one thread
+ * may fill it at a time: the loop callback's, if there is one.
+ *
+ * @param track The track.
  * @param idx The index of the slot to fill.
  * @param control Note control operation for the slot.
  * @param note The note to play for the slot.
- * @param synthParams Optional voice to change to when the slot is played.
+ * @param synthParams Optional voice to change to when the slot is played. It
+ * is compiled for the track's player now, and the slot is left empty if it
+ * can't be.
+ */
+void
+Sequencer_fillSlot(SequencerTrack track,
+                   SequencerIdx idx,
+                   FmPlayer_NoteCtrl control,
+                   Note note,
+                   const FmSynthParams* synthParams);
+
+/**
+ * Set the voice to change to when a slot of a track in the back pattern is
+ * played, leaving its note alone.
+ *
+ * @param track The track.
+ * @param idx The index of the slot.
+ * @param synthParams The voice, or NULL to keep the current one. Compiled as
+ * in Sequencer_fillSlot.
  */
 void
-Sequencer_fillSlot(SequencerIdx idx,
+Sequencer_setSlotVoice(SequencerTrack track,
+                       SequencerIdx idx,
+                       const FmSynthParams* synthParams);
+
+/**
+ * Add an event to a track in the back pattern. It plays after any events
+ * already at the same tick.
+ *
+ * @param track The track.
+ * @param tick When to play it, in ticks from the start of the track's loop.
+ * @param control Note control operation for the event.
+ * @param note The note to play, or NOTE_NONE.
+ * @param synthParams Optional voice to change to when the event is played.
+ * Compiled as in Sequencer_fillSlot.
+ * @return SEQ_OK on success, SEQ_EINVAL if there is no such track or the tick
+ * is past the end of its loop, SEQ_EFULL if the track holds SEQ_MAX_EVENTS
+ * events, or SEQ_EALLOC if the voice couldn't be compiled.
+ */
+int
+Sequencer_addEvent(SequencerTrack track,
+                   SequencerTick tick,
                    FmPlayer_NoteCtrl control,
                    Note note,
-                   FmSynthParams* synthParams);
+                   const FmSynthParams* synthParams);
+
+/**
+ * Set the length of the back pattern. Every track starts again from the top
+ * when it ends. Events at or past the new end of tracks that loop with the
+ * pattern are dropped.
+ *
+ * @param ticks The length in ticks.
+ * @return SEQ_OK on success, or SEQ_EINVAL if the length is 0.
+ */
+int
+Sequencer_setLength(SequencerTick ticks);
+
+/**
+ * Set the tempo of the back pattern. It takes over from the tempo playing
+ * when the pattern's loop starts, so a loop callback can set the tempo of the
+ * loop it fills without changing the one playing. A pattern without a tempo
+ * of its own carries on at the tempo playing before it.
+ *
+ * @param bpm The tempo, from SEQ_MIN_BPM to SEQ_MAX_BPM.
+ * @return SEQ_OK on success, or SEQ_EINVAL if the tempo is out of range.
+ */
+int
+Sequencer_setPatternBpm(SequencerBpm bpm);
+
+/**
+ * Set how long a track in the back pattern loops for. It repeats until the
+ * pattern ends, and is cut short if the pattern ends first. Events at or
+ * past the new end are dropped.
+ *
+ * @param track The track.
+ * @param ticks The length in ticks, or 0 to loop with the pattern.
+ * @return SEQ_OK on success, or SEQ_EINVAL if there is no such track.
+ */
+int
+Sequencer_setTrackLength(SequencerTrack track, SequencerTick ticks);
+
+/**
+ * Commit the back pattern, so it plays from the start of the next loop.
+ * Filling it again before then takes it back. Patterns filled by the loop
+ * callback are committed for it.
+ */
+void
+Sequencer_commit(void);
 
 /** Starts the sequencer playing. If the sequencer was stopped, it will resume
- * at the last played slot. */
+ * at the next event. */
 void
 Sequencer_start(void);
 
-/** Clears the sequencer. Does not stop! */
+/** Clears the back pattern's events on every track, keeping the lengths.
+ * Does not stop! */
 void
 Sequencer_clear(void);
 
-/** Stops the sequencer. */
+/**
+ * Clears a track's events in the back pattern, keeping its length.
+ *
+ * @param track The track.
+ * @return SEQ_OK on success, or SEQ_EINVAL if there is no such track.
+ */
+int
+Sequencer_clearTrack(SequencerTrack track);
+
+/** Stops the sequencer, letting go of every track's notes. */
 void
 Sequencer_stop(void);
 
-/** Sets the current slot index to 0 and starts the sequencer. */
+/** Goes back to the start of the pattern and starts the sequencer. With a loop
+ * callback, it starts once the callback has filled a pattern. */
 void
 Sequencer_reset(void);
 
 /**
- * Set the sequencer BPM.
+ * Set the sequencer BPM. Takes effect right away, even partway to the next
+ * event: the rest of the loop is spaced out at the new tempo from now. It
+ * lasts until a pattern with a tempo of its own starts. See
+ * Sequencer_setPatternBpm.
  *
  * @param bpm The new bpm.
+ * @return SEQ_OK on success, SEQ_EINVAL if bpm is less than SEQ_MIN_BPM or
+ * greater than SEQ_MAX_BPM. The tempo is left as it was.
  */
-void
+int
 Sequencer_setBpm(SequencerBpm bpm);
 
 /**
  * Adjust the sequencer BPM to the current bpm + bpmDelta.
  *
  * @param bpm Offset to add to the current bpm.
- * @return SEQ_OK on success, -1 if the delta would result in a new bpm less
- * than 20 or greater than 300.
+ * @return SEQ_OK on success, SEQ_EINVAL if the delta would result in a new
+ * bpm less than SEQ_MIN_BPM or greater than SEQ_MAX_BPM. The tempo is left
+ * as it was.
  */
 int
 Sequencer_adjustBpm(SequencerBpmDelta bpmDelta);
 
+/**
+ * Get the timing statistics. Safe to call from any thread while the
+ * sequencer plays.
+ *
+ * @param stats Receives the statistics.
+ */
+void
+Sequencer_getStats(Sequencer_Stats* stats);
+
+/**
+ * Print the timing statistics.
+ *
+ * @param out Where to print them.
+ */
+void
+Sequencer_printStats(FILE* out);
+
 /**
  * Stops and destroys the sequencer.
  */
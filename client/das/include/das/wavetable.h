@@ -5,9 +5,29 @@
  */
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 /** Number of samples in the tables. */
 #define WT_N_SAMPLES 255
 
+/** log2 of the number of samples in the band-limited tables. */
+#define WT_TABLE_BITS 11
+/** Number of samples in the band-limited tables. Each table has one more guard
+ * sample that repeats the first so interpolation never has to wrap. */
+#define WT_TABLE_SIZE (1u << WT_TABLE_BITS)
+/** Bits of a phase below the table index. Used for interpolation. */
+#define WT_FRAC_BITS (32 - WT_TABLE_BITS)
+/** Whole periods kept when converting phase offsets, as bits. See
+ * WaveTable_phaseFromCycles. */
+#define WT_OFFSET_HEADROOM_BITS 8
+
+/**
+ * A fixed point phase. One period of a wave is 2^32, so phases wrap for free
+ * when they overflow.
+ */
+typedef uint32_t WaveTable_Phase;
+
 /** Types of waves available. */
 typedef enum
 {
@@ -19,9 +39,85 @@ typedef enum
 /**
  * @brief Sample the table at the given angle.
  *
+ * This samples the original 255 sample tables. New code should prefer the
+ * band-limited tables, see @ref WaveTable_getBandLimited.
+ *
  * @param type The table to sample.
  * @param angle The angle to sample at, between 0 and 1.
  * @return double The sample.
  */
 double
 WaveTable_sample(WaveType type, double angle);
+
+/**
+ * @brief Build the band-limited tables.
+ *
+ * Must be called before @ref WaveTable_getBandLimited. Safe to call more than
+ * once and from more than one thread.
+ *
+ * @return 0 on success, or -ENOMEM if the tables couldn't be built. They are
+ * only built once, so every later call fails the same way.
+ */
+int
+WaveTable_initialize(void);
+
+/**
+ * @brief Get the phase step for a wave at the given frequency.
+ *
+ * @param freq The frequency in Hz.
+ * @param sampleRate The sample rate.
+ * @return WaveTable_Phase How much the phase advances each sample.
+ */
+WaveTable_Phase
+WaveTable_phaseStep(float freq, size_t sampleRate);
+
+/**
+ * @brief Get the table to use for a wave advancing by the given step.
+ *
+ * Saw and square waves have one table per octave, each holding only the
+ * harmonics that fit under Nyquist for the octave, so high notes don't alias.
+ * Sine waves have a single table.
+ *
+ * Saw waves rise from 0 to 1, drop to -1 at half a period, and rise back to
+ * 0. Square waves sit at 1 for the first half of the period and 0 for the
+ * second. Both match the shapes of the original tables.
+ *
+ * @param type The wave.
+ * @param step The phase step the table will be played at.
+ * @return const float* WT_TABLE_SIZE + 1 samples. The sine table if type is
+ * not a valid wave type.
+ */
+const float*
+WaveTable_getBandLimited(WaveType type, WaveTable_Phase step);
+
+/**
+ * @brief Sample a band-limited table at the given phase.
+ *
+ * @param table A table from @ref WaveTable_getBandLimited.
+ * @param phase The phase.
+ * @return float The linearly interpolated sample.
+ */
+static inline float
+WaveTable_lookup(const float* table, WaveTable_Phase phase)
+{
+    uint32_t idx = phase >> WT_FRAC_BITS;
+    float frac = (phase & ((1u << WT_FRAC_BITS) - 1)) *
+                 (1.0f / (1u << WT_FRAC_BITS));
+    return table[idx] + frac * (table[idx + 1] - table[idx]);
+}
+
+/**
+ * @brief Convert a phase offset in periods to a fixed point phase.
+ *
+ * @param cycles The offset. Must be within +-2^(WT_OFFSET_HEADROOM_BITS - 1)
+ * periods.
+ * @return WaveTable_Phase The offset, wrapped to one period.
+ */
+static inline WaveTable_Phase
+WaveTable_phaseFromCycles(float cycles)
+{
+    // Convert with some headroom so offsets of more than half a period still
+    // fit in an int, then shift the whole periods out the top.
+    int32_t offset = cycles * (float)(1u << (32 - WT_OFFSET_HEADROOM_BITS));
+    return (WaveTable_Phase)offset << WT_OFFSET_HEADROOM_BITS;
+}
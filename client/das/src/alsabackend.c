@@ -0,0 +1,487 @@
+/**
+ * @file alsabackend.c
+ * @brief Audio backend that plays through ALSA.
+ */
+#include "das/audiobackend.h"
+#include <alsa/asoundlib.h>
+#include <alsa/pcm.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** How long to wait for room while writing before checking again, in ms. */
+#define WRITE_WAIT_TIMEOUT_MS 200
+
+/** ALSA backend. */
+typedef struct
+{
+    /** Must be first. */
+    AudioBackend backend;
+
+    /** Handle to the PCM device. */
+    snd_pcm_t* pcm;
+    /** Render straight into the driver's ring buffer? */
+    bool useMmap;
+    /** Requested buffer length in microseconds. */
+    unsigned int bufferTimeUs;
+    /** Requested period length in microseconds, or 0 for half the buffer. */
+    unsigned int periodTimeUs;
+    /** PCM hardware buffer size. */
+    snd_pcm_uframes_t bufferSize;
+    /** PCM hardware period size. */
+    snd_pcm_uframes_t periodSize;
+
+    /** A period's worth of samples to render into, when not using mmap. */
+    int16_t* sampleBuffer;
+    /** Where the area from snd_pcm_mmap_begin starts in the ring buffer. */
+    snd_pcm_uframes_t mmapOffset;
+} _AlsaBackend;
+
+static int
+_start(AudioBackend* backend);
+static int
+_wait(AudioBackend* backend, int timeoutMs);
+static long
+_delay(AudioBackend* backend);
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames);
+static int
+_commit(AudioBackend* backend, size_t nFrames);
+static int
+_recover(AudioBackend* backend, int err);
+static void
+_close(AudioBackend* backend);
+
+/** Write frames to the PCM driver, waiting for room as needed. */
+static int
+_writeFrames(_AlsaBackend* alsa, const int16_t* buffer, size_t nFrames);
+/** Configures audio hardware parameters. */
+static int
+_setHwparams(_AlsaBackend* alsa, snd_pcm_hw_params_t* params);
+/** Configures audio driver software parameters. */
+static int
+_setSwparams(_AlsaBackend* alsa, snd_pcm_sw_params_t* swparams);
+/** Configures Alsa for our needs. */
+static int
+_configureAlsa(_AlsaBackend* alsa);
+
+static const AudioBackend_Ops _alsaOps = {
+    .start = _start,
+    .wait = _wait,
+    .delay = _delay,
+    .begin = _begin,
+    .commit = _commit,
+    .recover = _recover,
+    .close = _close,
+};
+
+static int
+_start(AudioBackend* backend)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    return snd_pcm_start(alsa->pcm);
+}
+
+static int
+_wait(AudioBackend* backend, int timeoutMs)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    return snd_pcm_wait(alsa->pcm, timeoutMs);
+}
+
+static long
+_delay(AudioBackend* backend)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    snd_pcm_sframes_t delay;
+    int err = snd_pcm_delay(alsa->pcm, &delay);
+    return err < 0 ? err : delay;
+}
+
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    if (!alsa->useMmap) {
+        *buffer = alsa->sampleBuffer;
+        return nFrames < alsa->periodSize ? nFrames : alsa->periodSize;
+    }
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa->pcm);
+    if (avail < 0) {
+        return avail;
+    }
+    if ((size_t)avail < nFrames) {
+        return 0;
+    }
+
+    // The area may stop short of what we asked for where the ring buffer
+    // wraps, in which case the player comes back for the rest.
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t frames = nFrames;
+    int err = snd_pcm_mmap_begin(alsa->pcm, &areas, &alsa->mmapOffset, &frames);
+    if (err < 0) {
+        return err;
+    }
+    *buffer = (int16_t*)((char*)areas[0].addr + areas[0].first / 8 +
+                         alsa->mmapOffset * areas[0].step / 8);
+    return frames;
+}
+
+static int
+_commit(AudioBackend* backend, size_t nFrames)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    if (!alsa->useMmap) {
+        return _writeFrames(alsa, alsa->sampleBuffer, nFrames);
+    }
+
+    snd_pcm_sframes_t committed =
+      snd_pcm_mmap_commit(alsa->pcm, alsa->mmapOffset, nFrames);
+    if (committed < 0) {
+        return committed;
+    }
+    if ((size_t)committed != nFrames) {
+        return -EPIPE;
+    }
+    return 0;
+}
+
+static int
+_recover(AudioBackend* backend, int err)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    return snd_pcm_recover(alsa->pcm, err, 0);
+}
+
+static void
+_close(AudioBackend* backend)
+{
+    _AlsaBackend* alsa = (_AlsaBackend*)backend;
+    snd_pcm_drain(alsa->pcm);
+    snd_pcm_close(alsa->pcm);
+    free(alsa->sampleBuffer);
+    free(alsa);
+}
+
+static int
+_writeFrames(_AlsaBackend* alsa, const int16_t* buffer, size_t nFrames)
+{
+    long written = 0;
+    long offset = 0;
+    int remain = nFrames;
+    while (remain > 0) {
+        const int16_t* frames = buffer + offset * alsa->backend.channels;
+        if (alsa->useMmap) {
+            written = snd_pcm_mmap_writei(alsa->pcm, frames, remain);
+        } else {
+            written = snd_pcm_writei(alsa->pcm, frames, remain);
+        }
+        // This is non-blocking, so we may get asked to try again once the
+        // driver has made room.
+        if (written == -EAGAIN) {
+            int err = snd_pcm_wait(alsa->pcm, WRITE_WAIT_TIMEOUT_MS);
+            if (err < 0) {
+                return err;
+            }
+            continue;
+        }
+        if (written < 0) {
+            return written;
+        }
+        offset += written;
+        remain -= written;
+    }
+    return 0;
+}
+
+static int
+_setHwparams(_AlsaBackend* alsa, snd_pcm_hw_params_t* params)
+{
+    snd_pcm_t* handle = alsa->pcm;
+    // Implementation adapted from the one given at
+    // https://www.alsa-project.org/alsa-doc/alsa-lib/_2test_2pcm_8c-example.html
+
+    unsigned int rrate;
+    int err;
+
+    /* choose all parameters */
+    err = snd_pcm_hw_params_any(handle, params);
+    if (err < 0) {
+        printf("Broken configuration for playback: no configurations "
+               "available: %s\n",
+               snd_strerror(err));
+        return err;
+    }
+    /* set hardware resampling */
+    err = snd_pcm_hw_params_set_rate_resample(handle, params, 1);
+    if (err < 0) {
+        printf("Resampling setup failed for playback: %s\n", snd_strerror(err));
+        return err;
+    }
+    /* set the interleaved read/write or mmap format */
+    err = snd_pcm_hw_params_set_access(
+      handle,
+      params,
+      alsa->useMmap
+        ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+        : SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (err < 0) {
+        printf("Access type not available for playback: %s\n",
+               snd_strerror(err));
+        return err;
+    }
+    /* set the sample format */
+    err = snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S16_LE);
+    if (err < 0) {
+        printf("Sample format not available for playback: %s\n",
+               snd_strerror(err));
+        return err;
+    }
+    /* set the count of channels */
+    err =
+      snd_pcm_hw_params_set_channels(handle, params, alsa->backend.channels);
+    if (err < 0) {
+        printf("Channels count (%u) not available for playbacks: %s\n",
+               alsa->backend.channels,
+               snd_strerror(err));
+        return err;
+    }
+    /* set the stream rate */
+    unsigned int rate = alsa->backend.sampleRate;
+    rrate = rate;
+    err = snd_pcm_hw_params_set_rate_near(handle, params, &rrate, 0);
+    if (err < 0) {
+        printf("Rate %uHz not available for playback: %s\n",
+               rrate,
+               snd_strerror(err));
+        return err;
+    }
+    if (rrate != rate) {
+        printf("Rate doesn't match (requested %uHz, get %iHz)\n", rate, err);
+        return -EINVAL;
+    }
+    /* Configure the buffer size. */
+    unsigned int buftime = alsa->bufferTimeUs;
+    int dir = 0;
+    err =
+      snd_pcm_hw_params_set_buffer_time_near(handle, params, &buftime, &dir);
+    if (err < 0) {
+        printf(
+          "Unable to set buffer time %u: %s\n", buftime, snd_strerror(err));
+        return err;
+    }
+
+    if ((err = snd_pcm_hw_params_get_buffer_size(params,
+                                                 &alsa->bufferSize)) < 0) {
+        printf("err getting buffer size size: %s\n", snd_strerror(err));
+        return err;
+    } else {
+        printf(
+          "Buffer size is %lu and dir is %d\n", alsa->bufferSize, dir);
+    }
+
+    /* Alsa divides its buffers into "periods", and does stuff when playback
+     * reaches the period boundaries like sending data to the ADC (I think?)
+     * and waking up applications waiting for buffers to become ready. By
+     * default we use 2 periods. Alsa can then do whatever it's gotta with
+     * the data in one period while we're writing to the other. */
+    dir = 0;
+    if (alsa->periodTimeUs > 0) {
+        unsigned int periodTime = alsa->periodTimeUs;
+        printf("Trying to set period time to %u\n", periodTime);
+        err = snd_pcm_hw_params_set_period_time_near(
+          handle, params, &periodTime, &dir);
+        if (err < 0) {
+            printf("Unable to set period time %u: %s\n",
+                   periodTime,
+                   snd_strerror(err));
+            return err;
+        }
+    } else {
+        snd_pcm_uframes_t period = alsa->bufferSize / 2;
+        printf("Trying to set period size to %lu\n", period);
+        err =
+          snd_pcm_hw_params_set_period_size_near(handle, params, &period, &dir);
+        if (err < 0) {
+            printf(
+              "Unable to set period size %lu: %s\n", period, snd_strerror(err));
+            return err;
+        }
+    }
+
+    if ((err = snd_pcm_hw_params_get_period_size(
+           params, &alsa->periodSize, &dir)) < 0) {
+        printf("err getting period size: %s\n", snd_strerror(err));
+        return err;
+    } else {
+        printf(
+          "Period size is %lu and dir is %d\n", alsa->periodSize, dir);
+    }
+
+    /* write the parameters to device */
+    err = snd_pcm_hw_params(handle, params);
+    if (err < 0) {
+        printf("Unable to set hw params for playback: %s\n", snd_strerror(err));
+        return err;
+    }
+    return 0;
+}
+
+static int
+_setSwparams(_AlsaBackend* alsa, snd_pcm_sw_params_t* swparams)
+{
+    snd_pcm_t* handle = alsa->pcm;
+    // Implementation adapted from the one given at
+    // https://www.alsa-project.org/alsa-doc/alsa-lib/_2test_2pcm_8c-example.html
+
+    int err;
+
+    /* get the current swparams */
+    err = snd_pcm_sw_params_current(handle, swparams);
+    if (err < 0) {
+        printf("Unable to determine current swparams for playback: %s\n",
+               snd_strerror(err));
+        return err;
+    }
+    // TODO: this should be much closer to the buffer size
+    if ((err = snd_pcm_sw_params_set_avail_min(
+           handle, swparams, alsa->periodSize)) < 0) {
+        printf("Unable to set avail min: %s\n", snd_strerror(err));
+        return err;
+    }
+
+    /* Threshold to stat playing. Choose one period. */
+    err = snd_pcm_sw_params_set_start_threshold(
+      handle, swparams, alsa->periodSize);
+    if (err < 0) {
+        printf("Unable to set start threshold mode for playback: %s\n",
+               snd_strerror(err));
+        return err;
+    }
+    /* allow the transfer when at least period_size samples can be processed
+     */
+    /* or disable this mechanism when period event is enabled (aka interrupt
+     * like style processing) */
+    err = snd_pcm_sw_params_set_period_event(handle, swparams, 1);
+    if (err < 0) {
+        printf("Unable to set period event: %s\n", snd_strerror(err));
+        return err;
+    }
+
+    /* write the parameters to the playback device */
+    err = snd_pcm_sw_params(handle, swparams);
+    if (err < 0) {
+        printf("Unable to set sw params for playback: %s\n", snd_strerror(err));
+        return err;
+    }
+    snd_pcm_drop(handle);
+    return 0;
+}
+
+static int
+_configureAlsa(_AlsaBackend* alsa)
+{
+    snd_pcm_t* handle = alsa->pcm;
+    snd_pcm_hw_params_t* hwParams;
+    snd_pcm_sw_params_t* swParams;
+    int err;
+    int16_t* silence;
+
+    snd_pcm_hw_params_alloca(&hwParams);
+    snd_pcm_sw_params_alloca(&swParams);
+
+    if ((err = _setHwparams(alsa, hwParams)) < 0) {
+        return err;
+    }
+
+    if ((err = _setSwparams(alsa, swParams)) < 0) {
+        return err;
+    }
+
+    if ((err = snd_pcm_prepare(handle)) < 0) {
+        printf("Prepare error: %s\n", snd_strerror(err));
+        return err;
+    }
+
+    const size_t silenceSamples = alsa->bufferSize * alsa->backend.channels;
+    silence = malloc(sizeof(int16_t) * silenceSamples);
+    if (!silence) {
+        return -ENOMEM;
+    }
+
+    if ((err = snd_pcm_format_set_silence(
+           SND_PCM_FORMAT_S16_LE, silence, silenceSamples)) < 0) {
+        printf("Silence error: %s\n", snd_strerror(err));
+        free(silence);
+        return err;
+    }
+
+    err = _writeFrames(alsa, silence, alsa->bufferSize);
+    free(silence);
+    if (err < 0) {
+        printf("Write error: %s\n", snd_strerror(err));
+        return err;
+    }
+    // TODO pretty sure this just lets alsa write errors to stdout?
+    snd_output_t* output;
+    err = snd_output_stdio_attach(&output, stdout, 0);
+    if (err < 0) {
+        printf("Output failed: %s\n", snd_strerror(err));
+        return err;
+    }
+    return 0;
+}
+
+int
+AudioBackend_openAlsa(AudioBackend** backend,
+                      bool useMmap,
+                      unsigned int sampleRate,
+                      unsigned int channels,
+                      unsigned int bufferTimeUs,
+                      unsigned int periodTimeUs)
+{
+    _AlsaBackend* alsa = calloc(1, sizeof(_AlsaBackend));
+    if (!alsa) {
+        return -ENOMEM;
+    }
+    alsa->backend.ops = &_alsaOps;
+    alsa->backend.sampleRate = sampleRate;
+    alsa->backend.channels = channels;
+    alsa->backend.realtime = true;
+    alsa->useMmap = useMmap;
+    alsa->bufferTimeUs = bufferTimeUs;
+    alsa->periodTimeUs = periodTimeUs;
+
+    // open PCM in non-blocking mode.
+    int err = snd_pcm_open(
+      &alsa->pcm, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (err < 0) {
+        free(alsa);
+        return err;
+    }
+    // TODO: need to config-pin the i2c pins so we have audio out.
+
+    if ((err = _configureAlsa(alsa)) < 0) {
+        snd_pcm_close(alsa->pcm);
+        free(alsa);
+        return err;
+    }
+    alsa->backend.bufferSize = alsa->bufferSize;
+    alsa->backend.periodSize = alsa->periodSize;
+
+    // Buffer a single period at a time. With mmap access we render straight
+    // into the driver's buffer instead.
+    if (!useMmap) {
+        alsa->sampleBuffer =
+          malloc(alsa->periodSize * channels * sizeof(int16_t));
+        if (!alsa->sampleBuffer) {
+            snd_pcm_close(alsa->pcm);
+            free(alsa);
+            return -ENOMEM;
+        }
+    }
+
+    *backend = &alsa->backend;
+    return 0;
+}
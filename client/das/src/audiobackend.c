@@ -0,0 +1,67 @@
+/**
+ * @file audiobackend.c
+ * @brief Dispatch for the audio backends.
+ */
+#include "das/audiobackend.h"
+#include <errno.h>
+
+#ifndef DAS_WITH_ALSA
+int
+AudioBackend_openAlsa(AudioBackend** backend,
+                      bool useMmap,
+                      unsigned int sampleRate,
+                      unsigned int channels,
+                      unsigned int bufferTimeUs,
+                      unsigned int periodTimeUs)
+{
+    (void)backend;
+    (void)useMmap;
+    (void)sampleRate;
+    (void)channels;
+    (void)bufferTimeUs;
+    (void)periodTimeUs;
+    return -ENOSYS;
+}
+#endif
+
+int
+AudioBackend_start(AudioBackend* backend)
+{
+    return backend->ops->start(backend);
+}
+
+int
+AudioBackend_wait(AudioBackend* backend, int timeoutMs)
+{
+    return backend->ops->wait(backend, timeoutMs);
+}
+
+long
+AudioBackend_delay(AudioBackend* backend)
+{
+    return backend->ops->delay(backend);
+}
+
+long
+AudioBackend_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames)
+{
+    return backend->ops->begin(backend, buffer, nFrames);
+}
+
+int
+AudioBackend_commit(AudioBackend* backend, size_t nFrames)
+{
+    return backend->ops->commit(backend, nFrames);
+}
+
+int
+AudioBackend_recover(AudioBackend* backend, int err)
+{
+    return backend->ops->recover(backend, err);
+}
+
+void
+AudioBackend_close(AudioBackend* backend)
+{
+    backend->ops->close(backend);
+}
@@ -21,6 +21,10 @@ _isTriggered(const Env_Envelope* env);
 static bool
 _isGated(const Env_Envelope* env);
 
+/** Sample the envelope's function at x. */
+static float
+_sample(Env_Envelope* env, float x);
+
 static bool
 _isTriggered(const Env_Envelope* env)
 {
@@ -33,14 +37,35 @@ _isGated(const Env_Envelope* env)
     return (env->state & ENV_GATE_BIT) == ENV_GATE_BIT;
 }
 
+static float
+_sample(Env_Envelope* env, float x)
+{
+    env->segment = Pwl_findSegment(&env->segments, x, env->segment);
+    return Pwl_sampleSegment(&env->segments, env->segment, x);
+}
+
 void
 Env_prepareEnvelope(Env_Envelope* env, size_t sampleRate)
 {
-    float samplesPerMs = sampleRate * 0.001;
-    float samplesPerEnv = env->lengthMs * samplesPerMs;
-    env->step = 1.0 / samplesPerEnv;
+    double samplesPerMs = sampleRate * 0.001;
+    double samplesPerEnv = env->lengthMs * samplesPerMs;
+    env->step = ENV_CONTROL_PERIOD / samplesPerEnv;
     env->current = 0;
     env->state = 0;
+    Pwl_compile(&env->fn, &env->segments);
+    env->segment = 0;
+}
+
+void
+Env_setShape(Env_Envelope* env, const Env_Envelope* shape)
+{
+    env->step = shape->step;
+    env->gatePoint = shape->gatePoint;
+    env->repeatPoint = shape->repeatPoint;
+    env->lengthMs = shape->lengthMs;
+    env->fn = shape->fn;
+    env->segments = shape->segments;
+    env->segment = Pwl_findSegment(&env->segments, env->current, 0);
 }
 
 float
@@ -51,7 +76,7 @@ Env_getValueAndAdvance(Env_Envelope* env)
         float x = env->current;
         float min = env->min;
 
-        value = Pwl_sample(&env->fn, x);
+        value = _sample(env, x);
         if (value < min) {
             value = min;
         } else {
@@ -83,7 +108,7 @@ void
 Env_trigger(Env_Envelope* env)
 {
     if (_isTriggered(env)) {
-        env->min = Pwl_sample(&env->fn, env->current);
+        env->min = _sample(env, env->current);
     }
     env->current = 0;
     env->state = ENV_TRIGGER_BIT;
@@ -94,3 +119,9 @@ Env_gate(Env_Envelope* env)
 {
     env->state |= ENV_GATE_BIT;
 }
+
+bool
+Env_isActive(const Env_Envelope* env)
+{
+    return _isTriggered(env);
+}
@@ -0,0 +1,178 @@
+/**
+ * @file eventqueue.c
+ * @brief Implementation of the event queue.
+ *
+ * This is the bounded queue described by Dmitry Vyukov. Every slot carries a
+ * sequence number that says whose turn it is: a producer may fill slot i when
+ * its sequence is the push position, and the consumer may empty it when its
+ * sequence is one past the pop position. Producers race for positions with
+ * a compare and swap; the single consumer doesn't need to.
+ */
+#include "das/eventqueue.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Size of a cache line. Keeps the producer and consumer positions apart. */
+#define EVENTQUEUE_CACHE_LINE 64
+
+struct EventQueue
+{
+    /** Next position to push to. Shared by producers. */
+    atomic_size_t head;
+    char headPad[EVENTQUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+    /** Next position to pop from. Owned by the consumer. */
+    atomic_size_t tail;
+    char tailPad[EVENTQUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+
+    /** Most events seen waiting at once. */
+    atomic_size_t highWater;
+    /** Failed pushes. */
+    atomic_ulong overflows;
+
+    /** capacity - 1. Capacity is a power of two. */
+    size_t mask;
+    /** Bytes per event. */
+    size_t eventSize;
+    /** Sequence number of each slot. */
+    atomic_size_t* seqs;
+    /** Event storage. */
+    unsigned char* events;
+};
+
+/** Raise the high water mark to at least used. */
+static void
+_updateHighWater(EventQueue* queue, size_t used);
+
+static void
+_updateHighWater(EventQueue* queue, size_t used)
+{
+    size_t seen = atomic_load_explicit(&queue->highWater, memory_order_relaxed);
+    while (used > seen &&
+           !atomic_compare_exchange_weak_explicit(&queue->highWater,
+                                                  &seen,
+                                                  used,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+EventQueue*
+EventQueue_create(size_t capacity, size_t eventSize)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    EventQueue* queue = malloc(sizeof(EventQueue));
+    if (!queue) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(EventQueue));
+
+    queue->mask = size - 1;
+    queue->eventSize = eventSize;
+    queue->seqs = malloc(size * sizeof(atomic_size_t));
+    queue->events = malloc(size * eventSize);
+    if (!queue->seqs || !queue->events) {
+        EventQueue_destroy(queue);
+        return NULL;
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->highWater, 0);
+    atomic_init(&queue->overflows, 0);
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->seqs[i], i);
+    }
+    return queue;
+}
+
+void
+EventQueue_destroy(EventQueue* queue)
+{
+    if (queue) {
+        free(queue->seqs);
+        free(queue->events);
+        free(queue);
+    }
+}
+
+bool
+EventQueue_push(EventQueue* queue, const void* event)
+{
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;) {
+        size_t seq = atomic_load_explicit(&queue->seqs[pos & queue->mask],
+                                          memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // The slot is free. Try to claim it.
+            if (atomic_compare_exchange_weak_explicit(&queue->head,
+                                                      &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer hasn't emptied the slot from a lap ago: full.
+            atomic_fetch_add_explicit(
+              &queue->overflows, 1, memory_order_relaxed);
+            return false;
+        } else {
+            // Another producer got here first.
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(queue->events + (pos & queue->mask) * queue->eventSize,
+           event,
+           queue->eventSize);
+    atomic_store_explicit(
+      &queue->seqs[pos & queue->mask], pos + 1, memory_order_release);
+
+    // The consumer may have popped this event, and ones pushed after it,
+    // since it was published, leaving the tail ahead of it.
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    intptr_t used = (intptr_t)(pos + 1 - tail);
+    if (used > 0) {
+        _updateHighWater(queue, used);
+    }
+    return true;
+}
+
+bool
+EventQueue_pop(EventQueue* queue, void* event)
+{
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t seq = atomic_load_explicit(&queue->seqs[pos & queue->mask],
+                                      memory_order_acquire);
+    if (seq != pos + 1) {
+        return false;
+    }
+
+    memcpy(event,
+           queue->events + (pos & queue->mask) * queue->eventSize,
+           queue->eventSize);
+    // Hand the slot back to producers for the next lap.
+    atomic_store_explicit(&queue->seqs[pos & queue->mask],
+                          pos + queue->mask + 1,
+                          memory_order_release);
+    atomic_store_explicit(&queue->tail, pos + 1, memory_order_relaxed);
+    return true;
+}
+
+void
+EventQueue_getStats(EventQueue* queue, EventQueue_Stats* stats)
+{
+    stats->capacity = queue->mask + 1;
+    stats->highWater =
+      atomic_load_explicit(&queue->highWater, memory_order_relaxed);
+    stats->overflows =
+      atomic_load_explicit(&queue->overflows, memory_order_relaxed);
+}
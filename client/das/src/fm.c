@@ -9,359 +9,2000 @@
  */
 #include "das/fm.h"
 #include "das/envelope.h"
+#include "das/notecache.h"
 #include "das/wavetable.h"
 
 #include <malloc.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /** Twelth root of two. Used for computing note frequencies. */
 #define TWELVETH_ROOT_OF_TWO 1.059463094359
 /** Default sample rate. */
 #define SAMPLE_RATE 44100
-/** How many times per second to update the ADSR. */
-#define ADSR_UPDATES_PER_SEC 64
 
-/** The FM synthesizer.*/
+/** Level the limiter keeps the mix under. Just under full scale, so dither
+ * can't push a limited sample over. */
+#define FM_LIMITER_CEILING 0.99f
+/** How long the limiter takes to come back up after turning the mix down. */
+#define FM_LIMITER_RELEASE_MS 50
+/** Seed for the dither noise, so dithered renders are repeatable too. */
+#define FM_DITHER_SEED 0x2545f491u
+/** Most control periods a voice switch waits for a zero crossing or a note
+ * boundary before it is made anyway. About 45 ms at 44.1 kHz. */
+#define FM_VOICE_MAX_DEFER 32
+/** How long a baked note fades out when another note takes over its voice,
+ * in samples. */
+#define FM_NOTE_CACHE_FADE 64
+
+/** Number of floats processed together by the vectorized kernels. */
+#define FM_LANE_WIDTH 4
+
+/** Mask with a bit set for every lane. */
+#define FM_ALL_LANES ((1u << FM_LANE_WIDTH) - 1)
+
+#if (FM_MAX_VOICES % FM_LANE_WIDTH) != 0
+#error "FM_MAX_VOICES must be a multiple of FM_LANE_WIDTH"
+#endif
+
+/** Forces the specialized kernels to be built from the generic kernel bodies.
+ */
+#define FM_ALWAYS_INLINE inline __attribute__((always_inline))
+
+/** Bit in a connection mask that is set if modOp modulates op. */
+#define FM_CONN_BIT(op, modOp) (1u << ((op) * FM_OPERATORS + (modOp)))
+/** Mask with a bit set for every operator. */
+#define FM_ALL_OPS ((1u << FM_OPERATORS) - 1)
+/** Mask with a bit set for every connection. */
+#define FM_ALL_CONNS ((uint32_t)((1ull << (FM_OPERATORS * FM_OPERATORS)) - 1))
+
+/**
+ * Operator topologies of the presets in fm.h. Kernels specialized to each of
+ * these are generated at compile time; any other topology falls back to the
+ * generic kernel.
+ *
+ * X(name, connection mask, output mask, live mask)
+ *
+ * The live mask is every operator that is heard, either directly or by
+ * modulating an operator that is.
+ */
+#define FM_KNOWN_TOPOLOGIES(X)                                                 \
+    X(default, 0x0002, 0x1, 0x3)                                               \
+    X(piano, 0x028e, 0x5, 0xf)                                                 \
+    X(sawblade, 0x4042, 0xf, 0xf)                                              \
+    X(bell, 0x8802, 0x5, 0xf)                                                  \
+    X(cry, 0x80c2, 0x1, 0xf)                                                   \
+    X(ahh, 0x0888, 0x7, 0xf)                                                   \
+    X(bass, 0x4048, 0x3, 0xf)                                                  \
+    X(brass, 0x2046, 0x9, 0xf)                                                 \
+    X(yoi, 0x004a, 0x3, 0xf)                                                   \
+    X(big, 0x04c8, 0x3, 0xf)                                                   \
+    X(boop, 0x080a, 0x5, 0xf)                                                  \
+    X(chirp, 0x0102, 0x7, 0x7)
+
+/** A vector of FM_LANE_WIDTH floats. */
+#if defined(__ARM_NEON)
+typedef float32x4_t FmLane;
+#elif defined(__SSE2__)
+typedef __m128 FmLane;
+#else
+typedef struct
+{
+    float v[FM_LANE_WIDTH];
+} FmLane;
+#endif
+
+/** A vector of FM_LANE_WIDTH phases. */
+#if defined(__ARM_NEON)
+typedef uint32x4_t FmPhaseLane;
+#elif defined(__SSE2__)
+typedef __m128i FmPhaseLane;
+#else
 typedef struct
+{
+    WaveTable_Phase v[FM_LANE_WIDTH];
+} FmPhaseLane;
+#endif
+
+struct _FmSynth;
+
+/** A render kernel. Kernels are never asked to render past the next envelope
+ * control point, so envelope ramps are constant for the whole call. */
+typedef void (*_FmRenderFn)(struct _FmSynth* synth,
+                            float* bus,
+                            size_t nSamples);
+
+/** Which operators are connected, and the kernels that render them. */
+typedef struct
+{
+    /** Connection mask. See FM_CONN_BIT. */
+    uint32_t connMask;
+    /** Bit op is set if the operator is mixed into the output. */
+    uint32_t outMask;
+    /** Bit op is set if the operator is heard. See FM_KNOWN_TOPOLOGIES. */
+    uint32_t liveMask;
+    /** Single voice kernel for the topology. */
+    _FmRenderFn renderMono;
+    /** Many voice kernel for the topology. */
+    _FmRenderFn renderPoly;
+} _FmTopology;
+
+/**
+ * A voice compiled from FmSynthParams.
+ *
+ * Holds everything about the params that doesn't depend on the note being
+ * played, worked out ahead of time, so switching to it only copies.
+ */
+struct _FmVoice
+{
+    /** The params the voice was compiled from. */
+    FmSynthParams params;
+    /** As in _FmSynth. */
+    float opModCoef[FM_OPERATORS][FM_OPERATORS];
+    float opOutput[FM_OPERATORS];
+    WaveType opWave[FM_OPERATORS];
+    float opCM[FM_OPERATORS];
+    Note opFixTo[FM_OPERATORS];
+    float opFixedFreq[FM_OPERATORS];
+    _FmTopology topology;
+    /** Operator envelopes, prepared and idle. */
+    Env_Envelope opAdsr[FM_OPERATORS];
+};
+
+/** The FM synthesizer.
+ *
+ * Per-voice operator state is stored as structure-of-arrays indexed by
+ * [operator][voice] so that the render loop can sweep every voice of one
+ * operator in a single pass. */
+typedef struct _FmSynth
 {
     // start with critical section data to ensure alignment
     /** Current operator envelope values. */
-    float opEnvelope[FM_OPERATORS];
-    /** Current operator sampling angles. */
-    float opAngle[FM_OPERATORS];
-    /** Current operator angle update step. */
-    float opStep[FM_OPERATORS];
-    /** Operator modulation matrix. */
-    float opModBy[FM_OPERATORS * FM_OPERATORS];
+    float opEnvelope[FM_OPERATORS][FM_MAX_VOICES];
+    /** How much the envelope values move each sample to ramp to the next
+     * control point. */
+    float opEnvelopeStep[FM_OPERATORS][FM_MAX_VOICES];
+    /** Current operator phases. */
+    WaveTable_Phase opPhase[FM_OPERATORS][FM_MAX_VOICES];
+    /** Current operator phase update step. */
+    WaveTable_Phase opStep[FM_OPERATORS][FM_MAX_VOICES];
+    /** Band-limited table each operator samples, picked for its frequency. */
+    const float* opTable[FM_OPERATORS][FM_MAX_VOICES];
+    /**
+     * Modulation matrix scaled so that operator samples give the phase
+     * offset in periods, indexed [op][modOp].
+     *
+     * The modulation an operator receives each sample is
+     * (modBy / modFreq) * (modSample * modStep), and since modStep is
+     * modFreq / sampleRate this is just modBy * modSample / sampleRate. It
+     * only changes with the params, never with the note.
+     */
+    float opModCoef[FM_OPERATORS][FM_OPERATORS];
     /** Operator output strength. */
     float opOutput[FM_OPERATORS];
-
-    float opFreq[FM_OPERATORS];
     /** Operator wave type. */
     WaveType opWave[FM_OPERATORS];
 
     // Everything else is configuration and control
     /** Synthesizer sample rate. */
     size_t sampleRate;
+    /** How many voices are in use. */
+    size_t nVoices;
+    /** Gain applied to the mix so that every voice at full volume does not
+     * clip. */
+    float voiceGain;
+    /** Gain the limiter applied at the end of the last block. */
+    float limiterGain;
+    /** How far limiterGain moves back towards 1 each control period. */
+    float limiterRelease;
+    /** Is the output dithered? */
+    bool dither;
+    /** State of the dither noise generator. */
+    uint32_t ditherState;
+    /** Mix samples past full scale. See FmMixStats. */
+    atomic_ulong mixClipped;
+    /** Blocks the limiter turned down. See FmMixStats. */
+    atomic_ulong mixLimited;
 
-    /** The note we are playing. */
-    Note note;
-    /** The base frequency. */
-    float baseFreq;
+    /** The note each voice is playing. */
+    Note voiceNote[FM_MAX_VOICES];
+    /** The base frequency of each voice. */
+    float voiceBaseFreq[FM_MAX_VOICES];
+    /** Is the voice held, i.e. triggered and not yet gated? */
+    bool voiceHeld[FM_MAX_VOICES];
+    /** When the voice was last triggered. Larger is newer. */
+    unsigned long voiceAge[FM_MAX_VOICES];
+    /** Counter used to stamp voice ages. */
+    unsigned long voiceClock;
 
     /** CM ratio of the operators. */
     float opCM[FM_OPERATORS];
+    /** Note that fixed operators are fixed to. */
+    Note opFixTo[FM_OPERATORS];
+    /** Frequency of opFixTo, for fixed operators. */
+    float opFixedFreq[FM_OPERATORS];
 
     /** Operator ADSRs. */
-    Env_Envelope opAdsr[FM_OPERATORS];
+    Env_Envelope opAdsr[FM_OPERATORS][FM_MAX_VOICES];
+    /** The envelope control point each operator is ramping to. */
+    float opEnvelopeTarget[FM_OPERATORS][FM_MAX_VOICES];
+    /** Samples left until the envelopes reach their targets. Carries over
+     * between calls so the control rate doesn't depend on buffer size. */
+    size_t controlCountdown;
+
+    /** Which kernel to render with. */
+    FmKernel kernel;
+    /** Topology of the current params. */
+    _FmTopology topology;
+
+    /** Voice waiting to be switched to. See Fm_setVoice. */
+    _Atomic(const struct _FmVoice*) pendingVoice;
+    /** Control periods the pending voice has waited. */
+    unsigned int voiceDeferred;
+    /** Did the last block rendered end on a zero crossing? */
+    bool atZeroCrossing;
+    /** Was every voice silent at the last control point? Nothing can sound
+     * before the next one, so until then rendering is skipped. */
+    bool idle;
+    /** The voice compiled by Fm_updateParams. */
+    struct _FmVoice ownVoice;
+
+    /** Params of the voice in use, or NULL once its operators have been
+     * changed. */
+    const FmSynthParams* voiceParams;
+    /** Note caches given to the synth. See Fm_addNoteCache. */
+    const NoteCache* noteCaches[FM_MAX_NOTE_CACHES];
+    /** How many note caches there are. */
+    size_t nNoteCaches;
+    /** The cache baked from the voice in use, or NULL if there isn't one. */
+    const NoteCache* noteCache;
+    /** The baked notes each voice is playing. */
+    NoteCache_Playhead voiceBaked[FM_MAX_VOICES];
 
 } _FmSynth;
 
-/** Calculate the step value for the given frequency given the sample rate.*/
-inline static float
-_calcStep(float freq, size_t sampleRate);
-/** Update the operator frequency. for the current note. */
+/** Load FM_LANE_WIDTH floats. */
+static inline FmLane
+_laneLoad(const float* src);
+/** Store FM_LANE_WIDTH floats. */
+static inline void
+_laneStore(float* dst, FmLane x);
+/** Broadcast a float to every lane. */
+static inline FmLane
+_laneSet(float x);
+/** a + b */
+static inline FmLane
+_laneAdd(FmLane a, FmLane b);
+/** a * b */
+static inline FmLane
+_laneMul(FmLane a, FmLane b);
+/** acc + (a * b) */
+static inline FmLane
+_laneMulAdd(FmLane acc, FmLane a, FmLane b);
+/** Sum of every lane. */
+static inline float
+_laneSum(FmLane x);
+/** Larger of a and b in each lane. */
+static inline FmLane
+_laneMax(FmLane a, FmLane b);
+/** |x| */
+static inline FmLane
+_laneAbs(FmLane x);
+/** Largest of the lanes. */
+static inline float
+_laneMaxAcross(FmLane x);
+/** Convert samples in [-1, 1] to 16 bits, saturating anything outside. */
+static inline void
+_laneToPcm(int16_t* dst, FmLane x);
+/** Load FM_LANE_WIDTH phases. */
+static inline FmPhaseLane
+_phaseLoad(const WaveTable_Phase* src);
+/** Store FM_LANE_WIDTH phases. */
+static inline void
+_phaseStore(WaveTable_Phase* dst, FmPhaseLane x);
+/** a + b, wrapping. */
+static inline FmPhaseLane
+_phaseAdd(FmPhaseLane a, FmPhaseLane b);
+/**
+ * Convert offsets in periods to phases, exactly like
+ * WaveTable_phaseFromCycles. Modulation never comes close to the limit of 128
+ * periods a sample.
+ */
+static inline FmPhaseLane
+_phaseFromCycles(FmLane cycles);
+/** The interpolation fraction of each phase, in [0, 1). */
+static inline FmLane
+_phaseFrac(FmPhaseLane phase);
+/**
+ * Sample one band-limited table per lane at the given phases. Lanes that
+ * aren't set in mask are not looked up and come back as 0.
+ */
+static inline FmLane
+_laneWaveSample(const float* const tables[FM_LANE_WIDTH],
+                FmPhaseLane phase,
+                uint32_t mask);
+
+/** Scalar kernel. */
+static void
+_generateScalar(_FmSynth* synth, float* bus, size_t nSamples);
+/**
+ * Vectorized kernel for a single voice. Lanes hold operators.
+ *
+ * Operators outside of live are never computed. If skipSilent is set,
+ * operators whose envelopes are at 0 are not sampled. Called with constant
+ * masks this is specialized into a kernel for one topology.
+ */
+static FM_ALWAYS_INLINE void
+_renderOperatorLanes(_FmSynth* synth,
+                     float* bus,
+                     size_t nSamples,
+                     const uint32_t conn,
+                     const uint32_t live,
+                     const bool skipSilent);
+/**
+ * Vectorized kernel for many voices. Lanes hold voices. Masks are as in @ref
+ * _renderOperatorLanes.
+ */
+static FM_ALWAYS_INLINE void
+_renderVoiceLanes(_FmSynth* synth,
+                  float* bus,
+                  size_t nSamples,
+                  const uint32_t conn,
+                  const uint32_t out,
+                  const uint32_t live,
+                  const bool skipSilent);
+/** Vectorized single voice kernel that computes every operator. */
+static void
+_generateOperatorLanes(_FmSynth* synth, float* bus, size_t nSamples);
+/** Vectorized many voice kernel that computes every operator. */
+static void
+_generateVoiceLanes(_FmSynth* synth, float* bus, size_t nSamples);
+/** Single voice kernel for the topology in the synth's masks. */
+static void
+_generateOperatorLanesGeneric(_FmSynth* synth, float* bus, size_t nSamples);
+/** Many voice kernel for the topology in the synth's masks. */
+static void
+_generateVoiceLanesGeneric(_FmSynth* synth, float* bus, size_t nSamples);
+/** Bit op is set if any of the voices in the lane group starting at
+ * firstVoice has a non-zero or ramping envelope. */
+static inline uint32_t
+_soundingMask(const _FmSynth* synth, size_t firstVoice);
+/** Work out the topology of the given connections and pick kernels for it.
+ */
+static void
+_findTopology(const float opOutput[FM_OPERATORS],
+              float (*const opModCoef)[FM_OPERATORS],
+              _FmTopology* topology);
+/** Compile params into a voice. */
+static void
+_compileVoice(struct _FmVoice* voice, const FmSynthParams* params);
+/**
+ * Switch the synth to a voice.
+ *
+ * With reset, every voice is silenced and starts over, as if the synth was
+ * new. Otherwise phases and envelope positions carry on, so sounding notes
+ * keep going with the new voice.
+ */
+static void
+_applyVoice(_FmSynth* synth, const struct _FmVoice* voice, bool reset);
+/**
+ * Switch to the pending voice, if there is one and now is a good time: at a
+ * note boundary, when nothing is sounding, at a zero crossing, or when it
+ * has waited too long. With now set it is switched to regardless. Returns
+ * whether the voice was switched.
+ */
+static bool
+_takePendingVoice(_FmSynth* synth, bool now);
+/** Pick the render kernel for the synth's kernel choice and topology. */
+static _FmRenderFn
+_selectRender(const _FmSynth* synth);
+/** Convert a sample in [-1, 1] to 16 bits, saturating anything outside. */
+static inline int16_t
+_toPcm(float sample);
+/** Next value of the dither noise generator. */
+static inline uint32_t
+_ditherNext(_FmSynth* synth);
+/** Triangular dither noise spanning one 16-bit step either side of 0. */
+static inline float
+_tpdf(_FmSynth* synth);
+/**
+ * Limit a block of the mix and convert it to 16 bits.
+ *
+ * The limiter looks at the peak of the block. If it is over the ceiling, the
+ * gain drops at once to bring it under; otherwise the gain ramps back towards
+ * 1 over the block. There is no look-ahead, so it adds no latency.
+ */
+static void
+_mixToPcm(_FmSynth* synth, const float* bus, int16_t* out, size_t n);
+
+/** Update the operator frequency of a voice for its current note. */
 inline static void
-_updateOperatorFreq(_FmSynth* synth, FmOperator op);
-/** Update all operator frequencies. */
+_updateOperatorFreq(_FmSynth* synth, FmOperator op, int voice);
+/** Update all operator frequencies of a voice. */
 inline static void
-_updateAllOperatorFreq(_FmSynth* synth);
+_updateAllOperatorFreq(_FmSynth* synth, int voice);
 
-/** Apply the paramters to the synthesizer.*/
-static void
-_configure(_FmSynth* synth, const FmSynthParams* params, bool initialize);
 /** Set params for one operator */
 static void
 _setOpParams(_FmSynth* synth, FmOperator op, const OperatorParams* params);
 /** Allocate a new _FmSynth. */
 static _FmSynth*
 _fmSynthAlloc(void);
-/** Set the playing note. */
+/** Wrap a _FmSynth configured with the given params in a handle. */
+static FmSynthesizer*
+_createSynthesizer(const FmSynthParams* params, size_t nVoices);
+/** Set the note a voice is playing. */
 static void
-_setNote(_FmSynth* synth, int note);
+_setNote(_FmSynth* synth, int voice, int note);
 /** Set an operator's CM value.*/
 static void
 _setOperatorCM(_FmSynth* synth, FmOperator op, float ratio, Note fixTo);
-/** Trigger all operator's ADSR's. */
+/** Trigger all of a voice's operator ADSR's. */
 static void
-_noteOn(_FmSynth* synth);
-/** Gate all operator's ADSR's. */
+_noteOn(_FmSynth* synth, int voice);
+/** Gate all of a voice's operator ADSR's. */
 static void
-_noteOff(_FmSynth* synth);
+_noteOff(_FmSynth* synth, int voice);
+/** Is any of the voice's envelopes still running? */
+static bool
+_voiceIsActive(const _FmSynth* synth, int voice);
+/** Is every voice silent, and going to stay that way until a note on? */
+static bool
+_isIdle(const _FmSynth* synth);
+/** Is a baked note playing on any voice? */
+static bool
+_isBakedPlaying(const _FmSynth* synth);
+/** Find the note cache baked from the voice in use. */
+static const NoteCache*
+_findNoteCache(const _FmSynth* synth);
+/** Hand a voice playing a baked note over to the operators, picking up at the
+ * same point in the envelopes. */
+static void
+_unbake(_FmSynth* synth, int voice);
+/** How loud the voice currently is. */
+static float
+_voiceLevel(const _FmSynth* synth, int voice);
+/** Pick a voice to play the given note on, stealing one if needed. */
+static int
+_allocateVoice(_FmSynth* synth, Note note);
+
+#if defined(__ARM_NEON)
 
-inline static float
-_calcStep(float freq, size_t sample_rate)
+static inline FmLane
+_laneLoad(const float* src)
 {
-    return (freq / sample_rate);
+    return vld1q_f32(src);
 }
 
-inline static void
-_updateOperatorFreq(_FmSynth* synth, FmOperator op)
+static inline void
+_laneStore(float* dst, FmLane x)
 {
-    if (synth->opCM[op] > 0) {
-        float opFreq = synth->baseFreq * synth->opCM[op];
-        synth->opStep[op] = _calcStep(opFreq, synth->sampleRate);
-        synth->opFreq[op] = opFreq;
-    }
+    vst1q_f32(dst, x);
 }
 
-inline static void
-_updateAllOperatorFreq(_FmSynth* synth)
+static inline FmLane
+_laneSet(float x)
 {
-    for (int op = 0; op < FM_OPERATORS; op++) {
-        _updateOperatorFreq(synth, op);
-    }
+    return vdupq_n_f32(x);
 }
 
-static _FmSynth*
-_fmSynthAlloc(void)
+static inline FmLane
+_laneAdd(FmLane a, FmLane b)
 {
-    _FmSynth* synth = malloc(sizeof(_FmSynth));
-    if (synth) {
-        memset(synth, 0, sizeof(_FmSynth));
-    }
-    return synth;
+    return vaddq_f32(a, b);
 }
 
-// TODO: property setting suuuuuucks here.
-// This function should only really be used if we're changing voices.
-// We need a different approach for tweaking params on the fly.
-static void
-_configure(_FmSynth* synth, const FmSynthParams* params, bool initialize)
+static inline FmLane
+_laneMul(FmLane a, FmLane b)
 {
-    if (NULL != synth) {
-        if (initialize) {
-            synth->sampleRate = params->sampleRate;
-        }
+    return vmulq_f32(a, b);
+}
 
-        for (int op = 0; op < FM_OPERATORS; op++) {
-            const OperatorParams* opParams = &params->opParams[op];
+static inline FmLane
+_laneMulAdd(FmLane acc, FmLane a, FmLane b)
+{
+    return vmlaq_f32(acc, a, b);
+}
 
-            _setOpParams(synth, op, opParams);
+static inline float
+_laneSum(FmLane x)
+{
+    float32x2_t sum = vadd_f32(vget_low_f32(x), vget_high_f32(x));
+    sum = vpadd_f32(sum, sum);
+    return vget_lane_f32(sum, 0);
+}
 
-            // TODO: this sucks
-            memcpy(&synth->opAdsr[op],
-                   &params->opEnvelopes[op],
-                   sizeof(Env_Envelope));
+static inline FmLane
+_laneMax(FmLane a, FmLane b)
+{
+    return vmaxq_f32(a, b);
+}
 
-            Env_prepareEnvelope(&synth->opAdsr[op],
-                                synth->sampleRate / ADSR_UPDATES_PER_SEC);
+static inline FmLane
+_laneAbs(FmLane x)
+{
+    return vabsq_f32(x);
+}
 
-            synth->opAngle[op] = 0;
-            synth->opEnvelope[op] = 0;
-        }
-    }
+static inline float
+_laneMaxAcross(FmLane x)
+{
+    float32x2_t max = vpmax_f32(vget_low_f32(x), vget_high_f32(x));
+    max = vpmax_f32(max, max);
+    return vget_lane_f32(max, 0);
 }
 
-static void
-_setOpParams(_FmSynth* synth, FmOperator op, const OperatorParams* params)
+static inline void
+_laneToPcm(int16_t* dst, FmLane x)
 {
-    synth->opWave[op] = params->waveType;
-    synth->opOutput[op] = params->outputStrength;
+    // Both the conversion and the narrowing saturate.
+    int32x4_t pcm = vcvtq_s32_f32(vmulq_f32(x, vdupq_n_f32(INT16_MAX)));
+    vst1_s16(dst, vqmovn_s32(pcm));
+}
 
-    _setOperatorCM(synth, op, params->CmRatio, params->fixToNote);
+static inline FmPhaseLane
+_phaseLoad(const WaveTable_Phase* src)
+{
+    return vld1q_u32(src);
+}
 
-    int modByIdx = op * FM_OPERATORS;
-    for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
-        synth->opModBy[modByIdx + modOp] = params->algorithmConnections[modOp];
-    }
+static inline void
+_phaseStore(WaveTable_Phase* dst, FmPhaseLane x)
+{
+    vst1q_u32(dst, x);
 }
 
-void
-Fm_updateOpParams(FmSynthesizer* s, FmOperator op, const OperatorParams* params)
+static inline FmPhaseLane
+_phaseAdd(FmPhaseLane a, FmPhaseLane b)
 {
-    _FmSynth* synth = s->__FmSynth;
-    _setOpParams(synth, op, params);
+    return vaddq_u32(a, b);
 }
 
-void
-Fm_setNote(FmSynthesizer* s, Note note)
+static inline FmPhaseLane
+_phaseFromCycles(FmLane cycles)
 {
-    _FmSynth* synth = s->__FmSynth;
-    _setNote(synth, note);
+    int32x4_t offset = vcvtq_s32_f32(
+      vmulq_f32(cycles, vdupq_n_f32(1u << (32 - WT_OFFSET_HEADROOM_BITS))));
+    return vshlq_n_u32(vreinterpretq_u32_s32(offset), WT_OFFSET_HEADROOM_BITS);
 }
 
-static void
-_setNote(_FmSynth* synth, int note) // note is an int to force signness
+static inline FmLane
+_phaseFrac(FmPhaseLane phase)
 {
-    // Frequency of a note relative to a reference frequency is given by:
-    //
-    // $$ F * 2^{N / 12} $$
-    //
-    // where:
-    // - F is the reference note frequency
-    // - N is how many half-steps away (positive or negative) the target note is
-    //   from the reference note.
-    synth->baseFreq = C2_HZ * powf(TWELVETH_ROOT_OF_TWO, note);
-    synth->note = note;
-    _updateAllOperatorFreq(synth);
+    uint32x4_t frac = vandq_u32(phase, vdupq_n_u32((1u << WT_FRAC_BITS) - 1));
+    return vmulq_f32(vcvtq_f32_u32(frac),
+                     vdupq_n_f32(1.0f / (1u << WT_FRAC_BITS)));
 }
 
-static void
-_setOperatorCM(_FmSynth* synth, FmOperator op, float ratio, Note fixTo)
+#elif defined(__SSE2__)
+
+static inline FmLane
+_laneLoad(const float* src)
 {
-    synth->opCM[op] = ratio;
-    if (ratio > 0) {
-        _updateOperatorFreq(synth, op);
-    } else {
-        float freq = C2_HZ * powf(TWELVETH_ROOT_OF_TWO, fixTo);
-        synth->opStep[op] = _calcStep(freq, synth->sampleRate);
-        synth->opFreq[op] = freq;
-    }
+    return _mm_loadu_ps(src);
 }
 
-static void
-_updateEnvelopes(_FmSynth* synth)
+static inline void
+_laneStore(float* dst, FmLane x)
 {
-    for (int op = 0; op < FM_OPERATORS; op++) {
-        synth->opEnvelope[op] = Env_getValueAndAdvance(&synth->opAdsr[op]);
-    }
+    _mm_storeu_ps(dst, x);
 }
 
-static void
-_noteOn(_FmSynth* synth)
+static inline FmLane
+_laneSet(float x)
 {
-    for (int op = 0; op < FM_OPERATORS; op++) {
-        Env_trigger(&synth->opAdsr[op]);
-    }
+    return _mm_set1_ps(x);
 }
 
-static void
-_noteOff(_FmSynth* synth)
+static inline FmLane
+_laneAdd(FmLane a, FmLane b)
 {
-    for (int op = 0; op < FM_OPERATORS; op++) {
-        Env_gate(&synth->opAdsr[op]);
+    return _mm_add_ps(a, b);
+}
+
+static inline FmLane
+_laneMul(FmLane a, FmLane b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+static inline FmLane
+_laneMulAdd(FmLane acc, FmLane a, FmLane b)
+{
+    return _mm_add_ps(acc, _mm_mul_ps(a, b));
+}
+
+static inline float
+_laneSum(FmLane x)
+{
+    FmLane hi = _mm_movehl_ps(x, x);
+    FmLane sum = _mm_add_ps(x, hi);
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+static inline FmLane
+_laneMax(FmLane a, FmLane b)
+{
+    return _mm_max_ps(a, b);
+}
+
+static inline FmLane
+_laneAbs(FmLane x)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+static inline float
+_laneMaxAcross(FmLane x)
+{
+    FmLane max = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    max = _mm_max_ss(max, _mm_shuffle_ps(max, max, 1));
+    return _mm_cvtss_f32(max);
+}
+
+static inline void
+_laneToPcm(int16_t* dst, FmLane x)
+{
+    // Out of range conversions come back as INT32_MIN, so clamp first. The
+    // pack saturates.
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1)), _mm_set1_ps(1));
+    __m128i pcm = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(INT16_MAX)));
+    _mm_storel_epi64((__m128i*)dst, _mm_packs_epi32(pcm, pcm));
+}
+
+static inline FmPhaseLane
+_phaseLoad(const WaveTable_Phase* src)
+{
+    return _mm_loadu_si128((const __m128i*)src);
+}
+
+static inline void
+_phaseStore(WaveTable_Phase* dst, FmPhaseLane x)
+{
+    _mm_storeu_si128((__m128i*)dst, x);
+}
+
+static inline FmPhaseLane
+_phaseAdd(FmPhaseLane a, FmPhaseLane b)
+{
+    return _mm_add_epi32(a, b);
+}
+
+static inline FmPhaseLane
+_phaseFromCycles(FmLane cycles)
+{
+    __m128i offset = _mm_cvttps_epi32(
+      _mm_mul_ps(cycles, _mm_set1_ps(1u << (32 - WT_OFFSET_HEADROOM_BITS))));
+    return _mm_slli_epi32(offset, WT_OFFSET_HEADROOM_BITS);
+}
+
+static inline FmLane
+_phaseFrac(FmPhaseLane phase)
+{
+    __m128i frac =
+      _mm_and_si128(phase, _mm_set1_epi32((1u << WT_FRAC_BITS) - 1));
+    return _mm_mul_ps(_mm_cvtepi32_ps(frac),
+                      _mm_set1_ps(1.0f / (1u << WT_FRAC_BITS)));
+}
+
+#else
+
+static inline FmLane
+_laneLoad(const float* src)
+{
+    FmLane x;
+    memcpy(x.v, src, sizeof(x.v));
+    return x;
+}
+
+static inline void
+_laneStore(float* dst, FmLane x)
+{
+    memcpy(dst, x.v, sizeof(x.v));
+}
+
+static inline FmLane
+_laneSet(float x)
+{
+    FmLane r;
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        r.v[l] = x;
     }
+    return r;
 }
 
-FmSynthesizer*
-Fm_defaultSynthesizer(void)
+static inline FmLane
+_laneAdd(FmLane a, FmLane b)
 {
-    _FmSynth* synth = _fmSynthAlloc();
-    if (!synth) {
-        return NULL;
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        a.v[l] += b.v[l];
     }
-    memset(synth, 0, sizeof(_FmSynth));
+    return a;
+}
 
-    FmSynthesizer* fmSynth = malloc(sizeof(FmSynthesizer));
-    if (!fmSynth) {
-        free(synth);
-        return NULL;
+static inline FmLane
+_laneMul(FmLane a, FmLane b)
+{
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        a.v[l] *= b.v[l];
     }
-    fmSynth->__FmSynth = synth;
+    return a;
+}
 
-    _configure(synth, &FM_DEFAULT_PARAMS, true);
-    return fmSynth;
+static inline FmLane
+_laneMulAdd(FmLane acc, FmLane a, FmLane b)
+{
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        acc.v[l] += a.v[l] * b.v[l];
+    }
+    return acc;
 }
 
-FmSynthesizer*
-Fm_createFmSynthesizer(const FmSynthParams* params)
+static inline float
+_laneSum(FmLane x)
 {
-    _FmSynth* synth = _fmSynthAlloc();
-    if (!synth) {
-        return NULL;
+    float sum = 0;
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        sum += x.v[l];
     }
-    memset(synth, 0, sizeof(_FmSynth));
+    return sum;
+}
 
-    FmSynthesizer* fmSynth = malloc(sizeof(FmSynthesizer));
-    if (!fmSynth) {
-        free(synth);
-        return NULL;
+static inline FmLane
+_laneMax(FmLane a, FmLane b)
+{
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        a.v[l] = a.v[l] > b.v[l] ? a.v[l] : b.v[l];
     }
-    fmSynth->__FmSynth = synth;
+    return a;
+}
 
-    _configure(synth, params, true);
-    return fmSynth;
+static inline FmLane
+_laneAbs(FmLane x)
+{
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        x.v[l] = fabsf(x.v[l]);
+    }
+    return x;
 }
 
-void
-Fm_destroySynthesizer(FmSynthesizer* synth)
+static inline float
+_laneMaxAcross(FmLane x)
 {
+    float max = x.v[0];
+    for (int l = 1; l < FM_LANE_WIDTH; l++) {
+        max = x.v[l] > max ? x.v[l] : max;
+    }
+    return max;
+}
 
-    if (NULL != synth) {
-        if (NULL != synth->__FmSynth) {
-            free(synth->__FmSynth);
-        }
-        free(synth);
+static inline void
+_laneToPcm(int16_t* dst, FmLane x)
+{
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        dst[l] = _toPcm(x.v[l]);
     }
 }
 
-void
-Fm_noteOn(FmSynthesizer* s)
+static inline FmPhaseLane
+_phaseLoad(const WaveTable_Phase* src)
 {
-    _FmSynth* synth = s->__FmSynth;
-    _noteOn(synth);
+    FmPhaseLane x;
+    memcpy(x.v, src, sizeof(x.v));
+    return x;
 }
 
-void
-Fm_noteOff(FmSynthesizer* s)
+static inline void
+_phaseStore(WaveTable_Phase* dst, FmPhaseLane x)
 {
-    _FmSynth* synth = s->__FmSynth;
-    _noteOff(synth);
+    memcpy(dst, x.v, sizeof(x.v));
 }
 
-void
-Fm_updateParams(FmSynthesizer* s, FmSynthParams* params)
+static inline FmPhaseLane
+_phaseAdd(FmPhaseLane a, FmPhaseLane b)
 {
-    _FmSynth* synth = s->__FmSynth;
-    _configure(synth, params, false);
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        a.v[l] += b.v[l];
+    }
+    return a;
 }
 
-void
-Fm_generateSamples(FmSynthesizer* s, int16_t* sampleBuf, size_t nSamples)
+static inline FmPhaseLane
+_phaseFromCycles(FmLane cycles)
 {
-    _FmSynth* synth = s->__FmSynth;
+    FmPhaseLane r;
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        r.v[l] = WaveTable_phaseFromCycles(cycles.v[l]);
+    }
+    return r;
+}
 
-    float opSamples[FM_OPERATORS] = { 0 };
-    float opMod[FM_OPERATORS] = { 0 };
-    for (size_t s = 0; s < nSamples; s++) {
+static inline FmLane
+_phaseFrac(FmPhaseLane phase)
+{
+    FmLane r;
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        r.v[l] = (phase.v[l] & ((1u << WT_FRAC_BITS) - 1)) *
+                 (1.0f / (1u << WT_FRAC_BITS));
+    }
+    return r;
+}
 
-        // Compute and cache the current sample values from each
-        // operator.
-        for (int op = 0; op < FM_OPERATORS; op++) {
-            opSamples[op] =
-              WaveTable_sample(synth->opWave[op], synth->opAngle[op]) *
-              synth->opEnvelope[op];
+#endif
+
+static inline FmLane
+_laneWaveSample(const float* const tables[FM_LANE_WIDTH],
+                FmPhaseLane phase,
+                uint32_t mask)
+{
+    // Tables can't be gathered from in a vector, so only the lookups are
+    // scalar. Everything else stays in lanes.
+    WaveTable_Phase phases[FM_LANE_WIDTH];
+    float low[FM_LANE_WIDTH] = { 0 };
+    float high[FM_LANE_WIDTH] = { 0 };
+    _phaseStore(phases, phase);
+    for (int l = 0; l < FM_LANE_WIDTH; l++) {
+        if ((mask & (1u << l)) == 0) {
+            continue;
         }
+        // Tables have a guard sample, so idx + 1 never needs wrapping.
+        uint32_t idx = phases[l] >> WT_FRAC_BITS;
+        low[l] = tables[l][idx];
+        high[l] = tables[l][idx + 1];
+    }
 
-        // Use the current sample value to modulate the angle of the operators.
-        // This will affect the next sample.
-        for (int op = 0; op < FM_OPERATORS; op++) {
-            int idx = op * FM_OPERATORS;
-            opMod[op] = 0;
-            // The algorithm connections are stored as a matrix. Multiplying the
-            // output of the operators by this matrix gives the modulation.
-            for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
-                float modIdx =
-                  synth->opModBy[idx + modOp] / synth->opFreq[modOp];
-                opMod[op] +=
-                  modIdx * (opSamples[modOp] * synth->opStep[modOp]); // ??
+    FmLane lo = _laneLoad(low);
+    FmLane hi = _laneLoad(high);
+    return _laneMulAdd(
+      lo, _phaseFrac(phase), _laneAdd(hi, _laneMul(lo, _laneSet(-1))));
+}
+
+inline static void
+_updateOperatorFreq(_FmSynth* synth, FmOperator op, int voice)
+{
+    float opFreq;
+    if (synth->opCM[op] > 0) {
+        opFreq = synth->voiceBaseFreq[voice] * synth->opCM[op];
+    } else {
+        opFreq = synth->opFixedFreq[op];
+    }
+    synth->opStep[op][voice] =
+      WaveTable_phaseStep(opFreq, synth->sampleRate);
+    synth->opTable[op][voice] =
+      WaveTable_getBandLimited(synth->opWave[op], synth->opStep[op][voice]);
+}
+
+inline static void
+_updateAllOperatorFreq(_FmSynth* synth, int voice)
+{
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        _updateOperatorFreq(synth, op, voice);
+    }
+}
+
+static _FmSynth*
+_fmSynthAlloc(void)
+{
+    _FmSynth* synth = malloc(sizeof(_FmSynth));
+    if (synth) {
+        memset(synth, 0, sizeof(_FmSynth));
+    }
+    return synth;
+}
+
+static void
+_compileVoice(struct _FmVoice* voice, const FmSynthParams* params)
+{
+    memcpy(&voice->params, params, sizeof(FmSynthParams));
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const OperatorParams* opParams = &params->opParams[op];
+        voice->opWave[op] = opParams->waveType;
+        voice->opOutput[op] = opParams->outputStrength;
+        voice->opCM[op] = opParams->CmRatio;
+        voice->opFixTo[op] = opParams->fixToNote;
+        voice->opFixedFreq[op] =
+          C2_HZ * powf(TWELVETH_ROOT_OF_TWO, opParams->fixToNote);
+        for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+            voice->opModCoef[op][modOp] =
+              opParams->algorithmConnections[modOp] / params->sampleRate;
+        }
+
+        voice->opAdsr[op] = params->opEnvelopes[op];
+        Env_prepareEnvelope(&voice->opAdsr[op], params->sampleRate);
+    }
+    _findTopology(voice->opOutput, voice->opModCoef, &voice->topology);
+}
+
+static void
+_applyVoice(_FmSynth* synth, const struct _FmVoice* voice, bool reset)
+{
+    memcpy(synth->opModCoef, voice->opModCoef, sizeof(synth->opModCoef));
+    memcpy(synth->opOutput, voice->opOutput, sizeof(synth->opOutput));
+    memcpy(synth->opWave, voice->opWave, sizeof(synth->opWave));
+    memcpy(synth->opCM, voice->opCM, sizeof(synth->opCM));
+    memcpy(synth->opFixTo, voice->opFixTo, sizeof(synth->opFixTo));
+    memcpy(
+      synth->opFixedFreq, voice->opFixedFreq, sizeof(synth->opFixedFreq));
+    synth->topology = voice->topology;
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            if (!reset) {
+                Env_setShape(&synth->opAdsr[op][v], &voice->opAdsr[op]);
+                continue;
             }
+            synth->opAdsr[op][v] = voice->opAdsr[op];
+            synth->opPhase[op][v] = 0;
+            synth->opEnvelope[op][v] = 0;
+            synth->opEnvelopeStep[op][v] = 0;
+            synth->opEnvelopeTarget[op][v] = 0;
+        }
+    }
 
-            synth->opAngle[op] += synth->opStep[op] + opMod[op];
-            synth->opAngle[op] -= floorf(synth->opAngle[op]);
+    const NoteCache* noteCache = synth->noteCache;
+    synth->voiceParams = &voice->params;
+    synth->noteCache = _findNoteCache(synth);
+
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        _updateAllOperatorFreq(synth, v);
+        if (reset) {
+            synth->voiceHeld[v] = false;
+            memset(&synth->voiceBaked[v], 0, sizeof(NoteCache_Playhead));
+        } else if (synth->noteCache != noteCache) {
+            _unbake(synth, v);
         }
+    }
+}
 
-        // If we need to, update the ADSR envelope and triggers.
-        if (s % ADSR_UPDATES_PER_SEC == 0) {
-            _updateEnvelopes(synth);
+static bool
+_takePendingVoice(_FmSynth* synth, bool now)
+{
+    // Cheap check first, this runs every control period.
+    if (atomic_load_explicit(&synth->pendingVoice, memory_order_relaxed) ==
+        NULL) {
+        return false;
+    }
+
+    if (!now && !synth->atZeroCrossing &&
+        synth->voiceDeferred < FM_VOICE_MAX_DEFER) {
+        bool sounding = false;
+        for (size_t v = 0; v < synth->nVoices && !sounding; v++) {
+            sounding = _voiceIsActive(synth, v);
+        }
+        if (sounding) {
+            synth->voiceDeferred++;
+            return false;
+        }
+    }
+
+    const struct _FmVoice* voice = atomic_exchange_explicit(
+      &synth->pendingVoice, NULL, memory_order_acquire);
+    if (voice) {
+        _applyVoice(synth, voice, false);
+    }
+    synth->voiceDeferred = 0;
+    return voice != NULL;
+}
+
+static void
+_setOpParams(_FmSynth* synth, FmOperator op, const OperatorParams* params)
+{
+    // The baked notes no longer sound like the voice.
+    synth->voiceParams = NULL;
+    synth->noteCache = NULL;
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        _unbake(synth, v);
+    }
+
+    synth->opWave[op] = params->waveType;
+    synth->opOutput[op] = params->outputStrength;
+
+    _setOperatorCM(synth, op, params->CmRatio, params->fixToNote);
+
+    for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+        synth->opModCoef[op][modOp] =
+          params->algorithmConnections[modOp] / synth->sampleRate;
+    }
+
+    _findTopology(synth->opOutput, synth->opModCoef, &synth->topology);
+}
+
+void
+Fm_updateOpParams(FmSynthesizer* s, FmOperator op, const OperatorParams* params)
+{
+    _FmSynth* synth = s->__FmSynth;
+    // Tweak the voice that was asked for last, not the one it replaces.
+    _takePendingVoice(synth, true);
+    _setOpParams(synth, op, params);
+}
+
+void
+Fm_setNote(FmSynthesizer* s, Note note)
+{
+    _FmSynth* synth = s->__FmSynth;
+    _setNote(synth, 0, note);
+}
+
+static void
+_setNote(_FmSynth* synth,
+         int voice,
+         int note) // note is an int to force signness
+{
+    // Frequency of a note relative to a reference frequency is given by:
+    //
+    // $$ F * 2^{N / 12} $$
+    //
+    // where:
+    // - F is the reference note frequency
+    // - N is how many half-steps away (positive or negative) the target note is
+    //   from the reference note.
+    NoteCache_Playhead* head = &synth->voiceBaked[voice];
+    if (head->current.samples &&
+        !NoteCache_retune(synth->noteCache, head, note, FM_NOTE_CACHE_FADE)) {
+        _unbake(synth, voice);
+    }
+
+    synth->voiceBaseFreq[voice] = C2_HZ * powf(TWELVETH_ROOT_OF_TWO, note);
+    synth->voiceNote[voice] = note;
+    _updateAllOperatorFreq(synth, voice);
+}
+
+static void
+_setOperatorCM(_FmSynth* synth, FmOperator op, float ratio, Note fixTo)
+{
+    synth->opCM[op] = ratio;
+    synth->opFixTo[op] = fixTo;
+    synth->opFixedFreq[op] = C2_HZ * powf(TWELVETH_ROOT_OF_TWO, fixTo);
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        _updateOperatorFreq(synth, op, v);
+    }
+}
+
+static void
+_updateEnvelopes(_FmSynth* synth)
+{
+    const float perSample = 1.0f / ENV_CONTROL_PERIOD;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            // Land exactly on the last control point so rounding in the
+            // ramp never accumulates.
+            float current = synth->opEnvelopeTarget[op][v];
+            float target = Env_getValueAndAdvance(&synth->opAdsr[op][v]);
+            synth->opEnvelope[op][v] = current;
+            synth->opEnvelopeTarget[op][v] = target;
+            synth->opEnvelopeStep[op][v] = (target - current) * perSample;
+        }
+    }
+}
+
+static void
+_noteOn(_FmSynth* synth, int voice)
+{
+    _takePendingVoice(synth, true);
+    synth->voiceHeld[voice] = true;
+    synth->voiceAge[voice] = ++synth->voiceClock;
+
+    // A note the operators are already playing carries on from where its
+    // envelopes are, which a baked note can't do.
+    NoteCache_Playhead* head = &synth->voiceBaked[voice];
+    bool live = false;
+    for (int op = 0; op < FM_OPERATORS && !live; op++) {
+        live = Env_isActive(&synth->opAdsr[op][voice]);
+    }
+    if (synth->noteCache && !live &&
+        NoteCache_start(synth->noteCache,
+                        head,
+                        synth->voiceNote[voice],
+                        FM_NOTE_CACHE_FADE)) {
+        return;
+    }
+
+    NoteCache_fadeOut(head, FM_NOTE_CACHE_FADE);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        Env_trigger(&synth->opAdsr[op][voice]);
+    }
+}
+
+static void
+_noteOff(_FmSynth* synth, int voice)
+{
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        Env_gate(&synth->opAdsr[op][voice]);
+    }
+    NoteCache_gate(&synth->voiceBaked[voice]);
+    synth->voiceHeld[voice] = false;
+}
+
+static bool
+_voiceIsActive(const _FmSynth* synth, int voice)
+{
+    // A baked note fading out doesn't hold on to its voice.
+    if (synth->voiceBaked[voice].current.samples) {
+        return true;
+    }
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        if (Env_isActive(&synth->opAdsr[op][voice])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+_isIdle(const _FmSynth* synth)
+{
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            if (Env_isActive(&synth->opAdsr[op][v]) ||
+                synth->opEnvelope[op][v] != 0 ||
+                synth->opEnvelopeStep[op][v] != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool
+_isBakedPlaying(const _FmSynth* synth)
+{
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        if (NoteCache_isPlaying(&synth->voiceBaked[v])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const NoteCache*
+_findNoteCache(const _FmSynth* synth)
+{
+    if (!synth->voiceParams) {
+        return NULL;
+    }
+    for (size_t i = 0; i < synth->nNoteCaches; i++) {
+        if (memcmp(NoteCache_getParams(synth->noteCaches[i]),
+                   synth->voiceParams,
+                   sizeof(FmSynthParams)) == 0) {
+            return synth->noteCaches[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+_unbake(_FmSynth* synth, int voice)
+{
+    NoteCache_Playhead* head = &synth->voiceBaked[voice];
+    if (!head->current.samples) {
+        return;
+    }
+
+    size_t held;
+    size_t released;
+    bool gated = NoteCache_getEnvelopeTime(head, &held, &released);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        Env_Envelope* env = &synth->opAdsr[op][voice];
+        Env_trigger(env);
+        for (size_t t = 0; t < held; t += ENV_CONTROL_PERIOD) {
+            Env_getValueAndAdvance(env);
+        }
+        if (gated) {
+            Env_gate(env);
+            for (size_t t = 0; t < released; t += ENV_CONTROL_PERIOD) {
+                Env_getValueAndAdvance(env);
+            }
+        }
+        // Ramp up from nothing at the next control point while the baked
+        // note fades out.
+        synth->opEnvelope[op][voice] = 0;
+        synth->opEnvelopeStep[op][voice] = 0;
+        synth->opEnvelopeTarget[op][voice] = 0;
+    }
+    NoteCache_fadeOut(head, synth->controlCountdown + ENV_CONTROL_PERIOD);
+}
+
+static float
+_voiceLevel(const _FmSynth* synth, int voice)
+{
+    float level = NoteCache_getLevel(&synth->voiceBaked[voice]);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        level += synth->opEnvelope[op][voice] * synth->opOutput[op];
+    }
+    return level;
+}
+
+static int
+_allocateVoice(_FmSynth* synth, Note note)
+{
+    int best = FM_VOICE_NONE;
+
+    // Retrigger a voice that is already playing this note, otherwise take
+    // the first voice that has gone quiet.
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        if (synth->voiceNote[v] == note && _voiceIsActive(synth, v)) {
+            return v;
+        }
+        if (best == FM_VOICE_NONE && !_voiceIsActive(synth, v)) {
+            best = v;
+        }
+    }
+    if (best != FM_VOICE_NONE) {
+        return best;
+    }
+
+    // Every voice is busy. Steal the quietest released voice, breaking ties
+    // by age.
+    float bestLevel = 0;
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        if (synth->voiceHeld[v]) {
+            continue;
+        }
+        float level = _voiceLevel(synth, v);
+        if (best == FM_VOICE_NONE || level < bestLevel ||
+            (level == bestLevel &&
+             synth->voiceAge[v] < synth->voiceAge[best])) {
+            best = v;
+            bestLevel = level;
+        }
+    }
+    if (best != FM_VOICE_NONE) {
+        return best;
+    }
+
+    // Every voice is held. Steal the oldest.
+    best = 0;
+    for (size_t v = 1; v < synth->nVoices; v++) {
+        if (synth->voiceAge[v] < synth->voiceAge[best]) {
+            best = v;
+        }
+    }
+    return best;
+}
+
+static FmSynthesizer*
+_createSynthesizer(const FmSynthParams* params, size_t nVoices)
+{
+    if (WaveTable_initialize() < 0) {
+        return NULL;
+    }
+    _FmSynth* synth = _fmSynthAlloc();
+    if (!synth) {
+        return NULL;
+    }
+
+    FmSynthesizer* fmSynth = malloc(sizeof(FmSynthesizer));
+    if (!fmSynth) {
+        free(synth);
+        return NULL;
+    }
+    fmSynth->__FmSynth = synth;
+
+    if (nVoices < 1) {
+        nVoices = 1;
+    } else if (nVoices > FM_MAX_VOICES) {
+        nVoices = FM_MAX_VOICES;
+    }
+    synth->nVoices = nVoices;
+    synth->voiceGain = 1.0f / nVoices;
+
+    synth->sampleRate = params->sampleRate;
+    atomic_init(&synth->pendingVoice, NULL);
+    _compileVoice(&synth->ownVoice, params);
+    _applyVoice(synth, &synth->ownVoice, true);
+
+    synth->limiterGain = 1;
+    synth->limiterRelease =
+      1 - expf(-1000.0f * ENV_CONTROL_PERIOD /
+               (FM_LIMITER_RELEASE_MS * (float)synth->sampleRate));
+    synth->ditherState = FM_DITHER_SEED;
+    atomic_init(&synth->mixClipped, 0);
+    atomic_init(&synth->mixLimited, 0);
+
+    // Give every voice a valid frequency so idle voices render silence.
+    for (size_t v = 0; v < nVoices; v++) {
+        _setNote(synth, v, C2);
+    }
+    return fmSynth;
+}
+
+FmSynthesizer*
+Fm_defaultSynthesizer(void)
+{
+    return _createSynthesizer(&FM_DEFAULT_PARAMS, 1);
+}
+
+FmSynthesizer*
+Fm_createFmSynthesizer(const FmSynthParams* params)
+{
+    return _createSynthesizer(params, 1);
+}
+
+FmSynthesizer*
+Fm_createPolySynthesizer(const FmSynthParams* params, size_t nVoices)
+{
+    return _createSynthesizer(params, nVoices);
+}
+
+void
+Fm_destroySynthesizer(FmSynthesizer* synth)
+{
+
+    if (NULL != synth) {
+        if (NULL != synth->__FmSynth) {
+            free(synth->__FmSynth);
+        }
+        free(synth);
+    }
+}
+
+void
+Fm_noteOn(FmSynthesizer* s)
+{
+    _FmSynth* synth = s->__FmSynth;
+    _noteOn(synth, 0);
+}
+
+void
+Fm_noteOff(FmSynthesizer* s)
+{
+    _FmSynth* synth = s->__FmSynth;
+    _noteOff(synth, 0);
+}
+
+int
+Fm_voiceOn(FmSynthesizer* s, Note note)
+{
+    _FmSynth* synth = s->__FmSynth;
+    int voice = _allocateVoice(synth, note);
+    if (voice != FM_VOICE_NONE) {
+        _setNote(synth, voice, note);
+        _noteOn(synth, voice);
+    }
+    return voice;
+}
+
+void
+Fm_voiceOff(FmSynthesizer* s, Note note)
+{
+    _FmSynth* synth = s->__FmSynth;
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        if (synth->voiceHeld[v] && synth->voiceNote[v] == note) {
+            _noteOff(synth, v);
+        }
+    }
+}
+
+void
+Fm_allVoicesOff(FmSynthesizer* s)
+{
+    _FmSynth* synth = s->__FmSynth;
+    for (size_t v = 0; v < synth->nVoices; v++) {
+        if (synth->voiceHeld[v]) {
+            _noteOff(synth, v);
+        }
+    }
+}
+
+size_t
+Fm_getVoiceCount(FmSynthesizer* s)
+{
+    _FmSynth* synth = s->__FmSynth;
+    return synth->nVoices;
+}
+
+void
+Fm_updateParams(FmSynthesizer* s, FmSynthParams* params)
+{
+    _FmSynth* synth = s->__FmSynth;
+    atomic_store_explicit(&synth->pendingVoice, NULL, memory_order_relaxed);
+    _compileVoice(&synth->ownVoice, params);
+    _applyVoice(synth, &synth->ownVoice, true);
+}
+
+FmVoice*
+Fm_compileVoice(const FmSynthParams* params)
+{
+    FmVoice* voice = malloc(sizeof(FmVoice));
+    if (voice) {
+        _compileVoice(voice, params);
+    }
+    return voice;
+}
+
+void
+Fm_destroyVoice(FmVoice* voice)
+{
+    free(voice);
+}
+
+const FmSynthParams*
+Fm_getVoiceParams(const FmVoice* voice)
+{
+    return &voice->params;
+}
+
+void
+Fm_setVoice(FmSynthesizer* s, const FmVoice* voice)
+{
+    _FmSynth* synth = s->__FmSynth;
+    atomic_store_explicit(&synth->pendingVoice, voice, memory_order_release);
+}
+
+void
+Fm_setKernel(FmSynthesizer* s, FmKernel kernel)
+{
+    _FmSynth* synth = s->__FmSynth;
+    synth->kernel = kernel;
+}
+
+void
+Fm_setDither(FmSynthesizer* s, bool dither)
+{
+    _FmSynth* synth = s->__FmSynth;
+    synth->dither = dither;
+}
+
+bool
+Fm_addNoteCache(FmSynthesizer* s, const NoteCache* cache)
+{
+    _FmSynth* synth = s->__FmSynth;
+    if (synth->nNoteCaches == FM_MAX_NOTE_CACHES) {
+        return false;
+    }
+    synth->noteCaches[synth->nNoteCaches++] = cache;
+    if (!synth->noteCache) {
+        synth->noteCache = _findNoteCache(synth);
+    }
+    return true;
+}
+
+bool
+Fm_isIdle(FmSynthesizer* s)
+{
+    _FmSynth* synth = s->__FmSynth;
+    return _isIdle(synth) && !_isBakedPlaying(synth);
+}
+
+void
+Fm_getMixStats(FmSynthesizer* s, FmMixStats* stats)
+{
+    _FmSynth* synth = s->__FmSynth;
+    stats->clipped =
+      atomic_load_explicit(&synth->mixClipped, memory_order_relaxed);
+    stats->limited =
+      atomic_load_explicit(&synth->mixLimited, memory_order_relaxed);
+}
+
+static inline int16_t
+_toPcm(float sample)
+{
+    if (sample > 1) {
+        sample = 1;
+    } else if (sample < -1) {
+        sample = -1;
+    }
+    return sample * INT16_MAX;
+}
+
+static inline uint32_t
+_ditherNext(_FmSynth* synth)
+{
+    // xorshift32. Plenty random for dither, and cheap.
+    uint32_t x = synth->ditherState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    synth->ditherState = x;
+    return x;
+}
+
+static inline float
+_tpdf(_FmSynth* synth)
+{
+    // The difference of two uniform values has a triangular distribution.
+    float a = _ditherNext(synth) >> 8;
+    float b = _ditherNext(synth) >> 8;
+    return (a - b) * (1.0f / (1u << 24) / INT16_MAX);
+}
+
+static void
+_mixToPcm(_FmSynth* synth, const float* bus, int16_t* out, size_t n)
+{
+    const size_t nLanes = n - n % FM_LANE_WIDTH;
+
+    FmLane peakLane = _laneSet(0);
+    for (size_t s = 0; s < nLanes; s += FM_LANE_WIDTH) {
+        peakLane = _laneMax(peakLane, _laneAbs(_laneLoad(&bus[s])));
+    }
+    float peak = _laneMaxAcross(peakLane);
+    for (size_t s = nLanes; s < n; s++) {
+        peak = fmaxf(peak, fabsf(bus[s]));
+    }
+
+    float start = synth->limiterGain;
+    float end = start + (1 - start) * synth->limiterRelease;
+    if (peak > FM_LIMITER_CEILING) {
+        float target = FM_LIMITER_CEILING / peak;
+        if (start > target) {
+            start = target;
+        }
+        if (end > target) {
+            end = target;
+        }
+        atomic_fetch_add_explicit(&synth->mixLimited, 1, memory_order_relaxed);
+    }
+    if (peak > 1) {
+        unsigned long clipped = 0;
+        for (size_t s = 0; s < n; s++) {
+            clipped += fabsf(bus[s]) > 1;
+        }
+        atomic_fetch_add_explicit(
+          &synth->mixClipped, clipped, memory_order_relaxed);
+    }
+    synth->limiterGain = end;
+
+    // Ramp the gain from start to end over the block.
+    const float step = (end - start) / n;
+    const float ramp[FM_LANE_WIDTH] = { 0, 1, 2, 3 };
+    const FmLane gainStep = _laneSet(step * FM_LANE_WIDTH);
+    const bool dither = synth->dither;
+    FmLane gain =
+      _laneMulAdd(_laneSet(start), _laneLoad(ramp), _laneSet(step));
+    for (size_t s = 0; s < nLanes; s += FM_LANE_WIDTH) {
+        FmLane x = _laneMul(_laneLoad(&bus[s]), gain);
+        if (dither) {
+            float noise[FM_LANE_WIDTH];
+            for (int l = 0; l < FM_LANE_WIDTH; l++) {
+                noise[l] = _tpdf(synth);
+            }
+            x = _laneAdd(x, _laneLoad(noise));
+        }
+        _laneToPcm(&out[s], x);
+        gain = _laneAdd(gain, gainStep);
+    }
+    for (size_t s = nLanes; s < n; s++) {
+        float x = bus[s] * (start + step * s);
+        out[s] = _toPcm(dither ? x + _tpdf(synth) : x);
+    }
+}
+
+static void
+_generateScalar(_FmSynth* synth, float* bus, size_t nSamples)
+{
+    const size_t nVoices = synth->nVoices;
+
+    float opSamples[FM_OPERATORS][FM_MAX_VOICES] = { { 0 } };
+    float opMod[FM_MAX_VOICES] = { 0 };
+    for (size_t s = 0; s < nSamples; s++) {
+
+        // Compute and cache the current sample values from each
+        // operator of every voice.
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            for (size_t v = 0; v < nVoices; v++) {
+                opSamples[op][v] = WaveTable_lookup(synth->opTable[op][v],
+                                                    synth->opPhase[op][v]) *
+                                   synth->opEnvelope[op][v];
+                synth->opEnvelope[op][v] += synth->opEnvelopeStep[op][v];
+            }
+        }
+
+        // Use the current sample value to modulate the phase of the
+        // operators. This will affect the next sample.
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            for (size_t v = 0; v < nVoices; v++) {
+                opMod[v] = 0;
+            }
+            // The algorithm connections are stored as a matrix. Multiplying the
+            // output of the operators by this matrix gives the modulation.
+            for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+                float coef = synth->opModCoef[op][modOp];
+                for (size_t v = 0; v < nVoices; v++) {
+                    opMod[v] += coef * opSamples[modOp][v];
+                }
+            }
+
+            for (size_t v = 0; v < nVoices; v++) {
+                synth->opPhase[op][v] +=
+                  synth->opStep[op][v] + WaveTable_phaseFromCycles(opMod[v]);
+            }
         }
 
         // Mix together the operators that are wired to output.
         float finalSample = 0;
         for (int op = 0; op < FM_OPERATORS; op++) {
-            finalSample += opSamples[op] * synth->opOutput[op];
+            for (size_t v = 0; v < nVoices; v++) {
+                finalSample += opSamples[op][v] * synth->opOutput[op];
+            }
+        }
+        bus[s] = finalSample * synth->voiceGain;
+    }
+}
+
+static inline uint32_t
+_soundingMask(const _FmSynth* synth, size_t firstVoice)
+{
+    uint32_t mask = 0;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (int l = 0; l < FM_LANE_WIDTH; l++) {
+            if (synth->opEnvelope[op][firstVoice + l] != 0 ||
+                synth->opEnvelopeStep[op][firstVoice + l] != 0) {
+                mask |= 1u << op;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+static FM_ALWAYS_INLINE void
+_renderOperatorLanes(_FmSynth* synth,
+                     float* bus,
+                     size_t nSamples,
+                     const uint32_t conn,
+                     const uint32_t live,
+                     const bool skipSilent)
+{
+    // One voice, one operator per lane. The whole voice lives in registers
+    // for the length of the block.
+    WaveTable_Phase phases[FM_LANE_WIDTH] = { 0 };
+    WaveTable_Phase steps[FM_LANE_WIDTH] = { 0 };
+    float envelopes[FM_LANE_WIDTH] = { 0 };
+    float envelopeSteps[FM_LANE_WIDTH] = { 0 };
+    float outputs[FM_LANE_WIDTH] = { 0 };
+    const float* tables[FM_LANE_WIDTH];
+    FmLane modColumn[FM_OPERATORS];
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        phases[op] = synth->opPhase[op][0];
+        steps[op] = synth->opStep[op][0];
+        envelopes[op] = synth->opEnvelope[op][0];
+        envelopeSteps[op] = synth->opEnvelopeStep[op][0];
+        outputs[op] = synth->opOutput[op] * synth->voiceGain;
+        tables[op] = synth->opTable[op][0];
+    }
+
+    // Column modOp of the modulation matrix.
+    for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+        float column[FM_LANE_WIDTH] = { 0 };
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            column[op] = synth->opModCoef[op][modOp];
+        }
+        modColumn[modOp] = _laneLoad(column);
+    }
+
+    FmPhaseLane phase = _phaseLoad(phases);
+    const FmPhaseLane step = _phaseLoad(steps);
+    const FmLane output = _laneLoad(outputs);
+    FmLane envelope = _laneLoad(envelopes);
+    const FmLane envelopeStep = _laneLoad(envelopeSteps);
+    const uint32_t sounding =
+      skipSilent ? _soundingMask(synth, 0) & live : live;
+
+    for (size_t s = 0; s < nSamples; s++) {
+        FmLane opSamples =
+          _laneMul(_laneWaveSample(tables, phase, sounding), envelope);
+        envelope = _laneAdd(envelope, envelopeStep);
+
+        float samples[FM_LANE_WIDTH];
+        _laneStore(samples, opSamples);
+
+        FmLane mod = _laneSet(0);
+        bool modulated = false;
+        for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+            bool modulates = false;
+            for (int op = 0; op < FM_OPERATORS; op++) {
+                modulates |= (live & (1u << op)) != 0 &&
+                             (conn & FM_CONN_BIT(op, modOp)) != 0;
+            }
+            if (modulates) {
+                mod =
+                  _laneMulAdd(mod, modColumn[modOp], _laneSet(samples[modOp]));
+                modulated = true;
+            }
+        }
+        phase = _phaseAdd(phase, step);
+        if (modulated) {
+            phase = _phaseAdd(phase, _phaseFromCycles(mod));
+        }
+
+        bus[s] = _laneSum(_laneMul(opSamples, output));
+    }
+
+    _phaseStore(phases, phase);
+    _laneStore(envelopes, envelope);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        synth->opPhase[op][0] = phases[op];
+        synth->opEnvelope[op][0] = envelopes[op];
+    }
+}
+
+static FM_ALWAYS_INLINE void
+_renderVoiceLanes(_FmSynth* synth,
+                  float* bus,
+                  size_t nSamples,
+                  const uint32_t conn,
+                  const uint32_t out,
+                  const uint32_t live,
+                  const bool skipSilent)
+{
+    // One operator at a time, one voice per lane.
+    const size_t nGroups =
+      (synth->nVoices + FM_LANE_WIDTH - 1) / FM_LANE_WIDTH;
+    FmLane outputs[FM_OPERATORS];
+    FmLane modCoef[FM_OPERATORS][FM_OPERATORS];
+    uint32_t sounding[FM_MAX_VOICES / FM_LANE_WIDTH];
+    uint32_t lanes[FM_MAX_VOICES / FM_LANE_WIDTH];
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        outputs[op] = _laneSet(synth->opOutput[op] * synth->voiceGain);
+        for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+            modCoef[op][modOp] = _laneSet(synth->opModCoef[op][modOp]);
+        }
+    }
+    for (size_t g = 0; g < nGroups; g++) {
+        sounding[g] =
+          skipSilent ? _soundingMask(synth, g * FM_LANE_WIDTH) & live : live;
+        // Voices past nVoices in the last group have no tables.
+        size_t inGroup = synth->nVoices - g * FM_LANE_WIDTH;
+        lanes[g] =
+          (inGroup >= FM_LANE_WIDTH) ? FM_ALL_LANES : (1u << inGroup) - 1;
+    }
+
+    for (size_t s = 0; s < nSamples; s++) {
+        FmLane mix = _laneSet(0);
+        for (size_t g = 0; g < nGroups; g++) {
+            const size_t v = g * FM_LANE_WIDTH;
+            FmLane opSamples[FM_OPERATORS];
+            for (int op = 0; op < FM_OPERATORS; op++) {
+                if ((sounding[g] & (1u << op)) == 0) {
+                    opSamples[op] = _laneSet(0);
+                    continue;
+                }
+                FmLane envelope = _laneLoad(&synth->opEnvelope[op][v]);
+                opSamples[op] =
+                  _laneMul(_laneWaveSample(&synth->opTable[op][v],
+                                           _phaseLoad(&synth->opPhase[op][v]),
+                                           lanes[g]),
+                           envelope);
+                _laneStore(
+                  &synth->opEnvelope[op][v],
+                  _laneAdd(envelope, _laneLoad(&synth->opEnvelopeStep[op][v])));
+                if ((out & (1u << op)) != 0) {
+                    mix = _laneMulAdd(mix, opSamples[op], outputs[op]);
+                }
+            }
+
+            for (int op = 0; op < FM_OPERATORS; op++) {
+                if ((live & (1u << op)) == 0) {
+                    continue;
+                }
+                FmPhaseLane phase = _phaseAdd(
+                  _phaseLoad(&synth->opPhase[op][v]),
+                  _phaseLoad(&synth->opStep[op][v]));
+                FmLane mod = _laneSet(0);
+                bool modulated = false;
+                for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+                    if ((conn & FM_CONN_BIT(op, modOp)) != 0) {
+                        mod = _laneMulAdd(
+                          mod, modCoef[op][modOp], opSamples[modOp]);
+                        modulated = true;
+                    }
+                }
+                if (modulated) {
+                    phase = _phaseAdd(phase, _phaseFromCycles(mod));
+                }
+                _phaseStore(&synth->opPhase[op][v], phase);
+            }
+        }
+
+        bus[s] = _laneSum(mix);
+    }
+}
+
+static void
+_generateOperatorLanes(_FmSynth* synth, float* bus, size_t nSamples)
+{
+    _renderOperatorLanes(
+      synth, bus, nSamples, FM_ALL_CONNS, FM_ALL_OPS, false);
+}
+
+static void
+_generateVoiceLanes(_FmSynth* synth, float* bus, size_t nSamples)
+{
+    _renderVoiceLanes(
+      synth, bus, nSamples, FM_ALL_CONNS, FM_ALL_OPS, FM_ALL_OPS, false);
+}
+
+static void
+_generateOperatorLanesGeneric(_FmSynth* synth, float* bus, size_t nSamples)
+{
+    _renderOperatorLanes(
+      synth,
+      bus,
+      nSamples,
+      synth->topology.connMask,
+      synth->topology.liveMask,
+      true);
+}
+
+static void
+_generateVoiceLanesGeneric(_FmSynth* synth, float* bus, size_t nSamples)
+{
+    _renderVoiceLanes(synth,
+                      bus,
+                      nSamples,
+                      synth->topology.connMask,
+                      synth->topology.outMask,
+                      synth->topology.liveMask,
+                      true);
+}
+
+/** Generates a pair of kernels for one entry in FM_KNOWN_TOPOLOGIES. */
+#define FM_TOPOLOGY_KERNELS(name, conn, out, live)                             \
+    static void _generateOperatorLanes_##name(                                 \
+      _FmSynth* synth, float* bus, size_t nSamples)                            \
+    {                                                                          \
+        _renderOperatorLanes(synth, bus, nSamples, conn, live, true);          \
+    }                                                                          \
+    static void _generateVoiceLanes_##name(                                    \
+      _FmSynth* synth, float* bus, size_t nSamples)                            \
+    {                                                                          \
+        _renderVoiceLanes(synth, bus, nSamples, conn, out, live, true);        \
+    }
+
+FM_KNOWN_TOPOLOGIES(FM_TOPOLOGY_KERNELS)
+
+/** A topology and the kernels specialized to it. */
+typedef struct
+{
+    uint32_t connMask;
+    uint32_t outMask;
+    _FmRenderFn renderMono;
+    _FmRenderFn renderPoly;
+} _FmTopologyKernels;
+
+/** Generates an entry in the topology table. */
+#define FM_TOPOLOGY_ENTRY(name, conn, out, live)                               \
+    { conn, out, _generateOperatorLanes_##name, _generateVoiceLanes_##name },
+
+/** Every specialized kernel. */
+static const _FmTopologyKernels _topologyKernels[] = { FM_KNOWN_TOPOLOGIES(
+  FM_TOPOLOGY_ENTRY) };
+
+static void
+_findTopology(const float opOutput[FM_OPERATORS],
+              float (*const opModCoef)[FM_OPERATORS],
+              _FmTopology* topology)
+{
+    uint32_t conn = 0;
+    uint32_t out = 0;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        if (opOutput[op] != 0) {
+            out |= 1u << op;
+        }
+        for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+            if (opModCoef[op][modOp] != 0) {
+                conn |= FM_CONN_BIT(op, modOp);
+            }
+        }
+    }
+
+    // Walk back from the outputs through the modulators.
+    uint32_t live = out;
+    uint32_t prev;
+    do {
+        prev = live;
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            if ((live & (1u << op)) == 0) {
+                continue;
+            }
+            for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+                if ((conn & FM_CONN_BIT(op, modOp)) != 0) {
+                    live |= 1u << modOp;
+                }
+            }
+        }
+    } while (live != prev);
+
+    topology->connMask = conn;
+    topology->outMask = out;
+    topology->liveMask = live;
+    topology->renderMono = _generateOperatorLanesGeneric;
+    topology->renderPoly = _generateVoiceLanesGeneric;
+
+    const size_t nKernels =
+      sizeof(_topologyKernels) / sizeof(_topologyKernels[0]);
+    for (size_t i = 0; i < nKernels; i++) {
+        if (_topologyKernels[i].connMask == conn &&
+            _topologyKernels[i].outMask == out) {
+            topology->renderMono = _topologyKernels[i].renderMono;
+            topology->renderPoly = _topologyKernels[i].renderPoly;
+            break;
+        }
+    }
+}
+
+static _FmRenderFn
+_selectRender(const _FmSynth* synth)
+{
+    const bool mono = synth->nVoices == 1 && FM_OPERATORS == FM_LANE_WIDTH;
+    switch (synth->kernel) {
+        case FM_KERNEL_SCALAR:
+            return _generateScalar;
+        case FM_KERNEL_SIMD:
+            return mono ? _generateOperatorLanes : _generateVoiceLanes;
+        default:
+            return mono ? synth->topology.renderMono
+                        : synth->topology.renderPoly;
+    }
+}
 
-            if (finalSample >= 1) {
-                fprintf(stderr, "WARN: clipping!\n");
-                finalSample = 1;
+void
+Fm_generateSamples(FmSynthesizer* s, int16_t* sampleBuf, size_t nSamples)
+{
+    _FmSynth* synth = s->__FmSynth;
+    float bus[ENV_CONTROL_PERIOD];
+
+    _FmRenderFn render = _selectRender(synth);
+
+    // Envelopes reach a control point every ENV_CONTROL_PERIOD samples no
+    // matter how the driver splits up buffers, so render one stretch between
+    // control points at a time.
+    while (nSamples > 0) {
+        if (synth->controlCountdown == 0) {
+            // A new voice can bring a new topology, and with it a new
+            // kernel.
+            if (_takePendingVoice(synth, false)) {
+                render = _selectRender(synth);
+            }
+            _updateEnvelopes(synth);
+            synth->controlCountdown = ENV_CONTROL_PERIOD;
+            synth->idle = _isIdle(synth);
+        }
+
+        size_t n = synth->controlCountdown;
+        if (n > nSamples) {
+            n = nSamples;
+        }
+        const bool baked = _isBakedPlaying(synth);
+        if (synth->idle && !baked) {
+            // Every envelope is at zero, so the operators would only render
+            // silence. A note on can't be heard before the next control point
+            // either. The phases stand still until then, which nobody can
+            // hear.
+            memset(sampleBuf, 0, n * sizeof(int16_t));
+            synth->atZeroCrossing = true;
+            synth->limiterGain = 1;
+        } else {
+            if (synth->idle) {
+                memset(bus, 0, n * sizeof(float));
+            } else {
+                render(synth, bus, n);
             }
+            for (size_t v = 0; baked && v < synth->nVoices; v++) {
+                NoteCache_mix(&synth->voiceBaked[v], bus, n, synth->voiceGain);
+            }
+            if (n >= 2) {
+                synth->atZeroCrossing = (bus[n - 1] < 0) != (bus[n - 2] < 0);
+            }
+            _mixToPcm(synth, bus, sampleBuf, n);
         }
-        sampleBuf[s] = finalSample * INT16_MAX;
+
+        synth->controlCountdown -= n;
+        sampleBuf += n;
+        nSamples -= n;
     }
 }
@@ -4,185 +4,396 @@
  * @author Spencer Leslie 301571329
  */
 #include "das/fmplayer.h"
+#include "das/audiobackend.h"
+#include "das/eventqueue.h"
 #include "das/fm.h"
 #include "das/wavetable.h"
-#include <alsa/asoundlib.h>
-#include <alsa/pcm.h>
-#include <asm-generic/errno-base.h>
-#include <bits/pthreadtypes.h>
-#include <bits/types/struct_sched_param.h>
+#include "com/threadutils.h"
+#include "com/timeutils.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** How much of the player thread's stack to fault in before it starts
+ * playing in real time. */
+#define PLAYER_STACK_PREFAULT (64 * 1024)
+/** How long to wait on the backend before giving up, in ms. */
+#define BACKEND_WAIT_TIMEOUT_MS 200
+
+/** How many events can wait for the player thread. The thread drains the
+ * queue every period, so this only needs to cover a burst of events. */
+#define EVENT_QUEUE_CAPACITY 256
+/** How long a producer waits before trying a full queue again, in ns. */
+#define EVENT_RETRY_NS 1000000
+/** Nanoseconds in a second. */
+#define NS_PER_SECOND 1000000000LL
+/** How quickly the period clock follows the measured playback time. Each
+ * period it moves 1 / PERIOD_CLOCK_SMOOTHING of the way, which smooths out
+ * wakeup jitter while still tracking drift between the clocks. */
+#define PERIOD_CLOCK_SMOOTHING 16
+
+/** Microseconds in a second. */
+#define US_PER_SECOND 1000000LL
+/** Nanoseconds in a microsecond. */
+#define NS_PER_US 1000LL
+
+/** Kinds of event sent to the player thread. */
+typedef enum
+{
+    /** Set the note. */
+    EVENT_NOTE,
+    /** Trigger or gate the note. */
+    EVENT_NOTE_CTRL,
+    /** Switch synth voices. */
+    EVENT_VOICE,
+    /** Change the player's gain and pan. */
+    EVENT_MIX,
+    /** Give the synth a note cache. */
+    EVENT_NOTE_CACHE,
+    /** Change an operator's wave type. */
+    EVENT_OP_WAVE,
+    /** Change an operator's CM ratio. */
+    EVENT_OP_CM,
+    /** Change an operator's output strength. */
+    EVENT_OP_OUTPUT,
+    /** Fix an operator to a note. */
+    EVENT_OP_FIX,
+    /** Change a modulation connection. */
+    EVENT_OP_CONNECTION,
+} _FmEventType;
+
+/** An event for the player thread. */
+typedef struct
+{
+    /** What to do. */
+    _FmEventType type;
+    /** When to do it, on the monotonic clock, or FMPLAYER_NOW. */
+    long long timeNs;
+    /** The operator the event applies to, for operator events. */
+    FmOperator op;
+    union
+    {
+        /** EVENT_NOTE and EVENT_OP_FIX. */
+        Note note;
+        /** EVENT_NOTE_CTRL. */
+        FmPlayer_NoteCtrl ctrl;
+        /** EVENT_VOICE. NULL re-applies the current voice. */
+        const FmVoice* voice;
+        /** EVENT_NOTE_CACHE. */
+        const NoteCache* noteCache;
+        /** EVENT_OP_WAVE. */
+        WaveType wave;
+        /** EVENT_OP_CM and EVENT_OP_OUTPUT. */
+        float value;
+        /** EVENT_OP_CONNECTION. */
+        struct
+        {
+            FmOperator modOp;
+            float modIndex;
+        } connection;
+        /** EVENT_MIX. */
+        struct
+        {
+            float gain;
+            float pan;
+        } mix;
+    };
+} _FmEvent;
+
+/** Histogram the player thread can update while others read it. */
+typedef struct
+{
+    atomic_ulong counts[FMPLAYER_HISTOGRAM_BINS];
+} _FmHistogram;
 
-/** This is the main paramter for tuning latency. This will set the length of
- * the hardware buffer in microseconds. In practice, the actual length of the
- * buffer is determined by what is available in the hardware. */
-#define ALSA_BUFFERTIME 200000
+/** Playback statistics, as in FmPlayer_Stats. Only the player thread writes
+ * them. */
+typedef struct
+{
+    atomic_ulong periods;
+    atomic_ulong xruns;
+    atomic_ulong recoveries;
+    atomic_ulong timeouts;
+    atomic_ulong overruns;
+    atomic_ulong idlePeriods;
+    atomic_ulong droppedEvents;
+    atomic_llong maxRenderUs;
+    atomic_llong minMarginUs;
+    _FmHistogram renderUs;
+    _FmHistogram renderMarginUs;
+    _FmHistogram delayFrames;
+} _FmPlayerStats;
+
+/** A synth on the output. */
+struct FmPlayer
+{
+    /** The synthesizer.*/
+    FmSynthesizer* synth;
+
+    /** Events waiting for the player thread. */
+    EventQueue* events;
+    /** Events taken off the queue that are due in a later period, sorted by
+     * time. Only touched by the player thread. */
+    _FmEvent pending[EVENT_QUEUE_CAPACITY];
+    /** How many events are pending. */
+    size_t nPending;
+
+    /** Current voice. Only touched by the player thread once it is
+     * running. */
+    const FmVoice* voice;
+    /** Have the operators been tweaked since the voice was applied? */
+    bool tweaked;
+    /** The voice's params with the tweaks made to them. Only valid if
+     * tweaked. */
+    FmSynthParams params;
+
+    /** Voices compiled so far, so each preset is only compiled once. */
+    FmVoice** voices;
+    /** How many voices are compiled. */
+    size_t nVoices;
+    /** How many voices fit in voices. */
+    size_t voicesCapacity;
 
-/** Flags determining whether the synth voice or any operators need updating. */
-#define UPDATE_NEEDED_BIT 0x1
-#define UPDATE_VOICE_BIT (0x1 << FM_OPERATORS)
+    /** What the synth is mixed into each output channel at. Only touched by
+     * the player thread once it is running. */
+    float channelGain[FMPLAYER_MAX_CHANNELS];
 
-/** FmPlayer private data. */
+    /** Note caches sent to the synth, counted when they are sent so that
+     * one too many can be turned away. */
+    atomic_uint nNoteCaches;
+
+    /** The synth's mix statistics as of the last period, so only what is
+     * new gets added to the output's. Only touched by the player thread. */
+    FmMixStats mixSeen;
+};
+
+/** The output the players are mixed into. */
 typedef struct
 {
-    /** Note to play. */
-    Note note;
-    /** Control operation that needs to be performed. */
-    FmPlayer_NoteCtrl ctrl;
     /** Are we running? */
     int running;
-    /** Flags indicating which updates need to be made. */
-    int updatesNeeded;
 
-    /** Pointer to a sample buffer that receives PCM frames from the synth. */
-    int16_t* sampleBuffer;
+    /** Audio output configuration. */
+    FmPlayer_Config config;
 
-    /** Handle to the PCM device. */
-    snd_pcm_t* pcmHandle;
-    /** PCM hardware buffer size. */
-    snd_pcm_uframes_t bufferSize;
-    /** PCM hardware period size. */
-    snd_pcm_uframes_t periodSize;
+    /** Where the samples go. */
+    AudioBackend* backend;
 
-    /** The synthesizer.*/
-    FmSynthesizer* synth;
+    /** Is periodStartNs a valid prediction? */
+    bool periodClockValid;
+    /** When the first frame of the next period is predicted to be heard. */
+    long long periodStartNs;
 
-    /** Worker thread that drives the synth. */
+    /** Worker thread that drives the synths. */
     pthread_t playerThread;
 
-    /**
-     * Lock for updates to the synth params.
-     * We only lock updates to the params, not the note or note control.
-     * Updating the note or note control will be atomic since they are both
-     * 32-bit ints and should be aligned. */
-    pthread_rwlock_t updateRwLock;
+    /** Held by the player thread while it writes a period, so players only
+     * come and go between periods. */
+    pthread_mutex_t playersMutex;
+    /** The players, in the order they were created. */
+    FmPlayer* players[FMPLAYER_MAX_PLAYERS];
+    /** How many players there are. */
+    size_t nPlayers;
+    /** The player made by FmPlayer_initialize. See FMPLAYER_MAIN. */
+    FmPlayer* main;
+
+    /** A player's samples, before they are mixed. A period long. */
+    int16_t* playerBuffer;
+    /** The players mixed together, a period of frames long. */
+    float* mixBus;
+    /** Samples the synths and the mix clipped. Only the player thread writes
+     * it. */
+    atomic_ulong mixClipped;
+    /** Blocks the synths' limiters turned down. Only the player thread
+     * writes it. */
+    atomic_ulong mixLimited;
+
+    /** Called as the output renders. See FmPlayer_setClock. Only touched
+     * with playersMutex held. */
+    FmPlayer_ClockFn clock;
+    /** Passed to the clock. */
+    void* clockData;
+    /** Frames rendered since the clock was last called. */
+    size_t clockElapsed;
+    /** Frames left to render before the clock is due. */
+    size_t clockDue;
+
+    /** Playback statistics. */
+    _FmPlayerStats stats;
+    /** Prints the statistics when asked by SIGUSR1, so the player thread
+     * never has to. */
+    pthread_t statsThread;
+    /** Is the stats thread running? */
+    bool hasStatsThread;
+} _FmOutput;
+
+/** The output. */
+static _FmOutput* _output;
+/** Guards the compiled voices, which any thread may add to. */
+static pthread_mutex_t _voicesMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Is this the player thread? Events it sends to itself, from a render
+ * clock, can't wait for it to make room. */
+static _Thread_local bool _onPlayerThread;
+
+/** Posted by SIGUSR1 to ask the stats thread to print the statistics. */
+static sem_t _printStatsRequest;
 
-    /** Current synth params. */
-    FmSynthParams params;
-} _FmPlayer;
-
-/** Pointer to the Fm Player. */
-static _FmPlayer* _fmPlayer;
-
-/** Writes samples to the PCM driver. */
-static int
-_writeToPcmBuffer(snd_pcm_t* pcm, int16_t* buffer, size_t nSamples);
 /** Main worker thread function. */
 static void*
 _play(void* arg);
-/** Configures audio hardware parameters. */
+/** Stats thread function. Prints the statistics each time SIGUSR1 asks. */
+static void*
+_printStatsOnRequest(void* arg);
+/** Open the backend the config asks for. */
 static int
-_setHwparams(snd_pcm_t* handle, snd_pcm_hw_params_t* params);
-/** Configures audio driver software parameters. */
+_openBackend(const FmSynthParams* params);
+/** Get the player to send to: the main player if player is FMPLAYER_MAIN. */
+static FmPlayer*
+_resolve(FmPlayer* player);
+/** Make a player. It plays once it is added to the output. */
+static FmPlayer*
+_createPlayer(const FmSynthParams* params);
+/** Free a player that isn't on the output. */
+static void
+_destroyPlayer(FmPlayer* player);
+/** Add a player to the output. Returns false if there's no room. */
+static bool
+_addPlayer(FmPlayer* player);
+/** Queue an event for the player thread, waiting for room if needed. */
+static void
+_postEvent(FmPlayer* player, const _FmEvent* event);
+/** Apply an event to the synth. Called on the player thread. */
+static void
+_applyEvent(FmPlayer* player, const _FmEvent* event);
+/** Work out the gain of each output channel for a gain and pan. */
+static void
+_setMix(FmPlayer* player, float gain, float pan);
+/** Find the compiled voice for the params, compiling it if there isn't one
+ * yet. Returns NULL if it can't be compiled. */
+static const FmVoice*
+_findVoice(FmPlayer* player, const FmSynthParams* params);
+/** Free every compiled voice. */
+static void
+_freeVoices(FmPlayer* player);
+/** Move events from the queue into the pending list. */
+static void
+_takeEvents(FmPlayer* player);
+/** Estimate when the first frame of the period about to be rendered will be
+ * heard, given the time now and the frames queued ahead of it. */
+static long long
+_estimatePeriodStart(long long nowNs, long delay);
+/** Recover the stream from an error, counting it in the stats. */
 static int
-_setSwparams(snd_pcm_t* handle, snd_pcm_sw_params_t* swparams);
-/** Configures Alsa for our needs. */
+_recover(int err);
+/** Add a value to a histogram. */
+static void
+_histogramAdd(_FmHistogram* histogram, long long value);
+/** Record the stats for a period that was written. */
+static void
+_recordPeriod(long long startNs, long delay);
+/** Copy a histogram out of the stats. */
+static void
+_histogramLoad(const _FmHistogram* histogram, FmPlayer_Histogram* out);
+/** SIGUSR1 handler. */
+static void
+_onPrintStatsSignal(int signal);
+/** Frame offset into the period starting at periodStartNs where the event
+ * falls. */
+static long long
+_eventOffset(const _FmEvent* event, long long periodStartNs);
+/** Render frames [from, to) of the period starting at startNs into buffer,
+ * applying pending events at the frame they fall on. If mixBus isn't NULL,
+ * also mix them into it. */
+static void
+_renderFrames(FmPlayer* player,
+              int16_t* buffer,
+              float* mixBus,
+              size_t from,
+              size_t to,
+              long long startNs);
+/** Mix a player's samples into the mix bus. */
+static void
+_mixPlayer(const FmPlayer* player,
+           const int16_t* samples,
+           float* mixBus,
+           size_t nFrames);
+/** Convert the mix bus to samples for the backend, saturating. */
+static void
+_mixToPcm(const float* mixBus, int16_t* buffer, size_t nFrames);
+/** Is a gain or pan change pending for the player? */
+static bool
+_hasMixEvent(const FmPlayer* player);
+/** Is the player silent up to frame to of the period starting at startNs? */
+static bool
+_isSilent(const FmPlayer* player, size_t to, long long startNs);
+/** Render every player into the frames [from, to) of the period starting at
+ * startNs. Returns false if they were all silent. */
+static bool
+_renderPlayers(int16_t* buffer, size_t from, size_t to, long long startNs);
+/** Call the render clock and take the events it sent. */
+static void
+_tickClock(void);
+/** Render the next period and hand it to the backend. */
 static int
-_configureAlsa(snd_pcm_t* handle);
-
-static int
-_writeToPcmBuffer(snd_pcm_t* pcm, int16_t* buffer, size_t nSamples)
-{
-    long written = 0;
-    long offset = 0;
-    int remain = nSamples;
-    while (remain > 0) {
-        written = snd_pcm_writei(pcm, buffer + offset, remain);
-        // This is non-blocking, so we may get asked to try again
-        if (written == -EAGAIN) {
-            continue;
-        }
-        if (written < 0) {
-            return written;
-        }
-        offset += written;
-        remain -= written;
-    }
-    return 0;
-}
+_writePeriod(void);
+/** Add what the synths' limiters did this period to the output's mix
+ * statistics, so they can be read without taking playersMutex. */
+static void
+_recordMixStats(void);
 
 static void*
 _play(void* arg)
 {
     (void)arg;
     int status;
+    _onPlayerThread = true;
 
-    snd_pcm_start(_fmPlayer->pcmHandle);
-
-    while (_fmPlayer->running) {
-        // set synth params if we need to
-        pthread_rwlock_rdlock(&_fmPlayer->updateRwLock);
-        if ((_fmPlayer->updatesNeeded & UPDATE_VOICE_BIT) == UPDATE_VOICE_BIT) {
-            Fm_updateParams(_fmPlayer->synth, &_fmPlayer->params);
-        }
-
-        // apply any pending operator updates
-        for (int op = 0; op < FM_OPERATORS; op++) {
-            if ((_fmPlayer->updatesNeeded & (UPDATE_NEEDED_BIT << op)) ==
-                (UPDATE_NEEDED_BIT << op)) {
-                Fm_updateOpParams(
-                  _fmPlayer->synth, op, &_fmPlayer->params.opParams[op]);
-            }
-        }
-        _fmPlayer->updatesNeeded = 0;
-        pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
-
-        // apply pending note update
-        if (_fmPlayer->note != NOTE_NONE) {
-            Fm_setNote(_fmPlayer->synth, _fmPlayer->note);
-            _fmPlayer->note = NOTE_NONE;
-        }
-
-        // trigger or gate a note
-        if (_fmPlayer->ctrl != NOTE_CTRL_NONE) {
-            if (_fmPlayer->ctrl == NOTE_CTRL_NOTE_STOCCATO ||
-                _fmPlayer->ctrl == NOTE_CTRL_NOTE_ON) {
-                Fm_noteOn(_fmPlayer->synth);
-            }
-
-            if (_fmPlayer->ctrl == NOTE_CTRL_NOTE_STOCCATO ||
-                _fmPlayer->ctrl == NOTE_CTRL_NOTE_OFF) {
-                Fm_noteOff(_fmPlayer->synth);
-            }
+    if (_output->config.realtimePriority > 0) {
+        Threadutils_prefaultStack(PLAYER_STACK_PREFAULT);
+    }
 
-            _fmPlayer->ctrl = NOTE_CTRL_NONE;
-        }
+    AudioBackend_start(_output->backend);
 
+    while (_output->running) {
         // wait for a period to become available.
         // This blocks until the next period is ready to write.
-        status = snd_pcm_wait(_fmPlayer->pcmHandle, 200);
+        status = AudioBackend_wait(_output->backend, BACKEND_WAIT_TIMEOUT_MS);
         if (status < 0) {
             // Try to recover the stream!
-            if ((status = snd_pcm_recover(_fmPlayer->pcmHandle, status, 0)) <
-                0) {
+            if ((status = _recover(status)) < 0) {
                 fprintf(stderr,
                         "Player received unrecoverable error %s\n",
-                        snd_strerror(status));
+                        strerror(-status));
                 // TODO: we need a way to shut down from here.
                 return NULL;
             }
         } else if (status == 0) {
             // time out on wait. Loop again to update params.
-            printf("we timed out\n");
+            atomic_fetch_add_explicit(
+              &_output->stats.timeouts, 1, memory_order_relaxed);
             continue;
         }
 
         // we have a period ready to be written, and the previous one is
-        // being sent to the speakers. Now is the time we generate samples,
-        Fm_generateSamples(
-          _fmPlayer->synth, _fmPlayer->sampleBuffer, _fmPlayer->periodSize);
-
-        // .. and write them out
-        if ((status = _writeToPcmBuffer(_fmPlayer->pcmHandle,
-                                        _fmPlayer->sampleBuffer,
-                                        _fmPlayer->periodSize)) < 0) {
-            fprintf(stderr, "recovering from error %s\n", snd_strerror(status));
-            if ((status = snd_pcm_recover(_fmPlayer->pcmHandle, status, 0)) <
-                0) {
+        // being sent to the speakers. Now is the time we generate samples
+        // and write them out.
+        pthread_mutex_lock(&_output->playersMutex);
+        status = _writePeriod();
+        pthread_mutex_unlock(&_output->playersMutex);
+        if (status < 0) {
+            // Counted in the stats. Printing here could cost another period.
+            if ((status = _recover(status)) < 0) {
                 fprintf(stderr,
                         "Player received unrecoverable error %s\n",
-                        snd_strerror(status));
+                        strerror(-status));
                 // TODO: we need a way to shut down from here.
                 return NULL;
             }
@@ -191,337 +402,1007 @@ _play(void* arg)
     return NULL;
 }
 
-static int
-_setHwparams(snd_pcm_t* handle, snd_pcm_hw_params_t* params)
-{
-    // Implementation adapted from the one given at
-    // https://www.alsa-project.org/alsa-doc/alsa-lib/_2test_2pcm_8c-example.html
-
-    unsigned int rrate;
-    int err;
-
-    /* choose all parameters */
-    err = snd_pcm_hw_params_any(handle, params);
-    if (err < 0) {
-        printf("Broken configuration for playback: no configurations "
-               "available: %s\n",
-               snd_strerror(err));
-        return err;
-    }
-    /* set hardware resampling */
-    err = snd_pcm_hw_params_set_rate_resample(handle, params, 1);
-    if (err < 0) {
-        printf("Resampling setup failed for playback: %s\n", snd_strerror(err));
-        return err;
-    }
-    /* set the interleaved read/write format */
-    err = snd_pcm_hw_params_set_access(
-      handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (err < 0) {
-        printf("Access type not available for playback: %s\n",
-               snd_strerror(err));
-        return err;
-    }
-    /* set the sample format */
-    err = snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S16_LE);
-    if (err < 0) {
-        printf("Sample format not available for playback: %s\n",
-               snd_strerror(err));
-        return err;
-    }
-    /* set the count of channels */
-    err = snd_pcm_hw_params_set_channels(handle, params, 1);
-    if (err < 0) {
-        printf("Channels count (%u) not available for playbacks: %s\n",
-               1,
-               snd_strerror(err));
-        return err;
-    }
-    /* set the stream rate */
-    unsigned int rate = 44100;
-    rrate = rate;
-    err = snd_pcm_hw_params_set_rate_near(handle, params, &rrate, 0);
-    if (err < 0) {
-        printf("Rate %uHz not available for playback: %s\n",
-               rrate,
-               snd_strerror(err));
-        return err;
-    }
-    if (rrate != rate) {
-        printf("Rate doesn't match (requested %uHz, get %iHz)\n", rate, err);
-        return -EINVAL;
+static void*
+_printStatsOnRequest(void* arg)
+{
+    (void)arg;
+    while (1) {
+        while (sem_wait(&_printStatsRequest) < 0) {
+            // Interrupted. Wait again.
+        }
+        if (!_output->running) {
+            return NULL;
+        }
+        FmPlayer_printStats(stderr);
     }
+}
 
-    /* Configure the buffer size. We want the buffer to be 2 periods long.
-     */
-    unsigned int buftime = ALSA_BUFFERTIME;
-    int dir = 0;
-    err =
-      snd_pcm_hw_params_set_buffer_time_near(handle, params, &buftime, &dir);
-    if (err < 0) {
-        printf(
-          "Unable to set buffer time %u: %s\n", buftime, snd_strerror(err));
-        return err;
-    }
-
-    if ((err = snd_pcm_hw_params_get_buffer_size(params,
-                                                 &_fmPlayer->bufferSize)) < 0) {
-        printf("err getting buffer size size: %s\n", snd_strerror(err));
-        return err;
-    } else {
-        printf(
-          "Buffer size is %lu and dir is %d\n", _fmPlayer->bufferSize, dir);
-    }
-
-    /* Alsa divides its buffers into "periods", and does stuff when playback
-     * reaches the period boundaries like sending data to the ADC (I think?)
-     * and waking up applications waiting for buffers to become ready. To
-     * keep latency low low low, we wanna use 2 periods. Alsa can then do
-     * whatever it's gotta with the data in one period while we're writing
-     * to the other. */
-    snd_pcm_uframes_t period = _fmPlayer->bufferSize / 2;
-    dir = 0;
-    printf("Trying to set period size to %lu\n", period);
-    err = snd_pcm_hw_params_set_period_size_near(handle, params, &period, &dir);
-    if (err < 0) {
-        printf(
-          "Unable to set period size %lu: %s\n", period, snd_strerror(err));
-        return err;
-    }
-
-    if ((err = snd_pcm_hw_params_get_period_size(
-           params, &_fmPlayer->periodSize, &dir)) < 0) {
-        printf("err getting period size: %s\n", snd_strerror(err));
-        return err;
-    } else {
-        printf(
-          "Period size is %lu and dir is %d\n", _fmPlayer->periodSize, dir);
-    }
-
-    /* write the parameters to device */
-    err = snd_pcm_hw_params(handle, params);
-    if (err < 0) {
-        printf("Unable to set hw params for playback: %s\n", snd_strerror(err));
-        return err;
+static void
+_takeEvents(FmPlayer* player)
+{
+    _FmEvent event;
+    // Stop when pending is full. Anything left stays in the queue until
+    // there is room, so nothing is dropped.
+    while (player->nPending < EVENT_QUEUE_CAPACITY &&
+           EventQueue_pop(player->events, &event)) {
+        // Insert after everything due at the same time or earlier, so events
+        // for the same time apply in the order they were sent.
+        size_t i = player->nPending;
+        while (i > 0 && player->pending[i - 1].timeNs > event.timeNs) {
+            player->pending[i] = player->pending[i - 1];
+            i--;
+        }
+        player->pending[i] = event;
+        player->nPending++;
     }
-    return 0;
 }
 
 static int
-_setSwparams(snd_pcm_t* handle, snd_pcm_sw_params_t* swparams)
-{
-    // Implementation adapted from the one given at
-    // https://www.alsa-project.org/alsa-doc/alsa-lib/_2test_2pcm_8c-example.html
-
-    int err;
-
-    /* get the current swparams */
-    err = snd_pcm_sw_params_current(handle, swparams);
-    if (err < 0) {
-        printf("Unable to determine current swparams for playback: %s\n",
-               snd_strerror(err));
-        return err;
-    }
-    // TODO: this should be much closer to the buffer size
-    if ((err = snd_pcm_sw_params_set_avail_min(
-           handle, swparams, _fmPlayer->periodSize)) < 0) {
-        printf("Unable to set avail min: %s\n", snd_strerror(err));
-        return err;
-    }
-
-    /* Threshold to stat playing. Choose one period. */
-    err = snd_pcm_sw_params_set_start_threshold(
-      handle, swparams, _fmPlayer->periodSize);
-    if (err < 0) {
-        printf("Unable to set start threshold mode for playback: %s\n",
-               snd_strerror(err));
-        return err;
-    }
-    /* allow the transfer when at least period_size samples can be processed
-     */
-    /* or disable this mechanism when period event is enabled (aka interrupt
-     * like style processing) */
-    err = snd_pcm_sw_params_set_period_event(handle, swparams, 1);
-    if (err < 0) {
-        printf("Unable to set period event: %s\n", snd_strerror(err));
-        return err;
-    }
-
-    /* write the parameters to the playback device */
-    err = snd_pcm_sw_params(handle, swparams);
-    if (err < 0) {
-        printf("Unable to set sw params for playback: %s\n", snd_strerror(err));
-        return err;
-    }
-    snd_pcm_drop(handle);
-    return 0;
+_recover(int err)
+{
+    atomic_fetch_add_explicit(
+      &_output->stats.recoveries, 1, memory_order_relaxed);
+    if (err == -EPIPE) {
+        atomic_fetch_add_explicit(
+          &_output->stats.xruns, 1, memory_order_relaxed);
+    }
+    _output->periodClockValid = false;
+    return AudioBackend_recover(_output->backend, err);
 }
 
-static int
-_configureAlsa(snd_pcm_t* handle)
+static void
+_histogramAdd(_FmHistogram* histogram, long long value)
+{
+    int bin = 0;
+    while (value > 0 && bin < FMPLAYER_HISTOGRAM_BINS - 1) {
+        value >>= 1;
+        bin++;
+    }
+    atomic_fetch_add_explicit(
+      &histogram->counts[bin], 1, memory_order_relaxed);
+}
+
+static void
+_recordPeriod(long long startNs, long delay)
+{
+    _FmPlayerStats* stats = &_output->stats;
+    long long renderUs =
+      (Timeutils_getMonotonicTimeInNs() - startNs) / NS_PER_US;
+    long long queuedUs =
+      delay * US_PER_SECOND / _output->backend->sampleRate;
+    long long marginUs = queuedUs - renderUs;
+
+    atomic_fetch_add_explicit(&stats->periods, 1, memory_order_relaxed);
+    _histogramAdd(&stats->renderUs, renderUs);
+    if (renderUs >
+        atomic_load_explicit(&stats->maxRenderUs, memory_order_relaxed)) {
+        atomic_store_explicit(
+          &stats->maxRenderUs, renderUs, memory_order_relaxed);
+    }
+    if (!_output->backend->realtime) {
+        // Nothing is waiting on the samples, so there is no deadline.
+        return;
+    }
+
+    if (marginUs <= 0) {
+        atomic_fetch_add_explicit(&stats->overruns, 1, memory_order_relaxed);
+    }
+    // Only this thread writes these, so there's no race between the load
+    // and the store.
+    if (marginUs <
+        atomic_load_explicit(&stats->minMarginUs, memory_order_relaxed)) {
+        atomic_store_explicit(
+          &stats->minMarginUs, marginUs, memory_order_relaxed);
+    }
+    _histogramAdd(&stats->renderMarginUs, marginUs);
+    _histogramAdd(&stats->delayFrames, delay);
+}
+
+static void
+_histogramLoad(const _FmHistogram* histogram, FmPlayer_Histogram* out)
 {
-    snd_pcm_hw_params_t* hwParams;
-    snd_pcm_sw_params_t* swParams;
-    int err;
-    int16_t* silence;
+    for (int i = 0; i < FMPLAYER_HISTOGRAM_BINS; i++) {
+        out->counts[i] =
+          atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+}
 
-    snd_pcm_hw_params_alloca(&hwParams);
-    snd_pcm_sw_params_alloca(&swParams);
+void
+FmPlayer_printHistogram(FILE* out,
+                        const char* name,
+                        const FmPlayer_Histogram* h)
+{
+    fprintf(out, "%s:\n", name);
+    for (int i = 0; i < FMPLAYER_HISTOGRAM_BINS; i++) {
+        if (h->counts[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            fprintf(out, "  %10s %10s  %lu\n", "<=", "0", h->counts[i]);
+        } else if (i == FMPLAYER_HISTOGRAM_BINS - 1) {
+            fprintf(out,
+                    "  %10s %10lld  %lu\n",
+                    ">=",
+                    1LL << (i - 1),
+                    h->counts[i]);
+        } else {
+            fprintf(out,
+                    "  %10lld %10lld  %lu\n",
+                    1LL << (i - 1),
+                    (1LL << i) - 1,
+                    h->counts[i]);
+        }
+    }
+}
 
-    if ((err = _setHwparams(handle, hwParams)) < 0) {
-        return err;
+static void
+_onPrintStatsSignal(int signal)
+{
+    (void)signal;
+    // Safe in a signal handler, unlike printing.
+    sem_post(&_printStatsRequest);
+}
+
+static long long
+_estimatePeriodStart(long long nowNs, long delay)
+{
+    const AudioBackend* backend = _output->backend;
+    long long measured = nowNs + delay * NS_PER_SECOND / backend->sampleRate;
+    long long periodNs =
+      backend->periodSize * NS_PER_SECOND / backend->sampleRate;
+
+    long long start = measured;
+    if (_output->periodClockValid) {
+        // Frames go out at exactly the sample rate, so the prediction is
+        // steadier than the measurement. Only nudge it towards the
+        // measurement, unless they're so far apart that we must have lost
+        // track.
+        long long error = measured - _output->periodStartNs;
+        if (error > -periodNs && error < periodNs) {
+            start = _output->periodStartNs + error / PERIOD_CLOCK_SMOOTHING;
+        }
     }
 
-    if ((err = _setSwparams(handle, swParams)) < 0) {
-        return err;
+    _output->periodClockValid = true;
+    _output->periodStartNs = start + periodNs;
+    return start;
+}
+
+static long long
+_eventOffset(const _FmEvent* event, long long periodStartNs)
+{
+    if (event->timeNs <= periodStartNs) {
+        return 0;
     }
+    return (event->timeNs - periodStartNs) * _output->backend->sampleRate /
+           NS_PER_SECOND;
+}
 
-    silence = malloc(sizeof(int16_t) * _fmPlayer->bufferSize);
+static void
+_renderFrames(FmPlayer* player,
+              int16_t* buffer,
+              float* mixBus,
+              size_t from,
+              size_t to,
+              long long startNs)
+{
+    const unsigned int channels = _output->backend->channels;
+    size_t done = from;
+
+    while (done < to) {
+        // Apply everything due by this frame, then render up to the next
+        // event or the end of the range.
+        size_t next = to;
+        size_t applied = 0;
+        while (applied < player->nPending) {
+            long long offset = _eventOffset(&player->pending[applied], startNs);
+            if (offset > (long long)done) {
+                if (offset < (long long)to) {
+                    next = offset;
+                }
+                break;
+            }
+            _applyEvent(player, &player->pending[applied]);
+            applied++;
+        }
+        if (applied > 0) {
+            player->nPending -= applied;
+            memmove(player->pending,
+                    player->pending + applied,
+                    player->nPending * sizeof(_FmEvent));
+        }
 
-    if ((err = snd_pcm_prepare(handle)) < 0) {
-        printf("Prepare error: %s\n", snd_strerror(err));
-        return err;
+        Fm_generateSamples(player->synth, buffer + (done - from), next - done);
+        // Mixed as we go, so gain changes land on the frame they are due.
+        if (mixBus) {
+            _mixPlayer(player,
+                       buffer + (done - from),
+                       mixBus + (done - from) * channels,
+                       next - done);
+        }
+        done = next;
+    }
+}
+
+static void
+_mixPlayer(const FmPlayer* player,
+           const int16_t* samples,
+           float* mixBus,
+           size_t nFrames)
+{
+    const unsigned int channels = _output->backend->channels;
+    for (size_t i = 0; i < nFrames; i++) {
+        for (unsigned int c = 0; c < channels; c++) {
+            mixBus[i * channels + c] += samples[i] * player->channelGain[c];
+        }
     }
+}
 
-    if ((err = snd_pcm_format_set_silence(
-           SND_PCM_FORMAT_S16_LE, silence, _fmPlayer->bufferSize)) < 0) {
-        printf("Silence error: %s\n", snd_strerror(err));
-        return err;
+static void
+_mixToPcm(const float* mixBus, int16_t* buffer, size_t nFrames)
+{
+    const size_t nSamples = nFrames * _output->backend->channels;
+    unsigned long clipped = 0;
+    for (size_t i = 0; i < nSamples; i++) {
+        float sample = mixBus[i];
+        if (sample > INT16_MAX) {
+            sample = INT16_MAX;
+            clipped++;
+        } else if (sample < INT16_MIN) {
+            sample = INT16_MIN;
+            clipped++;
+        }
+        buffer[i] = (int16_t)sample;
+    }
+    if (clipped > 0) {
+        atomic_fetch_add_explicit(
+          &_output->mixClipped, clipped, memory_order_relaxed);
+    }
+}
+
+static bool
+_hasMixEvent(const FmPlayer* player)
+{
+    for (size_t i = 0; i < player->nPending; i++) {
+        if (player->pending[i].type == EVENT_MIX) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+_isSilent(const FmPlayer* player, size_t to, long long startNs)
+{
+    // An event could start a note, so the player is only idle until its
+    // next one.
+    return Fm_isIdle(player->synth) &&
+           (player->nPending == 0 ||
+            _eventOffset(&player->pending[0], startNs) >= (long long)to);
+}
+
+static bool
+_renderPlayers(int16_t* buffer, size_t from, size_t to, long long startNs)
+{
+    const unsigned int channels = _output->backend->channels;
+    const size_t nFrames = to - from;
+
+    FmPlayer* sounding[FMPLAYER_MAX_PLAYERS];
+    size_t nSounding = 0;
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        if (!_isSilent(_output->players[p], to, startNs)) {
+            sounding[nSounding++] = _output->players[p];
+        }
+    }
+
+    if (nSounding == 0) {
+        // Nothing to hear, so don't wake the synths.
+        memset(buffer, 0, nFrames * channels * sizeof(int16_t));
+        return false;
+    }
+
+    // A lone player at unity gain on a mono output renders straight into
+    // the backend's buffer, as if there were no mixer, unless its gain is
+    // about to change.
+    if (nSounding == 1 && channels == 1 &&
+        sounding[0]->channelGain[0] == 1.0f && !_hasMixEvent(sounding[0])) {
+        _renderFrames(sounding[0], buffer, NULL, from, to, startNs);
+        return true;
+    }
+
+    memset(_output->mixBus, 0, nFrames * channels * sizeof(float));
+    for (size_t p = 0; p < nSounding; p++) {
+        _renderFrames(sounding[p],
+                      _output->playerBuffer,
+                      _output->mixBus,
+                      from,
+                      to,
+                      startNs);
+    }
+    _mixToPcm(_output->mixBus, buffer, nFrames);
+    return true;
+}
+
+static void
+_tickClock(void)
+{
+    size_t due = _output->clock(
+      _output->clockData, _output->clockElapsed, _output->backend->sampleRate);
+    // Due again straight away would never get any frames rendered.
+    _output->clockDue = due > 0 ? due : 1;
+    _output->clockElapsed = 0;
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        _takeEvents(_output->players[p]);
+    }
+}
+
+static int
+_writePeriod(void)
+{
+    AudioBackend* backend = _output->backend;
+    const size_t nFrames = backend->periodSize;
+    const unsigned int channels = backend->channels;
+    const long long nowNs = Timeutils_getMonotonicTimeInNs();
+    long delay = AudioBackend_delay(backend);
+    if (delay < 0) {
+        delay = 0;
+    }
+    const long long startNs = _estimatePeriodStart(nowNs, delay);
+    size_t done = 0;
+    bool sounding = false;
+
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        _takeEvents(_output->players[p]);
+    }
+    if (_output->clock) {
+        _tickClock();
     }
+    while (done < nFrames) {
+        // The backend may give us less than a period at a time, such as
+        // where a ring buffer wraps.
+        int16_t* buffer;
+        long frames = AudioBackend_begin(backend, &buffer, nFrames - done);
+        if (frames < 0) {
+            return frames;
+        }
+        if (frames == 0) {
+            // Not enough room yet. Sleep until the backend makes some.
+            int err = AudioBackend_wait(backend, BACKEND_WAIT_TIMEOUT_MS);
+            if (err < 0) {
+                return err;
+            }
+            continue;
+        }
 
-    if ((err = _writeToPcmBuffer(handle, silence, _fmPlayer->bufferSize)) < 0) {
-        printf("Write error: %s\n", snd_strerror(err));
-        return err;
+        // Stop wherever the render clock is due, so what it plays starts on
+        // that frame.
+        size_t at = done;
+        while (at < done + frames) {
+            size_t next = done + frames;
+            if (_output->clock) {
+                if (_output->clockDue == 0) {
+                    _tickClock();
+                }
+                if (next - at > _output->clockDue) {
+                    next = at + _output->clockDue;
+                }
+                _output->clockDue -= next - at;
+                _output->clockElapsed += next - at;
+            }
+            sounding |= _renderPlayers(
+              buffer + (at - done) * channels, at, next, startNs);
+            at = next;
+        }
+        int err = AudioBackend_commit(backend, frames);
+        if (err < 0) {
+            return err;
+        }
+        done += frames;
     }
-    // TODO pretty sure this just lets alsa write errors to stdout?
-    snd_output_t* output;
-    err = snd_output_stdio_attach(&output, stdout, 0);
-    if (err < 0) {
-        printf("Output failed: %s\n", snd_strerror(err));
-        return err;
+
+    if (!sounding) {
+        atomic_fetch_add_explicit(
+          &_output->stats.idlePeriods, 1, memory_order_relaxed);
     }
+    _recordMixStats();
+    _recordPeriod(nowNs, delay);
     return 0;
 }
 
-void
-FmPlayer_setNote(Note note)
+static void
+_recordMixStats(void)
 {
-    _fmPlayer->note = note;
+    unsigned long clipped = 0;
+    unsigned long limited = 0;
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        FmPlayer* player = _output->players[p];
+        FmMixStats mix;
+        Fm_getMixStats(player->synth, &mix);
+        clipped += mix.clipped - player->mixSeen.clipped;
+        limited += mix.limited - player->mixSeen.limited;
+        player->mixSeen = mix;
+    }
+    if (clipped) {
+        atomic_fetch_add_explicit(
+          &_output->mixClipped, clipped, memory_order_relaxed);
+    }
+    if (limited) {
+        atomic_fetch_add_explicit(
+          &_output->mixLimited, limited, memory_order_relaxed);
+    }
 }
 
-void
-FmPlayer_controlNote(FmPlayer_NoteCtrl ctrl)
+static void
+_postEvent(FmPlayer* player, const _FmEvent* event)
 {
-    _fmPlayer->ctrl = ctrl;
+    if (_onPlayerThread) {
+        // Only this thread makes room, so waiting would never end.
+        if (!EventQueue_push(player->events, event)) {
+            atomic_fetch_add_explicit(
+              &_output->stats.droppedEvents, 1, memory_order_relaxed);
+        }
+        return;
+    }
+
+    // Never drop an event. The player thread empties the queue every period,
+    // so there will be room soon.
+    const struct timespec retry = { .tv_sec = 0, .tv_nsec = EVENT_RETRY_NS };
+    while (!EventQueue_push(player->events, event)) {
+        nanosleep(&retry, NULL);
+    }
 }
 
-void
-FmPlayer_setSynthVoice(const FmSynthParams* newVoice)
+static void
+_applyEvent(FmPlayer* player, const _FmEvent* event)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
-    if (newVoice != NULL) {
-        memcpy(&_fmPlayer->params, newVoice, sizeof(FmSynthParams));
+    OperatorParams* opParams = &player->params.opParams[event->op];
+
+    // Tweaks start from the voice's params.
+    if (event->type >= EVENT_OP_WAVE && !player->tweaked) {
+        memcpy(&player->params,
+               Fm_getVoiceParams(player->voice),
+               sizeof(FmSynthParams));
+        player->tweaked = true;
     }
 
-    // Set update voice bit and clear operator update bits as those updates
-    // are now invalid
-    _fmPlayer->updatesNeeded |= UPDATE_VOICE_BIT;
+    switch (event->type) {
+        case EVENT_NOTE:
+            Fm_setNote(player->synth, event->note);
+            return;
+        case EVENT_NOTE_CTRL:
+            if (event->ctrl == NOTE_CTRL_NOTE_STOCCATO ||
+                event->ctrl == NOTE_CTRL_NOTE_ON) {
+                Fm_noteOn(player->synth);
+            }
+            if (event->ctrl == NOTE_CTRL_NOTE_STOCCATO ||
+                event->ctrl == NOTE_CTRL_NOTE_OFF) {
+                Fm_noteOff(player->synth);
+            }
+            return;
+        case EVENT_VOICE:
+            if (event->voice != NULL) {
+                player->voice = event->voice;
+            }
+            player->tweaked = false;
+            Fm_setVoice(player->synth, player->voice);
+            return;
+        case EVENT_MIX:
+            _setMix(player, event->mix.gain, event->mix.pan);
+            return;
+        case EVENT_NOTE_CACHE:
+            Fm_addNoteCache(player->synth, event->noteCache);
+            return;
+        case EVENT_OP_WAVE:
+            opParams->waveType = event->wave;
+            break;
+        case EVENT_OP_CM:
+            opParams->CmRatio = event->value;
+            break;
+        case EVENT_OP_OUTPUT:
+            opParams->outputStrength = event->value;
+            break;
+        case EVENT_OP_FIX:
+            opParams->CmRatio = -1;
+            opParams->fixToNote = event->note;
+            break;
+        case EVENT_OP_CONNECTION:
+            opParams->algorithmConnections[event->connection.modOp] =
+              event->connection.modIndex;
+            break;
+    }
+    Fm_updateOpParams(player->synth, event->op, opParams);
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+static void
+_setMix(FmPlayer* player, float gain, float pan)
+{
+    if (_output->backend->channels == 1) {
+        player->channelGain[0] = gain;
+        return;
+    }
+    // Constant power, so the player sounds as loud wherever it is panned.
+    float angle = (pan + 1.0f) * (float)M_PI / 4.0f;
+    player->channelGain[0] = gain * cosf(angle);
+    player->channelGain[1] = gain * sinf(angle);
+}
+
+static FmPlayer*
+_resolve(FmPlayer* player)
+{
+    return player ? player : _output->main;
 }
 
 void
-FmPlayer_updateOperatorWaveType(FmOperator op, WaveType wave)
+FmPlayer_setNote(FmPlayer* player, Note note)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
+    FmPlayer_setNoteAt(player, note, FMPLAYER_NOW);
+}
 
-    _fmPlayer->params.opParams[op].waveType = wave;
-    _fmPlayer->updatesNeeded |= (UPDATE_NEEDED_BIT << op);
+void
+FmPlayer_setNoteAt(FmPlayer* player, Note note, long long timeNs)
+{
+    _FmEvent event = { .type = EVENT_NOTE, .timeNs = timeNs, .note = note };
+    _postEvent(_resolve(player), &event);
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+void
+FmPlayer_controlNote(FmPlayer* player, FmPlayer_NoteCtrl ctrl)
+{
+    FmPlayer_controlNoteAt(player, ctrl, FMPLAYER_NOW);
 }
 
 void
-FmPlayer_updateOperatorCm(FmOperator op, float cm)
+FmPlayer_controlNoteAt(FmPlayer* player,
+                       FmPlayer_NoteCtrl ctrl,
+                       long long timeNs)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
+    _FmEvent event = { .type = EVENT_NOTE_CTRL,
+                       .timeNs = timeNs,
+                       .ctrl = ctrl };
+    _postEvent(_resolve(player), &event);
+}
 
-    _fmPlayer->params.opParams[op].CmRatio = cm;
-    _fmPlayer->updatesNeeded |= (UPDATE_NEEDED_BIT << op);
+void
+FmPlayer_setSynthVoice(FmPlayer* player, const FmSynthParams* newVoice)
+{
+    FmPlayer_setSynthVoiceAt(player, newVoice, FMPLAYER_NOW);
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+static const FmVoice*
+_findVoice(FmPlayer* player, const FmSynthParams* params)
+{
+    FmVoice* voice = NULL;
+
+    pthread_mutex_lock(&_voicesMutex);
+    for (size_t i = 0; i < player->nVoices; i++) {
+        if (memcmp(Fm_getVoiceParams(player->voices[i]),
+                   params,
+                   sizeof(FmSynthParams)) == 0) {
+            voice = player->voices[i];
+            break;
+        }
+    }
+
+    if (!voice && player->nVoices == player->voicesCapacity) {
+        size_t capacity =
+          player->voicesCapacity ? 2 * player->voicesCapacity : 16;
+        FmVoice** voices = realloc(player->voices, capacity * sizeof(FmVoice*));
+        if (voices) {
+            player->voices = voices;
+            player->voicesCapacity = capacity;
+        }
+    }
+    if (!voice && player->nVoices < player->voicesCapacity &&
+        (voice = Fm_compileVoice(params))) {
+        player->voices[player->nVoices++] = voice;
+    }
+    pthread_mutex_unlock(&_voicesMutex);
+
+    return voice;
+}
+
+static void
+_freeVoices(FmPlayer* player)
+{
+    for (size_t i = 0; i < player->nVoices; i++) {
+        Fm_destroyVoice(player->voices[i]);
+    }
+    free(player->voices);
+}
+
+const FmVoice*
+FmPlayer_getVoice(FmPlayer* player, const FmSynthParams* params)
+{
+    return _findVoice(_resolve(player), params);
+}
+
+void
+FmPlayer_setVoice(FmPlayer* player, const FmVoice* voice)
+{
+    _FmEvent event = { .type = EVENT_VOICE,
+                       .timeNs = FMPLAYER_NOW,
+                       .voice = voice };
+    _postEvent(_resolve(player), &event);
+}
+
+void
+FmPlayer_setSynthVoiceAt(FmPlayer* player,
+                         const FmSynthParams* newVoice,
+                         long long timeNs)
+{
+    player = _resolve(player);
+    _FmEvent event = { .type = EVENT_VOICE, .timeNs = timeNs, .voice = NULL };
+    // Compile here, so the player thread only has to switch to it.
+    if (newVoice && !(event.voice = _findVoice(player, newVoice))) {
+        fprintf(stderr, "Can't compile synth voice\n");
+        return;
+    }
+    _postEvent(player, &event);
 }
 
 void
-FmPlayer_updateOperatorOutputStrength(FmOperator op, float outStrength)
+FmPlayer_setMix(FmPlayer* player, float gain, float pan)
+{
+    _FmEvent event = { .type = EVENT_MIX,
+                       .timeNs = FMPLAYER_NOW,
+                       .mix = { .gain = gain, .pan = pan } };
+    _postEvent(_resolve(player), &event);
+}
+
+bool
+FmPlayer_setClock(FmPlayer_ClockFn clock, void* data)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
+    if (!_output) {
+        return false;
+    }
+
+    pthread_mutex_lock(&_output->playersMutex);
+    _output->clock = clock;
+    _output->clockData = data;
+    _output->clockElapsed = 0;
+    _output->clockDue = 0;
+    pthread_mutex_unlock(&_output->playersMutex);
+    return true;
+}
 
-    _fmPlayer->params.opParams[op].outputStrength = outStrength;
-    _fmPlayer->updatesNeeded |= (UPDATE_NEEDED_BIT << op);
+bool
+FmPlayer_addNoteCache(FmPlayer* player, const NoteCache* cache)
+{
+    player = _resolve(player);
+    if (atomic_fetch_add(&player->nNoteCaches, 1) >= FM_MAX_NOTE_CACHES) {
+        atomic_fetch_sub(&player->nNoteCaches, 1);
+        return false;
+    }
+    _FmEvent event = { .type = EVENT_NOTE_CACHE,
+                       .timeNs = FMPLAYER_NOW,
+                       .noteCache = cache };
+    _postEvent(player, &event);
+    return true;
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+void
+FmPlayer_updateOperatorWaveType(FmPlayer* player, FmOperator op, WaveType wave)
+{
+    _FmEvent event = { .type = EVENT_OP_WAVE, .op = op, .wave = wave };
+    _postEvent(_resolve(player), &event);
 }
 
 void
-FmPlayer_fixOperatorToNote(FmOperator op, Note note)
+FmPlayer_updateOperatorCm(FmPlayer* player, FmOperator op, float cm)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
+    _FmEvent event = { .type = EVENT_OP_CM, .op = op, .value = cm };
+    _postEvent(_resolve(player), &event);
+}
 
-    _fmPlayer->params.opParams[op].CmRatio = -1;
-    _fmPlayer->params.opParams[op].fixToNote = note;
-    _fmPlayer->updatesNeeded |= (UPDATE_NEEDED_BIT << op);
+void
+FmPlayer_updateOperatorOutputStrength(FmPlayer* player,
+                                      FmOperator op,
+                                      float outStrength)
+{
+    _FmEvent event = { .type = EVENT_OP_OUTPUT,
+                       .op = op,
+                       .value = outStrength };
+    _postEvent(_resolve(player), &event);
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+void
+FmPlayer_fixOperatorToNote(FmPlayer* player, FmOperator op, Note note)
+{
+    _FmEvent event = { .type = EVENT_OP_FIX, .op = op, .note = note };
+    _postEvent(_resolve(player), &event);
 }
 
 void
-FmPlayer_updateOperatorAlgorithmConnection(FmOperator op,
+FmPlayer_updateOperatorAlgorithmConnection(FmPlayer* player,
+                                           FmOperator op,
                                            FmOperator moddingOp,
                                            float modIndex)
 {
-    pthread_rwlock_wrlock(&_fmPlayer->updateRwLock);
+    _FmEvent event = { .type = EVENT_OP_CONNECTION,
+                       .op = op,
+                       .connection = { .modOp = moddingOp,
+                                       .modIndex = modIndex } };
+    _postEvent(_resolve(player), &event);
+}
+
+void
+FmPlayer_getQueueStats(FmPlayer* player, EventQueue_Stats* stats)
+{
+    EventQueue_getStats(_resolve(player)->events, stats);
+}
+
+void
+FmPlayer_getStats(FmPlayer_Stats* stats)
+{
+    const _FmPlayerStats* src = &_output->stats;
+    stats->periods = atomic_load_explicit(&src->periods, memory_order_relaxed);
+    stats->xruns = atomic_load_explicit(&src->xruns, memory_order_relaxed);
+    stats->recoveries =
+      atomic_load_explicit(&src->recoveries, memory_order_relaxed);
+    stats->timeouts =
+      atomic_load_explicit(&src->timeouts, memory_order_relaxed);
+    stats->overruns =
+      atomic_load_explicit(&src->overruns, memory_order_relaxed);
+    stats->idlePeriods =
+      atomic_load_explicit(&src->idlePeriods, memory_order_relaxed);
+    stats->droppedEvents =
+      atomic_load_explicit(&src->droppedEvents, memory_order_relaxed);
+    stats->maxRenderUs =
+      atomic_load_explicit(&src->maxRenderUs, memory_order_relaxed);
+    stats->minMarginUs =
+      atomic_load_explicit(&src->minMarginUs, memory_order_relaxed);
+    _histogramLoad(&src->renderUs, &stats->renderUs);
+    _histogramLoad(&src->renderMarginUs, &stats->renderMarginUs);
+    _histogramLoad(&src->delayFrames, &stats->delayFrames);
+
+    stats->mix.clipped =
+      atomic_load_explicit(&_output->mixClipped, memory_order_relaxed);
+    stats->mix.limited =
+      atomic_load_explicit(&_output->mixLimited, memory_order_relaxed);
+}
 
-    _fmPlayer->params.opParams[op].algorithmConnections[moddingOp] = modIndex;
-    _fmPlayer->updatesNeeded |= (UPDATE_NEEDED_BIT << op);
+void
+FmPlayer_printStats(FILE* out)
+{
+    FmPlayer_Stats stats;
+    FmPlayer_getStats(&stats);
+
+    fprintf(out,
+            "FmPlayer: %lu periods, %lu xruns, %lu recoveries, %lu timeouts, "
+            "%lu overruns, %lu idle, %lu dropped events\n",
+            stats.periods,
+            stats.xruns,
+            stats.recoveries,
+            stats.timeouts,
+            stats.overruns,
+            stats.idlePeriods,
+            stats.droppedEvents);
+    if (stats.periods > 0) {
+        fprintf(out,
+                "max render %lld us, min margin %lld us\n",
+                stats.maxRenderUs,
+                stats.minMarginUs);
+    }
+    fprintf(out,
+            "mix: %lu samples over full scale, limited %lu times\n",
+            stats.mix.clipped,
+            stats.mix.limited);
+    FmPlayer_printHistogram(out, "render time (us)", &stats.renderUs);
+    FmPlayer_printHistogram(out, "render margin (us)", &stats.renderMarginUs);
+    FmPlayer_printHistogram(out, "delay (frames)", &stats.delayFrames);
+}
 
-    pthread_rwlock_unlock(&_fmPlayer->updateRwLock);
+static int
+_openBackend(const FmSynthParams* params)
+{
+    const FmPlayer_Config* config = &_output->config;
+    unsigned int periodTimeUs = config->periodTimeUs > 0
+                                  ? config->periodTimeUs
+                                  : config->bufferTimeUs / 2;
+    size_t periodSize =
+      (unsigned long long)periodTimeUs * params->sampleRate / US_PER_SECOND;
+
+    if (config->channels < 1 || config->channels > FMPLAYER_MAX_CHANNELS) {
+        return -EINVAL;
+    }
+
+    switch (config->backend) {
+        case FMPLAYER_BACKEND_ALSA:
+            return AudioBackend_openAlsa(&_output->backend,
+                                         config->access == FMPLAYER_ACCESS_MMAP,
+                                         params->sampleRate,
+                                         config->channels,
+                                         config->bufferTimeUs,
+                                         config->periodTimeUs);
+        case FMPLAYER_BACKEND_WAV:
+            return AudioBackend_openWav(&_output->backend,
+                                        config->wavPath,
+                                        params->sampleRate,
+                                        config->channels,
+                                        periodSize);
+        case FMPLAYER_BACKEND_NULL:
+            return AudioBackend_openNull(&_output->backend,
+                                         params->sampleRate,
+                                         config->channels,
+                                         periodSize,
+                                         false);
+        case FMPLAYER_BACKEND_NULL_REALTIME:
+            return AudioBackend_openNull(&_output->backend,
+                                         params->sampleRate,
+                                         config->channels,
+                                         periodSize,
+                                         true);
+        default:
+            return -EINVAL;
+    }
+}
+
+static FmPlayer*
+_createPlayer(const FmSynthParams* params)
+{
+    FmPlayer* player = calloc(1, sizeof(FmPlayer));
+    if (!player) {
+        return NULL;
+    }
+
+    player->voice = _findVoice(player, params);
+    player->synth = Fm_createFmSynthesizer(params);
+    if (player->synth) {
+        Fm_setDither(player->synth, _output->config.dither);
+    }
+    player->events = EventQueue_create(EVENT_QUEUE_CAPACITY, sizeof(_FmEvent));
+    if (!player->events || !player->voice || !player->synth) {
+        _destroyPlayer(player);
+        return NULL;
+    }
+    _setMix(player, 1.0f, 0.0f);
+    return player;
+}
+
+static void
+_destroyPlayer(FmPlayer* player)
+{
+    EventQueue_destroy(player->events);
+    Fm_destroySynthesizer(player->synth);
+    _freeVoices(player);
+    free(player);
+}
+
+static bool
+_addPlayer(FmPlayer* player)
+{
+    bool added = false;
+    pthread_mutex_lock(&_output->playersMutex);
+    if (_output->nPlayers < FMPLAYER_MAX_PLAYERS) {
+        _output->players[_output->nPlayers++] = player;
+        added = true;
+    }
+    pthread_mutex_unlock(&_output->playersMutex);
+    return added;
+}
+
+FmPlayer*
+FmPlayer_create(const FmSynthParams* params)
+{
+    // Every synth renders at the output's rate.
+    if (!_output || params->sampleRate != _output->backend->sampleRate) {
+        return NULL;
+    }
+
+    FmPlayer* player = _createPlayer(params);
+    if (player && !_addPlayer(player)) {
+        _destroyPlayer(player);
+        return NULL;
+    }
+    return player;
+}
+
+void
+FmPlayer_destroy(FmPlayer* player)
+{
+    if (!player || player == _output->main) {
+        return;
+    }
+
+    pthread_mutex_lock(&_output->playersMutex);
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        if (_output->players[p] == player) {
+            _output->nPlayers--;
+            memmove(_output->players + p,
+                    _output->players + p + 1,
+                    (_output->nPlayers - p) * sizeof(FmPlayer*));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_output->playersMutex);
+    _destroyPlayer(player);
 }
 
 int
-FmPlayer_initialize(const FmSynthParams* params)
+FmPlayer_initialize(const FmSynthParams* params, const FmPlayer_Config* config)
 {
-    _fmPlayer = malloc(sizeof(_FmPlayer));
-    memset(_fmPlayer, 0, sizeof(_FmPlayer));
+    static const FmPlayer_Config defaultConfig = FMPLAYER_DEFAULT_CONFIG;
 
-    // open PCM in non-blocking mode.
-    int sndStatus = snd_pcm_open(&_fmPlayer->pcmHandle,
-                                 "default",
-                                 SND_PCM_STREAM_PLAYBACK,
-                                 SND_PCM_NONBLOCK);
-    if (sndStatus < 0) {
-        free(_fmPlayer);
-        return sndStatus;
+    _output = calloc(1, sizeof(_FmOutput));
+    if (!_output) {
+        return -ENOMEM;
+    }
+    _output->config = config ? *config : defaultConfig;
+    atomic_init(&_output->stats.minMarginUs, LLONG_MAX);
+
+    int status = _openBackend(params);
+    if (status < 0) {
+        fprintf(stderr, "Can't open audio output: %s\n", strerror(-status));
+        free(_output);
+        _output = NULL;
+        return status;
     }
-    // TODO: need to config-pin the i2c pins so we have audio out.
 
-    // Configure Alsa
-    sndStatus = _configureAlsa(_fmPlayer->pcmHandle);
-    if (sndStatus < 0) {
-        free(_fmPlayer);
-        return sndStatus;
+    // Players are added and removed while the player thread runs. Let it
+    // borrow our priority if it wants the lock while we hold it.
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (_output->config.realtimePriority > 0) {
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    }
+    pthread_mutex_init(&_output->playersMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    const size_t periodSize = _output->backend->periodSize;
+    _output->playerBuffer = malloc(periodSize * sizeof(int16_t));
+    _output->mixBus =
+      malloc(periodSize * _output->backend->channels * sizeof(float));
+    _output->main = _output->playerBuffer && _output->mixBus
+                      ? _createPlayer(params)
+                      : NULL;
+    if (!_output->main) {
+        AudioBackend_close(_output->backend);
+        pthread_mutex_destroy(&_output->playersMutex);
+        free(_output->playerBuffer);
+        free(_output->mixBus);
+        free(_output);
+        _output = NULL;
+        return -ENOMEM;
     }
+    _addPlayer(_output->main);
 
-    // init synth
-    memcpy(&_fmPlayer->params, params, sizeof(FmSynthParams));
-    _fmPlayer->synth = Fm_createFmSynthesizer(&_fmPlayer->params);
+    _output->running = 1;
 
-    _fmPlayer->running = 1;
-    // Buffer a single period at a time
-    _fmPlayer->sampleBuffer = malloc(_fmPlayer->periodSize * sizeof(int16_t));
+    // Lock memory before the thread starts so its stack gets locked too.
+    if (_output->config.realtimePriority > 0) {
+        Threadutils_lockMemory();
+    }
+    // Print stats on SIGUSR1, unless someone else already wants it.
+    struct sigaction action;
+    if (sigaction(SIGUSR1, NULL, &action) == 0 &&
+        (action.sa_handler == SIG_DFL ||
+         action.sa_handler == _onPrintStatsSignal)) {
+        sem_init(&_printStatsRequest, 0, 0);
+        _output->hasStatsThread = true;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = _onPrintStatsSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, NULL);
+    }
 
-    pthread_rwlock_init(&_fmPlayer->updateRwLock, NULL);
-    pthread_create(&_fmPlayer->playerThread, NULL, _play, NULL);
+    // The player thread inherits our signal mask. Keep signals off it, so
+    // they never interrupt a period.
+    sigset_t blocked;
+    sigset_t previous;
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    pthread_create(&_output->playerThread, NULL, _play, NULL);
+    if (_output->hasStatsThread) {
+        pthread_create(
+          &_output->statsThread, NULL, _printStatsOnRequest, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (_output->config.realtimePriority > 0) {
+        Threadutils_setRealtimePriority(_output->playerThread,
+                                        _output->config.realtimePriority);
+    }
+    Threadutils_pinToCpu(_output->playerThread, _output->config.cpu);
 
     return 1;
 }
@@ -529,15 +1410,23 @@ FmPlayer_initialize(const FmSynthParams* params)
 void
 FmPlayer_close(void)
 {
-    _fmPlayer->running = 0;
-    pthread_join(_fmPlayer->playerThread, NULL);
-    pthread_rwlock_destroy(&_fmPlayer->updateRwLock);
+    _output->running = 0;
+    pthread_join(_output->playerThread, NULL);
+    if (_output->hasStatsThread) {
+        // The handler stays installed, so the semaphore stays valid for it.
+        sem_post(&_printStatsRequest);
+        pthread_join(_output->statsThread, NULL);
+    }
 
-    Fm_destroySynthesizer(_fmPlayer->synth);
+    for (size_t p = 0; p < _output->nPlayers; p++) {
+        _destroyPlayer(_output->players[p]);
+    }
+    pthread_mutex_destroy(&_output->playersMutex);
 
-    snd_pcm_drain(_fmPlayer->pcmHandle);
-    snd_pcm_close(_fmPlayer->pcmHandle);
+    AudioBackend_close(_output->backend);
 
-    free(_fmPlayer->sampleBuffer);
-    free(_fmPlayer);
+    free(_output->playerBuffer);
+    free(_output->mixBus);
+    free(_output);
+    _output = NULL;
 }
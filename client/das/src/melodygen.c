@@ -63,7 +63,8 @@ _closestInChord(const Chord chord, const Note from, const int dir);
  * in the given direction.
  */
 static int
-_arpeggiateChord(const SequencerIdx startIdx,
+_arpeggiateChord(const SequencerTrack track,
+                 const SequencerIdx startIdx,
                  const Chord chord,
                  const Note from,
                  const int direction);
@@ -79,9 +80,11 @@ _selectChordProgression(const MelodyGenKey key);
 static Note
 _getPassingTone(const Note from, const int direction);
 
-/** Generates a melody to the sequencer according to the given params. */
+/** Generates a melody to a track of the sequencer according to the given
+ * params. */
 static void
-_generateToSequencer(const MelodyGenParams* params);
+_generateToSequencer(const SequencerTrack track,
+                     const MelodyGenParams* params);
 
 static int
 _randInRange(int start, int end)
@@ -170,7 +173,8 @@ _closestInChord(const Chord chord, const Note from, const int dir)
 }
 
 static int
-_arpeggiateChord(const SequencerIdx startIdx,
+_arpeggiateChord(const SequencerTrack track,
+                 const SequencerIdx startIdx,
                  const Chord chord,
                  const Note from,
                  const int direction)
@@ -180,7 +184,8 @@ _arpeggiateChord(const SequencerIdx startIdx,
 
     const Note* notesInChord = chordTable[chord];
 
-    Sequencer_fillSlot(startIdx, NOTE_CTRL_NOTE_ON, currentNote, NULL);
+    Sequencer_fillSlot(
+      track, startIdx, NOTE_CTRL_NOTE_ON, currentNote, NULL);
 
     int i = 0;
     int step = 1;
@@ -197,7 +202,8 @@ _arpeggiateChord(const SequencerIdx startIdx,
         }
 
         currentNote += _noteSignedRingDistance(currentNote, notesInChord[i]);
-        Sequencer_fillSlot(startIdx + (beatIdx * 2), // eighth notes
+        Sequencer_fillSlot(track,
+                           startIdx + (beatIdx * 2), // eighth notes
                            NOTE_CTRL_NOTE_ON,
                            currentNote,
                            NULL);
@@ -237,9 +243,10 @@ _getPassingTone(const Note from, const int direction)
 }
 
 static void
-_generateToSequencer(const MelodyGenParams* params)
+_generateToSequencer(const SequencerTrack track,
+                     const MelodyGenParams* params)
 {
-    Sequencer_setBpm(params->tempo);
+    Sequencer_setPatternBpm(params->tempo);
 
     const Chord* prog = _selectChordProgression(params->key);
 
@@ -265,13 +272,13 @@ _generateToSequencer(const MelodyGenParams* params)
         if (jumpy) {
             if (dense && _randomTest(0.5)) {
                 int notesAdded = _arpeggiateChord(
-                  beatIdx, prog[i], _lastNotePlayed, direction);
+                  track, beatIdx, prog[i], _lastNotePlayed, direction);
                 if (notesAdded < 4) {
                     Note passingTone =
                       _getPassingTone(_lastNotePlayed, direction);
 
                     Sequencer_fillSlot(
-                      beatIdx + 6, noteCtrl, passingTone, NULL);
+                      track, beatIdx + 6, noteCtrl, passingTone, NULL);
                     _lastNotePlayed = passingTone;
                 }
                 // we're full up
@@ -284,14 +291,16 @@ _generateToSequencer(const MelodyGenParams* params)
                     if (_lastNotePlayed != NOTE_NONE) {
                         currentNote += HALF_STEPS_IN_OCTAVE * direction;
                     }
-                    Sequencer_fillSlot(beatIdx, noteCtrl, currentNote, NULL);
+                    Sequencer_fillSlot(
+                      track, beatIdx, noteCtrl, currentNote, NULL);
                 }
             }
         } else {
             if (dense || _randomTest(0.75)) {
                 currentNote =
                   _closestInChord(prog[i], _lastNotePlayed, direction);
-                Sequencer_fillSlot(beatIdx, noteCtrl, currentNote, NULL);
+                Sequencer_fillSlot(
+                  track, beatIdx, noteCtrl, currentNote, NULL);
             }
         }
 
@@ -305,10 +314,13 @@ _generateToSequencer(const MelodyGenParams* params)
                     ? _closestInChord(prog[i], currentNote, direction)
                     : _getPassingTone(currentNote, direction);
                 Sequencer_fillSlot(
-                  beatIdx + (j * 2), noteCtrl, currentNote, NULL);
+                  track, beatIdx + (j * 2), noteCtrl, currentNote, NULL);
             } else {
-                Sequencer_fillSlot(
-                  beatIdx + (j * 2), NOTE_CTRL_NOTE_OFF, NOTE_NONE, NULL);
+                Sequencer_fillSlot(track,
+                                   beatIdx + (j * 2),
+                                   NOTE_CTRL_NOTE_OFF,
+                                   NOTE_NONE,
+                                   NULL);
             }
         }
         _lastNotePlayed = currentNote;
@@ -316,7 +328,7 @@ _generateToSequencer(const MelodyGenParams* params)
 }
 
 void
-Melody_generateToSequencer(const MelodyGenParams* params)
+Melody_generateToSequencer(SequencerTrack track, const MelodyGenParams* params)
 {
-    _generateToSequencer(params);
+    _generateToSequencer(track, params);
 }
@@ -0,0 +1,731 @@
+/**
+ * @file notecache.c
+ * @brief Baking notes, and playing them back.
+ */
+#include "das/notecache.h"
+#include "das/envelope.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** First bytes of a cache file. */
+#define NOTECACHE_MAGIC "TACN"
+/** Version of the cache file layout. */
+#define NOTECACHE_VERSION 1
+/** Written as a 32 bit value, so the byte order of the file can be checked. */
+#define NOTECACHE_BYTE_ORDER 0x01020304u
+
+/** Shortest sustain loop, in samples. */
+#define NOTECACHE_MIN_LOOP ENV_CONTROL_PERIOD
+/** Samples at the end of a loop crossfaded into the samples before its
+ * start, so it goes round without a click. */
+#define NOTECACHE_SEAM_WINDOW 256
+/** Loudest the difference between the two sides of a seam may be, relative
+ * to the sustain, in dB. Notes that can't be looped closer are played live.
+ */
+#define NOTECACHE_SEAM_DB -40
+/** How long a note gated in its loop takes to crossfade into its release, in
+ * samples. */
+#define NOTECACHE_RELEASE_FADE 256
+/** Longest attack or release baked, in seconds. */
+#define NOTECACHE_MAX_SECONDS 20
+
+/** Start of a cache. The entries follow it, then the samples. */
+typedef struct
+{
+    /** NOTECACHE_MAGIC. */
+    char magic[4];
+    /** NOTECACHE_VERSION. */
+    uint32_t version;
+    /** NOTECACHE_BYTE_ORDER. */
+    uint32_t byteOrder;
+    /** The first note. */
+    int32_t lowest;
+    /** How many notes there are entries for, from the lowest up. */
+    uint32_t count;
+    /** Where every note's loop starts, in samples. */
+    uint32_t loopStart;
+    /** Size of the whole cache, in bytes. */
+    uint64_t size;
+    /** The voice the notes were baked from. */
+    FmSynthParams params;
+} _NoteCache_Header;
+
+/** Where a note is in a cache. */
+typedef struct
+{
+    /** Where the note's samples start, in bytes from the start of the cache,
+     * or 0 if the note wasn't baked. */
+    uint64_t offset;
+    /** Length of the sustain loop, in samples. */
+    uint32_t loopLength;
+    /** Length of the release, in samples. */
+    uint32_t releaseLength;
+} _NoteCache_Entry;
+
+struct NoteCache
+{
+    /** The start of the cache. */
+    const _NoteCache_Header* header;
+    /** An entry for each note. */
+    const _NoteCache_Entry* entries;
+    /** The cache, baked or mapped. */
+    void* data;
+    /** Size of the cache, in bytes. */
+    size_t size;
+    /** Was it mapped from a file? */
+    bool mapped;
+};
+
+/** Samples, growing as they are rendered. */
+typedef struct
+{
+    int16_t* samples;
+    size_t length;
+    size_t capacity;
+} _NoteCache_Buffer;
+
+/** Work out how long the voice's attack is, from a trigger until every
+ * envelope holds still. */
+static int
+_attackLength(const FmSynthParams* params, size_t* length);
+/** Find the loop of the sustain, starting at loop, that best repeats. The
+ * NOTECACHE_SEAM_WINDOW samples before loop are part of the sustain too.
+ * Returns 0 if no loop repeats closely enough. */
+static size_t
+_findLoop(const int16_t* loop);
+/** Make room for more samples at the end of a buffer. Returns NULL if there
+ * is no memory. */
+static int16_t*
+_grow(_NoteCache_Buffer* buffer, size_t nSamples);
+/** Render a note into the end of a buffer. Returns the lengths of its loop
+ * and release, or a loop length of 0 if the note can't be baked. */
+static int
+_bakeNote(const FmSynthParams* params,
+          Note note,
+          size_t loopStart,
+          _NoteCache_Buffer* buffer,
+          _NoteCache_Entry* entry);
+/** Put the header, entries and samples together into a cache. */
+static int
+_assemble(NoteCache** cache,
+          const FmSynthParams* params,
+          Note lowest,
+          size_t loopStart,
+          const _NoteCache_Entry* entries,
+          size_t count,
+          const _NoteCache_Buffer* buffer);
+/** Get the entry for a note, or NULL if it wasn't baked. */
+static const _NoteCache_Entry*
+_findEntry(const NoteCache* cache, Note note);
+/** Samples until the cursor reaches the end of the attack, loop or release.
+ */
+static size_t
+_span(const NoteCache_Cursor* cursor);
+/** Go round the loop, skip it or stop, once the cursor reaches the end of a
+ * stretch. */
+static void
+_settle(NoteCache_Cursor* cursor);
+/** Take the next sample from a cursor. */
+static float
+_next(NoteCache_Cursor* cursor);
+
+static int
+_attackLength(const FmSynthParams* params, size_t* length)
+{
+    const size_t maxPeriods =
+      NOTECACHE_MAX_SECONDS * params->sampleRate / ENV_CONTROL_PERIOD;
+    size_t periods = 0;
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        Env_Envelope env = params->opEnvelopes[op];
+        // Repeating envelopes never hold still.
+        if (env.repeatPoint >= 0) {
+            return -EINVAL;
+        }
+        Env_prepareEnvelope(&env, params->sampleRate);
+        Env_trigger(&env);
+
+        // A held envelope sits exactly on its gate point, unless it has no
+        // sustain and finishes while held.
+        size_t held = 0;
+        while (Env_isActive(&env) && env.current != env.gatePoint) {
+            Env_getValueAndAdvance(&env);
+            if (++held > maxPeriods) {
+                return -EINVAL;
+            }
+        }
+        if (held > periods) {
+            periods = held;
+        }
+    }
+
+    // The synth ramps to each control point over the period after it.
+    *length = (periods + 1) * ENV_CONTROL_PERIOD;
+    return 0;
+}
+
+static size_t
+_findLoop(const int16_t* loop)
+{
+    // A loop of length L repeats well if the window before its end matches
+    // the window before its start, since the one is crossfaded into the
+    // other.
+    const int16_t* window = loop - NOTECACHE_SEAM_WINDOW;
+    double energy = 0;
+    for (size_t i = 0; i < NOTECACHE_SEAM_WINDOW; i++) {
+        energy += (double)window[i] * window[i];
+    }
+    const double tolerance = energy * pow(10, NOTECACHE_SEAM_DB / 10.0);
+
+    size_t best = 0;
+    double bestError = tolerance;
+    for (size_t length = NOTECACHE_MIN_LOOP; length <= NOTECACHE_MAX_LOOP;
+         length++) {
+        double error = 0;
+        for (size_t i = 0; i < NOTECACHE_SEAM_WINDOW && error <= bestError;
+             i++) {
+            double diff = window[length + i] - window[i];
+            error += diff * diff;
+        }
+        if (error < bestError || (best == 0 && error <= bestError)) {
+            best = length;
+            bestError = error;
+        }
+    }
+    return best;
+}
+
+static int16_t*
+_grow(_NoteCache_Buffer* buffer, size_t nSamples)
+{
+    if (buffer->length + nSamples > buffer->capacity) {
+        size_t capacity = buffer->capacity ? 2 * buffer->capacity : 65536;
+        while (capacity < buffer->length + nSamples) {
+            capacity *= 2;
+        }
+        int16_t* samples =
+          realloc(buffer->samples, capacity * sizeof(int16_t));
+        if (!samples) {
+            return NULL;
+        }
+        buffer->samples = samples;
+        buffer->capacity = capacity;
+    }
+    int16_t* end = buffer->samples + buffer->length;
+    buffer->length += nSamples;
+    return end;
+}
+
+static int
+_bakeNote(const FmSynthParams* params,
+          Note note,
+          size_t loopStart,
+          _NoteCache_Buffer* buffer,
+          _NoteCache_Entry* entry)
+{
+    memset(entry, 0, sizeof(_NoteCache_Entry));
+
+    // Hold the note long enough to try every loop length.
+    const size_t heldLength = loopStart + NOTECACHE_MAX_LOOP;
+    int16_t* held = malloc(heldLength * sizeof(int16_t));
+    FmSynthesizer* synth = Fm_createFmSynthesizer(params);
+    if (!held || !synth) {
+        free(held);
+        if (synth) {
+            Fm_destroySynthesizer(synth);
+        }
+        return -ENOMEM;
+    }
+    Fm_setNote(synth, note);
+    Fm_noteOn(synth);
+    Fm_generateSamples(synth, held, heldLength);
+    Fm_destroySynthesizer(synth);
+
+    size_t loopLength = _findLoop(held + loopStart);
+    if (loopLength == 0) {
+        // Played live instead.
+        free(held);
+        return 0;
+    }
+
+    // Render it again, this time releasing it at the end of the loop, so the
+    // release carries on from the loop without a seam.
+    synth = Fm_createFmSynthesizer(params);
+    if (!synth) {
+        free(held);
+        return -ENOMEM;
+    }
+    const size_t start = buffer->length;
+    int16_t* samples = _grow(buffer, loopStart + loopLength);
+    if (!samples) {
+        free(held);
+        Fm_destroySynthesizer(synth);
+        return -ENOMEM;
+    }
+    Fm_setNote(synth, note);
+    Fm_noteOn(synth);
+    Fm_generateSamples(synth, samples, loopStart + loopLength);
+    Fm_noteOff(synth);
+
+    // Fade the end of the loop into what comes before its start.
+    int16_t* seam = samples + loopStart + loopLength - NOTECACHE_SEAM_WINDOW;
+    const int16_t* before = held + loopStart - NOTECACHE_SEAM_WINDOW;
+    for (size_t i = 0; i < NOTECACHE_SEAM_WINDOW; i++) {
+        float fade = (i + 0.5f) / NOTECACHE_SEAM_WINDOW;
+        seam[i] = lrintf((1 - fade) * seam[i] + fade * before[i]);
+    }
+    free(held);
+
+    const size_t maxRelease = NOTECACHE_MAX_SECONDS * params->sampleRate;
+    size_t releaseLength = 0;
+    while (!Fm_isIdle(synth) && releaseLength < maxRelease) {
+        // Growing may move the samples.
+        if (!(samples = _grow(buffer, ENV_CONTROL_PERIOD))) {
+            Fm_destroySynthesizer(synth);
+            return -ENOMEM;
+        }
+        Fm_generateSamples(synth, samples, ENV_CONTROL_PERIOD);
+        releaseLength += ENV_CONTROL_PERIOD;
+    }
+    Fm_destroySynthesizer(synth);
+
+    // The last control period or so fades to nothing.
+    while (releaseLength > 0 && buffer->samples[buffer->length - 1] == 0) {
+        buffer->length--;
+        releaseLength--;
+    }
+
+    entry->offset = start * sizeof(int16_t);
+    entry->loopLength = loopLength;
+    entry->releaseLength = releaseLength;
+    return 0;
+}
+
+static int
+_assemble(NoteCache** cache,
+          const FmSynthParams* params,
+          Note lowest,
+          size_t loopStart,
+          const _NoteCache_Entry* entries,
+          size_t count,
+          const _NoteCache_Buffer* buffer)
+{
+    const size_t samplesStart =
+      sizeof(_NoteCache_Header) + count * sizeof(_NoteCache_Entry);
+    const size_t size = samplesStart + buffer->length * sizeof(int16_t);
+
+    NoteCache* c = calloc(1, sizeof(NoteCache));
+    // Zeroed so the padding in a saved file is too.
+    uint8_t* data = calloc(1, size);
+    if (!c || !data) {
+        free(c);
+        free(data);
+        return -ENOMEM;
+    }
+
+    _NoteCache_Header* header = (_NoteCache_Header*)data;
+    memcpy(header->magic, NOTECACHE_MAGIC, sizeof(header->magic));
+    header->version = NOTECACHE_VERSION;
+    header->byteOrder = NOTECACHE_BYTE_ORDER;
+    header->lowest = lowest;
+    header->count = count;
+    header->loopStart = loopStart;
+    header->size = size;
+    memcpy(&header->params, params, sizeof(FmSynthParams));
+
+    _NoteCache_Entry* out = (_NoteCache_Entry*)(header + 1);
+    for (size_t i = 0; i < count; i++) {
+        out[i] = entries[i];
+        if (out[i].loopLength > 0) {
+            out[i].offset += samplesStart;
+        }
+    }
+    if (buffer->length > 0) {
+        memcpy(data + samplesStart,
+               buffer->samples,
+               buffer->length * sizeof(int16_t));
+    }
+
+    c->header = header;
+    c->entries = out;
+    c->data = data;
+    c->size = size;
+    *cache = c;
+    return 0;
+}
+
+int
+NoteCache_bake(NoteCache** cache,
+               const FmSynthParams* params,
+               Note lowest,
+               Note highest)
+{
+    if (highest < lowest) {
+        return -EINVAL;
+    }
+
+    size_t attackLength;
+    int err = _attackLength(params, &attackLength);
+    if (err < 0) {
+        return err;
+    }
+    // The crossfade into the loop start comes from the sustain too.
+    const size_t loopStart = attackLength + NOTECACHE_SEAM_WINDOW;
+
+    const size_t count = highest - lowest + 1;
+    _NoteCache_Entry* entries = calloc(count, sizeof(_NoteCache_Entry));
+    _NoteCache_Buffer buffer = { 0 };
+    if (!entries) {
+        return -ENOMEM;
+    }
+    for (size_t i = 0; err == 0 && i < count; i++) {
+        err = _bakeNote(params, lowest + i, loopStart, &buffer, &entries[i]);
+    }
+    if (err == 0) {
+        err = _assemble(
+          cache, params, lowest, loopStart, entries, count, &buffer);
+    }
+
+    free(buffer.samples);
+    free(entries);
+    return err;
+}
+
+int
+NoteCache_open(NoteCache** cache, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(_NoteCache_Header)) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    // Private and read only, so notes are paged in from the file as they
+    // are played and never copied.
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+
+    const _NoteCache_Header* header = map;
+    const _NoteCache_Entry* entries = (const _NoteCache_Entry*)(header + 1);
+    bool valid =
+      memcmp(header->magic, NOTECACHE_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == NOTECACHE_VERSION &&
+      header->byteOrder == NOTECACHE_BYTE_ORDER && header->size == size &&
+      header->count <=
+        (size - sizeof(_NoteCache_Header)) / sizeof(_NoteCache_Entry);
+    for (size_t i = 0; valid && i < header->count; i++) {
+        const _NoteCache_Entry* entry = &entries[i];
+        uint64_t length = (uint64_t)header->loopStart + entry->loopLength +
+                          entry->releaseLength;
+        valid = entry->loopLength == 0 ||
+                (entry->offset % sizeof(int16_t) == 0 &&
+                 entry->offset <= size &&
+                 length <= (size - entry->offset) / sizeof(int16_t));
+    }
+    if (!valid) {
+        munmap(map, size);
+        return -EINVAL;
+    }
+
+    NoteCache* c = calloc(1, sizeof(NoteCache));
+    if (!c) {
+        munmap(map, size);
+        return -ENOMEM;
+    }
+    c->header = header;
+    c->entries = entries;
+    c->data = map;
+    c->size = size;
+    c->mapped = true;
+
+    *cache = c;
+    return 0;
+}
+
+int
+NoteCache_save(const NoteCache* cache, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return -errno;
+    }
+    int err = fwrite(cache->data, cache->size, 1, file) == 1 ? 0 : -EIO;
+    if (fclose(file) != 0 && err == 0) {
+        err = -EIO;
+    }
+    return err;
+}
+
+void
+NoteCache_close(NoteCache* cache)
+{
+    if (cache->mapped) {
+        munmap(cache->data, cache->size);
+    } else {
+        free(cache->data);
+    }
+    free(cache);
+}
+
+const FmSynthParams*
+NoteCache_getParams(const NoteCache* cache)
+{
+    return &cache->header->params;
+}
+
+size_t
+NoteCache_countNotes(const NoteCache* cache)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < cache->header->count; i++) {
+        count += cache->entries[i].loopLength > 0;
+    }
+    return count;
+}
+
+size_t
+NoteCache_getSize(const NoteCache* cache)
+{
+    return cache->size;
+}
+
+static const _NoteCache_Entry*
+_findEntry(const NoteCache* cache, Note note)
+{
+    const _NoteCache_Header* header = cache->header;
+    if (note < header->lowest || note - header->lowest >= (Note)header->count) {
+        return NULL;
+    }
+    const _NoteCache_Entry* entry = &cache->entries[note - header->lowest];
+    return entry->loopLength > 0 ? entry : NULL;
+}
+
+bool
+NoteCache_start(const NoteCache* cache,
+                NoteCache_Playhead* head,
+                Note note,
+                size_t fadeLength)
+{
+    const _NoteCache_Entry* entry = _findEntry(cache, note);
+    if (!entry) {
+        return false;
+    }
+
+    if (head->current.samples && fadeLength > 0) {
+        head->fading = head->current;
+        head->fadeLeft = fadeLength;
+        head->fadeLength = fadeLength;
+        head->crossfade = false;
+    }
+    NoteCache_Cursor* cursor = &head->current;
+    cursor->samples =
+      (const int16_t*)((const uint8_t*)cache->data + entry->offset);
+    cursor->pos = 0;
+    cursor->loopStart = cache->header->loopStart;
+    cursor->loopEnd = cursor->loopStart + entry->loopLength;
+    cursor->end = cursor->loopEnd + entry->releaseLength;
+    cursor->gated = false;
+    return true;
+}
+
+bool
+NoteCache_retune(const NoteCache* cache,
+                 NoteCache_Playhead* head,
+                 Note note,
+                 size_t fadeLength)
+{
+    const NoteCache_Cursor old = head->current;
+    if (!old.samples || !NoteCache_start(cache, head, note, 0)) {
+        return false;
+    }
+
+    // Every note has the same envelopes, only the loops differ in length.
+    NoteCache_Cursor* cursor = &head->current;
+    if (old.pos < old.loopStart) {
+        cursor->pos = old.pos;
+    } else if (old.pos < old.loopEnd) {
+        cursor->pos = cursor->loopStart +
+                      (old.pos - old.loopStart) %
+                        (cursor->loopEnd - cursor->loopStart);
+    } else {
+        cursor->pos = cursor->loopEnd + (old.pos - old.loopEnd);
+    }
+    cursor->gated = old.gated;
+    _settle(cursor);
+
+    if (fadeLength > 0) {
+        head->fading = old;
+        head->fadeLeft = fadeLength;
+        head->fadeLength = fadeLength;
+        head->crossfade = true;
+    }
+    return true;
+}
+
+void
+NoteCache_gate(NoteCache_Playhead* head)
+{
+    NoteCache_Cursor* cursor = &head->current;
+    if (!cursor->samples || cursor->gated) {
+        return;
+    }
+    cursor->gated = true;
+
+    // The envelopes release straight away, so rather than waiting for the end
+    // of the loop crossfade into the release.
+    if (cursor->pos >= cursor->loopStart && cursor->pos < cursor->loopEnd) {
+        head->fading = *cursor;
+        head->fading.gated = false;
+        head->fadeLeft = NOTECACHE_RELEASE_FADE;
+        head->fadeLength = NOTECACHE_RELEASE_FADE;
+        head->crossfade = true;
+        cursor->pos = cursor->loopEnd;
+        _settle(cursor);
+    }
+}
+
+void
+NoteCache_fadeOut(NoteCache_Playhead* head, size_t fadeLength)
+{
+    if (head->current.samples && fadeLength > 0) {
+        head->fading = head->current;
+        head->fadeLeft = fadeLength;
+        head->fadeLength = fadeLength;
+        head->crossfade = false;
+    }
+    head->current.samples = NULL;
+}
+
+bool
+NoteCache_isPlaying(const NoteCache_Playhead* head)
+{
+    return head->current.samples || head->fadeLeft > 0;
+}
+
+float
+NoteCache_getLevel(const NoteCache_Playhead* head)
+{
+    const NoteCache_Cursor* cursor = &head->current;
+    if (!cursor->samples) {
+        return 0;
+    }
+    if (cursor->pos < cursor->loopEnd) {
+        return 1;
+    }
+    return (float)(cursor->end - cursor->pos) /
+           (cursor->end - cursor->loopEnd);
+}
+
+bool
+NoteCache_getEnvelopeTime(const NoteCache_Playhead* head,
+                          size_t* held,
+                          size_t* released)
+{
+    const NoteCache_Cursor* cursor = &head->current;
+    // The envelopes stand still through the loop.
+    if (cursor->pos < cursor->loopStart) {
+        *held = cursor->pos;
+        *released = 0;
+    } else if (cursor->pos < cursor->loopEnd) {
+        *held = cursor->loopStart;
+        *released = 0;
+    } else {
+        *held = cursor->loopStart;
+        *released = cursor->pos - cursor->loopEnd;
+    }
+    return cursor->gated;
+}
+
+static size_t
+_span(const NoteCache_Cursor* cursor)
+{
+    if (cursor->pos < cursor->loopStart) {
+        return cursor->loopStart - cursor->pos;
+    }
+    if (cursor->pos < cursor->loopEnd) {
+        return cursor->loopEnd - cursor->pos;
+    }
+    return cursor->end - cursor->pos;
+}
+
+static void
+_settle(NoteCache_Cursor* cursor)
+{
+    if (cursor->pos == cursor->loopStart && cursor->gated) {
+        // Released during the attack, so there is nothing to hold.
+        cursor->pos = cursor->loopEnd;
+    } else if (cursor->pos == cursor->loopEnd && !cursor->gated) {
+        cursor->pos = cursor->loopStart;
+    }
+    if (cursor->pos >= cursor->end) {
+        cursor->samples = NULL;
+    }
+}
+
+static float
+_next(NoteCache_Cursor* cursor)
+{
+    if (!cursor->samples) {
+        return 0;
+    }
+    float sample = cursor->samples[cursor->pos++];
+    _settle(cursor);
+    return sample;
+}
+
+void
+NoteCache_mix(NoteCache_Playhead* head,
+              float* bus,
+              size_t nSamples,
+              float gain)
+{
+    const float scale = gain / INT16_MAX;
+    size_t s = 0;
+
+    // Sample by sample while fading, which is only ever briefly.
+    for (; s < nSamples && head->fadeLeft > 0; s++) {
+        float fade = (float)head->fadeLeft / head->fadeLength;
+        float sample = _next(&head->current);
+        if (head->crossfade) {
+            sample *= 1 - fade;
+        }
+        sample += fade * _next(&head->fading);
+        bus[s] += sample * scale;
+        head->fadeLeft--;
+    }
+
+    NoteCache_Cursor* cursor = &head->current;
+    while (s < nSamples && cursor->samples) {
+        size_t n = _span(cursor);
+        if (n > nSamples - s) {
+            n = nSamples - s;
+        }
+        const int16_t* samples = cursor->samples + cursor->pos;
+        for (size_t i = 0; i < n; i++) {
+            bus[s + i] += samples[i] * scale;
+        }
+        cursor->pos += n;
+        s += n;
+        _settle(cursor);
+    }
+}
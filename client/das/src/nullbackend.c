@@ -0,0 +1,199 @@
+/**
+ * @file nullbackend.c
+ * @brief Audio backend that discards its samples.
+ */
+#include "das/audiobackend.h"
+#include "com/timeutils.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Nanoseconds in a second. */
+#define NS_PER_SECOND 1000000000LL
+/** Nanoseconds in a millisecond. */
+#define NS_PER_MS 1000000LL
+/** Periods in a real-time sink's pretend buffer. */
+#define NULL_PERIODS 2
+
+/** Null backend. */
+typedef struct
+{
+    /** Must be first. */
+    AudioBackend backend;
+
+    /** A period's worth of samples to render into. */
+    int16_t* sampleBuffer;
+    /** When the sink started consuming samples. */
+    long long startNs;
+    /** Frames committed since startNs. */
+    long long framesWritten;
+} _NullBackend;
+
+static int
+_start(AudioBackend* backend);
+static int
+_wait(AudioBackend* backend, int timeoutMs);
+static long
+_delay(AudioBackend* backend);
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames);
+static int
+_commit(AudioBackend* backend, size_t nFrames);
+static int
+_recover(AudioBackend* backend, int err);
+static void
+_close(AudioBackend* backend);
+
+/** Frames committed but not yet consumed. Negative after an underrun. */
+static long long
+_framesQueued(const _NullBackend* sink);
+/** Sleep until the given monotonic time. */
+static void
+_sleepUntil(long long timeNs);
+
+static const AudioBackend_Ops _nullOps = {
+    .start = _start,
+    .wait = _wait,
+    .delay = _delay,
+    .begin = _begin,
+    .commit = _commit,
+    .recover = _recover,
+    .close = _close,
+};
+
+static int
+_start(AudioBackend* backend)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    // Start with a full buffer, as if it had been filled with silence.
+    sink->startNs = Timeutils_getMonotonicTimeInNs();
+    sink->framesWritten = backend->bufferSize;
+    return 0;
+}
+
+static int
+_wait(AudioBackend* backend, int timeoutMs)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    if (!backend->realtime) {
+        return 1;
+    }
+
+    long long queued = _framesQueued(sink);
+    if (queued < 0) {
+        return -EPIPE;
+    }
+    long long room = backend->bufferSize - backend->periodSize;
+    if (queued <= room) {
+        return 1;
+    }
+
+    // Sleep until enough has been consumed to fit another period.
+    long long readyNs = sink->startNs + (sink->framesWritten - room) *
+                                          NS_PER_SECOND / backend->sampleRate;
+    long long timeoutNs =
+      Timeutils_getMonotonicTimeInNs() + timeoutMs * NS_PER_MS;
+    if (readyNs > timeoutNs) {
+        _sleepUntil(timeoutNs);
+        return 0;
+    }
+    _sleepUntil(readyNs);
+    return 1;
+}
+
+static long
+_delay(AudioBackend* backend)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    if (!backend->realtime) {
+        return 0;
+    }
+    long long queued = _framesQueued(sink);
+    return queued < 0 ? -EPIPE : queued;
+}
+
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    *buffer = sink->sampleBuffer;
+    return nFrames < backend->periodSize ? nFrames : backend->periodSize;
+}
+
+static int
+_commit(AudioBackend* backend, size_t nFrames)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    if (backend->realtime && _framesQueued(sink) < 0) {
+        return -EPIPE;
+    }
+    sink->framesWritten += nFrames;
+    return 0;
+}
+
+static int
+_recover(AudioBackend* backend, int err)
+{
+    // An underrun is the only error, and starting over fixes it.
+    if (err == -EPIPE) {
+        return _start(backend);
+    }
+    return err;
+}
+
+static void
+_close(AudioBackend* backend)
+{
+    _NullBackend* sink = (_NullBackend*)backend;
+    free(sink->sampleBuffer);
+    free(sink);
+}
+
+static long long
+_framesQueued(const _NullBackend* sink)
+{
+    long long elapsedNs = Timeutils_getMonotonicTimeInNs() - sink->startNs;
+    long long consumed =
+      elapsedNs * sink->backend.sampleRate / NS_PER_SECOND;
+    return sink->framesWritten - consumed;
+}
+
+static void
+_sleepUntil(long long timeNs)
+{
+    struct timespec deadline = {
+        .tv_sec = timeNs / NS_PER_SECOND,
+        .tv_nsec = timeNs % NS_PER_SECOND,
+    };
+    while (clock_nanosleep(
+             CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+int
+AudioBackend_openNull(AudioBackend** backend,
+                      unsigned int sampleRate,
+                      unsigned int channels,
+                      size_t periodSize,
+                      bool realtime)
+{
+    _NullBackend* sink = calloc(1, sizeof(_NullBackend));
+    if (!sink) {
+        return -ENOMEM;
+    }
+    sink->backend.ops = &_nullOps;
+    sink->backend.sampleRate = sampleRate;
+    sink->backend.channels = channels;
+    sink->backend.periodSize = periodSize;
+    sink->backend.bufferSize = periodSize * NULL_PERIODS;
+    sink->backend.realtime = realtime;
+
+    sink->sampleBuffer = malloc(periodSize * channels * sizeof(int16_t));
+    if (!sink->sampleBuffer) {
+        free(sink);
+        return -ENOMEM;
+    }
+
+    *backend = &sink->backend;
+    return 0;
+}
@@ -0,0 +1,950 @@
+/**
+ * @file presetbank.c
+ * @brief The built in presets, and banks of presets mapped from files.
+ */
+#include "das/presetbank.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** First bytes of a bank file. */
+#define PRESETBANK_MAGIC "TACP"
+/** Version of the bank file layout. */
+#define PRESETBANK_VERSION 1
+/** Written as a 32 bit value, so the byte order of the file can be checked. */
+#define PRESETBANK_BYTE_ORDER 0x01020304u
+/** Highest sample rate a preset in a bank file may have. */
+#define PRESETBANK_MAX_SAMPLE_RATE 192000
+/** Furthest a note in a bank file may be from C2, in semitones. Any further
+ * and its frequency is nowhere near audible, or not even finite. */
+#define PRESETBANK_MAX_NOTE 128
+
+/** Start of a bank file. The records follow it. */
+typedef struct
+{
+    /** PRESETBANK_MAGIC. */
+    char magic[4];
+    /** PRESETBANK_VERSION. */
+    uint32_t version;
+    /** PRESETBANK_BYTE_ORDER. */
+    uint32_t byteOrder;
+    /** Size of a record, which changes with the layout of FmSynthParams. */
+    uint32_t recordSize;
+    /** How many records follow. */
+    uint32_t count;
+    /** Keeps the records that follow 8 byte aligned. Written as 0. */
+    uint32_t reserved;
+} _PresetBank_Header;
+
+/** A preset in a bank file. */
+typedef struct
+{
+    /** The name, NUL terminated. */
+    char name[PRESETBANK_NAME_MAX];
+    /** The preset. */
+    FmSynthParams params;
+} _PresetBank_Record;
+
+/** Can a preset from a bank file be played safely? */
+static bool
+_isValidParams(const FmSynthParams* params);
+/** Can an envelope from a bank file be played safely? */
+static bool
+_isValidEnvelope(const Env_Envelope* env);
+/** Is a note from a bank file within PRESETBANK_MAX_NOTE of C2? */
+static bool
+_isValidNote(Note note);
+
+struct PresetBank
+{
+    /** How many presets there are. */
+    size_t count;
+    /** The presets of a bank file, in the mapped file. */
+    const _PresetBank_Record* records;
+    /** Names of the built in presets. */
+    const char* const* names;
+    /** The built in presets. */
+    const FmSynthParams* const* params;
+    /** The mapped file, or NULL for the built in bank. */
+    void* map;
+    /** Size of the mapped file. */
+    size_t mapSize;
+};
+
+/**
+ * @brief "Default" parameters.
+ *
+ * Configures OPERATOR0 to output a simple sine wave at A440.
+ */
+static const FmSynthParams _DEFAULT_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 1.0,
+                    .algorithmConnections = { 0.0, 440.0, 0.0, 0.0 } },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .algorithmConnections = { 0 },
+                  },
+                  { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 2.0,
+                    .algorithmConnections = { 0 } },
+                  { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 2.0,
+                    .algorithmConnections = { 0 } } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 1.0,
+                       .repeatPoint = 0,
+                       .lengthMs = 1000,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION }
+
+    }
+};
+
+/** Approximates a piano. */
+static const FmSynthParams _PIANO_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0, 853, 220, 220 } },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.0,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 200.0 },
+                  },
+                  { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 2.5,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0.0, 880.0, 0.0, 0.0 } },
+                  { .waveType = WAVETYPE_SINE,
+                    .CmRatio = 4,
+                    .outputStrength = 0.0,
+                    .algorithmConnections = { 0, 0, 0, 0 } } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_ADSR_HAMMER_FUNCTION },
+                     { .gatePoint = 0.8,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_CONST_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_BELLSTRIKE_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_ADSR_AHH_FUNCTION }
+
+    }
+};
+
+/** A buzzy, angry sounding voice based on saw waves. */
+static const FmSynthParams _SAWBLADE_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 2.50,
+                    .outputStrength = 0.2,
+                    .algorithmConnections = { 0.0, 69, 0.0, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 0.25,
+                    .outputStrength = 0.1,
+                    .algorithmConnections = { 0, 0, 420, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 0.5,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0, 0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 3.5,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0, 0, 1760, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_ADSR_HAMMER_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_ADSR_AHH_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 1300,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 1200,
+                       .fn = PWL_ADSR_HAMMER_FUNCTION } }
+};
+
+/** A ringing bell sound. */
+static const FmSynthParams _BELL_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0.0, 800, 0.0, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3.5,
+                    .algorithmConnections = { 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0, 0, 0, 300 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3.5,
+                    .algorithmConnections = { 0, 0, 0, 100 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_LINEARFALL_FUNCTION },
+                     { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1200,
+                       .fn = PWL_BELLSTRIKE_FUNCTION },
+                     { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_BELLSTRIKE_FUNCTION },
+                     { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1300,
+                       .fn = PWL_BELLSTRIKE_FUNCTION } }
+};
+
+/** A sad sort of voice. */
+static const FmSynthParams _CRY_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1,
+                    .fixToNote = E2,
+                    .outputStrength = 1.0,
+                    .algorithmConnections = { 0.0, 300, 0.0, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .algorithmConnections = { 0, 0.0, 200, 100 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 9.0,
+                    .algorithmConnections = { 0, 0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3.0 / 2.0,
+                    .algorithmConnections = { 0, 0, 0, 160 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.85,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_LINEARFALL_FUNCTION },
+                     { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1200,
+                       .fn = PWL_BELLSTRIKE_FUNCTION },
+                     { .gatePoint = 0.75,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_BELLSTRIKE_FUNCTION },
+                     { .gatePoint = 1.0,
+                       .repeatPoint = 0,
+                       .lengthMs = 200,
+                       .fn = PWL_SWELL_FUNCTION } }
+};
+
+/** Approximates an "ahh" vowell. Tries to emulate the first two vocal formants,
+ * however the formants move with the carrier so it sounds most convincing at
+ * low pitches (around C3). */
+static const FmSynthParams _AHH_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 120 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 11.0,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 760 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 18.0,
+                    .outputStrength = 0.2,
+                    .algorithmConnections = { 0, 0, 0, 1130 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .algorithmConnections = { 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_AHH_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_AHH_FUNCTION },
+                     { .gatePoint = 1,
+                       .repeatPoint = 0,
+                       .lengthMs = 1600,
+                       .fn = PWL_CONST_FUNCTION } }
+};
+
+/** Approximates a bass guitar. */
+static const FmSynthParams _BASS_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 2,
+                    .outputStrength = 0.6,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 440 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 2.0,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0.0, 0.0, 230, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 2,
+                    .algorithmConnections = { 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 2.0,
+                    .algorithmConnections = { 0, 0, 140, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_EXP_FALLOFF_FUNCTION } }
+};
+
+/** Approximates a brass instrument. Sounds trumpet-like. */
+static const FmSynthParams _BRASS_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.6,
+                    .fixToNote = NOTE_NONE,
+                    .algorithmConnections = { 0.0,
+                                              (8 * 233.1),
+                                              (8 * 233.1),
+                                              0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.0,
+                    .fixToNote = NOTE_NONE,
+                    .algorithmConnections = { 0.0, 0.0, (6 * 233.1), 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3.0,
+                    .outputStrength = 0,
+                    .fixToNote = NOTE_NONE,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 4.0,
+                    .outputStrength = 0.2,
+                    .fixToNote = NOTE_NONE,
+                    .algorithmConnections = { 0, (8 * 233.1), 0, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_AHH_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_AHH_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_AHH_FUNCTION } }
+};
+
+/** Meant to have a "yoi" sound, but in practice has a buzzy and quiet
+ * electronic sort of sound. */
+static const FmSynthParams _YOI_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.51,
+                    .algorithmConnections = { 0.0, 4097.0, 0.0, 490.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.68,
+                    .algorithmConnections = { 0.0, 0.0, 1287, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1,
+                    .algorithmConnections = { 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 8.0 / 5,
+                    .algorithmConnections = { 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.1,
+                       .repeatPoint = 0.0,
+                       .lengthMs = 2000,
+                       .fn = PWL_PEAKFALL_FUNCTION },
+                     { .gatePoint = 0.5,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_PEAKFALL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_EXP_FALLOFF_FUNCTION } }
+};
+
+/** A mostly inharmonic but big-sounding voice. Good as a drone! */
+static const FmSynthParams _BIG_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.8,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 380 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1.0 / 20.0,
+                    .outputStrength = 0.3,
+                    .algorithmConnections = { 0.0, 0.0, 450, 30 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1,
+                    .algorithmConnections = { 0, 0, 140, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 2.0,
+                    .algorithmConnections = { 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1500,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 0.8,
+                       .repeatPoint = 0.2,
+                       .lengthMs = 3000,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 1.0,
+                       .repeatPoint = 0,
+                       .lengthMs = 7000,
+                       .fn = PWL_SWELL_FUNCTION }
+
+    }
+};
+
+/** An inharmonic, glitchy, electronic sound. */
+static const FmSynthParams _GLITCHBOOP_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.7,
+                    .algorithmConnections = { 0.0, 1250, 0, 304 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 100.0,
+                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 1.0 / 9,
+                    .outputStrength = 0.15,
+                    .algorithmConnections = { 0, 0, 0, 24 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SAW,
+                    .CmRatio = 1.0 / 27,
+                    .algorithmConnections = { 0, 0, 0, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1500,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 1.0,
+                       .repeatPoint = 0,
+                       .lengthMs = 2345,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.8,
+                       .repeatPoint = 0.2,
+                       .lengthMs = 1000,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = 0.1,
+                       .lengthMs = 3200,
+                       .fn = PWL_SWELL_FUNCTION } }
+
+};
+
+/** An inharmonic "boop boop" sound reminiscent of what people though computers
+ * sounded like in the late 70's. */
+static const FmSynthParams _BEEPBOOP_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.7,
+                    .algorithmConnections = { 0.0, 250, 0, 304 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 100.0,
+                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0 / 9,
+                    .outputStrength = 0.15,
+                    .algorithmConnections = { 0, 0, 0, 24 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SQUARE,
+                    .CmRatio = 1.0 / 53,
+                    .algorithmConnections = { 0, 0, 0, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.65,
+                       .repeatPoint = -1,
+                       .lengthMs = 1500,
+                       .fn = PWL_ADSR_PLUCK_FUNCTION },
+                     { .gatePoint = 1.0,
+                       .repeatPoint = 0,
+                       .lengthMs = 2345,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.8,
+                       .repeatPoint = 0.2,
+                       .lengthMs = 1000,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = 0.1,
+                       .lengthMs = 3200,
+                       .fn = PWL_SWELL_FUNCTION } }
+
+};
+
+/** A big, inharmonic, "shiny" sound with several interweaving
+ * layers. Very interesting as a drone. */
+static const FmSynthParams _SHINYDRONE_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0.0, 2000, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 4.0,
+                    .algorithmConnections = { 0.0, 0.0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 6.0,
+                    .outputStrength = 0.5,
+                    .algorithmConnections = { 0, 0, 0, 2000 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 2.5,
+                    .algorithmConnections = { 0, 0, 0, 2000 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.8,
+                       .repeatPoint = 0.2,
+                       .lengthMs = 1000,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.8,
+                       .repeatPoint = 0.2,
+                       .lengthMs = 800,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = 0.1,
+                       .lengthMs = 2500,
+                       .fn = PWL_SWELL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = 0.1,
+                       .lengthMs = 3700,
+                       .fn = PWL_SWELL_FUNCTION } }
+
+};
+
+/** A happy, short, chirpy sound. */
+static const FmSynthParams _CHIRP_PARAMS = {
+    .sampleRate = 44100,
+    .opParams = { {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.2,
+                    .algorithmConnections = { 0.0, 1760, 0, 0.0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 1.0,
+                    .outputStrength = 0.4,
+                    .algorithmConnections = { 0.0, 0.0, 0.0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 3,
+                    .outputStrength = 0.15,
+                    .algorithmConnections = { 380, 0, 0, 0 },
+                  },
+                  {
+                    .waveType = WAVETYPE_SINE,
+                    .CmRatio = 6.0,
+                    .algorithmConnections = { 0, 0, 0, 0 },
+                  } },
+    .opEnvelopes = { { .gatePoint = 0.2,
+                       .repeatPoint = -1,
+                       .lengthMs = 1000,
+                       .fn = PWL_PEAKFALL_FUNCTION },
+                     { .gatePoint = 0.3,
+                       .repeatPoint = -1,
+                       .lengthMs = 830,
+                       .fn = PWL_EXP_FALLOFF_FUNCTION },
+                     { .gatePoint = 0.2,
+                       .repeatPoint = -1,
+                       .lengthMs = 800,
+                       .fn = PWL_PEAKFALL_FUNCTION },
+                     { .gatePoint = 0.9,
+                       .repeatPoint = -1,
+                       .lengthMs = 600,
+                       .fn = PWL_CONST_FUNCTION } }
+
+};
+
+#define PRESETBANK_BUILTIN_NAME(NAME, name) name,
+#define PRESETBANK_BUILTIN_PARAMS(NAME, name) &_##NAME##_PARAMS,
+/** Names of the built in presets, indexed by FmPresetId. */
+static const char* const _builtinNames[FM_PRESET_COUNT] = { FM_PRESETS(
+  PRESETBANK_BUILTIN_NAME) };
+/** The built in presets, indexed by FmPresetId. */
+static const FmSynthParams* const _builtinParams[FM_PRESET_COUNT] = {
+    FM_PRESETS(PRESETBANK_BUILTIN_PARAMS)
+};
+
+/** The bank built into the library. */
+static const PresetBank _builtinBank = {
+    .count = FM_PRESET_COUNT,
+    .names = _builtinNames,
+    .params = _builtinParams,
+};
+
+/** The bank in use. */
+static const PresetBank* _activeBank = &_builtinBank;
+/** What Fm_getPreset returns, indexed by FmPresetId. */
+static const FmSynthParams* _activePresets[FM_PRESET_COUNT] = { FM_PRESETS(
+  PRESETBANK_BUILTIN_PARAMS) };
+
+static bool
+_isValidParams(const FmSynthParams* params)
+{
+    if (params->sampleRate == 0 ||
+        params->sampleRate > PRESETBANK_MAX_SAMPLE_RATE ||
+        !_isValidNote(params->note)) {
+        return false;
+    }
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const OperatorParams* opParams = &params->opParams[op];
+        // The wave type picks a table, and the rest set the pitch and the
+        // modulation, which turn into table indices. The fixed note is only
+        // played when the CM ratio is negative.
+        if (opParams->waveType < WAVETYPE_SINE ||
+            opParams->waveType > WAVETYPE_SAW ||
+            !isfinite(opParams->CmRatio) ||
+            !isfinite(opParams->outputStrength) ||
+            (opParams->CmRatio < 0 && !_isValidNote(opParams->fixToNote)) ||
+            !_isValidEnvelope(&params->opEnvelopes[op])) {
+            return false;
+        }
+        for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+            if (!isfinite(opParams->algorithmConnections[modOp])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool
+_isValidEnvelope(const Env_Envelope* env)
+{
+    // The step and segments are worked out again when the preset is used,
+    // but the rest is used as it is.
+    if (env->lengthMs <= 0 || env->fn.pts < 2 ||
+        env->fn.pts > PWL_MAX_POINTS || !isfinite(env->gatePoint) ||
+        !isfinite(env->repeatPoint) || !isfinite(env->min)) {
+        return false;
+    }
+    for (int i = 0; i < env->fn.pts; i++) {
+        if (!isfinite(env->fn.ptsX[i]) || !isfinite(env->fn.ptsY[i]) ||
+            (i > 0 && env->fn.ptsX[i] < env->fn.ptsX[i - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+_isValidNote(Note note)
+{
+    return note >= -PRESETBANK_MAX_NOTE && note <= PRESETBANK_MAX_NOTE;
+}
+
+const PresetBank*
+PresetBank_getBuiltin(void)
+{
+    return &_builtinBank;
+}
+
+int
+PresetBank_open(PresetBank** bank, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(_PresetBank_Header)) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    // Private and read only, so presets are paged in from the file as they
+    // are played and never copied.
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+
+    const _PresetBank_Header* header = map;
+    const _PresetBank_Record* records =
+      (const _PresetBank_Record*)(header + 1);
+    bool valid =
+      memcmp(header->magic, PRESETBANK_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == PRESETBANK_VERSION &&
+      header->byteOrder == PRESETBANK_BYTE_ORDER &&
+      header->recordSize == sizeof(_PresetBank_Record) &&
+      header->count <=
+        (size - sizeof(_PresetBank_Header)) / sizeof(_PresetBank_Record);
+    for (size_t i = 0; valid && i < header->count; i++) {
+        valid = memchr(records[i].name, '\0', PRESETBANK_NAME_MAX) != NULL &&
+                _isValidParams(&records[i].params);
+    }
+    if (!valid) {
+        munmap(map, size);
+        return -EINVAL;
+    }
+
+    PresetBank* b = calloc(1, sizeof(PresetBank));
+    if (!b) {
+        munmap(map, size);
+        return -ENOMEM;
+    }
+    b->count = header->count;
+    b->records = records;
+    b->map = map;
+    b->mapSize = size;
+
+    *bank = b;
+    return 0;
+}
+
+void
+PresetBank_close(PresetBank* bank)
+{
+    if (_activeBank == bank) {
+        PresetBank_use(&_builtinBank);
+    }
+    munmap(bank->map, bank->mapSize);
+    free(bank);
+}
+
+int
+PresetBank_write(const char* path,
+                 const char* const* names,
+                 const FmSynthParams* const* params,
+                 size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strlen(names[i]) >= PRESETBANK_NAME_MAX) {
+            return -ENAMETOOLONG;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return -errno;
+    }
+
+    _PresetBank_Header header = { .version = PRESETBANK_VERSION,
+                                  .byteOrder = PRESETBANK_BYTE_ORDER,
+                                  .recordSize = sizeof(_PresetBank_Record),
+                                  .count = count };
+    memcpy(header.magic, PRESETBANK_MAGIC, sizeof(header.magic));
+    int err = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -EIO;
+
+    for (size_t i = 0; err == 0 && i < count; i++) {
+        // Zeroed so the padding in the file is too.
+        _PresetBank_Record record;
+        memset(&record, 0, sizeof(record));
+        strcpy(record.name, names[i]);
+        memcpy(&record.params, params[i], sizeof(FmSynthParams));
+        if (fwrite(&record, sizeof(record), 1, file) != 1) {
+            err = -EIO;
+        }
+    }
+
+    if (fclose(file) != 0 && err == 0) {
+        err = -EIO;
+    }
+    return err;
+}
+
+size_t
+PresetBank_count(const PresetBank* bank)
+{
+    return bank->count;
+}
+
+const char*
+PresetBank_getName(const PresetBank* bank, size_t index)
+{
+    return bank->records ? bank->records[index].name : bank->names[index];
+}
+
+const FmSynthParams*
+PresetBank_get(const PresetBank* bank, size_t index)
+{
+    return bank->records ? &bank->records[index].params : bank->params[index];
+}
+
+const FmSynthParams*
+PresetBank_find(const PresetBank* bank, const char* name)
+{
+    for (size_t i = 0; i < bank->count; i++) {
+        if (strcmp(PresetBank_getName(bank, i), name) == 0) {
+            return PresetBank_get(bank, i);
+        }
+    }
+    return NULL;
+}
+
+void
+PresetBank_use(const PresetBank* bank)
+{
+    for (int id = 0; id < FM_PRESET_COUNT; id++) {
+        const FmSynthParams* params = PresetBank_find(bank, _builtinNames[id]);
+        _activePresets[id] = params ? params : _builtinParams[id];
+    }
+    _activeBank = bank;
+}
+
+const PresetBank*
+PresetBank_getActive(void)
+{
+    return _activeBank;
+}
+
+const FmSynthParams*
+Fm_getPreset(FmPresetId id)
+{
+    return _activePresets[id];
+}
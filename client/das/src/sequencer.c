@@ -6,17 +6,19 @@
 #include "das/sequencer.h"
 #include "com/timeutils.h"
 #include "das/fmplayer.h"
+#include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/** Slots in the sequencer. */
+/** Slots in the default pattern. */
 #define SEQUENCER_SLOTS (SEQ_BEAT_SLOTS * SEQ_SIXTEENTH_NOTE_IN_QUARTER_NOTE)
 
-/** Converts BPM to nanoseconds between slots. */
-#define BPM_TO_NS(B) (NS_IN_MINUTE / (B) / SEQ_SIXTEENTH_NOTE_IN_QUARTER_NOTE)
-
 /** Get a sequencer slot index given quarter, eighth, and sixteenth note index.
  */
 #define SEQ_SLOT_IDX(Q, E, S)                                                  \
@@ -24,7 +26,36 @@
      ((E) * SEQ_EIGHTH_NOTE_IN_QUARTER_NOTE) + (S))
 
 /** Number of NS in a minute. */
-#define NS_IN_MINUTE 60000000000
+#define NS_IN_MINUTE 60000000000ULL
+
+/** Number of NS in a second. */
+#define NS_IN_SECOND 1000000000LL
+
+/** Number of seconds in a minute. */
+#define SECONDS_IN_MINUTE 60ULL
+
+/** Number of NS in a microsecond. */
+#define NS_IN_US 1000
+
+/** How many slots late the sequencer can fall before it stops catching up
+ * and starts timing again from where it is. */
+#define SEQ_MAX_LATE_SLOTS 1
+
+/** How long to wait between checks for the pattern a reset asked for. */
+#define SEQ_PATTERN_POLL_NS 1000000
+
+/** Which of the two patterns is playing. */
+#define PATTERN_FRONT 1u
+/** The back pattern is filled and waiting to be swapped in. */
+#define PATTERN_READY 2u
+/** The back pattern hasn't been written since it was swapped out, so it
+ * still holds the loop before last. */
+#define PATTERN_STALE 4u
+/** One reset. The bits above the flags count resets, so that a pattern
+ * filled before a reset is never swapped in after it. */
+#define PATTERN_RESET 8u
+/** Mask of the reset count. */
+#define PATTERN_RESETS (~(PATTERN_RESET - 1))
 
 /** States the sequencer can be in. */
 enum sequencerState
@@ -35,58 +66,617 @@ enum sequencerState
     SEQ_END
 };
 
+/** An event in a pattern. */
+typedef struct
+{
+    /** When to play it, in ticks from the start of the pattern. */
+    SequencerTick tick;
+    /** What to play. */
+    SequencerOp op;
+} _SequencerEvent;
+
+/** A track's loop of events. */
+typedef struct
+{
+    /** How long the track loops for, in ticks, or 0 to loop with the
+     * pattern. */
+    SequencerTick length;
+    /** How many events there are. */
+    size_t nEvents;
+    /** The events, sorted by tick. Events at the same tick are in the order
+     * they were added. */
+    _SequencerEvent events[SEQ_MAX_EVENTS];
+} _SequencerTrackPattern;
+
+/** The loops of every track. */
+typedef struct
+{
+    /** How long the pattern is, in ticks. Every track starts again from the
+     * top when it ends. */
+    SequencerTick length;
+    /** The tempo to play the pattern at from the start of its loop, or 0 to
+     * carry on at the tempo playing. */
+    SequencerBpm bpm;
+    /** The tracks. */
+    _SequencerTrackPattern tracks[SEQ_MAX_TRACKS];
+} _SequencerPattern;
+
+/** Where a track is in the pattern playing. Only touched by the thread
+ * playing the events. */
+typedef struct
+{
+    /** The next event to play. */
+    size_t nextEvent;
+    /** The tick of the pattern the track's current loop started on. */
+    SequencerTick loopTick;
+} _SequencerTrackPosition;
+
 /** Internal sequencer struct. */
 struct sequencer
 {
-    /** The sequence. */
-    SequencerOp sequence[SEQUENCER_SLOTS];
-    /** Current playback position. */
-    SequencerIdx playbackPosition;
+    /** The front pattern, which is playing, and the back pattern, which is
+     * filled for the next loop. See _patternState for which is which. */
+    _SequencerPattern patterns[2];
+    /** Ticks per quarter note. */
+    SequencerTick ppq;
+    /** Where each track is in the front pattern. */
+    _SequencerTrackPosition positions[SEQ_MAX_TRACKS];
+    /** Has anything in the current loop played yet? Only touched by the
+     * thread playing the events. */
+    bool midLoop;
+    /** The player each track plays on. */
+    FmPlayer* players[SEQ_MAX_TRACKS];
+    /** Is each track muted? */
+    atomic_bool muted[SEQ_MAX_TRACKS];
+    /** How many tracks there are. The players of the first nTracks are
+     * set. */
+    atomic_size_t nTracks;
     /** BPM we're playing at. */
-    SequencerBpm bpm;
+    _Atomic SequencerBpm bpm;
     /** Optional callback. */
     loopCallbackFn loopCallback;
-    /** ns between advancing one slot (sixteenth note). */
-    unsigned long long nsBetweenUpdates;
+
+    /** When tick 0 of the current loop was due, on the monotonic clock.
+     * Every tick is due a fixed time after it, so lateness never adds up.
+     * Only touched by the sequencer thread. */
+    long long loopStartNs;
+    /** The tempo loopStartNs or loopFrame was worked out with. */
+    SequencerBpm loopBpm;
+    /** Is loopStartNs valid? Playback times itself from scratch when it
+     * starts, or after falling too far behind. */
+    bool timed;
+    /** Has the current loop been started with _startLoop? */
+    bool loopStarted;
+
+    /** What times the events. */
+    SequencerClock clock;
+    /** On SEQ_CLOCK_RENDER, frames rendered since tick 0 of the current
+     * loop was due, timed with loopBpm. Only touched by the player thread. */
+    long long loopFrame;
+    /** On SEQ_CLOCK_RENDER, have we played an event since we last stopped? */
+    bool playing;
+    /** Hold off playing until a pattern filled since the last reset is
+     * swapped in? Only touched by the thread playing the events. */
+    bool awaitingPattern;
+    /** The reset count when the front pattern was filled. */
+    unsigned int frontResets;
 };
 
+/** Timing statistics the sequencer thread updates while others read them. */
+typedef struct
+{
+    atomic_ulong events;
+    atomic_ulong wakeups;
+    atomic_ulong resyncs;
+    atomic_llong maxLateUs;
+    atomic_ulong lateUs[FMPLAYER_HISTOGRAM_BINS];
+} _SequencerStats;
+
 /** The sequencer. */
 static struct sequencer* seq;
 /** Current sequencer state. */
 static _Atomic enum sequencerState _sequencerState = SEQ_STOP;
 /** The sequencer worker thread.*/
 static pthread_t _sequencerThread;
-/** Lock protecting the sequencer data. */
-static pthread_rwlock_t _seqLock = PTHREAD_RWLOCK_INITIALIZER;
-/** State condition used for pausing the sequencer when stopped. */
+/** Which pattern is in front, whether the back one is ready, and how many
+ * resets there have been. The thread playing the events only reads the
+ * front pattern, and whoever fills the back one only writes that one, so
+ * neither takes a lock. */
+static _Atomic unsigned int _patternState;
+/** Thread that calls the loop callback to fill the back pattern. */
+static pthread_t _fillThread;
+/** Posted to ask the fill thread for a pattern. */
+static sem_t _fillRequest;
+/** Has a pattern been asked for that the fill thread hasn't started on? */
+static atomic_bool _fillRequested;
+/** State condition used for pausing the sequencer when stopped, and for
+ * waking it from a wait for the next tick when the state or tempo changes.
+ * Times its waits with the monotonic clock, like the ticks. */
 static pthread_cond_t _stateCond = PTHREAD_COND_INITIALIZER;
-/** Mutex required for the state condition.*/
+/** Mutex required for the state condition. The state and tempo are changed
+ * before taking it to signal, and checked with it held before waiting, so a
+ * change can't slip in between the check and the wait.*/
 static pthread_mutex_t _stateCondMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Timing statistics. */
+static _SequencerStats _stats;
 
-/** Performs the actions in the sequencer slot referenced by the given index. */
+/** Performs a sequencer operation on a track. */
+static void
+_runOp(SequencerTrack track, const SequencerOp* op);
+/** Make an operation for a track, compiling its voice for the track's
+ * player. */
+static int
+_makeOp(SequencerTrack track,
+        FmPlayer_NoteCtrl control,
+        Note note,
+        const FmSynthParams* synthParams,
+        SequencerOp* op);
+/** The tick a slot starts on. */
+static SequencerTick
+_slotTick(SequencerIdx idx);
+/** Index of the first event on the track at or after the tick. */
+static size_t
+_findTick(const _SequencerTrackPattern* track, SequencerTick tick);
+/** How long a track loops for. */
+static SequencerTick
+_trackLength(const _SequencerPattern* pattern, SequencerTrack track);
+/** Add an event to a track, after any already at its tick. */
+static int
+_addEvent(_SequencerPattern* pattern,
+          SequencerTrack track,
+          SequencerTick tick,
+          const SequencerOp* op);
+/** Remove every event at a tick from a track. */
+static void
+_removeTick(_SequencerTrackPattern* track, SequencerTick tick);
+/** Get the pattern that is playing. */
+static const _SequencerPattern*
+_frontPattern(void);
+/** The tick of the pattern a track's next event is due on, or SIZE_MAX if
+ * it has none. */
+static SequencerTick
+_trackNextTick(const _SequencerPattern* pattern, SequencerTrack track);
+/** The tick the next event on any track is due on, or the length of the
+ * pattern if there are no more events in it. */
+static SequencerTick
+_nextTick(void);
+/** Go back to the start of the pattern. */
+static void
+_rewind(void);
+/** Play the events due at the tick on every track. If the tick is the end of
+ * the pattern, start the next loop instead and return true. */
+static bool
+_playTick(SequencerTick tick);
+/** Time from the start of a loop to a tick, in ns. */
+static long long
+_tickNs(SequencerTick tick, SequencerBpm bpm);
+/** Work out when a tick is due, on the monotonic clock. */
+static long long
+_tickDeadline(SequencerTick tick, SequencerBpm bpm);
+/** Record a wakeup, and how late it was. */
 static void
-_runSequencerSlot(SequencerIdx idx);
+_recordLateness(long long lateNs);
+/** Wait for a tick's deadline, unless the state or tempo changes first.
+ * Returns whether the deadline was reached. */
+static bool
+_waitForTick(long long deadlineNs, SequencerBpm bpm);
+/** Wake the sequencer thread to look at the state and tempo again. */
+static void
+_wake(void);
 /** Main sequencer thread function. */
 static void*
 _sequencer(void*);
+/** Fill thread function. */
+static void*
+_filler(void*);
+/** Get the back pattern to write to. */
+static _SequencerPattern*
+_backPattern(void);
+/** Mark the back pattern ready, unless there was a reset since resets was
+ * read from _patternState. */
+static bool
+_commit(unsigned int resets);
+/** Swap in the back pattern if it is ready. */
+static bool
+_swapPatterns(void);
+/** Ask the fill thread for a pattern, if there is a loop callback. */
+static void
+_requestFill(void);
+/** Start a loop: swap in the pattern filled for it and ask for the next
+ * one. Returns false if a reset is still waiting for a pattern filled after
+ * it. */
+static bool
+_startLoop(void);
+/** Frame a tick is due on, counting from the start of the loop. */
+static long long
+_tickFrame(SequencerTick tick, SequencerBpm bpm, unsigned int sampleRate);
+/** Send a note off to every track's player. */
+static void
+_silenceTracks(void);
+/** Is the tempo from SEQ_MIN_BPM to SEQ_MAX_BPM? */
+static bool
+_isValidBpm(SequencerBpm bpm);
+/** Render clock. Plays the events that are due and returns the frames
+ * until the next one. */
+static size_t
+_onRenderClock(void* data, size_t elapsedFrames, unsigned int sampleRate);
+
+static void
+_runOp(SequencerTrack track, const SequencerOp* op)
+{
+    FmPlayer* player = seq->players[track];
+    // A muted track keeps changing voices and letting go of notes, so it
+    // picks up where it should when it's unmuted, but starts nothing.
+    bool muted = atomic_load_explicit(&seq->muted[track], memory_order_relaxed);
+
+    if (op->voice != NULL) {
+        FmPlayer_setVoice(player, op->voice);
+    }
+
+    if (op->note != NOTE_NONE && !muted) {
+        FmPlayer_setNote(player, op->note);
+    }
+
+    if (op->op == NOTE_CTRL_NOTE_OFF ||
+        (op->op != NOTE_CTRL_NONE && !muted)) {
+        FmPlayer_controlNote(player, op->op);
+    }
+}
+
+static int
+_makeOp(SequencerTrack track,
+        FmPlayer_NoteCtrl control,
+        Note note,
+        const FmSynthParams* synthParams,
+        SequencerOp* op)
+{
+    // Compiled now, so the thread playing the events never has to, which on
+    // SEQ_CLOCK_RENDER is the player thread.
+    op->op = control;
+    op->note = note;
+    op->voice = NULL;
+    if (synthParams &&
+        !(op->voice = FmPlayer_getVoice(seq->players[track], synthParams))) {
+        return SEQ_EALLOC;
+    }
+    return SEQ_OK;
+}
+
+static SequencerTick
+_slotTick(SequencerIdx idx)
+{
+    return idx * seq->ppq / SEQ_SIXTEENTH_NOTE_IN_QUARTER_NOTE;
+}
+
+static size_t
+_findTick(const _SequencerTrackPattern* track, SequencerTick tick)
+{
+    size_t lo = 0;
+    size_t hi = track->nEvents;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (track->events[mid].tick < tick) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static SequencerTick
+_trackLength(const _SequencerPattern* pattern, SequencerTrack track)
+{
+    SequencerTick length = pattern->tracks[track].length;
+    return length ? length : pattern->length;
+}
+
+static int
+_addEvent(_SequencerPattern* pattern,
+          SequencerTrack track,
+          SequencerTick tick,
+          const SequencerOp* op)
+{
+    if (track >= atomic_load(&seq->nTracks) ||
+        tick >= _trackLength(pattern, track)) {
+        return SEQ_EINVAL;
+    }
+
+    _SequencerTrackPattern* events = &pattern->tracks[track];
+    if (events->nEvents >= SEQ_MAX_EVENTS) {
+        return SEQ_EFULL;
+    }
+
+    // Events are mostly added in order, so search from the end.
+    size_t i = events->nEvents;
+    while (i > 0 && events->events[i - 1].tick > tick) {
+        events->events[i] = events->events[i - 1];
+        i--;
+    }
+    events->events[i].tick = tick;
+    events->events[i].op = *op;
+    events->nEvents++;
+    return SEQ_OK;
+}
+
+static void
+_removeTick(_SequencerTrackPattern* track, SequencerTick tick)
+{
+    size_t from = _findTick(track, tick);
+    size_t to = from;
+    while (to < track->nEvents && track->events[to].tick == tick) {
+        to++;
+    }
+    memmove(track->events + from,
+            track->events + to,
+            (track->nEvents - to) * sizeof(_SequencerEvent));
+    track->nEvents -= to - from;
+}
+
+static const _SequencerPattern*
+_frontPattern(void)
+{
+    return &seq->patterns[atomic_load(&_patternState) & PATTERN_FRONT];
+}
+
+static SequencerTick
+_trackNextTick(const _SequencerPattern* pattern, SequencerTrack track)
+{
+    const _SequencerTrackPattern* events = &pattern->tracks[track];
+    const _SequencerTrackPosition* position = &seq->positions[track];
+    if (events->nEvents == 0) {
+        return SIZE_MAX;
+    }
+    if (position->nextEvent < events->nEvents) {
+        return position->loopTick + events->events[position->nextEvent].tick;
+    }
+    // The first event of the track's next loop. Looping by itself doesn't
+    // need a wakeup.
+    return position->loopTick + _trackLength(pattern, track) +
+           events->events[0].tick;
+}
+
+static SequencerTick
+_nextTick(void)
+{
+    const _SequencerPattern* pattern = _frontPattern();
+    SequencerTick next = pattern->length;
+    size_t nTracks = atomic_load(&seq->nTracks);
+    for (SequencerTrack track = 0; track < nTracks; track++) {
+        SequencerTick tick = _trackNextTick(pattern, track);
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+static void
+_rewind(void)
+{
+    memset(seq->positions, 0, sizeof(seq->positions));
+    seq->midLoop = false;
+}
+
+static bool
+_playTick(SequencerTick tick)
+{
+    const _SequencerPattern* pattern = _frontPattern();
+    if (tick >= pattern->length) {
+        // Never waits: only a reset waits, and it starts its own loop.
+        _rewind();
+        _startLoop();
+        return true;
+    }
+
+    seq->midLoop = true;
+    size_t nTracks = atomic_load(&seq->nTracks);
+    for (SequencerTrack track = 0; track < nTracks; track++) {
+        if (_trackNextTick(pattern, track) != tick) {
+            continue;
+        }
+
+        const _SequencerTrackPattern* events = &pattern->tracks[track];
+        _SequencerTrackPosition* position = &seq->positions[track];
+        if (position->nextEvent >= events->nEvents) {
+            position->loopTick += _trackLength(pattern, track);
+            position->nextEvent = 0;
+        }
+        while (position->nextEvent < events->nEvents &&
+               position->loopTick +
+                   events->events[position->nextEvent].tick ==
+                 tick) {
+            _runOp(track, &events->events[position->nextEvent].op);
+            position->nextEvent++;
+            atomic_fetch_add_explicit(
+              &_stats.events, 1, memory_order_relaxed);
+        }
+    }
+    return false;
+}
+
+static _SequencerPattern*
+_backPattern(void)
+{
+    // Take back a pattern that is waiting to be swapped in, so it can't be
+    // swapped in half written. Nothing else changes the front pattern while
+    // the back one isn't ready.
+    unsigned int state = atomic_load(&_patternState);
+    while ((state & (PATTERN_READY | PATTERN_STALE)) &&
+           !atomic_compare_exchange_weak(
+             &_patternState,
+             &state,
+             state & ~(PATTERN_READY | PATTERN_STALE))) {
+    }
+
+    _SequencerPattern* front = &seq->patterns[state & PATTERN_FRONT];
+    _SequencerPattern* back = &seq->patterns[!(state & PATTERN_FRONT)];
+    if (state & PATTERN_STALE) {
+        // Start from what's playing, as if there were only one pattern. Its
+        // tempo was set when it was swapped in, and may have changed since.
+        back->length = front->length;
+        back->bpm = 0;
+        for (SequencerTrack track = 0; track < SEQ_MAX_TRACKS; track++) {
+            _SequencerTrackPattern* from = &front->tracks[track];
+            _SequencerTrackPattern* to = &back->tracks[track];
+            to->length = from->length;
+            to->nEvents = from->nEvents;
+            memcpy(to->events,
+                   from->events,
+                   from->nEvents * sizeof(_SequencerEvent));
+        }
+    }
+    return back;
+}
+
+static bool
+_commit(unsigned int resets)
+{
+    _backPattern();
+    unsigned int state = atomic_load(&_patternState);
+    do {
+        if ((state & PATTERN_RESETS) != resets) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(
+      &_patternState, &state, state | PATTERN_READY));
+    return true;
+}
+
+static bool
+_swapPatterns(void)
+{
+    unsigned int state = atomic_load(&_patternState);
+    while (state & PATTERN_READY) {
+        unsigned int swapped =
+          ((state & ~PATTERN_READY) ^ PATTERN_FRONT) | PATTERN_STALE;
+        if (atomic_compare_exchange_weak(&_patternState, &state, swapped)) {
+            // Ready patterns were filled since the last reset, or the reset
+            // would have taken them back.
+            seq->frontResets = state & PATTERN_RESETS;
+            SequencerBpm bpm = seq->patterns[swapped & PATTERN_FRONT].bpm;
+            if (bpm != 0) {
+                seq->bpm = bpm;
+            }
+            return true;
+        }
+    }
+    return false;
+}
 
 static void
-_runSequencerSlot(SequencerIdx idx)
+_requestFill(void)
 {
-    SequencerOp* op = &seq->sequence[idx];
-    if (op->synthParams != NULL) {
-        FmPlayer_setSynthVoice(op->synthParams);
+    if (seq->loopCallback && !atomic_exchange(&_fillRequested, true)) {
+        sem_post(&_fillRequest);
     }
+}
 
-    if (op->note != NOTE_NONE) {
-        FmPlayer_setNote(op->note);
+static bool
+_startLoop(void)
+{
+    _swapPatterns();
+    if (seq->awaitingPattern) {
+        unsigned int resets = atomic_load(&_patternState) & PATTERN_RESETS;
+        if (seq->frontResets != resets) {
+            return false;
+        }
+        seq->awaitingPattern = false;
     }
+    _requestFill();
+    return true;
+}
 
-    if (op->op != NOTE_CTRL_NONE) {
-        FmPlayer_controlNote(op->op);
+static void*
+_filler(void* _data)
+{
+    (void)_data;
+    while (1) {
+        while (sem_wait(&_fillRequest) < 0) {
+            // Interrupted. Wait again.
+        }
+        if (_sequencerState == SEQ_END) {
+            return NULL;
+        }
+
+        // Asked for again while filling, we fill again.
+        atomic_store(&_fillRequested, false);
+        unsigned int resets = atomic_load(&_patternState) & PATTERN_RESETS;
+        seq->loopCallback();
+        _commit(resets);
     }
 }
 
+static long long
+_tickNs(SequencerTick tick, SequencerBpm bpm)
+{
+    return tick * NS_IN_MINUTE / (bpm * seq->ppq);
+}
+
+static long long
+_tickDeadline(SequencerTick tick, SequencerBpm bpm)
+{
+    if (!seq->timed) {
+        // Due now. If nothing in the loop has played yet, the loop starts
+        // now instead.
+        SequencerTick from = seq->midLoop ? tick : 0;
+        seq->loopStartNs =
+          Timeutils_getMonotonicTimeInNs() - _tickNs(from, bpm);
+        seq->loopBpm = bpm;
+        seq->timed = true;
+    } else if (bpm != seq->loopBpm) {
+        // The tempo changed, maybe while waiting for this tick. Keep the
+        // loop where it is now and space the rest of it out from here.
+        long long now = Timeutils_getMonotonicTimeInNs();
+        seq->loopStartNs =
+          now - (now - seq->loopStartNs) * (long long)seq->loopBpm / bpm;
+        seq->loopBpm = bpm;
+    }
+    return seq->loopStartNs + _tickNs(tick, bpm);
+}
+
+static void
+_recordLateness(long long lateNs)
+{
+    long long lateUs = lateNs / NS_IN_US;
+    atomic_fetch_add_explicit(&_stats.wakeups, 1, memory_order_relaxed);
+    // Only this thread writes it, so there's no race between the load and
+    // the store.
+    if (lateUs >
+        atomic_load_explicit(&_stats.maxLateUs, memory_order_relaxed)) {
+        atomic_store_explicit(&_stats.maxLateUs, lateUs, memory_order_relaxed);
+    }
+
+    int bin = 0;
+    while (lateUs > 0 && bin < FMPLAYER_HISTOGRAM_BINS - 1) {
+        lateUs >>= 1;
+        bin++;
+    }
+    atomic_fetch_add_explicit(&_stats.lateUs[bin], 1, memory_order_relaxed);
+}
+
+static bool
+_waitForTick(long long deadlineNs, SequencerBpm bpm)
+{
+    const struct timespec deadline = { deadlineNs / NS_IN_SECOND,
+                                       deadlineNs % NS_IN_SECOND };
+    int err = 0;
+    pthread_mutex_lock(&_stateCondMutex);
+    if (_sequencerState == SEQ_RUN && seq->bpm == bpm) {
+        err = pthread_cond_timedwait(&_stateCond, &_stateCondMutex, &deadline);
+    }
+    pthread_mutex_unlock(&_stateCondMutex);
+    return err == ETIMEDOUT;
+}
+
+static void
+_wake(void)
+{
+    pthread_mutex_lock(&_stateCondMutex);
+    pthread_cond_broadcast(&_stateCond);
+    pthread_mutex_unlock(&_stateCondMutex);
+}
+
 static void*
 _sequencer(void* _data)
 {
@@ -99,47 +689,64 @@ _sequencer(void* _data)
                 // run the sequencer
                 // This thread is the only one that reads/writes playback
                 // position
-                long long start = Timeutils_getTimeInNs();
-                long long timeBetweenUpdates = 0;
-
-                SequencerIdx currentPos = seq->playbackPosition;
-
-                // Call the callback first.
-                if (currentPos == 0 && seq->loopCallback) {
-                    // TODO: This doesn't allow the user to cancel the
-                    // sequencer. We should at least check the state after
-                    // calling this to see if it was changed.
-                    seq->loopCallback();
+                if (!seq->loopStarted) {
+                    // The fill thread fills the next pattern while this one
+                    // plays.
+                    if (!_startLoop()) {
+                        Timeutils_sleepForNs(SEQ_PATTERN_POLL_NS);
+                        break;
+                    }
+                    seq->loopStarted = true;
                 }
 
-                pthread_rwlock_rdlock(&_seqLock);
-                _runSequencerSlot(currentPos);
-                timeBetweenUpdates = seq->nsBetweenUpdates;
-                pthread_rwlock_unlock(&_seqLock);
+                // Sleep through the ticks with nothing on them.
+                SequencerBpm bpm = seq->bpm;
+                SequencerTick tick = _nextTick();
+                long long deadline = _tickDeadline(tick, bpm);
+                if (!_waitForTick(deadline, bpm)) {
+                    // Stopped, reset or retimed while waiting for the tick.
+                    // The next pass works out the deadline again.
+                    break;
+                }
 
-                if (currentPos + 1 >= SEQUENCER_SLOTS) {
-                    seq->playbackPosition = 0;
-                } else {
-                    seq->playbackPosition = currentPos + 1;
+                long long now = Timeutils_getMonotonicTimeInNs();
+                if (now - deadline >
+                    _tickNs(_slotTick(SEQ_MAX_LATE_SLOTS), bpm)) {
+                    // Rushing through the missed events would only make it
+                    // worse. Time the loop from this tick instead.
+                    atomic_fetch_add_explicit(
+                      &_stats.resyncs, 1, memory_order_relaxed);
+                    seq->loopStartNs = now - _tickNs(tick, bpm);
                 }
+                _recordLateness(now - deadline);
 
-                long long elapsed = Timeutils_getTimeInNs() - start;
-                long long toSleep = timeBetweenUpdates - elapsed;
-                Timeutils_sleepForNs(toSleep);
+                if (_playTick(tick)) {
+                    // The new loop starts where the old one ended, at the
+                    // tempo of its own pattern.
+                    seq->loopStartNs += _tickNs(tick, seq->loopBpm);
+                    seq->loopBpm = seq->bpm;
+                }
 
                 break;
             }
             case SEQ_STOP: {
-                FmPlayer_controlNote(NOTE_CTRL_NOTE_OFF);
+                _silenceTracks();
 
                 pthread_mutex_lock(&_stateCondMutex);
-                pthread_cond_wait(&_stateCond, &_stateCondMutex);
+                while (_sequencerState == SEQ_STOP) {
+                    pthread_cond_wait(&_stateCond, &_stateCondMutex);
+                }
                 pthread_mutex_unlock(&_stateCondMutex);
 
+                // Resume from now, not from when we stopped.
+                seq->timed = false;
                 break;
             }
             case SEQ_RESET: {
-                seq->playbackPosition = 0;
+                _rewind();
+                seq->timed = false;
+                seq->loopStarted = false;
+                seq->awaitingPattern = seq->loopCallback != NULL;
                 _sequencerState = SEQ_RUN;
                 break;
             }
@@ -155,9 +762,118 @@ _sequencer(void* _data)
     }
 }
 
+static long long
+_tickFrame(SequencerTick tick, SequencerBpm bpm, unsigned int sampleRate)
+{
+    return tick * SECONDS_IN_MINUTE * sampleRate / (bpm * seq->ppq);
+}
+
+static void
+_silenceTracks(void)
+{
+    size_t nTracks = atomic_load(&seq->nTracks);
+    for (SequencerTrack track = 0; track < nTracks; track++) {
+        FmPlayer_controlNote(seq->players[track], NOTE_CTRL_NOTE_OFF);
+    }
+}
+
+static size_t
+_onRenderClock(void* data, size_t elapsedFrames, unsigned int sampleRate)
+{
+    (void)data;
+    int state = _sequencerState;
+    if (state == SEQ_RESET) {
+        _rewind();
+        seq->timed = false;
+        seq->loopStarted = false;
+        seq->awaitingPattern = seq->loopCallback != NULL;
+        _sequencerState = state = SEQ_RUN;
+    }
+    if (state != SEQ_RUN) {
+        if (seq->playing) {
+            _silenceTracks();
+            seq->playing = false;
+        }
+        // Resume from now, not from when we stopped. The clock is called
+        // every period, so there's no need to be called sooner.
+        seq->timed = false;
+        return SIZE_MAX;
+    }
+    if (!seq->loopStarted) {
+        if (!_startLoop()) {
+            // The clock is called every period, so look again then.
+            return SIZE_MAX;
+        }
+        seq->loopStarted = true;
+    }
+    seq->playing = true;
+
+    SequencerBpm bpm = seq->bpm;
+    if (!seq->timed) {
+        // Due now, as in _tickDeadline.
+        SequencerTick from = seq->midLoop ? _nextTick() : 0;
+        seq->loopFrame = _tickFrame(from, bpm, sampleRate);
+        seq->loopBpm = bpm;
+        seq->timed = true;
+    } else {
+        seq->loopFrame += elapsedFrames;
+        if (bpm != seq->loopBpm) {
+            // The tempo changed. Keep the next tick where it was and space
+            // the rest of the loop out around it.
+            SequencerTick tick = _nextTick();
+            long long left =
+              _tickFrame(tick, seq->loopBpm, sampleRate) - seq->loopFrame;
+            seq->loopFrame = _tickFrame(tick, bpm, sampleRate) - left;
+            seq->loopBpm = bpm;
+        }
+    }
+
+    while (1) {
+        SequencerTick tick = _nextTick();
+        long long due = _tickFrame(tick, seq->loopBpm, sampleRate);
+        if (seq->loopFrame < due) {
+            return due - seq->loopFrame;
+        }
+
+        _recordLateness(0);
+        if (_playTick(tick)) {
+            // As on the sequencer thread.
+            seq->loopFrame -= due;
+            seq->loopBpm = seq->bpm;
+            if (due == 0) {
+                // A loop shorter than a frame. Play the next one next frame
+                // rather than looping here forever.
+                return 1;
+            }
+        }
+    }
+}
+
+static bool
+_isValidBpm(SequencerBpm bpm)
+{
+    return bpm >= SEQ_MIN_BPM && bpm <= SEQ_MAX_BPM;
+}
+
 int
 Sequencer_initialize(SequencerBpm bpm, loopCallbackFn callback)
 {
+    Sequencer_Config config = SEQ_DEFAULT_CONFIG;
+    config.bpm = bpm;
+    return Sequencer_initializeWithConfig(&config, callback);
+}
+
+int
+Sequencer_initializeWithConfig(const Sequencer_Config* config,
+                               loopCallbackFn callback)
+{
+    // Slots have to fall on ticks, and ticks on frames.
+    if (!_isValidBpm(config->bpm) || config->ppq == 0 ||
+        config->ppq > SEQ_MAX_PPQ ||
+        config->ppq % SEQ_SIXTEENTH_NOTE_IN_QUARTER_NOTE != 0) {
+        return SEQ_EINVAL;
+    }
+
     seq = malloc(sizeof(struct sequencer));
     if (!seq) {
         return SEQ_EALLOC;
@@ -165,16 +881,41 @@ Sequencer_initialize(SequencerBpm bpm, loopCallbackFn callback)
 
     memset(seq, 0, sizeof(struct sequencer));
 
-    for (SequencerIdx i = 0; i < SEQUENCER_SLOTS; i++) {
-        seq->sequence[i].note = NOTE_NONE;
-    }
+    seq->ppq = config->ppq;
+    seq->players[SEQ_MAIN_TRACK] = FMPLAYER_MAIN;
+    atomic_store(&seq->nTracks, 1);
+    seq->patterns[0].length = _slotTick(SEQUENCER_SLOTS);
+    seq->patterns[1].length = _slotTick(SEQUENCER_SLOTS);
+    atomic_store(&_patternState, 0);
+    atomic_store(&_fillRequested, false);
+    sem_init(&_fillRequest, 0, 0);
 
-    seq->bpm = bpm;
-    seq->nsBetweenUpdates = BPM_TO_NS(bpm);
+    seq->bpm = config->bpm;
     seq->loopCallback = callback;
+    seq->clock = config->clock;
 
-    // TODO: error
-    pthread_create(&_sequencerThread, NULL, _sequencer, NULL);
+    if (config->clock == SEQ_CLOCK_RENDER) {
+        if (!FmPlayer_setClock(_onRenderClock, NULL)) {
+            sem_destroy(&_fillRequest);
+            free(seq);
+            seq = NULL;
+            return SEQ_EINVAL;
+        }
+    } else {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_destroy(&_stateCond);
+        pthread_cond_init(&_stateCond, &attr);
+        pthread_condattr_destroy(&attr);
+        // TODO: error
+        pthread_create(&_sequencerThread, NULL, _sequencer, NULL);
+    }
+
+    if (callback) {
+        // TODO: error
+        pthread_create(&_fillThread, NULL, _filler, NULL);
+    }
 
     return SEQ_OK;
 }
@@ -185,17 +926,158 @@ Sequencer_getSlotIndex(int quarter, int eighth, int sixteenth)
     return SEQ_SLOT_IDX(quarter, eighth, sixteenth);
 }
 
+SequencerTick
+Sequencer_getPpq(void)
+{
+    return seq->ppq;
+}
+
+int
+Sequencer_addTrack(FmPlayer* player)
+{
+    size_t track = atomic_load(&seq->nTracks);
+    if (track >= SEQ_MAX_TRACKS) {
+        return SEQ_EFULL;
+    }
+
+    seq->players[track] = player;
+    atomic_store(&seq->muted[track], false);
+    // Publishes the player.
+    atomic_store(&seq->nTracks, track + 1);
+    return track;
+}
+
+int
+Sequencer_setTrackMute(SequencerTrack track, bool mute)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return SEQ_EINVAL;
+    }
+
+    atomic_store(&seq->muted[track], mute);
+    if (mute) {
+        // Let go of whatever it's holding now, rather than at its next note
+        // off.
+        FmPlayer_controlNote(seq->players[track], NOTE_CTRL_NOTE_OFF);
+    }
+    return SEQ_OK;
+}
+
+void
+Sequencer_fillSlot(SequencerTrack track,
+                   SequencerIdx idx,
+                   FmPlayer_NoteCtrl control,
+                   Note note,
+                   const FmSynthParams* synthParams)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return;
+    }
+
+    _SequencerPattern* pattern = _backPattern();
+    SequencerTick tick = _slotTick(idx);
+
+    // A slot holds one operation, so this replaces whatever was there.
+    _removeTick(&pattern->tracks[track], tick);
+    SequencerOp op;
+    if ((control != NOTE_CTRL_NONE || note != NOTE_NONE || synthParams) &&
+        _makeOp(track, control, note, synthParams, &op) == SEQ_OK) {
+        _addEvent(pattern, track, tick, &op);
+    }
+}
+
 void
-Sequencer_fillSlot(SequencerIdx idx,
+Sequencer_setSlotVoice(SequencerTrack track,
+                       SequencerIdx idx,
+                       const FmSynthParams* synthParams)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return;
+    }
+
+    _SequencerPattern* pattern = _backPattern();
+    _SequencerTrackPattern* events = &pattern->tracks[track];
+    SequencerTick tick = _slotTick(idx);
+
+    SequencerOp op;
+    if (_makeOp(track, NOTE_CTRL_NONE, NOTE_NONE, synthParams, &op) !=
+        SEQ_OK) {
+        return;
+    }
+    size_t i = _findTick(events, tick);
+    if (i < events->nEvents && events->events[i].tick == tick) {
+        events->events[i].op.voice = op.voice;
+    } else if (op.voice) {
+        _addEvent(pattern, track, tick, &op);
+    }
+}
+
+int
+Sequencer_addEvent(SequencerTrack track,
+                   SequencerTick tick,
                    FmPlayer_NoteCtrl control,
                    Note note,
-                   FmSynthParams* synthParams)
+                   const FmSynthParams* synthParams)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return SEQ_EINVAL;
+    }
+
+    SequencerOp op;
+    int err = _makeOp(track, control, note, synthParams, &op);
+    if (err != SEQ_OK) {
+        return err;
+    }
+    return _addEvent(_backPattern(), track, tick, &op);
+}
+
+int
+Sequencer_setLength(SequencerTick ticks)
+{
+    if (ticks == 0) {
+        return SEQ_EINVAL;
+    }
+
+    _SequencerPattern* pattern = _backPattern();
+    pattern->length = ticks;
+    for (SequencerTrack track = 0; track < SEQ_MAX_TRACKS; track++) {
+        _SequencerTrackPattern* events = &pattern->tracks[track];
+        if (events->length == 0) {
+            events->nEvents = _findTick(events, ticks);
+        }
+    }
+    return SEQ_OK;
+}
+
+int
+Sequencer_setTrackLength(SequencerTrack track, SequencerTick ticks)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return SEQ_EINVAL;
+    }
+
+    _SequencerPattern* pattern = _backPattern();
+    _SequencerTrackPattern* events = &pattern->tracks[track];
+    events->length = ticks;
+    events->nEvents = _findTick(events, _trackLength(pattern, track));
+    return SEQ_OK;
+}
+
+int
+Sequencer_setPatternBpm(SequencerBpm bpm)
+{
+    if (!_isValidBpm(bpm)) {
+        return SEQ_EINVAL;
+    }
+
+    _backPattern()->bpm = bpm;
+    return SEQ_OK;
+}
+
+void
+Sequencer_commit(void)
 {
-    pthread_rwlock_wrlock(&_seqLock);
-    seq->sequence[idx].op = control;
-    seq->sequence[idx].note = note;
-    seq->sequence[idx].synthParams = synthParams;
-    pthread_rwlock_unlock(&_seqLock);
+    _commit(atomic_load(&_patternState) & PATTERN_RESETS);
 }
 
 void
@@ -203,7 +1085,7 @@ Sequencer_start(void)
 {
     if (_sequencerState == SEQ_STOP) {
         _sequencerState = SEQ_RUN;
-        pthread_cond_signal(&_stateCond);
+        _wake();
     }
 }
 
@@ -211,53 +1093,126 @@ void
 Sequencer_stop(void)
 {
     _sequencerState = SEQ_STOP;
+    _wake();
 }
 
 void
 Sequencer_clear(void)
 {
-    for (int i = 0; i < SEQUENCER_SLOTS; i++) {
-        seq->sequence[i].note = NOTE_NONE;
-        seq->sequence[i].op = NOTE_CTRL_NONE;
-        seq->sequence[i].synthParams = NULL;
+    _SequencerPattern* pattern = _backPattern();
+    for (SequencerTrack track = 0; track < SEQ_MAX_TRACKS; track++) {
+        pattern->tracks[track].nEvents = 0;
     }
 }
 
+int
+Sequencer_clearTrack(SequencerTrack track)
+{
+    if (track >= atomic_load(&seq->nTracks)) {
+        return SEQ_EINVAL;
+    }
+
+    _backPattern()->tracks[track].nEvents = 0;
+    return SEQ_OK;
+}
+
 void
 Sequencer_reset(void)
 {
+    if (seq->loopCallback) {
+        // Take back a pattern filled before the reset, and have one filled
+        // after it, which playback waits for.
+        unsigned int state = atomic_load(&_patternState);
+        while (!atomic_compare_exchange_weak(
+          &_patternState,
+          &state,
+          (state + PATTERN_RESET) & ~PATTERN_READY)) {
+        }
+        _requestFill();
+    }
     _sequencerState = SEQ_RESET;
-    pthread_cond_signal(&_stateCond);
+    _wake();
 }
 
-void
+int
 Sequencer_setBpm(SequencerBpm bpm)
 {
-    seq->nsBetweenUpdates = BPM_TO_NS(bpm);
+    if (!_isValidBpm(bpm)) {
+        return SEQ_EINVAL;
+    }
+
+    seq->bpm = bpm;
+    _wake();
+
+    return SEQ_OK;
 }
 
 int
 Sequencer_adjustBpm(SequencerBpmDelta bpmDelta)
 {
-    int sign = bpmDelta > 0 ? 1 : -1;
-    size_t posBpmDelta = sign * bpmDelta;
+    // Another thread can change the tempo too, so only add the delta to the
+    // tempo it was checked against.
+    SequencerBpm bpm = atomic_load(&seq->bpm);
+    long long newBpm;
+    do {
+        newBpm = (long long)bpm + bpmDelta;
+        if (newBpm < SEQ_MIN_BPM || newBpm > SEQ_MAX_BPM) {
+            return SEQ_EINVAL;
+        }
+    } while (!atomic_compare_exchange_weak(&seq->bpm, &bpm, newBpm));
+    _wake();
 
-    if (sign == -1 && posBpmDelta > seq->bpm) {
-        return SEQ_EINVAL;
+    return SEQ_OK;
+}
+
+void
+Sequencer_getStats(Sequencer_Stats* stats)
+{
+    stats->events =
+      atomic_load_explicit(&_stats.events, memory_order_relaxed);
+    stats->wakeups =
+      atomic_load_explicit(&_stats.wakeups, memory_order_relaxed);
+    stats->resyncs =
+      atomic_load_explicit(&_stats.resyncs, memory_order_relaxed);
+    stats->maxLateUs =
+      atomic_load_explicit(&_stats.maxLateUs, memory_order_relaxed);
+    for (int i = 0; i < FMPLAYER_HISTOGRAM_BINS; i++) {
+        stats->lateUs.counts[i] =
+          atomic_load_explicit(&_stats.lateUs[i], memory_order_relaxed);
     }
+}
 
-    seq->bpm += bpmDelta;
-    seq->nsBetweenUpdates = BPM_TO_NS(seq->bpm);
+void
+Sequencer_printStats(FILE* out)
+{
+    Sequencer_Stats stats;
+    Sequencer_getStats(&stats);
 
-    return SEQ_OK;
+    fprintf(out,
+            "Sequencer: %lu events, %lu wakeups, %lu resyncs, max late %lld "
+            "us\n",
+            stats.events,
+            stats.wakeups,
+            stats.resyncs,
+            stats.maxLateUs);
+    FmPlayer_printHistogram(out, "wakeup lateness (us)", &stats.lateUs);
 }
 
 void
 Sequencer_destroy(void)
 {
     _sequencerState = SEQ_END;
-    pthread_cond_signal(&_stateCond);
-    pthread_join(_sequencerThread, NULL);
+    if (seq->clock == SEQ_CLOCK_RENDER) {
+        FmPlayer_setClock(NULL, NULL);
+    } else {
+        _wake();
+        pthread_join(_sequencerThread, NULL);
+    }
+    if (seq->loopCallback) {
+        sem_post(&_fillRequest);
+        pthread_join(_fillThread, NULL);
+    }
+    sem_destroy(&_fillRequest);
 
     free(seq);
 }
@@ -0,0 +1,217 @@
+/**
+ * @file wavbackend.c
+ * @brief Audio backend that writes a WAV file.
+ */
+#include "das/audiobackend.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Size of the RIFF, fmt and data headers in front of the samples. */
+#define WAV_HEADER_SIZE 44
+/** Offset of the RIFF chunk size. */
+#define WAV_RIFF_SIZE_OFFSET 4
+/** Offset of the data chunk size. */
+#define WAV_DATA_SIZE_OFFSET 40
+
+/** WAV file backend. */
+typedef struct
+{
+    /** Must be first. */
+    AudioBackend backend;
+
+    /** The file. */
+    FILE* file;
+    /** A period's worth of samples to render into. */
+    int16_t* sampleBuffer;
+    /** Bytes of samples written so far. */
+    uint32_t dataSize;
+} _WavBackend;
+
+static int
+_start(AudioBackend* backend);
+static int
+_wait(AudioBackend* backend, int timeoutMs);
+static long
+_delay(AudioBackend* backend);
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames);
+static int
+_commit(AudioBackend* backend, size_t nFrames);
+static int
+_recover(AudioBackend* backend, int err);
+static void
+_close(AudioBackend* backend);
+
+/** Put a little endian 16 bit value in the header. */
+static void
+_put16(uint8_t* dest, uint16_t value);
+/** Put a little endian 32 bit value in the header. */
+static void
+_put32(uint8_t* dest, uint32_t value);
+/** Write a 32 bit value into the header of the file at the given offset. */
+static int
+_patch32(FILE* file, long offset, uint32_t value);
+
+static const AudioBackend_Ops _wavOps = {
+    .start = _start,
+    .wait = _wait,
+    .delay = _delay,
+    .begin = _begin,
+    .commit = _commit,
+    .recover = _recover,
+    .close = _close,
+};
+
+static int
+_start(AudioBackend* backend)
+{
+    (void)backend;
+    return 0;
+}
+
+static int
+_wait(AudioBackend* backend, int timeoutMs)
+{
+    (void)backend;
+    (void)timeoutMs;
+    return 1;
+}
+
+static long
+_delay(AudioBackend* backend)
+{
+    (void)backend;
+    return 0;
+}
+
+static long
+_begin(AudioBackend* backend, int16_t** buffer, size_t nFrames)
+{
+    _WavBackend* wav = (_WavBackend*)backend;
+    *buffer = wav->sampleBuffer;
+    return nFrames < backend->periodSize ? nFrames : backend->periodSize;
+}
+
+static int
+_commit(AudioBackend* backend, size_t nFrames)
+{
+    _WavBackend* wav = (_WavBackend*)backend;
+    const size_t nSamples = nFrames * backend->channels;
+    // WAV samples are little endian, so swap them on big endian hosts.
+    for (size_t i = 0; i < nSamples; i++) {
+        uint16_t sample = (uint16_t)wav->sampleBuffer[i];
+        uint8_t bytes[2];
+        _put16(bytes, sample);
+        memcpy(&wav->sampleBuffer[i], bytes, sizeof(bytes));
+    }
+    if (fwrite(wav->sampleBuffer, sizeof(int16_t), nSamples, wav->file) !=
+        nSamples) {
+        return -EIO;
+    }
+    wav->dataSize += nSamples * sizeof(int16_t);
+    return 0;
+}
+
+static int
+_recover(AudioBackend* backend, int err)
+{
+    (void)backend;
+    return err;
+}
+
+static void
+_close(AudioBackend* backend)
+{
+    _WavBackend* wav = (_WavBackend*)backend;
+    // Now we know how long the file is, fill in the sizes.
+    if (_patch32(wav->file,
+                 WAV_RIFF_SIZE_OFFSET,
+                 WAV_HEADER_SIZE - 8 + wav->dataSize) < 0 ||
+        _patch32(wav->file, WAV_DATA_SIZE_OFFSET, wav->dataSize) < 0) {
+        perror("Can't finish WAV file");
+    }
+    fclose(wav->file);
+    free(wav->sampleBuffer);
+    free(wav);
+}
+
+static void
+_put16(uint8_t* dest, uint16_t value)
+{
+    dest[0] = value & 0xff;
+    dest[1] = value >> 8;
+}
+
+static void
+_put32(uint8_t* dest, uint32_t value)
+{
+    _put16(dest, value & 0xffff);
+    _put16(dest + 2, value >> 16);
+}
+
+static int
+_patch32(FILE* file, long offset, uint32_t value)
+{
+    uint8_t bytes[4];
+    _put32(bytes, value);
+    if (fseek(file, offset, SEEK_SET) < 0 ||
+        fwrite(bytes, sizeof(bytes), 1, file) != 1) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int
+AudioBackend_openWav(AudioBackend** backend,
+                     const char* path,
+                     unsigned int sampleRate,
+                     unsigned int channels,
+                     size_t periodSize)
+{
+    _WavBackend* wav = calloc(1, sizeof(_WavBackend));
+    if (!wav) {
+        return -ENOMEM;
+    }
+    wav->backend.ops = &_wavOps;
+    wav->backend.sampleRate = sampleRate;
+    wav->backend.channels = channels;
+    wav->backend.periodSize = periodSize;
+    wav->backend.bufferSize = periodSize;
+    wav->backend.realtime = false;
+
+    wav->sampleBuffer = malloc(periodSize * channels * sizeof(int16_t));
+    wav->file = fopen(path, "wb");
+    if (!wav->sampleBuffer || !wav->file) {
+        int err = wav->file ? -ENOMEM : -errno;
+        if (wav->file) {
+            fclose(wav->file);
+        }
+        free(wav->sampleBuffer);
+        free(wav);
+        return err;
+    }
+
+    // 16 bit PCM. The sizes get filled in on close.
+    uint8_t header[WAV_HEADER_SIZE] = { 0 };
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    _put32(header + 16, 16);
+    _put16(header + 20, 1);
+    _put16(header + 22, channels);
+    _put32(header + 24, sampleRate);
+    _put32(header + 28, sampleRate * channels * sizeof(int16_t));
+    _put16(header + 32, channels * sizeof(int16_t));
+    _put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    if (fwrite(header, sizeof(header), 1, wav->file) != 1) {
+        fclose(wav->file);
+        free(wav->sampleBuffer);
+        free(wav);
+        return -EIO;
+    }
+
+    *backend = &wav->backend;
+    return 0;
+}
@@ -4,10 +4,21 @@
  * @author Spencer Leslie 301571329
  */
 #include "das/wavetable.h"
+#include <errno.h>
 #include <malloc.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 
+/** Number of band-limited tables per wave. Level l holds
+ * WT_MAX_HARMONICS >> l harmonics. */
+#define WT_MIP_LEVELS 10
+/** Harmonics in the fullest band-limited table. */
+#define WT_MAX_HARMONICS (1u << (WT_MIP_LEVELS - 1))
+/** Position of the highest set bit of a step that gets level 0. A wave whose
+ * step is below 2^WT_LEVEL0_STEP_BITS is below Nyquist / WT_MAX_HARMONICS. */
+#define WT_LEVEL0_STEP_BITS (31 - (WT_MIP_LEVELS - 1))
+
 /** 255 samples of one period of a sine wave. */
 static const double sineTable[] = { 0,
                                     0.024541228522912,
@@ -547,6 +558,34 @@ static const double sawTable[] = { 0,
                                    -0.015625000000000,
                                    -0.007812500000000 };
 
+/** Band-limited sine table. */
+static float _blSine[WT_TABLE_SIZE + 1];
+/** Band-limited square tables, one per octave. */
+static float _blSquare[WT_MIP_LEVELS][WT_TABLE_SIZE + 1];
+/** Band-limited saw tables, one per octave. */
+static float _blSaw[WT_MIP_LEVELS][WT_TABLE_SIZE + 1];
+/** Guards building the band-limited tables. */
+static pthread_once_t _tablesOnce = PTHREAD_ONCE_INIT;
+/** 0 once the band-limited tables are built, or a negative errno if they
+ * couldn't be. */
+static int _tablesStatus;
+
+/** Get one of the original tables. */
+static const double*
+_getTable(WaveType type);
+/**
+ * Sum harmonics into a table. Harmonic k has amplitude weights[k] / k. The
+ * result is scaled so its peak is 1. Returns 0, or -ENOMEM.
+ */
+static int
+_buildAdditive(float* table,
+               const double* sines,
+               const double* weights,
+               unsigned harmonics);
+/** Build every band-limited table. */
+static void
+_buildTables(void);
+
 double
 WaveTable_sample(WaveType type, double angle)
 {
@@ -556,23 +595,140 @@ WaveTable_sample(WaveType type, double angle)
     int idx = idxLow;
     int nextIdx = (idx < (WT_N_SAMPLES - 1)) ? idx + 1 : 0;
 
-    const double* table;
+    const double* table = _getTable(type);
+    if (table == NULL) {
+        return -1;
+    }
+    return ((idxFrac * table[idx]) + ((1.0 - idxFrac) * table[nextIdx]));
+}
+
+static const double*
+_getTable(WaveType type)
+{
     switch (type) {
-        case WAVETYPE_SINE: {
-            table = sineTable;
-            break;
+        case WAVETYPE_SINE:
+            return sineTable;
+        case WAVETYPE_SQUARE:
+            return squareTable;
+        case WAVETYPE_SAW:
+            return sawTable;
+        default:
+            return NULL;
+    }
+}
+
+static int
+_buildAdditive(float* table,
+               const double* sines,
+               const double* weights,
+               unsigned harmonics)
+{
+    double* sum = calloc(WT_TABLE_SIZE, sizeof(double));
+    if (!sum) {
+        return -ENOMEM;
+    }
+
+    // Lanczos sigma factors tame the Gibbs ringing at the discontinuities.
+    for (unsigned k = 1; k <= harmonics; k++) {
+        if (weights[k] == 0) {
+            continue;
+        }
+        double x = M_PI * k / (harmonics + 1);
+        double amp = weights[k] / k * (sin(x) / x);
+        for (unsigned n = 0; n < WT_TABLE_SIZE; n++) {
+            // sin(2 pi k n / N) is exactly sample (k * n) mod N of the sine.
+            sum[n] += amp * sines[(k * n) & (WT_TABLE_SIZE - 1)];
         }
-        case WAVETYPE_SQUARE: {
-            table = squareTable;
-            break;
+    }
+
+    double peak = 0;
+    for (unsigned n = 0; n < WT_TABLE_SIZE; n++) {
+        peak = fmax(peak, fabs(sum[n]));
+    }
+    for (unsigned n = 0; n < WT_TABLE_SIZE; n++) {
+        table[n] = (peak > 0) ? sum[n] / peak : 0;
+    }
+    table[WT_TABLE_SIZE] = table[0];
+
+    free(sum);
+    return 0;
+}
+
+static void
+_buildTables(void)
+{
+    double sines[WT_TABLE_SIZE];
+    double sawWeights[WT_MAX_HARMONICS + 1] = { 0 };
+    double squareWeights[WT_MAX_HARMONICS + 1] = { 0 };
+
+    for (unsigned n = 0; n < WT_TABLE_SIZE; n++) {
+        sines[n] = sin(2 * M_PI * n / WT_TABLE_SIZE);
+        _blSine[n] = sines[n];
+    }
+    _blSine[WT_TABLE_SIZE] = _blSine[0];
+
+    // Saw: every harmonic, alternating in sign. Square: odd harmonics.
+    for (unsigned k = 1; k <= WT_MAX_HARMONICS; k++) {
+        sawWeights[k] = (k % 2 == 1) ? 1 : -1;
+        squareWeights[k] = (k % 2 == 1) ? 1 : 0;
+    }
+
+    for (unsigned level = 0; level < WT_MIP_LEVELS; level++) {
+        unsigned harmonics = WT_MAX_HARMONICS >> level;
+        int err = _buildAdditive(_blSaw[level], sines, sawWeights, harmonics);
+        if (err < 0 ||
+            (err = _buildAdditive(
+               _blSquare[level], sines, squareWeights, harmonics)) < 0) {
+            _tablesStatus = err;
+            return;
         }
-        case WAVETYPE_SAW: {
-            table = sawTable;
-            break;
+
+        // The original square wave swings between 0 and 1, not -1 and 1.
+        // Keep that so voices that use it still sound the same.
+        for (unsigned n = 0; n <= WT_TABLE_SIZE; n++) {
+            _blSquare[level][n] = 0.5f + 0.5f * _blSquare[level][n];
         }
+    }
+}
+
+int
+WaveTable_initialize(void)
+{
+    pthread_once(&_tablesOnce, _buildTables);
+    return _tablesStatus;
+}
+
+WaveTable_Phase
+WaveTable_phaseStep(float freq, size_t sampleRate)
+{
+    double cycles = (double)freq / sampleRate;
+    cycles -= floor(cycles);
+    return (WaveTable_Phase)(cycles * 4294967296.0);
+}
+
+const float*
+WaveTable_getBandLimited(WaveType type, WaveTable_Phase step)
+{
+    // The octave of the step picks the level. A step under
+    // 2^WT_LEVEL0_STEP_BITS leaves room for every harmonic in level 0, and
+    // each octave above that halves the harmonics.
+    int stepBits = (step == 0) ? 0 : 32 - __builtin_clz(step);
+    int level = stepBits - WT_LEVEL0_STEP_BITS;
+    if (level < 0) {
+        level = 0;
+    } else if (level >= WT_MIP_LEVELS) {
+        level = WT_MIP_LEVELS - 1;
+    }
+
+    switch (type) {
+        case WAVETYPE_SINE:
+            return _blSine;
+        case WAVETYPE_SQUARE:
+            return _blSquare[level];
+        case WAVETYPE_SAW:
+            return _blSaw[level];
         default:
-            return -1;
-            break;
+            // Never hand the kernels a table they can't read.
+            return _blSine;
     }
-    return ((idxFrac * table[idx]) + ((1.0 - idxFrac) * table[nextIdx]));
 }
@@ -5,6 +5,7 @@
  */
 
 #include "hal/rfid.h"
+#include "com/threadutils.h"
 
 // NOTE: miguelbalboa's implementation gives more thought to this deadline
 // value, factoring in calculations from the datasheets and setting appropriate
@@ -364,6 +365,8 @@ _updateCurrentTagId(void* args)
 {
     (void)args;
 
+    Threadutils_applyWorkerPriority();
+
     // Through tests, I have found that a tag ID of 0xFF is sometimes returned
     // due to RFID_TIMEOUT_ERR, even when the tag is permanently sitting on top
     // of the reader. I don't believe this is caused by unintended noise, as the
@@ -1,4 +1,5 @@
 #include "hal/segDisplay.h"
+#include "com/threadutils.h"
 
 #define GPIO_DIR_LEFT "/sys/class/gpio/gpio61/value"
 #define GPIO_DIR_RIGHT "/sys/class/gpio/gpio44/value"
@@ -103,6 +104,7 @@ _display(void* args)
 {
     (void)args;
 
+    Threadutils_applyWorkerPriority();
     while (run) {
         // Singing is a unique emotion, in that it is not derived from sensory
         // params. The singing emotion has display priority above all
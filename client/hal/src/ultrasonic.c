@@ -1,4 +1,5 @@
 #include "hal/ultrasonic.h"
+#include "com/threadutils.h"
 #include "com/timeutils.h"
 #include "hal/gpio.h"
 
@@ -60,6 +61,7 @@ distanceLoop(void* unused)
 {
     (void)unused;
 
+    Threadutils_applyWorkerPriority();
     while (initialized) {
         Timeutils_sleepForMs(500);
         // let's not spam this quite so much.
@@ -0,0 +1,64 @@
+/**
+ * @file baseline.h
+ * @brief The synth as it sounded before the render kernels, pinned.
+ *
+ * A copy of the original scalar path: 255 sample double wave tables with
+ * naive squares and saws, envelopes stepped every 64 samples of each call
+ * with no ramp between steps, and a mix clipped at full scale with no
+ * limiter. It only plays one note at a time.
+ *
+ * The reference in reference.h is how the synth is meant to sound now. This
+ * is how it sounded then, so the check can tell how far the engine has moved
+ * from it. Never change it.
+ */
+#pragma once
+
+#include "das/fm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Baseline_Synth Baseline_Synth;
+
+/**
+ * Make a baseline synth.
+ *
+ * @param params The voice.
+ * @return The synth, or NULL if there's no memory.
+ */
+Baseline_Synth*
+Baseline_create(const FmSynthParams* params);
+
+/**
+ * Free a baseline synth.
+ */
+void
+Baseline_destroy(Baseline_Synth* synth);
+
+/**
+ * Play a note, triggering its envelopes.
+ *
+ * @param synth The synth.
+ * @param note The note.
+ */
+void
+Baseline_noteOn(Baseline_Synth* synth, Note note);
+
+/**
+ * Let go of the note.
+ */
+void
+Baseline_noteOff(Baseline_Synth* synth);
+
+/**
+ * Render samples. The envelopes step on every 64th sample counting from the
+ * start of each call, so render in the same calls to compare.
+ *
+ * @param synth The synth.
+ * @param out Receives the samples.
+ * @param nSamples How many.
+ */
+void
+Baseline_generateSamples(Baseline_Synth* synth,
+                         int16_t* out,
+                         size_t nSamples);
@@ -0,0 +1,78 @@
+/**
+ * @file golden.h
+ * @brief Checks that a render kernel sounds the same as the reference.
+ *
+ * The reference is the frozen synth in reference.h, which shares nothing with
+ * the library but the preset, so the scalar kernel is checked too. A preset
+ * is rendered deterministically across a range of notes, and as a chord,
+ * with the reference and with a candidate kernel, and the two renders are
+ * compared by signal to noise ratio and by the largest error on any one
+ * sample. A candidate drifts when either is past its tolerance.
+ *
+ * The reference only catches drift from how the synth sounds now. Each
+ * single note is also rendered with the baseline in baseline.h, the synth as
+ * it was before the render kernels, to pin how far it has moved since. The
+ * baseline's interpolation and envelope steps put its waveform out of phase,
+ * so the waveforms only measured -5 to 19 dB apart for the built-in presets,
+ * and that says nothing. Their loudness is compared instead, by the SNR of
+ * the RMS of each GOLDEN_LOUDNESS_FRAMES. That was measured for each built-in
+ * preset, at its worst note, and a candidate drifts when it falls more than
+ * GOLDEN_BASELINE_MARGIN_DB under it. Presets that weren't measured are only
+ * checked against the reference.
+ */
+#pragma once
+
+#include "das/fm.h"
+
+#include <stdbool.h>
+
+/** Least signal to noise ratio a candidate may have, in dB. */
+#define GOLDEN_MIN_SNR_DB 60.0
+/** Largest difference allowed on any one sample, in 16 bit steps. */
+#define GOLDEN_MAX_PEAK_ERROR 64
+/** Frames loudness is measured over when comparing with the baseline. 10 ms
+ * at 44.1 kHz. */
+#define GOLDEN_LOUDNESS_FRAMES 441
+/** How far the loudness SNR against the baseline may fall under what was
+ * measured, in dB. */
+#define GOLDEN_BASELINE_MARGIN_DB 2.0
+
+/** How far a render is from the reference. */
+typedef struct
+{
+    /** Signal to noise ratio in dB. Infinite when the renders match. */
+    double snrDb;
+    /** Largest difference on any one sample. */
+    int peakError;
+} Golden_Diff;
+
+/** How far a candidate is from the reference and from the baseline. */
+typedef struct
+{
+    /** The worst SNR and peak error against the reference. */
+    Golden_Diff reference;
+    /** The worst loudness SNR against the baseline, in dB. */
+    double baselineSnrDb;
+    /** The least baselineSnrDb allowed, or NAN if the preset wasn't
+     * measured. */
+    double baselineFloorDb;
+} Golden_Report;
+
+/**
+ * Compare a candidate kernel against the reference and the baseline for one
+ * preset, printing a line for every render that drifts. Notes are reported
+ * as Note values, so C2 is 0.
+ *
+ * @param name The preset's name, to report and to look up what was measured
+ * against the baseline.
+ * @param params The preset.
+ * @param candidate The kernel to check.
+ * @param report Receives the worst seen. May be NULL.
+ * @return The number of renders that drifted, or a negative errno if the
+ * synth couldn't be rendered.
+ */
+int
+Golden_checkPreset(const char* name,
+                   const FmSynthParams* params,
+                   FmKernel candidate,
+                   Golden_Report* report);
@@ -0,0 +1,46 @@
+/**
+ * @file midiSong.h
+ * @brief Loads the notes of a MIDI file.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A note starting or stopping. */
+typedef struct
+{
+    /** When, in seconds from the start of the song. */
+    double timeSec;
+    /** The MIDI note number. */
+    int note;
+    /** Is the note starting? */
+    bool on;
+} MidiSong_Event;
+
+/** The notes of a song, in time order. */
+typedef struct
+{
+    /** The events. */
+    MidiSong_Event* events;
+    /** How many events there are. */
+    size_t nEvents;
+} MidiSong;
+
+/**
+ * Load the notes of every track and channel of a MIDI file, except the
+ * percussion channel. Tempo changes are applied, so event times are real
+ * times.
+ *
+ * @param path The file.
+ * @param song Receives the song. Free it with MidiSong_free.
+ * @return 0 on success, or a negative errno.
+ */
+int
+MidiSong_load(const char* path, MidiSong* song);
+
+/**
+ * Free a song loaded with MidiSong_load.
+ */
+void
+MidiSong_free(MidiSong* song);
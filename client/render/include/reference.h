@@ -0,0 +1,72 @@
+/**
+ * @file reference.h
+ * @brief A frozen reference synthesizer the render kernels are checked
+ * against.
+ *
+ * This is a plain copy of how the synth is meant to sound: band-limited wave
+ * tables per octave, envelopes stepped at the control rate and ramped between
+ * control points, phase modulation scaled by the sample rate, and a limiter
+ * on the mix. It does the same single precision and fixed point arithmetic as
+ * the library, since FM feedback turns any rounding difference into audible
+ * drift, but it only shares FmSynthParams with it. It builds its own tables
+ * and reads the envelopes' points directly, so a change to the library's
+ * wavetables, envelopes or voice setup shows up as drift instead of moving
+ * the reference along with it.
+ *
+ * Keep it slow and obvious, and only change it when the synth is meant to
+ * sound different.
+ */
+#pragma once
+
+#include "das/fm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Reference_Synth Reference_Synth;
+
+/**
+ * Make a reference synth.
+ *
+ * @param params The voice.
+ * @param nVoices How many voices, from 1 to FM_MAX_VOICES.
+ * @return The synth, or NULL if there's no memory.
+ */
+Reference_Synth*
+Reference_create(const FmSynthParams* params, size_t nVoices);
+
+/**
+ * Free a reference synth.
+ */
+void
+Reference_destroy(Reference_Synth* synth);
+
+/**
+ * Play a note on a voice, triggering its envelopes.
+ *
+ * @param synth The synth.
+ * @param voice The voice.
+ * @param note The note.
+ */
+void
+Reference_noteOn(Reference_Synth* synth, size_t voice, Note note);
+
+/**
+ * Let go of every voice's note.
+ */
+void
+Reference_allNotesOff(Reference_Synth* synth);
+
+/**
+ * Render samples. Like Fm_generateSamples, the limiter works on the stretches
+ * between envelope control points, split where calls end, so render in the
+ * same calls to compare.
+ *
+ * @param synth The synth.
+ * @param out Receives the samples.
+ * @param nSamples How many.
+ */
+void
+Reference_generateSamples(Reference_Synth* synth,
+                          int16_t* out,
+                          size_t nSamples);
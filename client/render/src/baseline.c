@@ -0,0 +1,286 @@
+/**
+ * @file baseline.c
+ * @brief Implementation of the baseline synthesizer.
+ */
+#include "baseline.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** Samples in each wave table. */
+#define BASE_N_SAMPLES 255
+/** Samples between envelope steps, counted from the start of each call. */
+#define BASE_ADSR_PERIOD 64
+/** Frequency of C2. */
+#define BASE_C2_HZ 65.41
+/** Twelth root of two, for note frequencies. */
+#define BASE_TWELVETH_ROOT_OF_TWO 1.059463094359
+
+/** One operator envelope. */
+typedef struct
+{
+    /** How far it moves each step. */
+    float step;
+    /** How far through the envelope it is, from 0 to 1. */
+    float current;
+    /** Value it can't drop under after a retrigger, or -1. */
+    float min;
+    /** Has it been triggered, and not yet run out? */
+    bool triggered;
+    /** Has it been let go? */
+    bool gated;
+} _BaseEnvelope;
+
+struct Baseline_Synth
+{
+    /** The voice. */
+    FmSynthParams params;
+    /** Each operator's envelope value. */
+    float opEnvelope[FM_OPERATORS];
+    /** Each operator's angle, from 0 to 1. */
+    float opAngle[FM_OPERATORS];
+    /** How far each angle moves each sample. */
+    float opStep[FM_OPERATORS];
+    /** Each operator's frequency. */
+    float opFreq[FM_OPERATORS];
+    /** Each operator's envelope. */
+    _BaseEnvelope env[FM_OPERATORS];
+};
+
+/** One period of a sine, sampled at 256 points. */
+static double _sine[BASE_N_SAMPLES + 1];
+/** A square, high for the first half. */
+static double _square[BASE_N_SAMPLES];
+/** A saw, rising from 0 to 1 then from -1 to 0. */
+static double _saw[BASE_N_SAMPLES + 1];
+/** Have the tables been built? */
+static bool _tablesBuilt;
+
+/** Build every table. */
+static void
+_buildTables(void);
+/** Sample a table at an angle from 0 to 1. */
+static double
+_sampleTable(WaveType wave, double angle);
+/** Set the note, moving the operators that follow it. */
+static void
+_setNote(Baseline_Synth* synth, Note note);
+/** Sample an envelope's function. */
+static float
+_sampleFn(const Pwl_Function* fn, float x);
+/** Get an envelope's value, and step it. */
+static float
+_advance(const Env_Envelope* shape, _BaseEnvelope* env);
+
+static void
+_buildTables(void)
+{
+    // The original tables were listed out to 15 places. These match them to
+    // within the last place of the sine, and exactly for the others.
+    for (int n = 0; n <= BASE_N_SAMPLES; n++) {
+        _sine[n] = sin(2 * M_PI * n / (BASE_N_SAMPLES + 1));
+        _saw[n] = (n < 128 ? n : (n == 128 ? -127 : n - 256)) / 128.0;
+    }
+    for (int n = 0; n < BASE_N_SAMPLES; n++) {
+        _square[n] = n < 128 ? 1 : 0;
+    }
+    _tablesBuilt = true;
+}
+
+static double
+_sampleTable(WaveType wave, double angle)
+{
+    double idxExact = angle * BASE_N_SAMPLES;
+    double idxLow;
+    double idxFrac = modf(idxExact, &idxLow);
+    int idx = idxLow;
+    int nextIdx = (idx < (BASE_N_SAMPLES - 1)) ? idx + 1 : 0;
+
+    const double* table;
+    switch (wave) {
+        case WAVETYPE_SINE:
+            table = _sine;
+            break;
+        case WAVETYPE_SQUARE:
+            table = _square;
+            break;
+        case WAVETYPE_SAW:
+            table = _saw;
+            break;
+        default:
+            return -1;
+    }
+    // The weights were the wrong way around. Kept, since it's how it sounded.
+    return (idxFrac * table[idx]) + ((1.0 - idxFrac) * table[nextIdx]);
+}
+
+static void
+_setNote(Baseline_Synth* synth, Note note)
+{
+    float baseFreq = BASE_C2_HZ * powf(BASE_TWELVETH_ROOT_OF_TWO, note);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const OperatorParams* opParams = &synth->params.opParams[op];
+        float freq;
+        if (opParams->CmRatio > 0) {
+            freq = baseFreq * opParams->CmRatio;
+        } else {
+            freq =
+              BASE_C2_HZ * powf(BASE_TWELVETH_ROOT_OF_TWO, opParams->fixToNote);
+        }
+        synth->opStep[op] = freq / synth->params.sampleRate;
+        synth->opFreq[op] = freq;
+    }
+}
+
+static float
+_sampleFn(const Pwl_Function* fn, float x)
+{
+    float x0 = 0;
+    float x1 = 0;
+    float y0 = 0;
+    float y1 = 0;
+    for (int i = 0; i < fn->pts - 1; i++) {
+        if (fn->ptsX[i] <= x) {
+            x0 = fn->ptsX[i];
+            x1 = fn->ptsX[i + 1];
+            y0 = fn->ptsY[i];
+            y1 = fn->ptsY[i + 1];
+        }
+    }
+    return ((x - x0) / (x1 - x0)) * (y1 - y0) + y0;
+}
+
+static float
+_advance(const Env_Envelope* shape, _BaseEnvelope* env)
+{
+    if (!env->triggered) {
+        return 0;
+    }
+
+    float value = _sampleFn(&shape->fn, env->current);
+    if (value < env->min) {
+        value = env->min;
+    } else {
+        env->min = -1;
+    }
+
+    float x = env->current + env->step;
+    if (x >= shape->gatePoint && !env->gated) {
+        x = shape->repeatPoint >= 0 ? shape->repeatPoint : shape->gatePoint;
+    }
+    if (x > 1) {
+        env->triggered = false;
+        env->gated = false;
+        x = 0;
+    }
+    env->current = x;
+    return value;
+}
+
+Baseline_Synth*
+Baseline_create(const FmSynthParams* params)
+{
+    if (!_tablesBuilt) {
+        _buildTables();
+    }
+
+    Baseline_Synth* synth = calloc(1, sizeof(Baseline_Synth));
+    if (!synth) {
+        return NULL;
+    }
+    synth->params = *params;
+
+    // Envelopes were prepared with the step rate in place of the sample rate.
+    size_t stepRate = params->sampleRate / BASE_ADSR_PERIOD;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const Env_Envelope* shape = &params->opEnvelopes[op];
+        float samplesPerMs = stepRate * 0.001;
+        float samplesPerEnv = shape->lengthMs * samplesPerMs;
+        synth->env[op].step = 1.0 / samplesPerEnv;
+        synth->env[op].min = shape->min;
+    }
+    _setNote(synth, C2);
+    return synth;
+}
+
+void
+Baseline_destroy(Baseline_Synth* synth)
+{
+    free(synth);
+}
+
+void
+Baseline_noteOn(Baseline_Synth* synth, Note note)
+{
+    _setNote(synth, note);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        _BaseEnvelope* env = &synth->env[op];
+        if (env->triggered) {
+            env->min =
+              _sampleFn(&synth->params.opEnvelopes[op].fn, env->current);
+        }
+        env->current = 0;
+        env->triggered = true;
+        env->gated = false;
+    }
+}
+
+void
+Baseline_noteOff(Baseline_Synth* synth)
+{
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        synth->env[op].gated = true;
+    }
+}
+
+void
+Baseline_generateSamples(Baseline_Synth* synth,
+                         int16_t* out,
+                         size_t nSamples)
+{
+    float opSamples[FM_OPERATORS];
+    for (size_t s = 0; s < nSamples; s++) {
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            opSamples[op] =
+              _sampleTable(synth->params.opParams[op].waveType,
+                           synth->opAngle[op]) *
+              synth->opEnvelope[op];
+        }
+
+        // Each operator's angle is pushed by the operators modulating it.
+        // This affects the next sample.
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            const OperatorParams* opParams = &synth->params.opParams[op];
+            float mod = 0;
+            for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+                float modIdx = opParams->algorithmConnections[modOp] /
+                               synth->opFreq[modOp];
+                mod += modIdx * (opSamples[modOp] * synth->opStep[modOp]);
+            }
+            synth->opAngle[op] += synth->opStep[op] + mod;
+            synth->opAngle[op] -= floorf(synth->opAngle[op]);
+        }
+
+        if (s % BASE_ADSR_PERIOD == 0) {
+            for (int op = 0; op < FM_OPERATORS; op++) {
+                synth->opEnvelope[op] =
+                  _advance(&synth->params.opEnvelopes[op], &synth->env[op]);
+            }
+        }
+
+        // Clipped at the top as it was. It was never clipped at the bottom,
+        // which overflowed, so that is clipped here too.
+        float mix = 0;
+        for (int op = 0; op < FM_OPERATORS; op++) {
+            mix += opSamples[op] * synth->params.opParams[op].outputStrength;
+            if (mix >= 1) {
+                mix = 1;
+            }
+        }
+        if (mix < -1) {
+            mix = -1;
+        }
+        out[s] = mix * INT16_MAX;
+    }
+}
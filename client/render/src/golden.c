@@ -0,0 +1,348 @@
+/**
+ * @file golden.c
+ * @brief Implementation of the kernel check.
+ */
+#include "golden.h"
+#include "baseline.h"
+#include "reference.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Sample rate renders are made at. */
+#define GOLDEN_SAMPLE_RATE 44100
+/** How long each note is held, in frames. */
+#define GOLDEN_HELD_FRAMES (GOLDEN_SAMPLE_RATE / 2)
+/** How long the release is rendered for after the note is let go. */
+#define GOLDEN_RELEASE_FRAMES (GOLDEN_SAMPLE_RATE / 2)
+/** Frames in a whole render. */
+#define GOLDEN_FRAMES (GOLDEN_HELD_FRAMES + GOLDEN_RELEASE_FRAMES)
+/** Frames rendered per call. Not a multiple of the envelope control period,
+ * so the split between calls gets exercised too. */
+#define GOLDEN_PERIOD_FRAMES 1000
+/** Lowest and highest note rendered. The whole keyboard the synth knows. */
+#define GOLDEN_LOW_NOTE C2
+#define GOLDEN_HIGH_NOTE B6
+/** Distance between the notes rendered, in semitones. */
+#define GOLDEN_NOTE_STEP 5
+
+/** A chord held by every voice, for the polyphonic render. */
+static const Note _chord[FM_MAX_VOICES] = { C3, E3, G3, B3, D4, F4, A4, C5 };
+
+/** The loudness SNR against the baseline measured for a built-in preset. */
+typedef struct
+{
+    /** The preset. */
+    const char* name;
+    /** The SNR at its worst note, in dB, rounded down. */
+    double snrDb;
+} _Measured;
+
+/** What the built-in presets measured against the baseline, with every
+ * kernel. */
+static const _Measured _measured[] = {
+    { "default", 26.8 },
+    { "piano", 9.6 },
+    { "sawblade", 26.1 },
+    { "bell", 10.9 },
+    { "cry", 12.6 },
+    { "ahh", 25.6 },
+    { "bass", 10.7 },
+    { "brass", 11.0 },
+    { "yoi", 13.0 },
+    { "big", 17.5 },
+    { "glitchboop", 14.2 },
+    { "beepboop", 13.6 },
+    { "shinydrone", 23.3 },
+    { "chirp", 9.1 },
+};
+
+/** A render to compare. */
+typedef struct
+{
+    /** Notes held. */
+    const Note* notes;
+    /** How many. One means the mono synthesizer is used. */
+    size_t nNotes;
+} _Render;
+
+/** Render notes held then released with the given kernel. */
+static int
+_render(const FmSynthParams* params,
+        FmKernel kernel,
+        const _Render* render,
+        int16_t* out);
+/** Render notes held then released with the reference synth. */
+static int
+_renderReference(const FmSynthParams* params,
+                 const _Render* render,
+                 int16_t* out);
+/** Render a note held then released with the baseline synth. */
+static int
+_renderBaseline(const FmSynthParams* params, Note note, int16_t* out);
+/** Get how many frames to render next, stopping at the release. */
+static size_t
+_framesFrom(size_t frame);
+/** Compare a candidate render to the reference. */
+static Golden_Diff
+_compare(const int16_t* reference, const int16_t* candidate, size_t n);
+/** Compare the loudness of a candidate render to the baseline. Returns the
+ * SNR in dB. */
+static double
+_compareLoudness(const int16_t* baseline, const int16_t* candidate, size_t n);
+/** Is the diff within tolerance? */
+static bool
+_isClose(const Golden_Diff* diff);
+/** Get the least loudness SNR against the baseline a preset may have, or NAN
+ * if it wasn't measured. */
+static double
+_baselineFloor(const char* name);
+
+static int
+_render(const FmSynthParams* params,
+        FmKernel kernel,
+        const _Render* render,
+        int16_t* out)
+{
+    FmSynthesizer* synth =
+      render->nNotes == 1
+        ? Fm_createFmSynthesizer(params)
+        : Fm_createPolySynthesizer(params, render->nNotes);
+    if (!synth) {
+        return -ENOMEM;
+    }
+    Fm_setKernel(synth, kernel);
+    if (render->nNotes == 1) {
+        Fm_setNote(synth, render->notes[0]);
+        Fm_noteOn(synth);
+    } else {
+        for (size_t i = 0; i < render->nNotes; i++) {
+            Fm_voiceOn(synth, render->notes[i]);
+        }
+    }
+
+    for (size_t frame = 0; frame < GOLDEN_FRAMES;) {
+        if (frame == GOLDEN_HELD_FRAMES) {
+            if (render->nNotes == 1) {
+                Fm_noteOff(synth);
+            } else {
+                Fm_allVoicesOff(synth);
+            }
+        }
+        size_t n = _framesFrom(frame);
+        Fm_generateSamples(synth, out + frame, n);
+        frame += n;
+    }
+
+    Fm_destroySynthesizer(synth);
+    return 0;
+}
+
+static int
+_renderReference(const FmSynthParams* params,
+                 const _Render* render,
+                 int16_t* out)
+{
+    Reference_Synth* synth = Reference_create(params, render->nNotes);
+    if (!synth) {
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < render->nNotes; i++) {
+        Reference_noteOn(synth, i, render->notes[i]);
+    }
+
+    for (size_t frame = 0; frame < GOLDEN_FRAMES;) {
+        if (frame == GOLDEN_HELD_FRAMES) {
+            Reference_allNotesOff(synth);
+        }
+        size_t n = _framesFrom(frame);
+        Reference_generateSamples(synth, out + frame, n);
+        frame += n;
+    }
+
+    Reference_destroy(synth);
+    return 0;
+}
+
+static int
+_renderBaseline(const FmSynthParams* params, Note note, int16_t* out)
+{
+    Baseline_Synth* synth = Baseline_create(params);
+    if (!synth) {
+        return -ENOMEM;
+    }
+    Baseline_noteOn(synth, note);
+
+    for (size_t frame = 0; frame < GOLDEN_FRAMES;) {
+        if (frame == GOLDEN_HELD_FRAMES) {
+            Baseline_noteOff(synth);
+        }
+        size_t n = _framesFrom(frame);
+        Baseline_generateSamples(synth, out + frame, n);
+        frame += n;
+    }
+
+    Baseline_destroy(synth);
+    return 0;
+}
+
+static size_t
+_framesFrom(size_t frame)
+{
+    // Stop at the release so it lands on the same frame every time.
+    size_t end = frame < GOLDEN_HELD_FRAMES ? GOLDEN_HELD_FRAMES
+                                            : GOLDEN_FRAMES;
+    size_t n = end - frame;
+    return n > GOLDEN_PERIOD_FRAMES ? GOLDEN_PERIOD_FRAMES : n;
+}
+
+static Golden_Diff
+_compare(const int16_t* reference, const int16_t* candidate, size_t n)
+{
+    double signal = 0;
+    double noise = 0;
+    Golden_Diff diff = { .peakError = 0 };
+    for (size_t i = 0; i < n; i++) {
+        int error = abs(candidate[i] - reference[i]);
+        signal += (double)reference[i] * reference[i];
+        noise += (double)error * error;
+        if (error > diff.peakError) {
+            diff.peakError = error;
+        }
+    }
+
+    if (noise == 0) {
+        diff.snrDb = INFINITY;
+    } else if (signal == 0) {
+        diff.snrDb = -INFINITY;
+    } else {
+        diff.snrDb = 10 * log10(signal / noise);
+    }
+    return diff;
+}
+
+static double
+_compareLoudness(const int16_t* baseline, const int16_t* candidate, size_t n)
+{
+    double signal = 0;
+    double noise = 0;
+    for (size_t start = 0; start + GOLDEN_LOUDNESS_FRAMES <= n;
+         start += GOLDEN_LOUDNESS_FRAMES) {
+        double baselineSum = 0;
+        double candidateSum = 0;
+        for (size_t i = start; i < start + GOLDEN_LOUDNESS_FRAMES; i++) {
+            baselineSum += (double)baseline[i] * baseline[i];
+            candidateSum += (double)candidate[i] * candidate[i];
+        }
+        double baselineRms = sqrt(baselineSum / GOLDEN_LOUDNESS_FRAMES);
+        double candidateRms = sqrt(candidateSum / GOLDEN_LOUDNESS_FRAMES);
+        signal += baselineRms * baselineRms;
+        noise += (candidateRms - baselineRms) * (candidateRms - baselineRms);
+    }
+
+    if (noise == 0) {
+        return INFINITY;
+    }
+    return signal == 0 ? -INFINITY : 10 * log10(signal / noise);
+}
+
+static bool
+_isClose(const Golden_Diff* diff)
+{
+    return diff->snrDb >= GOLDEN_MIN_SNR_DB &&
+           diff->peakError <= GOLDEN_MAX_PEAK_ERROR;
+}
+
+static double
+_baselineFloor(const char* name)
+{
+    for (size_t i = 0; i < sizeof(_measured) / sizeof(_measured[0]); i++) {
+        if (strcmp(_measured[i].name, name) == 0) {
+            return _measured[i].snrDb - GOLDEN_BASELINE_MARGIN_DB;
+        }
+    }
+    return NAN;
+}
+
+int
+Golden_checkPreset(const char* name,
+                   const FmSynthParams* params,
+                   FmKernel candidate,
+                   Golden_Report* report)
+{
+    int16_t* reference = malloc(3 * GOLDEN_FRAMES * sizeof(int16_t));
+    if (!reference) {
+        return -ENOMEM;
+    }
+    int16_t* rendered = reference + GOLDEN_FRAMES;
+    int16_t* baseline = rendered + GOLDEN_FRAMES;
+
+    Golden_Diff worstDiff = { .snrDb = INFINITY, .peakError = 0 };
+    double worstBaselineSnrDb = INFINITY;
+    double baselineFloorDb = _baselineFloor(name);
+    int drifted = 0;
+    int err = 0;
+    // Every note in the range, then the chord.
+    const int nNotes = (GOLDEN_HIGH_NOTE - GOLDEN_LOW_NOTE) / GOLDEN_NOTE_STEP;
+    for (int i = 0; i <= nNotes + 1; i++) {
+        bool chord = i > nNotes;
+        Note note = GOLDEN_LOW_NOTE + i * GOLDEN_NOTE_STEP;
+        _Render render = { .notes = chord ? _chord : &note,
+                           .nNotes = chord ? FM_MAX_VOICES : 1 };
+
+        err = _renderReference(params, &render, reference);
+        if (err < 0 || (err = _render(params, candidate, &render, rendered))) {
+            break;
+        }
+
+        Golden_Diff diff = _compare(reference, rendered, GOLDEN_FRAMES);
+        bool close = _isClose(&diff);
+        if (!close) {
+            if (chord) {
+                printf("  %s chord: ", name);
+            } else {
+                printf("  %s note %d: ", name, note);
+            }
+            printf("SNR %.1f dB, peak error %d\n", diff.snrDb, diff.peakError);
+        }
+        // The baseline only plays one note at a time.
+        if (!chord) {
+            if ((err = _renderBaseline(params, note, baseline)) < 0) {
+                break;
+            }
+            double snrDb = _compareLoudness(baseline, rendered, GOLDEN_FRAMES);
+            if (snrDb < baselineFloorDb) {
+                close = false;
+                printf("  %s note %d: loudness SNR %.1f dB from the baseline\n",
+                       name,
+                       note,
+                       snrDb);
+            }
+            if (snrDb < worstBaselineSnrDb) {
+                worstBaselineSnrDb = snrDb;
+            }
+        }
+        drifted += !close;
+        if (diff.snrDb < worstDiff.snrDb) {
+            worstDiff.snrDb = diff.snrDb;
+        }
+        if (diff.peakError > worstDiff.peakError) {
+            worstDiff.peakError = diff.peakError;
+        }
+    }
+
+    free(reference);
+    if (err < 0) {
+        return err;
+    }
+    if (report) {
+        report->reference = worstDiff;
+        report->baselineSnrDb = worstBaselineSnrDb;
+        report->baselineFloorDb = baselineFloorDb;
+    }
+    return drifted;
+}
@@ -0,0 +1,461 @@
+// Offline renderer for the DAS library.
+// Renders a preset or a MIDI file straight to a WAV file as fast as the CPU
+// allows, then reports how many times faster than realtime that was.
+// With -c it instead checks the kernels against a frozen reference synth.
+// With -B it bakes the notes of the preset to a note cache, which -u renders
+// with.
+
+#include "golden.h"
+#include "midiSong.h"
+
+#include "com/timeutils.h"
+#include "das/audiobackend.h"
+#include "das/fm.h"
+#include "das/notecache.h"
+#include "das/presetbank.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Frames rendered at a time. */
+#define RENDER_PERIOD_FRAMES 4096
+/** How long to keep rendering after the last note is released, in seconds,
+ * so release tails aren't cut off. */
+#define RENDER_TAIL_SECONDS 2.0
+/** The MIDI note number of C2, which is note 0 to the synth. */
+#define MIDI_C2 36
+/** The MIDI note number of A4. */
+#define MIDI_A4 69
+
+/** Most presets a bank written with -w can hold. */
+#define RENDER_MAX_BANK_PRESETS 64
+
+/** Frames rendered so far. */
+static size_t _framesRendered;
+
+/** Print usage to stderr. */
+static void
+_usage(const char* program);
+/** Write the presets in use, and any aliases for them given as name=preset,
+ * to a bank file. */
+static int
+_writeBank(const char* path, char** aliases, size_t nAliases);
+/** Bake the notes of a preset to a note cache file. */
+static int
+_bakeNotes(const char* path, const FmSynthParams* params);
+/** Parse a kernel name. Returns 0 on success. */
+static int
+_parseKernel(const char* name, FmKernel* kernel);
+/** Render frames from the synth to the output. */
+static int
+_render(FmSynthesizer* synth, AudioBackend* out, size_t nFrames);
+/** Render a single note held for the given time, then its release. */
+static int
+_renderNote(FmSynthesizer* synth, AudioBackend* out, int note, double heldSec);
+/** Render every note of a song. */
+static int
+_renderSong(FmSynthesizer* synth, AudioBackend* out, const MidiSong* song);
+/** Check every preset against the reference with the given kernel. Returns
+ * the number of presets that drifted, or a negative errno. */
+static int
+_checkKernel(const char* kernelName, FmKernel kernel);
+
+static void
+_usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [-b bank] [-p preset] [-n note] [-s seconds] "
+            "[-k kernel] [-d] [-u notes] [-o out.wav] [song.mid]\n"
+            "       %s [-b bank] -c [-k kernel]\n"
+            "       %s [-b bank] -w out.bank [name=preset...]\n"
+            "       %s [-b bank] [-p preset] -B out.notes\n"
+            "\n"
+            "Renders song.mid, or a single note if no song is given.\n"
+            "With -c, checks that every preset sounds the same with the\n"
+            "kernel as with the reference synth, and fails if it drifts.\n"
+            "Checks every kernel if no kernel is given.\n"
+            "With -w, writes every preset to a bank, adding each preset\n"
+            "given after it again under the new name.\n"
+            "With -B, bakes every note of the preset to a note cache.\n"
+            "  -b  bank file to take presets from (default built in)\n"
+            "  -p  preset to play with (default piano)\n"
+            "  -n  MIDI note to play without a song (default %d)\n"
+            "  -s  seconds to hold the note (default 2)\n"
+            "  -k  kernel: auto, scalar or simd (default auto)\n"
+            "  -d  dither the output\n"
+            "  -o  file to write (default out.wav)\n"
+            "  -u  note cache to play baked notes from\n"
+            "\n"
+            "presets:",
+            program,
+            program,
+            program,
+            program,
+            MIDI_A4);
+    const PresetBank* bank = PresetBank_getActive();
+    for (size_t i = 0; i < PresetBank_count(bank); i++) {
+        fprintf(stderr, " %s", PresetBank_getName(bank, i));
+    }
+    fprintf(stderr, "\n");
+}
+
+static int
+_writeBank(const char* path, char** aliases, size_t nAliases)
+{
+    const PresetBank* bank = PresetBank_getActive();
+    const char* names[RENDER_MAX_BANK_PRESETS];
+    const FmSynthParams* params[RENDER_MAX_BANK_PRESETS];
+    size_t count = PresetBank_count(bank);
+    if (count + nAliases > RENDER_MAX_BANK_PRESETS) {
+        fprintf(stderr, "Too many presets for a bank\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        names[i] = PresetBank_getName(bank, i);
+        params[i] = PresetBank_get(bank, i);
+    }
+    for (size_t i = 0; i < nAliases; i++) {
+        char* preset = strchr(aliases[i], '=');
+        if (!preset || !(params[count] = PresetBank_find(bank, preset + 1))) {
+            fprintf(stderr, "Bad alias %s\n", aliases[i]);
+            return -1;
+        }
+        *preset = '\0';
+        names[count++] = aliases[i];
+    }
+
+    int err = PresetBank_write(path, names, params, count);
+    if (err < 0) {
+        fprintf(stderr, "Can't write %s: %s\n", path, strerror(-err));
+        return -1;
+    }
+    printf("wrote %zu presets to %s\n", count, path);
+    return 0;
+}
+
+static int
+_bakeNotes(const char* path, const FmSynthParams* params)
+{
+    NoteCache* cache;
+    long long start = Timeutils_getMonotonicTimeInNs();
+    int err = NoteCache_bake(
+      &cache, params, NOTECACHE_LOWEST_NOTE, NOTECACHE_HIGHEST_NOTE);
+    double elapsedSec = (Timeutils_getMonotonicTimeInNs() - start) / 1e9;
+    if (err < 0) {
+        fprintf(stderr, "Can't bake: %s\n", strerror(-err));
+        return -1;
+    }
+
+    if ((err = NoteCache_save(cache, path)) < 0) {
+        fprintf(stderr, "Can't write %s: %s\n", path, strerror(-err));
+        NoteCache_close(cache);
+        return -1;
+    }
+    printf("baked %zu of %d notes to %s in %.2f s: %.1f MB\n",
+           NoteCache_countNotes(cache),
+           NOTECACHE_HIGHEST_NOTE - NOTECACHE_LOWEST_NOTE + 1,
+           path,
+           elapsedSec,
+           NoteCache_getSize(cache) / 1e6);
+    NoteCache_close(cache);
+    return 0;
+}
+
+static int
+_parseKernel(const char* name, FmKernel* kernel)
+{
+    if (strcmp(name, "auto") == 0) {
+        *kernel = FM_KERNEL_AUTO;
+    } else if (strcmp(name, "scalar") == 0) {
+        *kernel = FM_KERNEL_SCALAR;
+    } else if (strcmp(name, "simd") == 0) {
+        *kernel = FM_KERNEL_SIMD;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+_render(FmSynthesizer* synth, AudioBackend* out, size_t nFrames)
+{
+    while (nFrames > 0) {
+        int16_t* buffer;
+        long frames = AudioBackend_begin(out, &buffer, nFrames);
+        if (frames < 0) {
+            return frames;
+        }
+        Fm_generateSamples(synth, buffer, frames);
+        int err = AudioBackend_commit(out, frames);
+        if (err < 0) {
+            return err;
+        }
+        nFrames -= frames;
+        _framesRendered += frames;
+    }
+    return 0;
+}
+
+static int
+_renderNote(FmSynthesizer* synth, AudioBackend* out, int note, double heldSec)
+{
+    Fm_setNote(synth, note - MIDI_C2);
+    Fm_noteOn(synth);
+    int err = _render(synth, out, heldSec * out->sampleRate);
+    if (err < 0) {
+        return err;
+    }
+    Fm_noteOff(synth);
+    return _render(synth, out, RENDER_TAIL_SECONDS * out->sampleRate);
+}
+
+static int
+_renderSong(FmSynthesizer* synth, AudioBackend* out, const MidiSong* song)
+{
+    for (size_t i = 0; i < song->nEvents; i++) {
+        const MidiSong_Event* event = &song->events[i];
+        size_t frame = event->timeSec * out->sampleRate;
+        if (frame > _framesRendered) {
+            int err = _render(synth, out, frame - _framesRendered);
+            if (err < 0) {
+                return err;
+            }
+        }
+        if (event->on) {
+            Fm_voiceOn(synth, event->note - MIDI_C2);
+        } else {
+            Fm_voiceOff(synth, event->note - MIDI_C2);
+        }
+    }
+    Fm_allVoicesOff(synth);
+    return _render(synth, out, RENDER_TAIL_SECONDS * out->sampleRate);
+}
+
+static int
+_checkKernel(const char* kernelName, FmKernel kernel)
+{
+    printf("checking the %s kernel against the reference "
+           "(SNR >= %.0f dB, peak error <= %d) and the baseline "
+           "(loudness SNR no more than %.0f dB under what was measured)\n",
+           kernelName,
+           GOLDEN_MIN_SNR_DB,
+           GOLDEN_MAX_PEAK_ERROR,
+           GOLDEN_BASELINE_MARGIN_DB);
+
+    const PresetBank* bank = PresetBank_getActive();
+    int drifted = 0;
+    for (size_t i = 0; i < PresetBank_count(bank); i++) {
+        const char* name = PresetBank_getName(bank, i);
+        Golden_Report worst;
+        int n =
+          Golden_checkPreset(name, PresetBank_get(bank, i), kernel, &worst);
+        if (n < 0) {
+            return n;
+        }
+        printf("%-12s %s: worst SNR %.1f dB, worst peak error %d, "
+               "baseline loudness SNR %.1f dB",
+               name,
+               n > 0 ? "DRIFTED" : "ok",
+               worst.reference.snrDb,
+               worst.reference.peakError,
+               worst.baselineSnrDb);
+        if (isnan(worst.baselineFloorDb)) {
+            printf(" (not measured)\n");
+        } else {
+            printf(" (>= %.1f)\n", worst.baselineFloorDb);
+        }
+        drifted += n > 0;
+    }
+    return drifted;
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* presetName = "piano";
+    const char* bankPath = NULL;
+    const char* writeBankPath = NULL;
+    const char* bakePath = NULL;
+    const char* notesPath = NULL;
+    const char* outPath = "out.wav";
+    FmKernel kernel = FM_KERNEL_AUTO;
+    const char* kernelName = NULL;
+    bool dither = false;
+    bool check = false;
+    int note = MIDI_A4;
+    double heldSec = 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:p:n:s:k:do:cw:B:u:h")) != -1) {
+        switch (opt) {
+            case 'b':
+                bankPath = optarg;
+                break;
+            case 'p':
+                presetName = optarg;
+                break;
+            case 'n':
+                note = atoi(optarg);
+                break;
+            case 's':
+                heldSec = atof(optarg);
+                break;
+            case 'k':
+                if (_parseKernel(optarg, &kernel) < 0) {
+                    fprintf(stderr, "Unknown kernel %s\n", optarg);
+                    _usage(argv[0]);
+                    return 1;
+                }
+                kernelName = optarg;
+                break;
+            case 'd':
+                dither = true;
+                break;
+            case 'c':
+                check = true;
+                break;
+            case 'w':
+                writeBankPath = optarg;
+                break;
+            case 'o':
+                outPath = optarg;
+                break;
+            case 'B':
+                bakePath = optarg;
+                break;
+            case 'u':
+                notesPath = optarg;
+                break;
+            default:
+                _usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    const char* songPath = optind < argc ? argv[optind] : NULL;
+
+    // The bank stays mapped until we exit, the presets are used to the end.
+    PresetBank* bank;
+    int err;
+    if (bankPath) {
+        if ((err = PresetBank_open(&bank, bankPath)) < 0) {
+            fprintf(stderr, "Can't open %s: %s\n", bankPath, strerror(-err));
+            return 1;
+        }
+        PresetBank_use(bank);
+    }
+
+    if (writeBankPath) {
+        return _writeBank(writeBankPath, argv + optind, argc - optind) < 0;
+    }
+
+    const FmSynthParams* params =
+      PresetBank_find(PresetBank_getActive(), presetName);
+    if (!params) {
+        fprintf(stderr, "Unknown preset %s\n", presetName);
+        _usage(argv[0]);
+        return 1;
+    }
+
+    if (bakePath) {
+        return _bakeNotes(bakePath, params) < 0;
+    }
+
+    if (check) {
+        const char* names[] = { "scalar", "simd", "auto" };
+        FmKernel kernels[] = { FM_KERNEL_SCALAR,
+                               FM_KERNEL_SIMD,
+                               FM_KERNEL_AUTO };
+        size_t nKernels = sizeof(kernels) / sizeof(kernels[0]);
+        if (kernelName) {
+            names[0] = kernelName;
+            kernels[0] = kernel;
+            nKernels = 1;
+        }
+
+        int drifted = 0;
+        for (size_t i = 0; i < nKernels; i++) {
+            int n = _checkKernel(names[i], kernels[i]);
+            if (n < 0) {
+                fprintf(stderr, "Can't render: %s\n", strerror(-n));
+                return 1;
+            }
+            drifted += n;
+        }
+        return drifted > 0 ? 1 : 0;
+    }
+
+    // Like the bank, the cache stays mapped until we exit.
+    NoteCache* notes = NULL;
+    if (notesPath && (err = NoteCache_open(&notes, notesPath)) < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", notesPath, strerror(-err));
+        return 1;
+    }
+    if (notes && memcmp(NoteCache_getParams(notes),
+                        params,
+                        sizeof(FmSynthParams)) != 0) {
+        fprintf(stderr, "%s wasn't baked from %s\n", notesPath, presetName);
+        return 1;
+    }
+
+    MidiSong song = { 0 };
+    if (songPath && (err = MidiSong_load(songPath, &song)) < 0) {
+        fprintf(stderr, "Can't load %s: %s\n", songPath, strerror(-err));
+        return 1;
+    }
+
+    // Songs need a voice per note, a single note needs just the one.
+    FmSynthesizer* synth = songPath
+                             ? Fm_createPolySynthesizer(params, FM_MAX_VOICES)
+                             : Fm_createFmSynthesizer(params);
+    AudioBackend* out;
+    if (!synth) {
+        fprintf(stderr, "Can't create synthesizer\n");
+        MidiSong_free(&song);
+        return 1;
+    }
+    Fm_setKernel(synth, kernel);
+    Fm_setDither(synth, dither);
+    if (notes) {
+        Fm_addNoteCache(synth, notes);
+    }
+    if ((err = AudioBackend_openWav(
+           &out, outPath, params->sampleRate, 1, RENDER_PERIOD_FRAMES)) < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", outPath, strerror(-err));
+        Fm_destroySynthesizer(synth);
+        MidiSong_free(&song);
+        return 1;
+    }
+
+    long long start = Timeutils_getMonotonicTimeInNs();
+    err = songPath ? _renderSong(synth, out, &song)
+                   : _renderNote(synth, out, note, heldSec);
+    double elapsedSec = (Timeutils_getMonotonicTimeInNs() - start) / 1e9;
+    FmMixStats mix;
+    Fm_getMixStats(synth, &mix);
+
+    AudioBackend_close(out);
+    Fm_destroySynthesizer(synth);
+    MidiSong_free(&song);
+    if (err < 0) {
+        fprintf(stderr, "Can't write %s: %s\n", outPath, strerror(-err));
+        return 1;
+    }
+
+    double audioSec = (double)_framesRendered / params->sampleRate;
+    printf("rendered %.2f s of audio to %s in %.3f s: %.1fx realtime\n",
+           audioSec,
+           outPath,
+           elapsedSec,
+           elapsedSec > 0 ? audioSec / elapsedSec : 0);
+    if (mix.limited > 0) {
+        printf("limited %lu times, %lu samples were over full scale\n",
+               mix.limited,
+               mix.clipped);
+    }
+    return 0;
+}
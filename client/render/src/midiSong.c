@@ -0,0 +1,245 @@
+/**
+ * @file midiSong.c
+ * @brief Implementation of the MIDI song loader.
+ */
+#include "midiSong.h"
+#include "midi-parser.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** The percussion channel, which has no pitched notes. */
+#define MIDI_PERCUSSION_CHANNEL 9
+/** Tempo until the file sets one: 120 bpm, in microseconds per beat. */
+#define MIDI_DEFAULT_TEMPO 500000
+/** Microseconds in a second. */
+#define US_PER_SECOND 1e6
+
+/** An event as it is in the file, timed in ticks. */
+typedef struct
+{
+    /** Ticks from the start of the song. */
+    int64_t tick;
+    /** Position in the file, to keep events at the same tick in order. */
+    size_t order;
+    /** Microseconds per beat, or 0 if this is a note event. */
+    uint32_t tempo;
+    /** MIDI note number. */
+    int note;
+    /** Is the note starting? */
+    bool on;
+} _RawEvent;
+
+/** A growable list of raw events. */
+typedef struct
+{
+    _RawEvent* events;
+    size_t nEvents;
+    size_t capacity;
+} _RawEvents;
+
+/** Read a whole file. Returns the contents, or NULL. */
+static uint8_t*
+_readFile(const char* path, size_t* size);
+/** Append an event. Returns 0 or -ENOMEM. */
+static int
+_append(_RawEvents* list, const _RawEvent* event);
+/** Parse every event in the file into raw events. */
+static int
+_parse(struct midi_parser* parser, _RawEvents* list, int* ppq);
+/** qsort comparison putting raw events in time order. */
+static int
+_compareRaw(const void* a, const void* b);
+
+static uint8_t*
+_readFile(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    uint8_t* data = NULL;
+    long length;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(length);
+        if (data && fread(data, 1, length, file) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = length;
+    }
+    fclose(file);
+    return data;
+}
+
+static int
+_append(_RawEvents* list, const _RawEvent* event)
+{
+    if (list->nEvents == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        _RawEvent* events =
+          realloc(list->events, capacity * sizeof(_RawEvent));
+        if (!events) {
+            return -ENOMEM;
+        }
+        list->events = events;
+        list->capacity = capacity;
+    }
+    list->events[list->nEvents++] = *event;
+    return 0;
+}
+
+static int
+_parse(struct midi_parser* parser, _RawEvents* list, int* ppq)
+{
+    int64_t tick = 0;
+    while (1) {
+        _RawEvent event = { .order = list->nEvents };
+        switch (midi_parse(parser)) {
+            case MIDI_PARSER_EOB:
+                return 0;
+
+            case MIDI_PARSER_ERROR:
+                return -EINVAL;
+
+            case MIDI_PARSER_HEADER:
+                // Negative divisions count SMPTE frames, which no file we
+                // have uses.
+                if (parser->header.time_division <= 0) {
+                    return -ENOTSUP;
+                }
+                *ppq = parser->header.time_division;
+                break;
+
+            case MIDI_PARSER_TRACK:
+                // Every track counts time from the start of the song.
+                tick = 0;
+                break;
+
+            case MIDI_PARSER_TRACK_MIDI:
+                tick += parser->vtime;
+                if (parser->midi.channel == MIDI_PERCUSSION_CHANNEL) {
+                    break;
+                }
+                if (parser->midi.status != MIDI_STATUS_NOTE_ON &&
+                    parser->midi.status != MIDI_STATUS_NOTE_OFF) {
+                    break;
+                }
+                event.tick = tick;
+                event.note = parser->midi.param1;
+                // A note on with no velocity is a note off.
+                event.on = parser->midi.status == MIDI_STATUS_NOTE_ON &&
+                           parser->midi.param2 > 0;
+                if (_append(list, &event) < 0) {
+                    return -ENOMEM;
+                }
+                break;
+
+            case MIDI_PARSER_TRACK_META:
+                tick += parser->vtime;
+                if (parser->meta.type != MIDI_META_SET_TEMPO ||
+                    parser->meta.length != 3) {
+                    break;
+                }
+                event.tick = tick;
+                event.tempo = parser->meta.bytes[0] << 16 |
+                              parser->meta.bytes[1] << 8 |
+                              parser->meta.bytes[2];
+                if (_append(list, &event) < 0) {
+                    return -ENOMEM;
+                }
+                break;
+
+            case MIDI_PARSER_TRACK_SYSEX:
+                tick += parser->vtime;
+                break;
+
+            default:
+                return -EINVAL;
+        }
+    }
+}
+
+static int
+_compareRaw(const void* a, const void* b)
+{
+    const _RawEvent* left = a;
+    const _RawEvent* right = b;
+    if (left->tick != right->tick) {
+        return left->tick < right->tick ? -1 : 1;
+    }
+    return left->order < right->order ? -1 : left->order > right->order;
+}
+
+int
+MidiSong_load(const char* path, MidiSong* song)
+{
+    size_t size = 0;
+    errno = 0;
+    uint8_t* data = _readFile(path, &size);
+    if (!data) {
+        return errno ? -errno : -EIO;
+    }
+
+    struct midi_parser parser = {
+        .state = MIDI_PARSER_INIT,
+        .in = data,
+        .size = size,
+    };
+    _RawEvents list = { 0 };
+    int ppq = 0;
+    int err = _parse(&parser, &list, &ppq);
+    free(data);
+    if (err == 0 && ppq == 0) {
+        err = -EINVAL;
+    }
+    if (err < 0) {
+        free(list.events);
+        return err;
+    }
+
+    // Tracks come one after another, so put everything in time order before
+    // working out when things happen.
+    qsort(list.events, list.nEvents, sizeof(_RawEvent), _compareRaw);
+
+    // One extra so a file with no notes still gets an allocation.
+    song->events = malloc((list.nEvents + 1) * sizeof(MidiSong_Event));
+    song->nEvents = 0;
+    if (!song->events) {
+        free(list.events);
+        return -ENOMEM;
+    }
+
+    uint32_t tempo = MIDI_DEFAULT_TEMPO;
+    int64_t lastTick = 0;
+    double timeSec = 0;
+    for (size_t i = 0; i < list.nEvents; i++) {
+        const _RawEvent* raw = &list.events[i];
+        timeSec += (raw->tick - lastTick) * (tempo / US_PER_SECOND) / ppq;
+        lastTick = raw->tick;
+        if (raw->tempo) {
+            tempo = raw->tempo;
+            continue;
+        }
+        song->events[song->nEvents++] = (MidiSong_Event){
+            .timeSec = timeSec,
+            .note = raw->note,
+            .on = raw->on,
+        };
+    }
+
+    free(list.events);
+    return 0;
+}
+
+void
+MidiSong_free(MidiSong* song)
+{
+    free(song->events);
+    song->events = NULL;
+    song->nEvents = 0;
+}
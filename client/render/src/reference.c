@@ -0,0 +1,443 @@
+/**
+ * @file reference.c
+ * @brief Implementation of the reference synthesizer.
+ */
+#include "reference.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Bits of phase that index a wave table. */
+#define REF_TABLE_BITS 11
+/** Samples in each wave table. */
+#define REF_TABLE_SIZE (1u << REF_TABLE_BITS)
+/** Bits of phase between two table samples. */
+#define REF_FRAC_BITS (32 - REF_TABLE_BITS)
+/** Headroom for phase offsets of more than half a period. */
+#define REF_OFFSET_HEADROOM_BITS 8
+/** Band-limited tables per wave. Level l holds REF_MAX_HARMONICS >> l
+ * harmonics. */
+#define REF_MIP_LEVELS 10
+/** Harmonics in the fullest table. */
+#define REF_MAX_HARMONICS (1u << (REF_MIP_LEVELS - 1))
+/** Steps under 2^REF_LEVEL0_STEP_BITS have room for every harmonic. */
+#define REF_LEVEL0_STEP_BITS (31 - (REF_MIP_LEVELS - 1))
+/** Samples between envelope control points. */
+#define REF_CONTROL_PERIOD 64
+/** Level the limiter keeps the mix under. */
+#define REF_LIMITER_CEILING 0.99f
+/** How long the limiter takes to come back up, in ms. */
+#define REF_LIMITER_RELEASE_MS 50
+/** Twelth root of two, for note frequencies. */
+#define REF_TWELVETH_ROOT_OF_TWO 1.059463094359
+
+/** Where one operator envelope is. */
+typedef struct
+{
+    /** How far through the envelope it is, from 0 to 1. */
+    float x;
+    /** How far it moves each control point. */
+    float step;
+    /** Value it can't drop under after a retrigger, or -1. */
+    float min;
+    /** Has it been triggered, and not yet run out? */
+    bool triggered;
+    /** Has it been let go? */
+    bool gated;
+    /** Level now, ramped toward the target. */
+    float level;
+    /** Level at the next control point. */
+    float target;
+    /** How much the level ramps each sample. */
+    float ramp;
+} _RefEnvelope;
+
+struct Reference_Synth
+{
+    /** The voice. */
+    FmSynthParams params;
+    /** How many voices. */
+    size_t nVoices;
+    /** Phase of each operator of each voice, as a 32 bit fraction. */
+    uint32_t phase[FM_OPERATORS][FM_MAX_VOICES];
+    /** How far each phase moves each sample. */
+    uint32_t step[FM_OPERATORS][FM_MAX_VOICES];
+    /** The table each operator plays. */
+    const float* table[FM_OPERATORS][FM_MAX_VOICES];
+    /** Each operator's envelope. */
+    _RefEnvelope env[FM_OPERATORS][FM_MAX_VOICES];
+    /** Samples until the next control point. */
+    size_t countdown;
+    /** Is every envelope silent until the next control point? */
+    bool idle;
+    /** The limiter's gain. */
+    float limiterGain;
+};
+
+/** One period of a sine, for building the other tables from. */
+static double _sines[REF_TABLE_SIZE];
+/** The sine table. */
+static float _sine[REF_TABLE_SIZE + 1];
+/** Saw tables, one per octave. */
+static float _saw[REF_MIP_LEVELS][REF_TABLE_SIZE + 1];
+/** Square tables, one per octave. */
+static float _square[REF_MIP_LEVELS][REF_TABLE_SIZE + 1];
+/** Have the tables been built? */
+static bool _tablesBuilt;
+
+/** Build every table. */
+static void
+_buildTables(void);
+/** Sum harmonics into a table peaking at 1. Squares only have the odd
+ * harmonics, saws have all of them alternating in sign. */
+static void
+_buildAdditive(float* table, bool square, unsigned harmonics);
+/** Get the table for a wave at a step. */
+static const float*
+_table(WaveType wave, uint32_t step);
+/** Set the note of a voice. */
+static void
+_setNote(Reference_Synth* synth, size_t voice, Note note);
+/** Sample an envelope's function. */
+static float
+_sampleFn(const Pwl_Function* fn, float x);
+/** Get an envelope's value at this control point, and advance it. */
+static float
+_advance(const Env_Envelope* shape, _RefEnvelope* env);
+/** Reach a control point. */
+static void
+_controlPoint(Reference_Synth* synth);
+/** Render the next sample of the mix. */
+static float
+_renderSample(Reference_Synth* synth);
+/** Limit and convert one stretch between control points. */
+static void
+_mixToPcm(Reference_Synth* synth, const float* bus, int16_t* out, size_t n);
+
+static void
+_buildTables(void)
+{
+    for (unsigned n = 0; n < REF_TABLE_SIZE; n++) {
+        _sines[n] = sin(2 * M_PI * n / REF_TABLE_SIZE);
+        _sine[n] = _sines[n];
+    }
+    _sine[REF_TABLE_SIZE] = _sine[0];
+
+    for (unsigned level = 0; level < REF_MIP_LEVELS; level++) {
+        _buildAdditive(_saw[level], false, REF_MAX_HARMONICS >> level);
+        _buildAdditive(_square[level], true, REF_MAX_HARMONICS >> level);
+        // Squares swing between 0 and 1.
+        for (unsigned n = 0; n <= REF_TABLE_SIZE; n++) {
+            _square[level][n] = 0.5f + 0.5f * _square[level][n];
+        }
+    }
+    _tablesBuilt = true;
+}
+
+static void
+_buildAdditive(float* table, bool square, unsigned harmonics)
+{
+    double sum[REF_TABLE_SIZE] = { 0 };
+
+    // Each harmonic has amplitude 1 / k, softened by a Lanczos sigma factor.
+    for (unsigned k = 1; k <= harmonics; k++) {
+        if (square && k % 2 == 0) {
+            continue;
+        }
+        double sign = k % 2 == 1 ? 1 : -1;
+        double x = M_PI * k / (harmonics + 1);
+        double amp = sign / k * (sin(x) / x);
+        for (unsigned n = 0; n < REF_TABLE_SIZE; n++) {
+            sum[n] += amp * _sines[(k * n) % REF_TABLE_SIZE];
+        }
+    }
+
+    double peak = 0;
+    for (unsigned n = 0; n < REF_TABLE_SIZE; n++) {
+        peak = fmax(peak, fabs(sum[n]));
+    }
+    for (unsigned n = 0; n < REF_TABLE_SIZE; n++) {
+        table[n] = sum[n] / peak;
+    }
+    table[REF_TABLE_SIZE] = table[0];
+}
+
+static const float*
+_table(WaveType wave, uint32_t step)
+{
+    // Each octave above level 0 halves the harmonics.
+    int stepBits = 0;
+    while (stepBits < 32 && (step >> stepBits) != 0) {
+        stepBits++;
+    }
+    int level = stepBits - REF_LEVEL0_STEP_BITS;
+    if (level < 0) {
+        level = 0;
+    } else if (level >= REF_MIP_LEVELS) {
+        level = REF_MIP_LEVELS - 1;
+    }
+
+    switch (wave) {
+        case WAVETYPE_SQUARE:
+            return _square[level];
+        case WAVETYPE_SAW:
+            return _saw[level];
+        default:
+            return _sine;
+    }
+}
+
+static void
+_setNote(Reference_Synth* synth, size_t voice, Note note)
+{
+    const float baseFreq = C2_HZ * powf(REF_TWELVETH_ROOT_OF_TWO, note);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const OperatorParams* opParams = &synth->params.opParams[op];
+        float freq;
+        if (opParams->CmRatio > 0) {
+            freq = baseFreq * opParams->CmRatio;
+        } else {
+            freq = C2_HZ * powf(REF_TWELVETH_ROOT_OF_TWO, opParams->fixToNote);
+        }
+
+        double cycles = (double)freq / synth->params.sampleRate;
+        cycles -= floor(cycles);
+        synth->step[op][voice] = (uint32_t)(cycles * 4294967296.0);
+        synth->table[op][voice] =
+          _table(opParams->waveType, synth->step[op][voice]);
+    }
+}
+
+static float
+_sampleFn(const Pwl_Function* fn, float x)
+{
+    // The last segment starting at or before x, carried on past its end.
+    int segment = 0;
+    for (int i = 1; i < fn->pts - 1; i++) {
+        if (fn->ptsX[i] <= x) {
+            segment = i;
+        }
+    }
+    float dx = fn->ptsX[segment + 1] - fn->ptsX[segment];
+    float slope =
+      dx != 0 ? (fn->ptsY[segment + 1] - fn->ptsY[segment]) / dx : 0;
+    return fn->ptsY[segment] + (x - fn->ptsX[segment]) * slope;
+}
+
+static float
+_advance(const Env_Envelope* shape, _RefEnvelope* env)
+{
+    if (!env->triggered) {
+        return 0;
+    }
+
+    float value = _sampleFn(&shape->fn, env->x);
+    if (value < env->min) {
+        value = env->min;
+    } else {
+        env->min = -1;
+    }
+
+    // Held at the gate point, or looped back to the repeat point, until let
+    // go, then run to the end.
+    float x = env->x + env->step;
+    if (x >= shape->gatePoint && !env->gated) {
+        x = shape->repeatPoint >= 0 ? shape->repeatPoint : shape->gatePoint;
+    }
+    if (x > 1) {
+        env->triggered = false;
+        env->gated = false;
+        x = 0;
+    }
+    env->x = x;
+    return value;
+}
+
+static void
+_controlPoint(Reference_Synth* synth)
+{
+    synth->idle = true;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            _RefEnvelope* env = &synth->env[op][v];
+            float target = _advance(&synth->params.opEnvelopes[op], env);
+            env->level = env->target;
+            env->target = target;
+            env->ramp = (target - env->level) * (1.0f / REF_CONTROL_PERIOD);
+            if (env->triggered || env->level != 0 || env->ramp != 0) {
+                synth->idle = false;
+            }
+        }
+    }
+}
+
+static float
+_renderSample(Reference_Synth* synth)
+{
+    float out[FM_OPERATORS][FM_MAX_VOICES];
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            _RefEnvelope* env = &synth->env[op][v];
+            const float* table = synth->table[op][v];
+            uint32_t phase = synth->phase[op][v];
+            uint32_t i = phase >> REF_FRAC_BITS;
+            float frac = (phase & ((1u << REF_FRAC_BITS) - 1)) *
+                         (1.0f / (1u << REF_FRAC_BITS));
+            out[op][v] =
+              (table[i] + frac * (table[i + 1] - table[i])) * env->level;
+            env->level += env->ramp;
+        }
+    }
+
+    // Each operator's phase is pushed by the operators modulating it, by
+    // their output over the sample rate in periods.
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const OperatorParams* opParams = &synth->params.opParams[op];
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            float mod = 0;
+            for (int modOp = 0; modOp < FM_OPERATORS; modOp++) {
+                float coef = opParams->algorithmConnections[modOp] /
+                             synth->params.sampleRate;
+                mod += coef * out[modOp][v];
+            }
+            int32_t offset =
+              mod * (float)(1u << (32 - REF_OFFSET_HEADROOM_BITS));
+            synth->phase[op][v] +=
+              synth->step[op][v] +
+              ((uint32_t)offset << REF_OFFSET_HEADROOM_BITS);
+        }
+    }
+
+    float mix = 0;
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            mix += out[op][v] * synth->params.opParams[op].outputStrength;
+        }
+    }
+    return mix * (1.0f / synth->nVoices);
+}
+
+static void
+_mixToPcm(Reference_Synth* synth, const float* bus, int16_t* out, size_t n)
+{
+    float peak = 0;
+    for (size_t s = 0; s < n; s++) {
+        peak = fmaxf(peak, fabsf(bus[s]));
+    }
+
+    // Turn down right away to keep the peak under the ceiling, and come back
+    // up smoothly. The gain ramps across the stretch.
+    const float release =
+      1 - expf(-1000.0f * REF_CONTROL_PERIOD /
+               (REF_LIMITER_RELEASE_MS * (float)synth->params.sampleRate));
+    float start = synth->limiterGain;
+    float end = start + (1 - start) * release;
+    if (peak > REF_LIMITER_CEILING) {
+        float target = REF_LIMITER_CEILING / peak;
+        start = fminf(start, target);
+        end = fminf(end, target);
+    }
+    synth->limiterGain = end;
+
+    const float step = (end - start) / n;
+    for (size_t s = 0; s < n; s++) {
+        float x = bus[s] * (start + step * s);
+        x = fmaxf(-1, fminf(1, x));
+        out[s] = x * INT16_MAX;
+    }
+}
+
+Reference_Synth*
+Reference_create(const FmSynthParams* params, size_t nVoices)
+{
+    if (!_tablesBuilt) {
+        _buildTables();
+    }
+
+    Reference_Synth* synth = calloc(1, sizeof(Reference_Synth));
+    if (!synth) {
+        return NULL;
+    }
+    synth->params = *params;
+    synth->nVoices = nVoices;
+    synth->limiterGain = 1;
+
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        const Env_Envelope* shape = &params->opEnvelopes[op];
+        double samplesPerEnvelope =
+          shape->lengthMs * (params->sampleRate * 0.001);
+        for (size_t v = 0; v < nVoices; v++) {
+            synth->env[op][v].step = REF_CONTROL_PERIOD / samplesPerEnvelope;
+            synth->env[op][v].min = shape->min;
+        }
+    }
+    for (size_t v = 0; v < nVoices; v++) {
+        _setNote(synth, v, C2);
+    }
+    return synth;
+}
+
+void
+Reference_destroy(Reference_Synth* synth)
+{
+    free(synth);
+}
+
+void
+Reference_noteOn(Reference_Synth* synth, size_t voice, Note note)
+{
+    _setNote(synth, voice, note);
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        _RefEnvelope* env = &synth->env[op][voice];
+        // A retriggered envelope doesn't drop below where it was.
+        if (env->triggered) {
+            env->min = _sampleFn(&synth->params.opEnvelopes[op].fn, env->x);
+        }
+        env->x = 0;
+        env->triggered = true;
+        env->gated = false;
+    }
+}
+
+void
+Reference_allNotesOff(Reference_Synth* synth)
+{
+    for (int op = 0; op < FM_OPERATORS; op++) {
+        for (size_t v = 0; v < synth->nVoices; v++) {
+            synth->env[op][v].gated = true;
+        }
+    }
+}
+
+void
+Reference_generateSamples(Reference_Synth* synth,
+                          int16_t* out,
+                          size_t nSamples)
+{
+    float bus[REF_CONTROL_PERIOD];
+    while (nSamples > 0) {
+        if (synth->countdown == 0) {
+            _controlPoint(synth);
+            synth->countdown = REF_CONTROL_PERIOD;
+        }
+
+        size_t n = synth->countdown < nSamples ? synth->countdown : nSamples;
+        if (synth->idle) {
+            // Nothing sounds until the next control point, so the phases
+            // hold still.
+            memset(out, 0, n * sizeof(int16_t));
+            synth->limiterGain = 1;
+        } else {
+            for (size_t s = 0; s < n; s++) {
+                bus[s] = _renderSample(synth);
+            }
+            _mixToPcm(synth, bus, out, n);
+        }
+
+        synth->countdown -= n;
+        out += n;
+        nSamples -= n;
+    }
+}